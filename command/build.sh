@@ -12,6 +12,8 @@ main()
 		exit $ERROR_NOT_SYNCED
 	fi
 
+	startElfutilsServer
+
 	# remove old modules from workdir
 	local validmodules=()
 	for file in $(modifiedFiles)
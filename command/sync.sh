@@ -23,8 +23,9 @@ main()
 	fi
 
 	logInfo "Synchronize..."
-	rm -rf "$workdir"/deku_*
+	rm -rf "$workdir"/deku_* "$FINGERPRINTS_DIR"
 	getKernelVersion > "$KERNEL_VERSION_FILE"
+	buildSymbolIndex
 	regenerateSymbols
 
 	if [ "$KERN_SRC_INSTALL_DIR" ]; then
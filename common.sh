@@ -65,10 +65,29 @@ findObjWithSymbol()
 
 	#TODO: For module objects try to find symbol in the same module
 	#TODO: Consider checking type of the symbol
-	grep -q "\b$sym\b" "$SYSTEM_MAP" && { echo vmlinux; return $NO_ERROR; }
+	local out
+	if [[ -f "$SYMBOL_INDEX_FILE" ]]; then
+		out=`elfutilsRequest --lookupSymbol -i "$SYMBOL_INDEX_FILE" "$sym"`
+		if [[ $? == 0 ]]; then
+			# keep symbols of the module in the symbols dir like the lookup without the index
+			local path=${out##* }
+			[[ $path == *.ko && ! -f "$SYMBOLS_DIR/${path%.ko}" ]] && \
+				generateSymbols "$MODULES_DIR/$path"
+			echo ${out%% *}
+			return $NO_ERROR
+		fi
+	fi
+	local rc=$ERROR_NO_ELFUTILS_SERVER
+	if [[ -S "$ELFUTILS_SOCKET" ]]; then
+		./elfutils --request "$ELFUTILS_SOCKET" owner "$sym" && return $NO_ERROR
+		rc=$?
+	fi
+	if [[ $rc == $ERROR_NO_ELFUTILS_SERVER ]]; then
+		grep -q "\b$sym\b" "$SYSTEM_MAP" && { echo vmlinux; return $NO_ERROR; }
 
-	local out=`grep -lr "\b$sym\b" $SYMBOLS_DIR`
-	[ "$out" != "" ] && { echo $(filenameNoExt "$out"); return $NO_ERROR; }
+		out=`grep -lr "\b$sym\b" $SYMBOLS_DIR`
+		[ "$out" != "" ] && { echo $(filenameNoExt "$out"); return $NO_ERROR; }
+	fi
 
 	local srcpath=$SOURCE_DIR/
 	local modulespath=$MODULES_DIR/
@@ -95,6 +114,56 @@ findObjWithSymbol()
 }
 export -f findObjWithSymbol
 
+# index all symbols from vmlinux, the modules and the Module.symvers
+buildSymbolIndex()
+{
+	local args=(-o "$SYMBOL_INDEX_FILE")
+	[[ -f "$BUILD_DIR/vmlinux" ]] && args+=(-k "$BUILD_DIR/vmlinux")
+	[[ -d "$MODULES_DIR" ]] && args+=(-d "$MODULES_DIR")
+	[[ -f "$LINUX_HEADERS/Module.symvers" ]] && args+=(-s "$LINUX_HEADERS/Module.symvers")
+	rm -f "$SYMBOL_INDEX_FILE"
+	[[ ${#args[@]} == 2 ]] && return $NO_ERROR
+	./elfutils --symbolIndex "${args[@]}" || \
+		logWarn "Failed to build the symbol index. Symbols will be searched in the System.map"
+}
+export -f buildSymbolIndex
+
+# run elfutils command in the elfutils server if it's running
+elfutilsRequest()
+{
+	if [[ -S "$ELFUTILS_SOCKET" ]]; then
+		./elfutils --request "$ELFUTILS_SOCKET" "$@"
+		local rc=$?
+		[[ $rc != $ERROR_NO_ELFUTILS_SERVER ]] && return $rc
+	fi
+	./elfutils "$@"
+}
+export -f elfutilsRequest
+
+# start the elfutils server that keeps indexes of the kernel build in memory
+startElfutilsServer()
+{
+	[[ "$USE_ELFUTILS_SERVER" != 1 ]] && return
+	./elfutils --request "$ELFUTILS_SOCKET" ping > /dev/null 2>&1 && return
+
+	local args=(-S "$ELFUTILS_SOCKET" -k "$KERNEL_VERSION_FILE")
+	[[ -f "$SYSTEM_MAP" ]] && args+=(-m "$SYSTEM_MAP")
+	[[ -f "$LINUX_HEADERS/Module.symvers" ]] && args+=(-s "$LINUX_HEADERS/Module.symvers")
+	[[ -d "$SYMBOLS_DIR" ]] && args+=(-d "$SYMBOLS_DIR")
+	# the index is used once it is built
+	args+=(-i "$SYMBOL_INDEX_FILE")
+	logDebug "Start elfutils server"
+	setsid ./elfutils --serve "${args[@]}" > "$workdir/elfutils.log" 2>&1 < /dev/null &
+}
+export -f startElfutilsServer
+
+stopElfutilsServer()
+{
+	[[ -S "$ELFUTILS_SOCKET" ]] || return
+	./elfutils --request "$ELFUTILS_SOCKET" stop > /dev/null 2>&1
+}
+export -f stopElfutilsServer
+
 getKernelVersion()
 {
 	grep -r UTS_VERSION "$LINUX_HEADERS/include/generated/" | \
@@ -154,6 +223,7 @@ generateDEKUHash()
 	find integration -type f -name "*";			\
 	find . -maxdepth 1 -type f -name "*.sh";	\
 	find . -maxdepth 1 -type f -name "*.c";		\
+	find . -maxdepth 1 -type f -name "*.h";		\
 	echo ./deku									\
 	`
 	local sum=
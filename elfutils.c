@@ -7,1348 +7,472 @@
 #include <errno.h>
 #include <error.h>
 #include <fcntl.h>
-#include <stdarg.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
-#include <gelf.h>
+#include "libdeku.h"
 
-#ifdef SUPPORT_DISASS
-#define PACKAGE 1			//requred by libbfd
-#include <dis-asm.h>
+// returned by --request when the server is not running
+#define ERROR_NO_SERVER 255
 
-#define MAX_DISASS_LINE_LEN 256
-#endif
-
-#define ERROR_UNSUPPORTED_READ_MOSTLY 30
-
-static bool ShowDebugLog = 0;
-#define LOG_ERR(fmt, ...)												\
-	do																	\
-	{																	\
-		fprintf(stderr, "ERROR (%s:%d): " fmt "\n", __FILE__, __LINE__,	\
-				##__VA_ARGS__);											\
-		exit(1);														\
-	} while (0)
-#define LOG_INFO(fmt, ...)												\
-	do																	\
-	{																	\
-		printf(fmt "\n", ##__VA_ARGS__);								\
-	} while (0)
-#define LOG_DEBUG(fmt, ...)												\
-	do																	\
-	{																	\
-		if (ShowDebugLog)												\
-			printf(fmt "\n", ##__VA_ARGS__);							\
-	} while (0)
-
-#define CHECK_ALLOC(m)	\
-	if (m == NULL)		\
-	LOG_ERR("Failed to alloc memory in %s (%s:%d)", __func__, __FILE__, __LINE__)
-
-#define invalidSym(sym) (sym.st_name == 0 && sym.st_info == 0 && sym.st_shndx == 0)
-
-typedef struct
-{
-	uint8_t *data;
-	size_t size;
-} SymbolData;
-
-typedef struct
-{
-	char *name;
-	size_t index;
-	size_t secIndex;
-	bool isFun;
-	bool isVar;
-	size_t linkedSymbol;
-	size_t copiedIndex;
-	size_t st_size;
-	size_t st_value;
-	unsigned char st_info;
-	size_t *callees;
-} Symbol;
-
-static Symbol **Symbols = NULL;
-static Elf_Scn **CopiedScnMap = NULL;
-static size_t SectionsCount = 0;
-static size_t SymbolsCount = 0;
+// kernel files of the server are used for all requests
+static bool Serving = false;
 
-typedef struct
+static void help(const char *execName)
 {
-	Elf *elf;
-	GElf_Sym sym;
-	GElf_Shdr shdr;
-	SymbolData *symData;
-} DisasmData;
+	error(EXIT_FAILURE, EINVAL, "Usage: %s [-diff|--callchain|--extract|--changeCallSymbol|--batch|--symbolIndex|--lookupSymbol|--symbolPosition|--unexportedSymbols|--serve|--request"
+#ifdef SUPPORT_DISASSEMBLE
+	"|--disassemble"
+#endif
+	"] ...", execName);
+}
 
-static uint32_t crc32(uint8_t *data, uint32_t len)
+static int showDiff(DekuContext *ctx, int argc, char *argv[])
 {
-	uint32_t byte, crc, mask;
-	crc = 0xFFFFFFFF;
-	for (uint32_t i = 0; i < len; i++)
+	char *firstFile = NULL;
+	char *secondFile = NULL;
+	char *cacheDir = NULL;
+	char *versionFile = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "a:b:c:k:MV")) != -1)
 	{
-		byte = data[i];
-		crc = crc ^ byte;
-		for (int j = 7; j >= 0; j--)
+		switch (opt)
 		{
-			mask = -(crc & 1);
-			crc = (crc >> 1) ^ (0xEDB88320 & mask);
+		case 'M':
+			dekuSetKeepMetadataChanges(ctx, true);
+			break;
+		case 'a':
+			firstFile = optarg;
+			break;
+		case 'b':
+			secondFile = optarg;
+			break;
+		case 'c':
+			cacheDir = optarg;
+			break;
+		case 'k':
+			versionFile = optarg;
+			break;
 		}
-		i = i + 1;
 	}
-	return ~crc;
-}
 
-static size_t appendString(GElf_Shdr *shdr, Elf_Data *data, const char *text)
-{
-	size_t oldSize = data->d_size;
-	size_t newSize = data->d_size + strlen(text) + 1;
-	char *buf = (char *)calloc(1, newSize);
-	CHECK_ALLOC(buf);
-
-	memcpy(buf, data->d_buf, data->d_size);
-	strcpy(&buf[data->d_size], text);
-	data->d_buf = buf;
-	data->d_size = newSize;
-	shdr->sh_size = newSize;
-	return oldSize;
-}
-
-static GElf_Shdr getSectionHeader(Elf *elf, Elf64_Section index)
-{
-	GElf_Shdr shdr = {0};
-	size_t shstrndx;
-	elf_getshdrstrndx(elf, &shstrndx);
-	Elf_Scn *scn = elf_getscn(elf, index);
-	if (scn)
-		gelf_getshdr(scn, &shdr);
-	return shdr;
-}
-
-static Elf_Scn *getSectionByName(Elf *elf, const char *secName)
-{
-	Elf_Scn *scn = NULL;
-	GElf_Shdr shdr;
-	size_t shstrndx;
-	elf_getshdrstrndx(elf, &shstrndx);
-	while ((scn = elf_nextscn(elf, scn)) != NULL)
+	if (firstFile == NULL || secondFile == NULL)
 	{
-		gelf_getshdr(scn, &shdr);
-		char *name = elf_strptr(elf, shstrndx, shdr.sh_name);
-		if (name != NULL && strcmp(name, secName) == 0)
-			return scn;
+		error(0, EINVAL, "Invalid parameters to show difference between objects file. Valid parameters:"
+			  "-a <ELF_FILE> -b <ELF_FILE> [-c <FINGERPRINTS_DIR> -k <KERNEL_VERSION_FILE>] [-M] [-V]");
+		return EXIT_FAILURE;
 	}
-	return NULL;
-}
 
-static Elf_Scn *getRelForSectionIndex(Elf *elf, Elf64_Section index)
-{
-	Elf_Scn *scn = NULL;
-	GElf_Shdr shdr;
-	while ((scn = elf_nextscn(elf, scn)) != NULL)
+	DekuDiff diff = {0};
+	int status = 0;
+	if (versionFile != NULL && !Serving)
+		status = dekuSetKernelFiles(ctx, versionFile, NULL, NULL, NULL);
+	if (status == 0)
+		status = dekuSetFingerprintCache(ctx, cacheDir);
+	if (status == 0)
+		status = dekuDiff(ctx, firstFile, secondFile, &diff);
+	for (size_t i = 0; i < diff.count; i++)
 	{
-		gelf_getshdr(scn, &shdr);
-		if (shdr.sh_type == SHT_RELA && shdr.sh_info == index)
-			return scn;
-	}
-	return NULL;
-}
-
-static char *getSectionName(Elf *elf, Elf64_Section index)
-{
-	size_t shstrndx;
-	elf_getshdrstrndx(elf, &shstrndx);
-	GElf_Shdr shdr = getSectionHeader(elf, index);
-	return elf_strptr(elf, shstrndx, shdr.sh_name);
-}
-
-static Symbol **readSymbols(Elf *elf)
-{
-	Symbol **syms;
-	Elf_Scn *scn = getSectionByName(elf, ".symtab");
-	if (scn == NULL)
-		LOG_ERR("Failed to find .symtab section");
-	GElf_Shdr shdr;
-	GElf_Sym sym;
-	Elf_Data *data = elf_getdata(scn, NULL);
-	gelf_getshdr(scn, &shdr);
-	size_t cnt = shdr.sh_size / shdr.sh_entsize;
-	syms = (Symbol **)calloc(cnt + 1, sizeof(Symbol *));
-	CHECK_ALLOC(syms);
-	for (size_t i = 0; i < cnt; i++)
-	{
-		gelf_getsym(data, i, &sym);
-		syms[i] = calloc(1, sizeof(Symbol));
-		CHECK_ALLOC(syms[i]);
-		// name
-		syms[i]->name = elf_strptr(elf, shdr.sh_link, sym.st_name);
-		// section index
-		syms[i]->secIndex = sym.st_shndx;
-		// is function
-		if ((sym.st_info == ELF64_ST_INFO(STB_GLOBAL, STT_FUNC) ||
-			 (sym.st_info == ELF64_ST_INFO(STB_LOCAL, STT_FUNC))) &&
-			strlen(syms[i]->name) > 0)
+		static const char *prefixes[] =
 		{
-			syms[i]->isFun = true;
-		}
-		// is variable
-		if (sym.st_info == ELF64_ST_INFO(STB_GLOBAL, STT_OBJECT) ||
-			(sym.st_info == ELF64_ST_INFO(STB_LOCAL, STT_OBJECT)))
+			[DEKU_MODIFIED_FUNCTION] = "Modified function",
+			[DEKU_NEW_FUNCTION] = "New function",
+			[DEKU_NEW_VARIABLE] = "New variable",
+		};
+		static const char *causes[] =
 		{
-			const char *scnName = getSectionName(elf, sym.st_shndx);
-			if (strstr(scnName, ".data.") == scnName ||
-				strstr(scnName, ".bss.") == scnName)
-				syms[i]->isVar = true;
-			if (strstr(scnName, ".rodata.") == scnName ||
-				strstr(scnName, ".rodata.str") != scnName)
-				syms[i]->isVar = true;
-		}
-		syms[i]->st_info = sym.st_info;
-		syms[i]->st_size = sym.st_size;
-		syms[i]->st_value = sym.st_value;
-		syms[i]->index = SymbolsCount++;
-	}
-
-	return syms;
-}
-
-static GElf_Sym getSymbolByName(Elf *elf, char *name, size_t *symIndex)
-{
-	Elf_Scn *scn = getSectionByName(elf, ".symtab");
-	GElf_Shdr shdr;
-	GElf_Sym sym = {0};
-	Elf_Data *data = elf_getdata(scn, NULL);
-	gelf_getshdr(scn, &shdr);
-	size_t cnt = shdr.sh_size / shdr.sh_entsize;
-	*symIndex = 0;
-	for (size_t i = 0; i < cnt; i++)
-	{
-		gelf_getsym(data, i, &sym);
-		if (strcmp(elf_strptr(elf, shdr.sh_link, sym.st_name), name) == 0)
-			return sym;
-		(*symIndex)++;
+			[DEKU_CHANGE_CODE] = "code",
+			[DEKU_CHANGE_CALL] = "call",
+			[DEKU_CHANGE_DATA] = "data",
+			[DEKU_CHANGE_METADATA] = "metadata",
+		};
+		const DekuDiffEntry *entry = &diff.entries[i];
+		if (entry->kind == DEKU_MODIFIED_FUNCTION)
+			printf("%s: %s (%s)\n", prefixes[entry->kind], entry->name, causes[entry->cause]);
+		else
+			printf("%s: %s\n", prefixes[entry->kind], entry->name);
 	}
-	memset(&sym, 0, sizeof(sym));
-	*symIndex = 0;
-	return sym;
+	dekuSetKeepMetadataChanges(ctx, false);
+	dekuFreeDiff(&diff);
+	return status;
 }
 
-static bool getSymbolByNameAndType(Elf *elf, const char *symName, const int type, GElf_Sym *sym)
+static void printChain(const char *const *chain, size_t len, void *arg)
 {
-	Elf_Scn *scn = getSectionByName(elf, ".symtab");
-	if (scn == NULL)
-		LOG_ERR("Failed to find .symtab section");
-	GElf_Shdr shdr;
-	Elf_Data *data = elf_getdata(scn, NULL);
-	gelf_getshdr(scn, &shdr);
-	size_t cnt = shdr.sh_size / shdr.sh_entsize;
-	for (size_t i = 0; i < cnt; i++)
-	{
-		gelf_getsym(data, i, sym);
-		if ((sym->st_info == ELF64_ST_INFO(STB_LOCAL, type) ||
-			 sym->st_info == ELF64_ST_INFO(STB_GLOBAL, type)) &&
-			strcmp(elf_strptr(elf, shdr.sh_link, sym->st_name), symName) == 0)
-			return true;
-	}
-	return false;
+	(void)arg;
+	for (size_t i = 0; i < len; i++)
+		printf("%s ", chain[i]);
+	puts("");
 }
 
-static GElf_Sym getSymbolByIndex(Elf *elf, size_t index)
+static void printSymbol(const char *symbol, void *arg)
 {
-	Elf_Scn *scn = getSectionByName(elf, ".symtab");
-	GElf_Shdr shdr;
-	GElf_Sym sym = {0};
-	Elf_Data *data = elf_getdata(scn, NULL);
-	gelf_getshdr(scn, &shdr);
-	size_t cnt = shdr.sh_size / shdr.sh_entsize;
-	if (index < cnt)
-		gelf_getsym(data, index, &sym);
-	return sym;
+	(void)arg;
+	printf("%s\n", symbol);
 }
 
-static uint16_t getSymbolIndexByName(Elf *elf, const char *symName)
+typedef struct
 {
-	Elf_Scn *scn = getSectionByName(elf, ".symtab");
-	if (scn == NULL)
-		LOG_ERR("Failed to find .symtab section");
-	GElf_Sym sym;
-	GElf_Shdr shdr;
-	Elf_Data *data = elf_getdata(scn, NULL);
-	gelf_getshdr(scn, &shdr);
-	size_t cnt = shdr.sh_size / shdr.sh_entsize;
-	for (size_t i = 0; i < cnt; i++)
-	{
-		gelf_getsym(data, i, &sym);
-		if (strcmp(elf_strptr(elf, shdr.sh_link, sym.st_name), symName) == 0)
-			return i;
-	}
-	return 0;
-}
+	const char *parent;
+	size_t others;
+} OnlyCaller;
 
-static Symbol *getSymbolForRelocation(const GElf_Rela rela)
+static void printOtherCaller(const char *const *chain, size_t len, void *arg)
 {
-	size_t symIndex = ELF64_R_SYM(rela.r_info);
-	if (Symbols[symIndex]->secIndex == 0)
-		return Symbols[symIndex];
-	if (Symbols[symIndex]->st_size > 0)
-		return Symbols[symIndex];
-	if (ELF64_ST_TYPE(Symbols[symIndex]->st_info) == STT_FUNC ||
-		ELF64_ST_TYPE(Symbols[symIndex]->st_info) == STT_OBJECT)
-		return Symbols[symIndex];
-
-	size_t secIndex = Symbols[symIndex]->secIndex;
-	Elf64_Sxword addend = rela.r_addend;
-	switch (ELF64_R_TYPE(rela.r_info))
-	{
-	case R_386_PC32:
-	case R_X86_64_PLT32:
-		addend += 4;
-		break;
-	}
-
-	for (Symbol **s = Symbols; *s != NULL; s++)
+	(void)len;
+	OnlyCaller *onlyCaller = (OnlyCaller *)arg;
+	if (strcmp(chain[1], onlyCaller->parent) != 0)
 	{
-		if (s[0]->index != symIndex && s[0]->secIndex == secIndex &&
-			(size_t)addend >= s[0]->st_value &&
-			(size_t)addend < s[0]->st_value + s[0]->st_size)
-			return s[0];
+		printf("%s\n", chain[1]);
+		onlyCaller->others++;
 	}
-
-	// example: referer to symbol (st_value == st_size == 0) that points to .rodata.str1.1
-	return Symbols[symIndex];
 }
 
-static GElf_Sym getLinkedSym(Elf *elf, GElf_Sym *sym)
+static int findCallChains(DekuContext *ctx, int argc, char *argv[])
 {
-	Elf_Scn *scn = getSectionByName(elf, ".symtab");
-	GElf_Shdr shdr;
-	GElf_Sym tsym = {0};
-	Elf_Data *data = elf_getdata(scn, NULL);
-	gelf_getshdr(scn, &shdr);
-	size_t cnt = shdr.sh_size / shdr.sh_entsize;
-	for (size_t i = 0; i < cnt; i++)
+	char *filePath = NULL;
+	char *callersOf = NULL;
+	char *inlinedCallersOf = NULL;
+	char *onlyCaller = NULL;
+	char *parent = NULL;
+	char *refFile = NULL;
+	int opt;
+	static const struct option longOptions[] =
 	{
-		gelf_getsym(data, i, &tsym);
-		if (memcmp(&tsym, sym, sizeof(*sym)) != 0 && tsym.st_name != 0 &&
-				   tsym.st_shndx == sym->st_shndx)
-			return tsym;
-	}
-	memset(&tsym, 0, sizeof(tsym));
-	return tsym;
-}
-
-static SymbolData getSymbolData(Elf *elf, const char *name, char type, bool modReloc)
-{
-	SymbolData result;
-	Elf_Scn *scn = getSectionByName(elf, ".symtab");
-	if (scn == NULL)
-		LOG_ERR("Failed to find .symtab section");
-	GElf_Shdr shdr;
-	GElf_Sym sym;
-	size_t secCount;
-	elf_getshdrnum(elf, &secCount);
-	Elf_Data *data = elf_getdata(scn, NULL);
-	gelf_getshdr(scn, &shdr);
-	size_t cnt = shdr.sh_size / shdr.sh_entsize;
-	for (size_t i = 0; i < cnt; i++)
+		{"callers-of", required_argument, NULL, 'c'},
+		{"inlined-callers-of", required_argument, NULL, 'i'},
+		{"only-caller", required_argument, NULL, 'o'},
+		{NULL, 0, NULL, 0}
+	};
+	while ((opt = getopt_long(argc, argv, "f:r:", longOptions, NULL)) != -1)
 	{
-		gelf_getsym(data, i, &sym);
-		if (strcmp(elf_strptr(elf, shdr.sh_link, sym.st_name), name) == 0)
+		switch (opt)
 		{
-			if (ELF64_ST_TYPE(sym.st_info) == type &&
-				sym.st_size > 0 && sym.st_shndx < secCount)
-			{
-				Elf_Scn *scn = elf_getscn(elf, sym.st_shndx);
-				Elf_Data *data = elf_getdata(scn, NULL);
-				result.data = &((uint8_t *)data->d_buf)[sym.st_value];
-				result.size = sym.st_size;
-				if (modReloc)
-				{
-					GElf_Rela rela;
-					GElf_Shdr shdr;
-					Elf_Scn *scn = getRelForSectionIndex(elf, sym.st_shndx);
-					if (scn == NULL)
-						continue;
-					Elf_Data *rdata = elf_getdata(scn, NULL);
-					gelf_getshdr(scn, &shdr);
-					size_t cnt = shdr.sh_size / shdr.sh_entsize;
-					for (size_t i = 0; i < cnt; i++)
-					{
-						gelf_getrela(rdata, i, &rela);
-						if (rela.r_offset >= sym.st_value && rela.r_offset < sym.st_value + sym.st_size)
-						{
-							void *addr = &((uint8_t *)data->d_buf)[rela.r_offset];
-							if (ELF64_R_TYPE(rela.r_info) == R_X86_64_PC32)
-								*(uint32_t *)addr += -4;
-							else
-								*(uint32_t *)addr += rela.r_addend;
-						}
-					}
-				}
-				break;
-			}
+		case 'f':
+			filePath = optarg;
+			break;
+		case 'r':
+			refFile = optarg;
+			break;
+		case 'c':
+			callersOf = optarg;
+			break;
+		case 'i':
+			inlinedCallersOf = optarg;
+			break;
+		case 'o':
+			onlyCaller = optarg;
+			if (optind < argc)
+				parent = argv[optind++];
+			break;
 		}
 	}
-	return result;
-}
-
-#ifdef SUPPORT_DISASSEMBLE
-
-static GElf_Sym getSymbolForReloc(Elf *elf, Elf64_Section sec, size_t offset)
-{
-	GElf_Rela rela;
-	GElf_Shdr shdr;
-	GElf_Sym invalidSym = {};
-	Elf_Scn *scn = getRelForSectionIndex(elf, sec);
-	if(scn == NULL)
-		return invalidSym;
-	Elf_Data *data = elf_getdata(scn, NULL);
-	gelf_getshdr(scn, &shdr);
-	size_t cnt = shdr.sh_size / shdr.sh_entsize;
-	for (size_t i = 0; i < cnt; i++)
-	{
-		gelf_getrela(data, i, &rela);
-		if (rela.r_offset == offset)
-			return getSymbolByIndex(elf, ELF64_R_SYM(rela.r_info));
-	}
-	return invalidSym;
-}
 
-static GElf_Sym getSymbolByOffset(Elf *elf, Elf64_Section shndx, size_t offset)
-{
-	Elf_Scn *scn = getSectionByName(elf, ".symtab");
-	GElf_Shdr shdr;
-	GElf_Sym sym = {};
-	Elf_Data *data = elf_getdata(scn, NULL);
-	gelf_getshdr(scn, &shdr);
-	size_t cnt = shdr.sh_size / shdr.sh_entsize;
-	for (size_t i = 0; i < cnt; i++)
+	if (filePath == NULL || (onlyCaller != NULL && parent == NULL))
 	{
-		gelf_getsym(data, i, &sym);
-		if (sym.st_name != 0 && sym.st_shndx == shndx && sym.st_value == offset)
-			return sym;
+		error(0, EINVAL, "Invalid parameters to print call chain. Valid parameters:"
+			  "-f <ELF_FILE> [--callers-of <FUN> [-r <REF_ELF_FILE>]] [--inlined-callers-of <FUN>] "
+			  "[--only-caller <FUN> <PARENT>]");
+		return EXIT_FAILURE;
 	}
-	memset(&sym, 0, sizeof(sym));
-	return sym;
-}
 
-static int disasmPrintf(void *buf, const char *format, ...)
-{
-	char localBuf[MAX_DISASS_LINE_LEN];
-	va_list args;
-	va_start (args, format);
-	int len = vsnprintf(localBuf, sizeof(localBuf), format, args);
-	va_end (args);
-
-	char **buffer = (char **)buf;
-	buffer[0] = realloc(buffer[0], strlen(buffer[0]) + len + 1);
-	strcat(buffer[0], localBuf);
-	return len;
-}
-
-static void printFunAtAddr(bfd_vma vma, struct disassemble_info *inf)
-{
-	DisasmData *data = (DisasmData *)inf->application_data;
-	int32_t x = *(uint32_t *)(data->symData->data + vma);
-	vma += data->sym.st_value;
-	GElf_Sym sym = getSymbolByOffset(data->elf, data->sym.st_shndx, vma);
-	if(invalidSym(sym))
-		sym = getSymbolForReloc(data->elf, data->sym.st_shndx, vma);
-
-	if(invalidSym(sym))
+	if (onlyCaller != NULL)
 	{
-		sym = getSymbolForReloc(data->elf, data->sym.st_shndx, vma);
-		const char *name = elf_strptr(data->elf, data->shdr.sh_link, data->sym.st_name);
-		(*inf->fprintf_func)(inf->stream, "<%s+0x%lX>", name, vma - data->sym.st_value);
-	}
-	else
-	{
-		const char *name = elf_strptr(data->elf, data->shdr.sh_link, sym.st_name);
-		(*inf->fprintf_func)(inf->stream, "%s", name);
+		// check whether the function is called only by the parent
+		OnlyCaller other = { .parent = parent };
+		int status = dekuDirectCallers(ctx, filePath, onlyCaller, printOtherCaller, &other);
+		if (status == 0 && other.others > 0)
+			status = 1;
+		return status;
 	}
+	if (inlinedCallersOf != NULL)
+		return dekuInlinedCallers(ctx, filePath, inlinedCallersOf, printSymbol, NULL);
+	if (callersOf != NULL)
+		return dekuCallers(ctx, filePath, callersOf, refFile, printChain, NULL);
+	return dekuCallees(ctx, filePath, printChain, NULL);
 }
 
-char *disassembleBytes(uint8_t *inputBuf, size_t inputBufSize, DisasmData *data)
-{
-	char *buf[] = { calloc(0, 1) };
-
-	disassemble_info disasmInfo = {};
-	init_disassemble_info(&disasmInfo, buf, disasmPrintf);
-	disasmInfo.arch = bfd_arch_i386;
-	disasmInfo.mach = bfd_mach_x86_64;
-	disasmInfo.read_memory_func = buffer_read_memory;
-	disasmInfo.buffer = inputBuf;
-	disasmInfo.buffer_vma = 0;
-	disasmInfo.buffer_length = inputBufSize;
-	disasmInfo.application_data = (void *)data;
-	disassemble_init_for_target(&disasmInfo);
-
-	disasmInfo.print_address_func = printFunAtAddr;
-
-	disassembler_ftype disasm = disassembler(bfd_arch_i386, false, bfd_mach_x86_64, NULL);
-
-	size_t pc = 0;
-	while (pc < inputBufSize)
-	{
-		pc += disasm(pc, &disasmInfo);
-		disasmInfo.fprintf_func(disasmInfo.stream, "\n");
-	}
-
-	return buf[0];
-}
-#endif
-
-static uint32_t calcSymHash(Elf *elf, const GElf_Sym *sym)
+static int extractSymbols(DekuContext *ctx, int argc, char *argv[])
 {
-	Elf_Scn *scn = elf_getscn(elf, sym->st_shndx);
-	Elf_Data *data = elf_rawdata(scn, NULL);
-	uint32_t crc = crc32((uint8_t *)data->d_buf + sym->st_value, sym->st_size);
-
-	GElf_Rela rela;
-	GElf_Shdr shdr;
-	scn = getRelForSectionIndex(elf, sym->st_shndx);
-	if (scn == NULL)
-		return crc;
-	Elf_Data *rdata = elf_getdata(scn, NULL);
-	gelf_getshdr(scn, &shdr);
-	size_t cnt = shdr.sh_size / shdr.sh_entsize;
-
-	scn = getSectionByName(elf, ".symtab");
-	gelf_getshdr(scn, &shdr);
-	Elf64_Word symtabLink = shdr.sh_link;
-
-	for (size_t i = 0; i < cnt; i++)
+	char *filePath = NULL;
+	char *outFile = NULL;
+	const char **symToCopy = calloc(argc, sizeof(char *));
+	if (symToCopy == NULL)
+		error(EXIT_FAILURE, ENOMEM, "Failed to alloc memory");
+	const char **syms;
+	int opt;
+	while ((opt = getopt(argc, argv, "f:o:s:")) != -1)
 	{
-		gelf_getrela(rdata, i, &rela);
-		if (rela.r_offset >= sym->st_value && rela.r_offset < sym->st_value + sym->st_size)
+		switch (opt)
 		{
-			GElf_Sym rsym = getSymbolByIndex(elf, ELF64_R_SYM(rela.r_info));
-			if(invalidSym(rsym))
-				LOG_ERR("Can't find symbol at index: %ld", ELF64_R_SYM(rela.r_info));
-			int secIndex = rsym.st_shndx;
-			const char *name = NULL;
-			if(rsym.st_name == 0)
-			{
-				if (rsym.st_info == STT_SECTION)
-				{
-					name = getSectionName(elf, secIndex);
-				}
-				else
-				{
-					rsym = getLinkedSym(elf, &rsym);
-					if(invalidSym(rsym))
-						LOG_ERR("Can't find symbol at index: %ld", ELF64_R_SYM(rela.r_info));
-					name = elf_strptr(elf, symtabLink, rsym.st_name);
-				}
-			}
-			else
-			{
-				name = elf_strptr(elf, symtabLink, rsym.st_name);
-			}
-			if (name)
+		case 'f':
+			filePath = optarg;
+			break;
+		case 'o':
+			outFile = optarg;
+			break;
+		case 's':
+			syms = symToCopy;
+			while (*syms != NULL)
 			{
-				if (strstr(name, ".str.") || strstr(name, ".str1.") || strstr(name, ".rodata.str") == name)
-				{
-					Elf_Scn *scn = elf_getscn(elf, secIndex);
-					Elf_Data *data = elf_getdata(scn, NULL);
-					GElf_Shdr shdr;
-					gelf_getshdr(scn, &shdr);
-					if ((Elf64_Sxword)shdr.sh_size > rela.r_addend)
-						name = (char *)data->d_buf + rela.r_addend;
-				}
-				if (strstr(name, ".text.unlikely.") == name)
-					name += strlen(".text.unlikely.");
-				else if (strstr(name, ".text.") == name)
-					name += strlen(".text.");
-				crc += crc32((uint8_t *)name, strlen(name));
+				if (strcmp(*syms, optarg) == 0)
+					break;
+				syms++;
 			}
+			if (*syms == NULL)
+				*syms = optarg;
+			break;
 		}
 	}
-	return crc;
-}
-
-static bool equalFunctions(Elf *elf, Elf *secondElf, const char *funName)
-{
-	SymbolData symData1 = getSymbolData(elf, funName, STT_FUNC, false);
-	SymbolData symData2 = getSymbolData(secondElf, funName, STT_FUNC, false);
 
-	if (symData1.size != symData2.size)
-		return false;
+	int status = EXIT_FAILURE;
+	if (filePath == NULL || outFile == NULL || *symToCopy == NULL)
+		error(0, EINVAL, "Invalid parameters to extract symbols. Valid parameters:"
+			  "-f <ELF_FILE> -o <OUT_FILE> -s <SYMBOL_NAME> [-n <SKIP_DEP_SYMBOL>] [-V]");
+	else
+		status = dekuExtract(ctx, filePath, outFile, symToCopy);
 
-	GElf_Sym sym1;
-	GElf_Sym sym2;
-	getSymbolByNameAndType(elf, funName, STT_FUNC, &sym1);
-	getSymbolByNameAndType(secondElf, funName, STT_FUNC, &sym2);
-	return calcSymHash(elf, &sym1) == calcSymHash(secondElf, &sym2);
+	free(symToCopy);
+	return status;
 }
 
-static void findModifiedSymbols(Elf *elf, Elf *secondElf)
+static int runBatch(DekuContext *ctx, int argc, char *argv[])
 {
-	Elf_Scn *scn = getSectionByName(elf, ".symtab");
-	if (scn == NULL)
-		LOG_ERR("Failed to find .symtab section");
-	GElf_Shdr shdr;
-	GElf_Sym sym;
-	size_t secCount;
-	elf_getshdrnum(elf, &secCount);
-	Elf_Data *data = elf_getdata(scn, NULL);
-	gelf_getshdr(scn, &shdr);
-	size_t cnt = shdr.sh_size / shdr.sh_entsize;
-	for (size_t i = 0; i < cnt; i++)
+	long workers = 0;
+	char *systemMap = NULL;
+	char *cacheDir = NULL;
+	char *versionFile = NULL;
+	int opt;
+	bool keepMetadata = false;
+	while ((opt = getopt(argc, argv, "j:m:c:k:MV")) != -1)
 	{
-		gelf_getsym(data, i, &sym);
-		if (sym.st_size == 0 || sym.st_shndx == 0 || sym.st_shndx >= secCount || sym.st_name == 0)
-			continue;
-		const char *name = elf_strptr(elf, shdr.sh_link, sym.st_name);
-		if (ELF64_ST_TYPE(sym.st_info) == STT_FUNC)
-		{
-			GElf_Sym secondSym;
-			if (!getSymbolByNameAndType(secondElf, name, STT_FUNC, &secondSym))
-			{
-				printf("New function: %s\n", name);
-			}
-			else
-			{
-				if (!equalFunctions(elf, secondElf, name))
-					printf("Modified function: %s\n", name);
-			}
-		}
-		else if (ELF64_ST_TYPE(sym.st_info) == STT_OBJECT)
+		switch (opt)
 		{
-			GElf_Sym secondSym;
-			if (!getSymbolByNameAndType(secondElf, name, STT_OBJECT, &secondSym))
-			{
-				char *bssName = malloc(strlen(name) + 6);
-				CHECK_ALLOC(bssName);
-				char *dataName = malloc(strlen(name) + 7);
-				CHECK_ALLOC(dataName);
-				char *rodataName = malloc(strlen(name) + 9);
-				CHECK_ALLOC(rodataName);
-				snprintf(bssName, strlen(name) + 6, ".bss.%s", name);
-				snprintf(dataName, strlen(name) + 7, ".data.%s", name);
-				snprintf(rodataName, strlen(name) + 9, ".rodata.%s", name);
-
-				const char *scnName = getSectionName(elf, sym.st_shndx);
-				if (strcmp(scnName, bssName) == 0 ||
-					strcmp(scnName, dataName) == 0 ||
-					strcmp(scnName, rodataName) == 0 ||
-					strcmp(scnName, ".bss") == 0 ||
-					strcmp(scnName, ".data") == 0 ||
-					strcmp(scnName, ".rodata") == 0)
-					printf("New variable: %s\n", name);
-
-				free(rodataName);
-				free(dataName);
-				free(bssName);
-			}
+		case 'M':
+			keepMetadata = true;
+			break;
+		case 'j':
+			workers = atol(optarg);
+			if (workers < 1)
+				workers = -1;
+			break;
+		case 'm':
+			systemMap = optarg;
+			break;
+		case 'c':
+			cacheDir = optarg;
+			break;
+		case 'k':
+			versionFile = optarg;
+			break;
 		}
 	}
-}
-
-static Elf *createNewElf(const char *outFile)
-{
-	int fd = open(outFile, O_RDWR|O_TRUNC|O_CREAT, 0666);
-	if (fd == -1)
-		LOG_ERR("Failed to create file: %s", outFile);
-
-	Elf *elf = elf_begin(fd, ELF_C_WRITE, 0);
-
-	Elf64_Ehdr *m_ehdr = elf64_newehdr(elf);
-
-	m_ehdr->e_ident[EI_MAG0] = ELFMAG0;
-	m_ehdr->e_ident[EI_MAG1] = ELFMAG1;
-	m_ehdr->e_ident[EI_MAG2] = ELFMAG2;
-	m_ehdr->e_ident[EI_MAG3] = ELFMAG3;
-	m_ehdr->e_ident[EI_CLASS] = ELFCLASS64;
-	m_ehdr->e_ident[EI_DATA] = ELFDATA2LSB;
-	m_ehdr->e_ident[EI_VERSION] = EV_CURRENT;
-	m_ehdr->e_machine = EM_X86_64;
-	m_ehdr->e_type = ET_REL;
-	m_ehdr->e_version = EV_CURRENT;
-	m_ehdr->e_shstrndx = 1;
-
-	GElf_Shdr shdr;
-	Elf_Scn *strtabScn = elf_newscn(elf);
-	Elf_Data *newData = elf_newdata(strtabScn);
-	gelf_getshdr(strtabScn, &shdr);
-	static uint8_t blank[1] = {'\0'};
-	newData->d_buf = blank;
-	newData->d_size = 1;
-	Elf64_Word shname = appendString(&shdr, newData, ".strtab");
-	Elf64_Word symtabname = appendString(&shdr, newData, ".symtab");
-	shdr.sh_type = SHT_STRTAB;
-	shdr.sh_name = appendString(&shdr, newData, ".shstrtab");
-	gelf_update_shdr(strtabScn, &shdr);
-
-	Elf_Scn *shstrtabScn = elf_newscn(elf);
-	newData = elf_newdata(shstrtabScn);
-	newData->d_buf = blank;
-	newData->d_size = 1;
-	gelf_getshdr(shstrtabScn, &shdr);
-	shdr.sh_size = 1;
-	shdr.sh_type = SHT_STRTAB;
-	shdr.sh_name = shname;
-	gelf_update_shdr(shstrtabScn, &shdr);
-
-	Elf_Scn *symtabScn = elf_newscn(elf);
-	newData = elf_newdata(symtabScn);
-	gelf_getshdr(symtabScn, &shdr);
-
-	GElf_Sym emptySym = {0};
-	newData->d_type = ELF_T_SYM;
-	newData->d_buf = malloc(sizeof(GElf_Sym));
-	CHECK_ALLOC(newData->d_buf);
-	memcpy(newData->d_buf, &emptySym, sizeof(GElf_Sym));
-	newData->d_size = sizeof(GElf_Sym);
-
-	shdr.sh_size = sizeof(GElf_Sym);
-	shdr.sh_link = elf_ndxscn(getSectionByName(elf, ".strtab"));
-	shdr.sh_type = SHT_SYMTAB;
-	shdr.sh_name = symtabname;
-	shdr.sh_entsize = sizeof(GElf_Sym);
-	gelf_update_shdr(symtabScn, &shdr);
-
-	return elf;
-}
 
-void checkStaticKeys(Elf *elf, bool *symToCopy)
-{
-	Elf_Scn *scn = getSectionByName(elf, "__jump_table");
-	if (scn == NULL)
-		return;
-	Elf_Scn *relScn = getRelForSectionIndex(elf, elf_ndxscn(scn));
-	if (relScn == NULL)
-		LOG_ERR("Can't find relocation section for __jump_table");
-
-	GElf_Rela rela;
-	GElf_Shdr shdr;
-	Elf_Data *data = elf_getdata(relScn, NULL);
-	gelf_getshdr(relScn, &shdr);
-	size_t cnt = shdr.sh_size / shdr.sh_entsize;
-	for (size_t i = 0; i < cnt; i+=3)
+	if (optind >= argc || workers < 0)
 	{
-		gelf_getrela(data, i, &rela);
-		Symbol *symbol = getSymbolForRelocation(rela);
-		if (symToCopy[symbol->index])
-		{
-			gelf_getrela(data, i + 2, &rela);
-			const char *keyName = Symbols[ELF64_R_SYM(rela.r_info)]->name;
-			LOG_INFO("The '%s' function uses static key `%s` that is not yet "
-					 "supported by DEKU.", symbol->name, keyName);
-		}
+		error(0, EINVAL, "Invalid parameters to run batch. Valid parameters:"
+			  "<MANIFEST> [-j <WORKERS>] [-m <SYSTEM_MAP>] "
+			  "[-c <FINGERPRINTS_DIR> -k <KERNEL_VERSION_FILE>] [-M] [-V]");
+		return EXIT_FAILURE;
 	}
-}
 
-static Elf_Scn *copySection(Elf *elf, Elf *outElf, Elf64_Section index, bool copyData)
-{
-	if (CopiedScnMap[index] != NULL)
-		return CopiedScnMap[index];
-
-	if (index >= SectionsCount)
-		LOG_ERR("Try to copy section that is out range (%d/%ld)", index, SectionsCount);
-
-	size_t shstrndx;
-	GElf_Shdr newShdr;
-	GElf_Shdr oldShdr;
-	GElf_Shdr strshdr;
-	elf_getshdrstrndx(elf, &shstrndx);
-	Elf_Scn *strtabScn = getSectionByName(outElf, ".shstrtab");
-	Elf_Data *strData = elf_getdata(strtabScn, NULL);
-	gelf_getshdr(strtabScn, &strshdr);
-	Elf_Scn *oldScn = elf_getscn(elf, index);
-	Elf_Data *oldData = elf_getdata(oldScn, NULL);
-	Elf_Scn *newScn = elf_newscn(outElf);
-	Elf_Data *newData = elf_newdata(newScn);
-	gelf_getshdr(oldScn, &oldShdr);
-	gelf_getshdr(newScn, &newShdr);
-	newShdr.sh_type = oldShdr.sh_type;
-	newShdr.sh_flags = oldShdr.sh_flags;
-	newShdr.sh_entsize = oldShdr.sh_entsize;
-	newShdr.sh_name = appendString(&strshdr, strData, elf_strptr(elf, shstrndx, oldShdr.sh_name));
-	newData->d_type = oldData->d_type;
-	if (copyData)
+	if ((systemMap != NULL || versionFile != NULL) && !Serving)
 	{
-		newShdr.sh_size = oldShdr.sh_size;
-		newData->d_buf = calloc(1, oldData->d_size);
-		CHECK_ALLOC(newData->d_buf);
-		newData->d_size = oldData->d_size;
-		if (oldData->d_buf)
-			memcpy(newData->d_buf, oldData->d_buf, oldData->d_size);
+		int status = dekuSetKernelFiles(ctx, versionFile, systemMap, NULL, NULL);
+		if (status != 0)
+			return status;
 	}
-	gelf_update_shdr(newScn, &newShdr);
-	gelf_update_shdr(strtabScn, &strshdr);
+	int status = dekuSetFingerprintCache(ctx, cacheDir);
+	if (status != 0)
+		return status;
+	// the server keeps the context between the requests
+	dekuSetKeepMetadataChanges(ctx, keepMetadata);
 
-	CopiedScnMap[index] = newScn;
-	return newScn;
+	return dekuBatch(ctx, argv[optind], workers, stdout);
 }
 
-static Elf64_Word copyStrtabItem(Elf *elf, Elf *outElf, size_t offset)
+static int buildSymbolIndex(DekuContext *ctx, int argc, char *argv[])
 {
-	GElf_Shdr strshdr;
-	Elf_Scn *strtabScn = getSectionByName(outElf, ".strtab");
-	Elf_Data *strData = elf_getdata(strtabScn, NULL);
-	gelf_getshdr(strtabScn, &strshdr);
-	size_t strtabIdx = elf_ndxscn(getSectionByName(elf, ".strtab"));
-	char *text = elf_strptr(elf, strtabIdx, offset);
-	Elf64_Word newStrOffset = appendString(&strshdr, strData, text);
-
-	gelf_update_shdr(strtabScn, &strshdr);
-	return newStrOffset;
-}
-
-static void swapSymbolIndex(Elf *elf, size_t left, size_t right)
-{
-	Elf_Scn *scn = NULL;
-	GElf_Shdr shdr;
-	size_t shstrndx;
-	elf_getshdrstrndx(elf, &shstrndx);
-	while ((scn = elf_nextscn(elf, scn)) != NULL)
-	{
-		gelf_getshdr(scn, &shdr);
-		if (shdr.sh_type != SHT_RELA)
-			continue;
-
-		GElf_Rela rela;
-		Elf_Data *data = elf_getdata(scn, NULL);
-		size_t cnt = shdr.sh_size / shdr.sh_entsize;
-		for (size_t i = 0; i < cnt; i++)
-		{
-			gelf_getrela(data, i, &rela);
-			if (ELF64_R_SYM(rela.r_info) == left)
-			{
-				rela.r_info = ELF64_R_INFO(right, ELF64_R_TYPE(rela.r_info));
-				gelf_update_rela(data, i, &rela);
-			}
-			else if (ELF64_R_SYM(rela.r_info) == right)
-			{
-				rela.r_info = ELF64_R_INFO(left, ELF64_R_TYPE(rela.r_info));
-				gelf_update_rela(data, i, &rela);
-			}
-		}
-	}
-}
-
-static void sortSymtab(Elf *elf)
-{
-	Elf_Scn *scn = getSectionByName(elf, ".symtab");
-	if (scn == NULL)
-		LOG_ERR("Failed to find .symtab section");
-	GElf_Shdr shdr;
-	GElf_Sym sym;
-	Elf_Data *data = elf_getdata(scn, NULL);
-	gelf_getshdr(scn, &shdr);
-	int firstGlobalIndex = 0;
-	size_t cnt = shdr.sh_size / shdr.sh_entsize;
-	for (size_t i = 0; i < cnt; i++)
+	long workers = 0;
+	char *vmlinux = NULL;
+	char *modulesDir = NULL;
+	char *symvers = NULL;
+	char *indexFile = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "o:k:d:s:j:V")) != -1)
 	{
-		gelf_getsym(data, i, &sym);
-		if (firstGlobalIndex == 0 && ELF64_ST_BIND(sym.st_info) == STB_GLOBAL)
-			firstGlobalIndex = i;
-
-		if (firstGlobalIndex != 0 && ELF64_ST_BIND(sym.st_info) == STB_LOCAL)
+		switch (opt)
 		{
-			GElf_Sym globalSym;
-			gelf_getsym(data, firstGlobalIndex, &globalSym);
-			gelf_update_sym(data, i, &globalSym);
-			gelf_update_sym(data, firstGlobalIndex, &sym);
-			swapSymbolIndex(elf, i, firstGlobalIndex);
-			firstGlobalIndex = 0;
-			i = 0;
+		case 'o':
+			indexFile = optarg;
+			break;
+		case 'k':
+			vmlinux = optarg;
+			break;
+		case 'd':
+			modulesDir = optarg;
+			break;
+		case 's':
+			symvers = optarg;
+			break;
+		case 'j':
+			workers = atol(optarg);
+			if (workers < 1)
+				workers = -1;
+			break;
 		}
 	}
-	// update section info
-	shdr.sh_info = firstGlobalIndex;
-	gelf_update_shdr(scn, &shdr);
-}
 
-static Elf64_Word appendStringToScn(Elf *elf, char *scnName, char *text)
-{
-	GElf_Shdr shdr;
-	Elf_Scn *scn = getSectionByName(elf, scnName);
-	Elf_Data *data = elf_getdata(scn, NULL);
-	gelf_getshdr(scn, &shdr);
-	Elf64_Word result = appendString(&shdr, data, text);
-	gelf_update_shdr(scn, &shdr);
-	return result;
-}
-
-static size_t copySymbol(Elf *elf, Elf *outElf, size_t index, bool copySec)
-{
-	GElf_Sym oldSym;
-	GElf_Shdr shdr;
-	Elf_Scn *scn;
-	Elf_Data *data;
-	GElf_Sym newSym;
-
-	if (Symbols[index]->copiedIndex)
-		return Symbols[index]->copiedIndex;
-
-	scn = getSectionByName(elf, ".symtab");
-	data = elf_getdata(scn, NULL);
-	gelf_getshdr(scn, &shdr);
-	gelf_getsym(data, index, &oldSym);
-	scn = getSectionByName(outElf, ".symtab");
-	gelf_getshdr(scn, &shdr);
-	size_t newIndex = shdr.sh_size/shdr.sh_entsize;
-	data = elf_getdata(scn, NULL);
-	data->d_buf = realloc(data->d_buf, data->d_size + sizeof(GElf_Sym));
-	CHECK_ALLOC(data->d_buf);
-	newSym = oldSym;
-
-	char symType = ELF64_ST_TYPE(oldSym.st_info);
-	if (oldSym.st_shndx > 0 && oldSym.st_shndx < SectionsCount &&
-		copySec)
+	if (indexFile == NULL || (vmlinux == NULL && modulesDir == NULL && symvers == NULL) ||
+		workers < 0)
 	{
-		Elf_Scn *scn = copySection(elf, outElf, oldSym.st_shndx, true);
-		newSym.st_shndx = elf_ndxscn(scn);
-
-		if (oldSym.st_name != 0)
-		{
-			newSym.st_info = ELF64_ST_INFO(STB_GLOBAL, symType);
-			// TODO: Avoid modify symbol name for functions
-			if (symType == STT_FUNC)
-			{
-				char *symName = strdup(Symbols[index]->name);
-				CHECK_ALLOC(symName);
-				char *n;
-				while ((n = strchr(symName, '.')) != NULL)
-					*n = '_';
-				newSym.st_name = appendStringToScn(outElf, ".strtab", symName);
-
-				free(symName);
-			}
-			else
-			{
-				newSym.st_name = appendStringToScn(outElf, ".strtab", Symbols[index]->name);
-			}
-		}
+		error(0, EINVAL, "Invalid parameters to build symbol index. Valid parameters:"
+			  "-o <INDEX_FILE> [-k <VMLINUX>] [-d <MODULES_DIR>] [-s <MODULE_SYMVERS>] "
+			  "[-j <WORKERS>] [-V]");
+		return EXIT_FAILURE;
 	}
-	else // mark symbol as "external"
-	{
-		if (symType == STT_OBJECT && oldSym.st_name != 0)
-		{
-			if (strstr(getSectionName(elf, oldSym.st_shndx), ".read_mostly"))
-			{
-				fprintf(stderr, "ERROR (%s:%d): Changes to the source code " \
-						"affects the %s variable marked with the " \
-						"__read_mostly macro. This is not yet supported by " \
-						"DEKU.\n", __FILE__, __LINE__, Symbols[index]->name);
-				exit(ERROR_UNSUPPORTED_READ_MOSTLY);
-			}
-		}
-		if (oldSym.st_shndx > 0 && oldSym.st_shndx < SectionsCount)
-			newSym.st_shndx = 0;
-		newSym.st_size = 0;
-		newSym.st_info = ELF64_ST_INFO(STB_GLOBAL, symType);
-		if (oldSym.st_name != 0)
-			newSym.st_name = copyStrtabItem(elf, outElf, oldSym.st_name);
-	}
-
-	memcpy((uint8_t *)data->d_buf + data->d_size, &newSym, sizeof(GElf_Sym));
-	data->d_size += sizeof(GElf_Sym);
-	shdr.sh_size = data->d_size;
-	gelf_update_shdr(scn, &shdr);
 
-	Symbols[index]->copiedIndex = newIndex;
-	return newIndex;
+	return dekuBuildSymbolIndex(ctx, vmlinux, modulesDir, symvers, workers, indexFile);
 }
 
-static void copyRelSection(Elf *elf, Elf *outElf, Elf64_Section index, size_t relTo, GElf_Sym *fromSym)
+// print "<OBJECT> <TYPE> <COUNT> <TOTAL> <PATH>" for every symbol
+static int lookupSymbols(DekuContext *ctx, int argc, char *argv[])
 {
-	Elf_Scn *outScn = copySection(elf, outElf, index, false);
-	GElf_Shdr shdr;
-	gelf_getshdr(outScn, &shdr);
-	shdr.sh_link = elf_ndxscn(getSectionByName(outElf, ".symtab"));
-	shdr.sh_info = relTo;
-	gelf_update_shdr(outScn, &shdr);
-
-	GElf_Rela rela;
-	size_t j = shdr.sh_size / shdr.sh_entsize;
-	Elf_Scn *scn = elf_getscn(elf, index);
-	Elf_Data *data = elf_getdata(scn, NULL);
-	Elf_Data *outData = elf_getdata(outScn, NULL);
-	gelf_getshdr(scn, &shdr);
-	size_t cnt = shdr.sh_size / shdr.sh_entsize;
-	outData->d_size += shdr.sh_size;
-	outData->d_buf = realloc(outData->d_buf, outData->d_size);
-	CHECK_ALLOC(outData->d_buf);
-	for (size_t i = 0; i < cnt; i++)
-	{
-		gelf_getrela(data, i, &rela);
-		if (fromSym != NULL &&
-			(rela.r_offset < fromSym->st_value || rela.r_offset > fromSym->st_value + fromSym->st_size))
-			continue;
-		size_t newSymIndex;
-		size_t symIndex = ELF64_R_SYM(rela.r_info);
-		GElf_Shdr shdr = getSectionHeader(elf, Symbols[symIndex]->secIndex);
-		const char *secName = getSectionName(elf, Symbols[symIndex]->secIndex);
-		if (shdr.sh_flags & SHF_STRINGS ||
-			strstr(secName, ".rodata.__func__") == secName)
-		{
-			newSymIndex = copySymbol(elf, outElf, symIndex, true);
-		}
-		else
-		{
-			Symbol *sym = fromSym == NULL ? Symbols[symIndex] : getSymbolForRelocation(rela);
-			bool isFuncOrVar = Symbols[sym->index]->isFun || Symbols[sym->index]->isVar;
-			bool copySec = fromSym == NULL ? true : !isFuncOrVar;
-			newSymIndex = copySymbol(elf, outElf, sym->index, copySec);
-		}
-		rela.r_info = ELF64_R_INFO(newSymIndex, ELF64_R_TYPE(rela.r_info));
-		gelf_update_rela(outData, j, &rela);
-		j++;
-	}
-	gelf_getshdr(outScn, &shdr);
-	shdr.sh_size = j * shdr.sh_entsize;
-	outData->d_size = shdr.sh_size;
-	if (!gelf_update_shdr(outScn, &shdr))
-		LOG_ERR("gelf_update_shdr failed");
-}
-
-static void copySectionWithRel(Elf *elf, Elf *outElf, Elf64_Section index, GElf_Sym *fromSym)
-{
-	Elf_Scn *newScn = copySection(elf, outElf, index, true);
-	Elf_Scn *relScn = getRelForSectionIndex(elf, index);
-	if (relScn)
-		copyRelSection(elf, outElf, elf_ndxscn(relScn), elf_ndxscn(newScn), fromSym);
-}
-
-static void copySymbols(Elf *elf, Elf *outElf, char **symbols)
-{
-	Elf_Scn *scn;
-	GElf_Shdr shdr;
-	GElf_Sym sym;
-	size_t symIndex;
-	char **syms = symbols;
-	bool *symToCopy = calloc(sizeof(bool), SymbolsCount);
-	CHECK_ALLOC(symToCopy);
-
-	while(*syms != NULL)
+	char *indexFile = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "i:V")) != -1)
 	{
-		sym = getSymbolByName(elf, *syms, &symIndex);
-		if (sym.st_name == 0)
-			LOG_ERR("Can't find symbol: %s", *syms);
-		symToCopy[symIndex] = true;
-		syms++;
+		if (opt == 'i')
+			indexFile = optarg;
 	}
 
-	for (size_t i = 0; i < SymbolsCount; i++)
+	if ((indexFile == NULL && !Serving) || optind >= argc)
 	{
-		if (!symToCopy[i])
-			continue;
-
-		sym = getSymbolByIndex(elf, i);
-		Elf_Scn *newScn = copySection(elf, outElf, sym.st_shndx, true);
-		size_t index = copySymbol(elf, outElf, i, true);
-		Elf_Scn *symScn = getSectionByName(outElf, ".symtab");
-		gelf_getshdr(symScn, &shdr);
-		Elf_Data *symData = elf_getdata(symScn, NULL);
-		gelf_getsym(symData, index, &sym);
-		sym.st_shndx = elf_ndxscn(newScn);
-		gelf_update_sym(symData, index, &sym);
+		error(0, EINVAL, "Invalid parameters to lookup symbol. Valid parameters:"
+			  "-i <INDEX_FILE> <SYMBOL>... [-V]");
+		return EXIT_FAILURE;
 	}
 
-	for (size_t i = 0; i < SymbolsCount; i++)
+	if (indexFile != NULL && !Serving)
 	{
-		if (!symToCopy[i])
-			continue;
-
-		sym = getSymbolByIndex(elf, i);
-		copySectionWithRel(elf, outElf, sym.st_shndx, &sym);
-	}
-	const char *extraSections[] = {".altinstructions", ".altinstr_aux",
-								   ".altinstr_replacement",
-									/* needed for BUG() */ "__bug_table"
-								  };
-	for (size_t i = 0; i < sizeof(extraSections) / sizeof(*extraSections); i++)
-	{
-		scn = getSectionByName(elf, extraSections[i]);
-		if (scn)
-		{
-			LOG_DEBUG("Copy %s section", extraSections[i]);
-			size_t index = elf_ndxscn(scn);
-			copySectionWithRel(elf, outElf, index, NULL);
-		}
+		int status = dekuSetSymbolIndex(ctx, indexFile);
+		if (status != 0)
+			return status;
 	}
-	checkStaticKeys(elf, symToCopy);
 
-	// TODO: Fix file path in string sections
-
-	sortSymtab(outElf);
-
-	elf_update(outElf, ELF_C_WRITE);
-	elf_end(outElf);
-
-	free(symToCopy);
-}
-
-static Elf *openElf(const char *filePath, int *fd)
-{
-	*fd = open(filePath, O_RDONLY);
-	if (*fd == -1)
-		error(EXIT_FAILURE, errno, "Cannot open file '%s'", filePath);
-
-	Elf *elf = elf_begin(*fd, ELF_C_READ, NULL);
-	if (elf == NULL)
-		error(EXIT_FAILURE, errno, "Problems opening '%s' as ELF file: %s",
-			  filePath, elf_errmsg(-1));
-
-	size_t shstrndx;
-	if (elf_getshdrstrndx(elf, &shstrndx))
-		error(EXIT_FAILURE, errno, "Cannot get section header string index in %s", filePath);
-
-	if (getSectionByName(elf, ".strtab") == NULL)
-		LOG_ERR("Failed to find .strtab section");
-	if (getSectionByName(elf, ".symtab") == NULL)
-		LOG_ERR("Failed to find .symtab section");
-
-	return elf;
-}
-
-static void symbolCallees(Elf *elf, Symbol *s, size_t *result)
-{
-	GElf_Shdr shdr;
-	GElf_Rela rela;
-	Elf_Scn *scn = getRelForSectionIndex(elf, s->secIndex);
-	gelf_getshdr(scn, &shdr);
-	Elf_Data *data = elf_getdata(scn, NULL);
-	size_t cnt = shdr.sh_size / shdr.sh_entsize;
-	for (size_t i = 0; i < cnt; i++)
+	for (int i = optind; i < argc; i++)
 	{
-		gelf_getrela(data, i, &rela);
-		size_t symIndex = ELF64_R_SYM(rela.r_info);
-		if (symIndex >= SymbolsCount)
-			LOG_ERR("Invalid symbol index: %ld in section relocation %ld", symIndex, elf_ndxscn(scn));
-		Symbol *sym = getSymbolForRelocation(rela);
-		if (sym->isFun)
-		{
-			size_t *r = result;
-			// add symIndex to result if result not contains it
-			while (*r != 0)
-			{
-				if (*r == sym->index)
-					break;
-				r++;
-			}
-			if (*r == 0)
-				*r = sym->index;
-		}
-	}
-}
-
-static void printCallees(Symbol *s, size_t *callStack, bool *visited)
-{
-	size_t *stack = callStack;
-	while(*stack-- != 0)
-	{
-		if (*stack == s->index)
-			return;
+		DekuSymbolInfo info;
+		int status = dekuLookupSymbol(ctx, argv[i], &info);
+		if (status != 0)
+			return status;
+		printf("%s %c %zu %zu %s\n", info.object, info.type, info.count, info.total, info.path);
 	}
-	if (visited[s->index])
-		return;
-	visited[s->index] = true;
-
-	*callStack = s->index;
-	size_t *calleeIdx = s->callees;
-	if (*calleeIdx == 0)
-	{
-		do
-		{
-			printf("%s ", Symbols[*callStack]->name);
-			callStack--;
-		} while(*callStack != 0);
-		puts("");
-		return;
-	}
-	while(*calleeIdx != 0)
-	{
-		printCallees(Symbols[*calleeIdx], callStack + 1, visited);
-		calleeIdx++;
-	}
-}
-
-static void help(const char *execName)
-{
-	error(EXIT_FAILURE, EINVAL, "Usage: %s [-diff|--callchain|--extract|--changeCallSymbol"
-#ifdef SUPPORT_DISASSEMBLE
-	"|--disassemble"
-#endif
-	"] ...", execName);
+	return 0;
 }
 
-static void showDiff(int argc, char *argv[])
+static int unexportedSymbols(DekuContext *ctx, int argc, char *argv[])
 {
-	char *firstFile;
-	char *secondFile;
+	char *indexFile = NULL;
+	char *symvers = NULL;
 	int opt;
-	while ((opt = getopt(argc, argv, "a:b:")) != -1)
+	while ((opt = getopt(argc, argv, "i:s:V")) != -1)
 	{
 		switch (opt)
 		{
-		case 'a':
-			firstFile = strdup(optarg);
+		case 'i':
+			indexFile = optarg;
 			break;
-		case 'b':
-			secondFile = strdup(optarg);
+		case 's':
+			symvers = optarg;
 			break;
 		}
 	}
 
-	if (firstFile == NULL || secondFile == NULL)
-		error(EXIT_FAILURE, EINVAL, "Invalid parameters to show difference between objects file. Valid parameters:"
-			  "-a <ELF_FILE> -b <ELF_FILE> [-V]");
-
-	int firstFd;
-	int secondFd;
-	Elf *firstElf = openElf(firstFile, &firstFd);
-	Elf *secondElf = openElf(secondFile, &secondFd);
-	findModifiedSymbols(secondElf, firstElf);
-	close(firstFd);
-	close(secondFd);
-}
-
-static void findCallChains(int argc, char *argv[])
-{
-	char *filePath = NULL;
-	int opt;
-	while ((opt = getopt(argc, argv, "f:")) != -1)
+	if ((indexFile == NULL && symvers == NULL && !Serving) || optind + 1 != argc)
 	{
-		switch (opt)
-		{
-		case 'f':
-			filePath = strdup(optarg);
-			break;
-		}
+		error(0, EINVAL, "Invalid parameters to find unexported symbols. Valid parameters:"
+			  "[-i <INDEX_FILE>] [-s <MODULE_SYMVERS>] <MODULE> [-V]");
+		return EXIT_FAILURE;
 	}
 
-	if (filePath == NULL)
-		error(EXIT_FAILURE, EINVAL, "Invalid parameters to print call chain. Valid parameters:"
-			  "-f <ELF_FILE>");
-
-	int fd;
-	Elf *elf = openElf(filePath, &fd);
-	Symbols = readSymbols(elf);
-	for (Symbol **s = Symbols; *s != NULL; s++)
-	{
-		if (s[0]->isFun)
-		{
-			s[0]->callees = calloc(SymbolsCount, sizeof(size_t));
-			CHECK_ALLOC(s[0]->callees);
-			symbolCallees(elf, s[0], s[0]->callees);
-		}
-	}
-	size_t *callStack = malloc(SymbolsCount * sizeof(size_t));
-	bool *visited = malloc(SymbolsCount * sizeof(bool));
-	CHECK_ALLOC(callStack);
-	for (Symbol **s = Symbols; *s != NULL; s++)
-	{
-		if (s[0]->isFun)
-		{
-			memset(callStack, 0, SymbolsCount * sizeof(size_t));
-			memset(visited, 0, SymbolsCount * sizeof(bool));
-			printCallees(s[0], callStack + 1, visited);
-		}
-	}
-	free(callStack);
-	free(visited);
-	close(fd);
+	int status = 0;
+	if (indexFile != NULL && !Serving)
+		status = dekuSetSymbolIndex(ctx, indexFile);
+	if (status == 0 && symvers != NULL && !Serving)
+		status = dekuSetKernelFiles(ctx, NULL, NULL, symvers, NULL);
+	if (status == 0)
+		status = dekuUnexportedSymbols(ctx, argv[optind], printSymbol, NULL);
+	return status;
 }
 
-static void extractSymbols(int argc, char *argv[])
+static int symbolPosition(DekuContext *ctx, int argc, char *argv[])
 {
-	char *filePath = NULL;
-	char *outFile = NULL;
-	char **symToCopy = calloc(argc, sizeof(char *));
-	CHECK_ALLOC(symToCopy);
-	char **skipSymToCopy = calloc(argc, sizeof(char *));
-	CHECK_ALLOC(skipSymToCopy);
-	char **syms;
+	char *indexFile = NULL;
+	char *objFile = NULL;
 	int opt;
-	while ((opt = getopt(argc, argv, "f:o:s:")) != -1)
+	while ((opt = getopt(argc, argv, "i:f:V")) != -1)
 	{
 		switch (opt)
 		{
-		case 'f':
-			filePath = strdup(optarg);
+		case 'i':
+			indexFile = optarg;
 			break;
-		case 'o':
-			outFile = strdup(optarg);
-			break;
-		case 's':
-			syms = symToCopy;
-			while (*syms != NULL)
-			{
-				if (strcmp(*syms, optarg) == 0)
-					break;
-				syms++;
-			}
-			if (*syms == NULL)
-				*syms = strdup(optarg);
+		case 'f':
+			objFile = optarg;
 			break;
 		}
 	}
 
-	if (filePath == NULL || outFile == NULL || *symToCopy == NULL)
-		error(EXIT_FAILURE, EINVAL, "Invalid parameters to extract symbols. Valid parameters:"
-			  "-f <ELF_FILE> -o <OUT_FILE> -s <SYMBOL_NAME> [-n <SKIP_DEP_SYMBOL>] [-V]");
-
-	int fd;
-	Elf *pelf = openElf(filePath, &fd);
-
-	elf_getshdrnum(pelf, &SectionsCount);
-	CopiedScnMap = calloc(SectionsCount, sizeof(Elf_Scn *));
-	CHECK_ALLOC(CopiedScnMap);
-
-	Elf *outElf = createNewElf(outFile);
-	Symbols = readSymbols(pelf);
-	copySymbols(pelf, outElf, symToCopy);
-
-	for (Symbol **s = Symbols; *s != NULL; s++)
-		free(s[0]);
-
-	free(Symbols);
-	free(CopiedScnMap);
+	if (indexFile == NULL || optind + 1 != argc)
+	{
+		error(0, EINVAL, "Invalid parameters to find symbol position. Valid parameters:"
+			  "-i <INDEX_FILE> [-f <OBJ_FILE>] <SYMBOL> [-V]");
+		return EXIT_FAILURE;
+	}
 
-	close(fd);
-	free(filePath);
+	size_t position;
+	int status = dekuSetSymbolIndex(ctx, indexFile);
+	if (status == 0)
+		status = dekuSymbolPosition(ctx, argv[optind], objFile, &position);
+	if (status == 0)
+		printf("%zu\n", position);
+	return status;
 }
 
-static void changeCallSymbol(int argc, char *argv[])
+static int changeCallSymbol(DekuContext *ctx, int argc, char *argv[])
 {
 	char *filePath = NULL;
-	char **symToCopy = calloc(argc, sizeof(char *));
-	CHECK_ALLOC(symToCopy);
-	int opt;
 	char *fromRelSym = NULL;
 	char *toRelSym = NULL;
-	size_t replaced = 0;
+	int opt;
 
 	while ((opt = getopt(argc, argv, "s:d:vh")) != -1)
 	{
 		switch (opt)
 		{
 		case 's':
-			fromRelSym = strdup(optarg);
-			CHECK_ALLOC(fromRelSym);
+			fromRelSym = optarg;
 			break;
 		case 'd':
-			toRelSym = strdup(optarg);
-			CHECK_ALLOC(toRelSym);
+			toRelSym = optarg;
 			break;
 		case 'v':
-			ShowDebugLog = 0;
+			dekuSetDebug(ctx, false);
 			break;
 		case '?':
 		case 'h':
 			help(argv[0]);
 			break;
 		case ':':
-			LOG_ERR("Missing arg for %c", optopt);
+			error(EXIT_FAILURE, EINVAL, "Missing arg for %c", optopt);
 			break;
 		}
 	}
@@ -1356,71 +480,22 @@ static void changeCallSymbol(int argc, char *argv[])
 	if (optind - 1 < argc)
 	{
 		filePath = argv[optind++];
-		while (optind < argc)
-			LOG_ERR("Unknown parameter: %s", argv[optind++]);
+		if (optind < argc)
+			error(EXIT_FAILURE, EINVAL, "Unknown parameter: %s", argv[optind]);
 	}
 
 	if (filePath == NULL || fromRelSym == NULL || toRelSym== NULL)
-		error(EXIT_FAILURE, EINVAL, "Invalid parameters to change calling function. Valid parameters:"
-			  "-s <SYMBOL_NAME_SOURCE> -d <SYMBOL_NAME_DEST> [-v] <MODULE.ko>");
-
-	int fd = open(filePath, O_RDWR);
-	if (fd == -1)
-		error(EXIT_FAILURE, errno, "Cannot open input file '%s'", filePath);
-
-	Elf *elf = elf_begin(fd, ELF_C_RDWR, NULL);
-	if (elf == NULL)
-		error(EXIT_FAILURE, errno, "Problems opening '%s' as ELF file: %s",
-			  filePath, elf_errmsg(-1));
-
-	size_t shstrndx;
-	if (elf_getshdrstrndx(elf, &shstrndx))
-		error(EXIT_FAILURE, errno, "Cannot get section header string index");
-
-	Elf_Scn *scn = NULL;
-	GElf_Shdr shdr;
-	GElf_Rela rela;
-	Elf_Data *data;
-
-	uint16_t oldSymIndex = getSymbolIndexByName(elf, fromRelSym);
-	uint16_t newSymIndex = getSymbolIndexByName(elf, toRelSym);
-	if (oldSymIndex == 0)
-		LOG_ERR("Can't find symbol '%s'\n", fromRelSym);
-	if (newSymIndex == 0)
-		LOG_ERR("Can't find symbol '%s'\n", toRelSym);
-
-	while ((scn = elf_nextscn(elf, scn)) != NULL)
 	{
-		gelf_getshdr(scn, &shdr);
-		if (shdr.sh_type != SHT_RELA)
-			continue;
-		data = elf_getdata(scn, NULL);
-		Elf64_Xword cnt = shdr.sh_size / shdr.sh_entsize;
-		for (Elf64_Xword i = 0; i < cnt; i++)
-		{
-			gelf_getrela(data, i, &rela);
-			if (ELF64_R_SYM(rela.r_info) == oldSymIndex)
-			{
-				rela.r_info = ELF64_R_INFO(newSymIndex, ELF64_R_TYPE(rela.r_info));
-				gelf_update_rela(data, i, &rela);
-				replaced++;
-			}
-		}
+		error(0, EINVAL, "Invalid parameters to change calling function. Valid parameters:"
+			  "-s <SYMBOL_NAME_SOURCE> -d <SYMBOL_NAME_DEST> [-v] <MODULE.ko>");
+		return EXIT_FAILURE;
 	}
 
-	if (replaced && elf_update(elf, ELF_C_WRITE) == -1)
-		error(EXIT_FAILURE, errno, "elf_update failed: %s", elf_errmsg(-1));
-
-	close(fd);
-	free(fromRelSym);
-	free(toRelSym);
-
-	if (replaced == 0)
-		LOG_ERR("No relocation has been replaced");
+	return dekuChangeCallSymbol(ctx, filePath, fromRelSym, toRelSym);
 }
 
 #ifdef SUPPORT_DISASSEMBLE
-static void disassemble(int argc, char *argv[])
+static int disassemble(DekuContext *ctx, int argc, char *argv[])
 {
 	char *filePath = NULL;
 	char *symName = NULL;
@@ -1430,45 +505,42 @@ static void disassemble(int argc, char *argv[])
 		switch (opt)
 		{
 		case 'f':
-			filePath = strdup(optarg);
+			filePath = optarg;
 			break;
 		case 's':
-			symName = strdup(optarg);
+			symName = optarg;
 			break;
 		}
 	}
 
 	if (filePath == NULL || symName == NULL)
-		error(EXIT_FAILURE, 0, "Invalid parameters to disassemble. Valid parameters:"
+	{
+		error(0, 0, "Invalid parameters to disassemble. Valid parameters:"
 			  "-f <ELF_FILE> -s <SYMBOL_NAME>");
+		return EXIT_FAILURE;
+	}
 
-	int fd;
-	Elf *elf = openElf(filePath, &fd);
-	GElf_Sym sym;
-	if (!getSymbolByNameAndType(elf, symName, STT_FUNC, &sym))
-		LOG_ERR("Can't find symbol %s", symName);
-
-	GElf_Shdr shdr;
-	gelf_getshdr(getSectionByName(elf, ".symtab"), &shdr);
-	SymbolData symData = getSymbolData(elf, symName, STT_FUNC, true);
-	DisasmData data = { .elf = elf, .sym = sym, .shdr = shdr, .symData = &symData };
-
-	char *disassembled = disassembleBytes(data.symData->data, data.symData->size, &data);
-	puts(disassembled);
-
+	char *disassembled = NULL;
+	int status = dekuDisassemble(ctx, filePath, symName, &disassembled);
+	if (status == 0)
+		puts(disassembled);
 	free(disassembled);
-	free(symName);
-	free(filePath);
-	close(fd);
+	return status;
 }
 #endif
 
-int main(int argc, char *argv[])
+// returns false if no command was found in the arguments
+static bool runCommand(DekuContext *ctx, int argc, char *argv[], int *status)
 {
 	bool showDiffElf = false;
 	bool showCallChain = false;
 	bool extractSym = false;
 	bool changeCallSym = false;
+	bool batch = false;
+	bool symbolIndex = false;
+	bool lookupSymbol = false;
+	bool symbolPos = false;
+	bool unexported = false;
 #ifdef SUPPORT_DISASSEMBLE
 	bool disasm = false;
 #endif
@@ -1482,28 +554,360 @@ int main(int argc, char *argv[])
 			extractSym = true;
 		if (strcmp(argv[i], "--changeCallSymbol") == 0)
 			changeCallSym = true;
+		if (strcmp(argv[i], "--batch") == 0)
+			batch = true;
+		if (strcmp(argv[i], "--symbolIndex") == 0)
+			symbolIndex = true;
+		if (strcmp(argv[i], "--lookupSymbol") == 0)
+			lookupSymbol = true;
+		if (strcmp(argv[i], "--symbolPosition") == 0)
+			symbolPos = true;
+		if (strcmp(argv[i], "--unexportedSymbols") == 0)
+			unexported = true;
 #ifdef SUPPORT_DISASSEMBLE
 		if (strcmp(argv[i], "--disassemble") == 0)
 			disasm = true;
 #endif
 		if (strcmp(argv[i], "-V") == 0)
-			ShowDebugLog = true;
+			dekuSetDebug(ctx, true);
 	}
-	elf_version(EV_CURRENT);
 
 	if (showDiffElf)
-		showDiff(argc - 1, argv + 1);
+		*status = showDiff(ctx, argc - 1, argv + 1);
 	else if (showCallChain)
-		findCallChains(argc - 1, argv + 1);
+		*status = findCallChains(ctx, argc - 1, argv + 1);
 	else if (extractSym)
-		extractSymbols(argc - 1, argv + 1);
+		*status = extractSymbols(ctx, argc - 1, argv + 1);
 	else if (changeCallSym)
-		changeCallSymbol(argc - 1, argv + 1);
+		*status = changeCallSymbol(ctx, argc - 1, argv + 1);
+	else if (batch)
+		*status = runBatch(ctx, argc - 1, argv + 1);
+	else if (symbolIndex)
+		*status = buildSymbolIndex(ctx, argc - 1, argv + 1);
+	else if (lookupSymbol)
+		*status = lookupSymbols(ctx, argc - 1, argv + 1);
+	else if (symbolPos)
+		*status = symbolPosition(ctx, argc - 1, argv + 1);
+	else if (unexported)
+		*status = unexportedSymbols(ctx, argc - 1, argv + 1);
 #ifdef SUPPORT_DISASSEMBLE
 	else if (disasm)
-		disassemble(argc - 1, argv + 1);
+		*status = disassemble(ctx, argc - 1, argv + 1);
 #endif
 	else
+		return false;
+	return true;
+}
+
+/*
+ * Request is: <CWD> <COMMAND> [<ARGS>...]. COMMAND is one of the elfutils
+ * commands (--diff, --callchain, --extract, --batch, --lookupSymbol,
+ * --unexportedSymbols) or one of the queries served from the kernel indexes: owner <SYM>,
+ * sympos <SYM> [<OBJ_FILE>], exported <SYM>.
+ */
+static int handleRequest(DekuContext *ctx, int argc, char *argv[], bool *stop)
+{
+	if (argc < 2)
+	{
+		error(0, EINVAL, "Invalid request");
+		return EXIT_FAILURE;
+	}
+	if (chdir(argv[0]) != 0)
+	{
+		error(0, errno, "Cannot change directory to '%s'", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	int status = 0;
+	const char *command = argv[1];
+	const char *value;
+	size_t position;
+	if (strcmp(command, "--diff") == 0 || strcmp(command, "--callchain") == 0 ||
+		strcmp(command, "--extract") == 0 || strcmp(command, "--batch") == 0 ||
+		strcmp(command, "--lookupSymbol") == 0 || strcmp(command, "--unexportedSymbols") == 0)
+	{
+		optind = 0;
+		argv[0] = "elfutils";
+		runCommand(ctx, argc, argv, &status);
+	}
+	else if (strcmp(command, "owner") == 0 && argc == 3)
+	{
+		status = dekuSymbolOwner(ctx, argv[2], &value);
+		if (status == 0)
+			printf("%s\n", value);
+	}
+	else if (strcmp(command, "sympos") == 0 && (argc == 3 || argc == 4))
+	{
+		status = dekuSymbolPosition(ctx, argv[2], argc == 4 ? argv[3] : NULL, &position);
+		if (status == 0)
+			printf("%zu\n", position);
+	}
+	else if (strcmp(command, "exported") == 0 && argc == 3)
+	{
+		status = dekuExportingModule(ctx, argv[2], &value);
+		if (status == 0)
+			printf("%s\n", value);
+	}
+	else if (strcmp(command, "ping") == 0)
+	{
+		status = dekuLoadKernelIndex(ctx);
+	}
+	else if (strcmp(command, "stop") == 0)
+	{
+		*stop = true;
+	}
+	else
+	{
+		error(0, EINVAL, "Unknown request: %s", command);
+		status = EXIT_FAILURE;
+	}
+
+	dekuSetDebug(ctx, false);
+	return status;
+}
+
+static char *readRequest(int fd, size_t *size)
+{
+	size_t capacity = 4096;
+	char *request = malloc(capacity);
+	if (request == NULL)
+		error(EXIT_FAILURE, ENOMEM, "Failed to alloc memory");
+	*size = 0;
+	while (true)
+	{
+		if (*size == capacity)
+		{
+			capacity *= 2;
+			request = realloc(request, capacity);
+			if (request == NULL)
+				error(EXIT_FAILURE, ENOMEM, "Failed to alloc memory");
+		}
+		ssize_t len = read(fd, request + *size, capacity - *size);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			break;
+		*size += len;
+	}
+	return request;
+}
+
+static void writeAll(int fd, const char *buf, size_t size)
+{
+	while (size > 0)
+	{
+		ssize_t len = write(fd, buf, size);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			return;
+		buf += len;
+		size -= len;
+	}
+}
+
+// the symbol index may be built or removed while the server is running
+static void updateSymbolIndex(DekuContext *ctx, const char *indexFile, bool *indexed)
+{
+	bool exists = indexFile != NULL && access(indexFile, R_OK) == 0;
+	if (exists != *indexed && dekuSetSymbolIndex(ctx, exists ? indexFile : NULL) == 0)
+		*indexed = exists;
+}
+
+static void sendErrors(int fd, FILE *errors)
+{
+	char buf[4096];
+	size_t len;
+	rewind(errors);
+	while ((len = fread(buf, 1, sizeof(buf), errors)) > 0)
+		writeAll(fd, buf, len);
+}
+
+/*
+ * Serve requests on the unix socket until the "stop" request. Output of the
+ * request is sent back to the client followed by '\0', the exit status, '\0'
+ * and the error output of the request.
+ */
+static void serve(DekuContext *ctx, int argc, char *argv[])
+{
+	char *socketPath = NULL;
+	char *versionFile = NULL;
+	char *systemMap = NULL;
+	char *symvers = NULL;
+	char *symbolsDir = NULL;
+	char *symbolIndex = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "S:k:m:s:d:i:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'S':
+			socketPath = optarg;
+			break;
+		case 'k':
+			versionFile = optarg;
+			break;
+		case 'm':
+			systemMap = optarg;
+			break;
+		case 's':
+			symvers = optarg;
+			break;
+		case 'd':
+			symbolsDir = optarg;
+			break;
+		case 'i':
+			symbolIndex = optarg;
+			break;
+		}
+	}
+
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (socketPath == NULL || versionFile == NULL)
+		error(EXIT_FAILURE, EINVAL, "Invalid parameters to serve. Valid parameters:"
+			  "-S <SOCKET> -k <KERNEL_VERSION_FILE> [-m <SYSTEM_MAP>] [-s <MODULE_SYMVERS>] [-d <SYMBOLS_DIR>] [-i <SYMBOL_INDEX>]");
+	if (strlen(socketPath) >= sizeof(addr.sun_path))
+		error(EXIT_FAILURE, EINVAL, "Socket path is too long: %s", socketPath);
+	strcpy(addr.sun_path, socketPath);
+
+	int status = dekuSetKernelFiles(ctx, versionFile, systemMap, symvers, symbolsDir);
+	if (status != 0)
+		exit(status);
+	bool indexed = false;
+	updateSymbolIndex(ctx, symbolIndex, &indexed);
+	dekuSetCache(ctx, true);
+	Serving = true;
+
+	int server = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (server < 0)
+		error(EXIT_FAILURE, errno, "Cannot create socket");
+	unlink(socketPath);
+	if (bind(server, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(server, 16) != 0)
+		error(EXIT_FAILURE, errno, "Cannot listen on '%s'", socketPath);
+
+	int cwd = open(".", O_RDONLY | O_DIRECTORY);
+	if (cwd < 0)
+		error(EXIT_FAILURE, errno, "Cannot open current directory");
+	signal(SIGPIPE, SIG_IGN);
+	bool stop = false;
+	while (!stop)
+	{
+		int client = accept(server, NULL, NULL);
+		if (client < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			error(EXIT_FAILURE, errno, "Failed to accept connection");
+		}
+
+		size_t size;
+		char *request = readRequest(client, &size);
+		char **args = calloc(size + 1, sizeof(char *));
+		if (args == NULL)
+			error(EXIT_FAILURE, ENOMEM, "Failed to alloc memory");
+		int count = 0;
+		for (size_t i = 0; i < size;)
+		{
+			char *end = memchr(request + i, '\0', size - i);
+			if (end == NULL)
+				break;
+			args[count++] = request + i;
+			i = end - request + 1;
+		}
+
+		updateSymbolIndex(ctx, symbolIndex, &indexed);
+		// errors are collected to be sent after the output of the request
+		FILE *errors = tmpfile();
+		if (errors == NULL)
+			error(EXIT_FAILURE, errno, "Cannot create temporary file");
+		fflush(stdout);
+		fflush(stderr);
+		int savedStdout = dup(STDOUT_FILENO);
+		int savedStderr = dup(STDERR_FILENO);
+		dup2(client, STDOUT_FILENO);
+		dup2(fileno(errors), STDERR_FILENO);
+		status = handleRequest(ctx, count, args, &stop);
+		fflush(stdout);
+		fflush(stderr);
+		dup2(savedStdout, STDOUT_FILENO);
+		dup2(savedStderr, STDERR_FILENO);
+		close(savedStdout);
+		close(savedStderr);
+		if (fchdir(cwd) != 0)
+			error(EXIT_FAILURE, errno, "Cannot restore working directory");
+
+		char trailer[16];
+		int len = snprintf(trailer, sizeof(trailer), "%c%d%c", '\0', status, '\0');
+		writeAll(client, trailer, len);
+		sendErrors(client, errors);
+		fclose(errors);
+		close(client);
+		free(args);
+		free(request);
+	}
+
+	close(cwd);
+	close(server);
+	unlink(socketPath);
+}
+
+// send request to the server and exit with the status of the request
+static void sendRequest(int argc, char *argv[])
+{
+	if (argc < 3)
+		error(EXIT_FAILURE, EINVAL, "Invalid parameters to send request. Valid parameters:"
+			  "<SOCKET> <COMMAND> [<ARGS>...]");
+
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(argv[1]) >= sizeof(addr.sun_path))
+		error(EXIT_FAILURE, EINVAL, "Socket path is too long: %s", argv[1]);
+	strcpy(addr.sun_path, argv[1]);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+		exit(ERROR_NO_SERVER);
+
+	char *cwd = getcwd(NULL, 0);
+	if (cwd == NULL)
+		error(EXIT_FAILURE, errno, "Cannot get current directory");
+	writeAll(fd, cwd, strlen(cwd) + 1);
+	for (int i = 2; i < argc; i++)
+		writeAll(fd, argv[i], strlen(argv[i]) + 1);
+	shutdown(fd, SHUT_WR);
+	free(cwd);
+
+	size_t size;
+	char *response = readRequest(fd, &size);
+	close(fd);
+	char *end = memchr(response, '\0', size);
+	if (end == NULL)
+		exit(ERROR_NO_SERVER);
+
+	fwrite(response, 1, end - response, stdout);
+	int status = atoi(end + 1);
+	char *errors = memchr(end + 1, '\0', response + size - end - 1);
+	if (errors != NULL)
+	{
+		fflush(stdout);
+		fwrite(errors + 1, 1, response + size - errors - 1, stderr);
+	}
+	free(response);
+	exit(status);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1 && strcmp(argv[1], "--request") == 0)
+		sendRequest(argc - 1, argv + 1);
+
+	DekuContext *ctx = dekuOpen();
+	if (ctx == NULL)
+		error(EXIT_FAILURE, 0, "Failed to initialize libdeku");
+
+	int status = 0;
+	if (argc > 1 && strcmp(argv[1], "--serve") == 0)
+		serve(ctx, argc - 1, argv + 1);
+	else if (!runCommand(ctx, argc, argv, &status))
 		help(argv[0]);
-	return 0;
+	dekuClose(ctx);
+	return status;
 }
@@ -31,27 +31,20 @@ findModifiedModules()
 getSymbolsToRelocate()
 {
 	local module=$1
-	local originobj=$2
-	local symvers=$3
-	local ignoresymbols=(
-						"_printk"
-						)
-	local syms=()
-	local staticsymbols=(`readelf -W -s "$originobj" | \
-						  awk 'BEGIN { ORS=" " } {
-						  	if(($4 == "FUNC" || $4 == "OBJECT") && $5 == "LOCAL" ) {print $8}
-						  }'`)
-	local undsymbols=(`readelf -W -s "$module" | awk 'BEGIN { ORS=" " } { if($7 == "UND") {print $8} }'`)
-	local greparg=`printf -- " -e \\s%s\\s" "${undsymbols[@]}"`
-	local globalsymbols=`grep $greparg "$symvers" | tr '\n' ' '`
-	read -a globalsymbols <<< "$globalsymbols"
-	for sym in "${undsymbols[@]}"
+	local symvers=$2
+	local ignoresymbols=" _printk "
+	local syms
+	if [[ ! -f "$SYMBOL_INDEX_FILE" ]] || \
+	   ! syms=`elfutilsRequest --unexportedSymbols -i "$SYMBOL_INDEX_FILE" "$module"`; then
+		syms=`elfutilsRequest --unexportedSymbols -s "$symvers" "$module"`
+	fi
+	while read -r sym
 	do
+		[[ "$sym" == "" ]] && continue
 		[[ "$sym" == $DEKU_FUN_PREFIX* ]] && continue
-		[[ " ${ignoresymbols[*]} " =~ " $sym " ]] && continue
-		[[ " ${globalsymbols[*]} " =~ " $sym " ]] && continue
+		[[ "$ignoresymbols" == *" $sym "* ]] && continue
 		echo "$sym"
-	done
+	done <<< "$syms"
 }
 
 relocations()
@@ -60,18 +53,23 @@ relocations()
 	local module=$2
 	local modsymfile="$moduledir/$MOD_SYMBOLS_FILE"
 	local srcfile=$(<$moduledir/$FILE_SRC_PATH)
-	local originobj="$BUILD_DIR/${srcfile%.*}.o"
 
-	local syms=$(getSymbolsToRelocate "$moduledir/$module.ko" "$originobj" "$LINUX_HEADERS/Module.symvers")
+	local syms=$(getSymbolsToRelocate "$moduledir/$module.ko" "$LINUX_HEADERS/Module.symvers")
 
 	while read -r sym;
 	do
 		grep -q "\b$sym\b" "$modsymfile" && continue
 		local objname=$(findObjWithSymbol "$sym" "$srcfile")
 		if [[ $objname != "vmlinux" ]]; then
-			local objpath=`find $SYMBOLS_DIR -type f -name "$objname"`
-			objpath=${objpath#*$SYMBOLS_DIR/}.ko
-			local cnt=`nm "$BUILD_DIR/$objpath" | grep "\b$sym\b" | wc -l`
+			local cnt=
+			if [[ -f "$SYMBOL_INDEX_FILE" ]]; then
+				cnt=`./elfutils --lookupSymbol -i "$SYMBOL_INDEX_FILE" "$sym" | cut -d ' ' -f 3`
+			fi
+			if [[ $cnt == "" ]]; then
+				local objpath=`find $SYMBOLS_DIR -type f -name "$objname"`
+				objpath=${objpath#*$SYMBOLS_DIR/}.ko
+				cnt=`nm "$BUILD_DIR/$objpath" | grep "\b$sym\b" | wc -l`
+			fi
 			if [[ $cnt > 1 ]]; then
 				logErr "A relocation is needed for the '$sym' function, which is located in the kernel module. This is not yet supported by DEKU."
 			fi
@@ -93,6 +91,24 @@ findSymbolIndex()
 	local symbol=${rel#*.}
 	index=0
 	[[ "$objname" != "vmlinux" ]] && return $NO_ERROR
+	local srcfile=$(<`dirname $kofile`/$FILE_SRC_PATH)
+	local originobj="$BUILD_DIR/${srcfile%.*}.o"
+	if [[ -S "$ELFUTILS_SOCKET" ]]; then
+		index=`./elfutils --request "$ELFUTILS_SOCKET" sympos "$symbol" "$originobj"` && \
+			return $NO_ERROR
+		index=0
+	fi
+	# the symbol index knows the source file of every symbol in vmlinux
+	if [[ -f "$SYMBOL_INDEX_FILE" ]]; then
+		index=`./elfutils --symbolPosition -i "$SYMBOL_INDEX_FILE" -f "$originobj" "$symbol"`
+		local rc=$?
+		[[ $rc == $NO_ERROR ]] && return $NO_ERROR
+		index=0
+		if [[ $rc == $ERROR_CANT_FIND_SYM_INDEX ]]; then
+			logErr "Can't find index for symbol '$symbol'"
+			exit $ERROR_CANT_FIND_SYM_INDEX
+		fi
+	fi
 	local mapfile="$SYSTEM_MAP"
 	local count=`grep " $symbol$" "$mapfile" | wc -l`
 	[[ $count == "1" ]] && return
@@ -108,8 +124,7 @@ findSymbolIndex()
 			[[ $occure == "10" ]] && return $NO_ERROR
 		fi
 	done <<< "$maches"
-	local filename=$(<`dirname $kofile`/$FILE_SRC_PATH)
-	filename=`basename $filename`
+	local filename=`basename $srcfile`
 	index=`readelf -a "$BUILD_DIR/vmlinux" | \
 		grep -e "\b$filename\b" -e "\b$symbol$" | \
 		grep -n $filename | \
@@ -142,31 +157,46 @@ main()
 		local objname=$(<$moduledir/$FILE_OBJECT)
 		relocs=$(relocations "$moduledir" $module)
 		local rc=${PIPESTATUS[0]}
-		[[ $rc != 0 ]] && exit $rc
+		[[ $rc != 0 ]] && { rm -f "$moduledir/id"; exit $rc; }
 
 		logDebug "Processing $module..."
+		# restore calls to origin func XYZ instead of __deku_XYZ
+		while read -r symbol; do
+			local plainsymbol="${symbol//./_}"
+			args+=("-c ${DEKU_FUN_PREFIX}${plainsymbol}:${plainsymbol}")
+		done < $modsymfile
+
 		if [[ "$relocs" != "" ]]; then
 			while read -r sym; do
 				args+=("-s $objname.$sym")
 			done < $modsymfile
 
+			# pass relocations in the file to not hit the limit of the arguments
+			local relocsfile="$moduledir/relocations"
+			: > "$relocsfile"
 			while read -r rel; do
 				local ndx=0
 				findSymbolIndex ndx "$rel" "$kofile"
-				args+=("-r $rel,$ndx")
+				echo "$rel,$ndx" >> "$relocsfile"
 				logDebug "Relocate \"$rel\""
 			done <<< "$relocs"
-
-			[[ "$LOG_LEVEL" > 0 ]] && args+=("-V")
-			args+=("$kofile")
-			logDebug "Make livepatch module"
-			./mklivepatch ${args[@]}
-			if [[ $? != 0 ]]; then
-				exit $ERROR_GENERATE_LIVEPATCH_MODULE
-			fi
+			args+=("-R $relocsfile")
 		else
 			logDebug "Module does not need to adjust relocations"
 		fi
+
+		args+=("-n $moduledir/$NOTE_FILE")
+		[[ "$LOG_LEVEL" > 0 ]] && args+=("-V")
+		args+=("$kofile")
+		logDebug "Finalize livepatch module"
+		./mklivepatch ${args[@]}
+		rc=$?
+		if [[ $rc != 0 ]]; then
+			# the module is not usable, build it again in the next run
+			rm -f "$moduledir/id"
+			[[ $rc == $ERROR_CHANGE_CALL_TO_ORIGIN ]] && exit $ERROR_CHANGE_CALL_TO_ORIGIN
+			exit $ERROR_GENERATE_LIVEPATCH_MODULE
+		fi
 	done <<< "$modules"
 	logInfo "Generate DEKU module. Done"
 }
@@ -217,140 +217,95 @@ buildLivepatchModule()
 	buildModules "$moduledir"
 }
 
-function isTraceable()
-{
-	local file=$1
-	local symbol=$2
-
-	local val=`readelf -sW "$file" | \
-			   grep FUNC | \
-			   grep " $symbol$" | \
-			   cut -d':' -f 2 | \
-			   xargs | \
-			   cut -d' ' -f 1`
-	[[ $val == "" ]] && return 0
-	val="0x$val"
-	fentryoff=`printf "000000%x" $(($val + 1))`
-	fentry=`readelf -rW "$file" | grep __fentry__`
-	grep -q $fentryoff <<< $fentry && return 0 || return 1
-}
-
 generateDiffObject()
 {
 	local moduledir=$1
 	local file=$2
-	local filename=$(filenameNoExt "$file")
-	local out=`./elfutils --diff -a "$moduledir/_$filename.o" -b "$moduledir/$filename.o"`
-	local tmpmodfun=`sed -n "s/^Modified function: \(.\+\)/\1/p" <<< "$out"`
-	local newfun=`sed -n "s/^New function: \(.\+\)/\1/p" <<< "$out"`
-	local newvar=`sed -n "s/^New variable: \(.\+\)/\1/p" <<< "$out"`
+	local status=""
 	local modfun=()
 
-	while read -r fun
+	# results of the "elfutils --batch" job for this file
+	while IFS=$'\t' read -r kind value
 	do
-		[[ $fun == "" ]] && continue
-		local initfunc=`objdump -t -j ".init.text" "$moduledir/_$filename.o" 2>/dev/null | grep "\b$fun\b"`
-		if [[ "$initfunc" != "" ]]; then
-			logInfo "The init function '$fun' has been modified. Any changes made to this function will not be applied."
-			continue
-		fi
-		local initfunc=`objdump -t -j ".exit.text" "$moduledir/_$filename.o" 2>/dev/null | grep "\b$fun\b"`
-		if [[ "$initfunc" != "" ]]; then
-			logInfo "The exit function '$fun' has been modified. Any changes made to this function will not be applied."
-			continue
-		fi
-		if [[ $fun == *".cold" ]]; then
-			local originfun=${fun%.*}
-			local calls=`./elfutils --callchain -f "$moduledir/$filename.o" | \
-						 grep -E "\b$fun \b"`
-			local callswithparent=`./elfutils --callchain -f "$moduledir/$filename.o" | \
-								    grep -E "\b$fun $originfun\b"`
-			# check if ".cold" part of function is only called by the origin
-			# function. If not, then disallow for changes
-			if [[ "$calls" != "$callswithparent" ]]; then
-				logErr "Can't apply changes to '$file' because the compiler in this file has optimized the '$originfun' function and split it into two parts. This is not yet supported by DEKU."
-				exit $ERROR_NO_SUPPORT_COLD_FUN
-			fi
-		elif ! isTraceable "$BUILD_DIR/${file%.*}.o" $fun; then
-			logErr "Can't apply changes to the '$file' because the '$fun' function is forbidden to modify."
+		case $kind in
+		init_function)
+			logInfo "The init function '$value' has been modified. Any changes made to this function will not be applied."
+			;;
+		exit_function)
+			logInfo "The exit function '$value' has been modified. Any changes made to this function will not be applied."
+			;;
+		cold_split)
+			logErr "Can't apply changes to '$file' because the compiler in this file has optimized the '${value%.*}' function and split it into two parts. This is not yet supported by DEKU."
+			exit $ERROR_NO_SUPPORT_COLD_FUN
+			;;
+		notrace)
+			logErr "Can't apply changes to the '$file' because the '$value' function is forbidden to modify."
 			exit $ERROR_FORBIDDEN_MODIFY
-		fi
-
-		local objpath=$(findObjWithSymbol $fun "$file")
-		if [[ "$objpath" == "vmlinux" ]]; then
-			local count=`nm "$BUILD_DIR/$objpath" | grep "\b$fun\b" | wc -l`
-			if [[ $count > 1 ]]; then
-				logWarn "Found multiple instances of '$fun' from the '$file' in the kernel image. This case is not yet fully supported by DEKU."
-			fi
-		fi
-
-		modfun+=("$fun")
-	done <<< "$tmpmodfun"
+			;;
+		duplicate)
+			logWarn "Found multiple instances of '$value' from the '$file' in the kernel image. This case is not yet fully supported by DEKU."
+			;;
+		inlined)
+			logDebug "$value function in $file is inlined"
+			;;
+		cause)
+			logDebug "'${value% *}' function in $file is modified by the ${value##* } change"
+			;;
+		metadata_only)
+			logDebug "Skip '$value' function in $file because only the numbering of its local symbols changed"
+			;;
+		livepatch)
+			modfun+=("$value")
+			;;
+		status)
+			status=$value
+			;;
+		esac
+	done < "$moduledir/$DIFF_RESULT_FILE"
 
 	printf "%s\n" "${modfun[@]}" > "$moduledir/$MOD_SYMBOLS_FILE"
 
-	[[ "$newfun" == "" && ${#modfun[@]} == 0 && "$newvar" == "" ]] && return 0
+	case "$status" in
+	patch)
+		return 1
+		;;
+	unchanged)
+		return 0
+		;;
+	"error $ERROR_UNSUPPORTED_READ_MOSTLY")
+		exit $ERROR_UNSUPPORTED_READ_MOSTLY
+		;;
+	*)
+		logErr "Failed to extract modified symbols for $(<$moduledir/$FILE_SRC_PATH)"
+		exit $ERROR_EXTRACT_SYMBOLS
+		;;
+	esac
+}
 
-	local originfuncs=`nm -C -f posix "$BUILD_DIR/${file%.*}.o" | grep -i " t " | cut -d ' ' -f 1`
-	local extractsyms=""
-	for fun in ${modfun[@]};
+# find changes in all modified files and extract them to "patch.o" in one run
+runDiffBatch()
+{
+	local manifest="$workdir/diff_manifest"
+	local moduledirs=("$@")
+	local jobs=()
+	: > "$manifest"
+	for moduledir in "${moduledirs[@]}"
 	do
-		[[ "$fun" == "" ]] && continue
-		# if modified function is inlined in origin file then get functions that call
-		# this function and make DEKU module for those functions
-		if ! grep -q "\b$fun\b" <<< "$originfuncs"; then
-			logDebug "$fun function in $file is inlined"
-			sed -i "/\b$fun\b/d" "$moduledir/$MOD_SYMBOLS_FILE"
-			local calls=`./elfutils --callchain -f "$moduledir/$filename.o" | grep -E "^\b$fun\b"`
-			while read -r chain;
-			do
-				# check if the call chain contains only one function from origin file
-				local count=0
-				local originfun=""
-				local toextract=""
-				for s in $chain; do
-					if grep -q "\b$s\b" <<< "$originfuncs"; then
-						((count=count+1))
-						[[ $count > 1 ]] && break
-						originfun=$s
-					fi
-					# add to list if another function in call chain is inlined
-					[[ $count == 0 ]] && ! grep -q "\b$s\b" <<< "$extractsyms" && toextract+="-s $s "
-				done
-				if [[ $count == 1 ]]; then
-					extractsyms+="$toextract"
-					extractsyms+="-s $originfun "
-					echo "$originfun" >> "$moduledir/$MOD_SYMBOLS_FILE"
-				fi
-			done <<< "$calls"
-		else
-			extractsyms+="-s $fun "
-		fi
+		local file=$(<"$moduledir/$FILE_SRC_PATH")
+		local filename=$(filenameNoExt "$file")
+		printf "%s\t%s\t%s\t%s\n" "$moduledir/_$filename.o" "$moduledir/$filename.o" \
+			   "$moduledir/patch.o" "$BUILD_DIR/${file%.*}.o" >> "$manifest"
+		: > "$moduledir/$DIFF_RESULT_FILE"
 	done
 
-	while read -r fun;
-	do
-		[[ "$fun" == "" ]] && continue
-		extractsyms+="-s $fun "
-	done <<< "$newfun"
-
-	while read -r var;
+	local args=()
+	[[ -f "$KERNEL_VERSION_FILE" ]] && args+=(-c "$FINGERPRINTS_DIR" -k "$KERNEL_VERSION_FILE")
+	[[ -f "$SYSTEM_MAP" ]] && args+=(-m "$SYSTEM_MAP")
+	elfutilsRequest --batch "$manifest" "${args[@]}" | \
+	while IFS=$'\t' read -r job kind value
 	do
-		[[ "$var" == "" ]] && continue
-		extractsyms+="-s $var "
-	done <<< "$newvar"
-
-	./elfutils --extract -f "$moduledir/$filename.o" -o "$moduledir/patch.o" $extractsyms
-	local rc=$?
-	if [[ $rc == $ERROR_UNSUPPORTED_READ_MOSTLY ]]; then
-		exit $ERROR_UNSUPPORTED_READ_MOSTLY
-	fi
-	if [[ $rc != 0 ]]; then
-		logErr "Failed to extract modified symbols for $(<$moduledir/$FILE_SRC_PATH)"
-		exit $ERROR_EXTRACT_SYMBOLS
-	fi
-
-	return 1
+		printf "%s\t%s\n" "$kind" "$value" >> "${moduledirs[$job]}/$DIFF_RESULT_FILE"
+	done
 }
 
 generateLivepatchSource()
@@ -464,6 +419,10 @@ main()
 		RUN_POST_BUILD=1
 	fi
 
+	local builtfiles=()
+	local moduledirs=()
+	local modules=()
+	local moduleids=()
 	for file in $files
 	do
 		local basename=`basename $file`
@@ -513,6 +472,22 @@ main()
 			buildModules "$moduledir"
 		fi
 
+		builtfiles+=("$file")
+		moduledirs+=("$moduledir")
+		modules+=("$module")
+		moduleids+=("$moduleid")
+	done
+
+	[[ ${#moduledirs[@]} == 0 ]] && { postBuild; return; }
+	runDiffBatch "${moduledirs[@]}"
+
+	for i in "${!moduledirs[@]}"
+	do
+		local file=${builtfiles[$i]}
+		local moduledir=${moduledirs[$i]}
+		local module=${modules[$i]}
+		local moduleid=${moduleids[$i]}
+
 		if generateDiffObject "$moduledir" "$file"; then
 			logInfo "No valid changes found in '$file'"
 			continue
@@ -522,25 +497,13 @@ main()
 		generateLivepatchMakefile "$moduledir/Makefile" "$file" "$module"
 		buildLivepatchModule "$moduledir"
 
-		# restore calls to origin func XYZ instead of __deku_XYZ
-		while read -r symbol; do
-			local plainsymbol="${symbol//./_}"
-			./elfutils --changeCallSymbol -s ${DEKU_FUN_PREFIX}${plainsymbol} -d ${plainsymbol} \
-					   "$moduledir/$module.ko" || exit $ERROR_CHANGE_CALL_TO_ORIGIN
-			objcopy --strip-symbol=${DEKU_FUN_PREFIX}${plainsymbol} "$moduledir/$module.ko"
-		done < "$moduledir/$MOD_SYMBOLS_FILE"
-
 		echo -n "$moduleid" > "$moduledir/id"
 
-		# Add note to module with module name and id
+		# note with module name and id, added to the module by mklivepatch
 		local notefile="$moduledir/$NOTE_FILE"
 		echo -n "$module " > "$notefile"
 		cat "$moduledir/id" >> "$notefile"
 		echo "" >> "$notefile"
-		objcopy --add-section .note.deku="$notefile" \
-				--set-section-flags .note.deku=alloc,readonly \
-				"$moduledir/$module.ko"
-
 	done
 	postBuild
 }
@@ -17,9 +17,24 @@ export FILE_SRC_PATH=path
 # file for note in module
 export NOTE_FILE=note
 
+# file with results of "elfutils --batch" for the module
+export DIFF_RESULT_FILE=diff_result
+
 # dir with kernel's object symbols
 export SYMBOLS_DIR="$workdir/symbols"
 
+# index of the symbols defined in vmlinux and the modules, built on sync
+export SYMBOL_INDEX_FILE="$workdir/symbols.idx"
+
+# fingerprints of the origin objects cached by "elfutils --batch", cleared on sync
+export FINGERPRINTS_DIR="$workdir/fingerprints"
+
+# unix socket of the elfutils server
+export ELFUTILS_SOCKET="$workdir/elfutils.sock"
+
+# set to 1 to keep the elfutils server running between builds
+export USE_ELFUTILS_SERVER=${USE_ELFUTILS_SERVER:-}
+
 # configuration file
 export CONFIG_FILE="$workdir/config"
 
@@ -80,3 +95,4 @@ export ERROR_INSUFFICIENT_BUILD_PARAMS=33
 export ERROR_INVALID_KERNEL_ON_DEVICE=34
 export ERROR_WORKDIR_EXISTS=35
 export ERROR_BOARD_NOT_EXISTS=36
+export ERROR_NO_ELFUTILS_SERVER=255
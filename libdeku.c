@@ -0,0 +1,6296 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/*
+ * Copyright (C) Semihalf, 2022
+ * Author: Marek Maślanka <mm@semihalf.com>
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <gelf.h>
+#include <dwarf.h>
+#include <elfutils/libdwfl.h>
+
+#ifdef SUPPORT_DISASS
+#define PACKAGE 1			//requred by libbfd
+#include <dis-asm.h>
+
+#define MAX_DISASS_LINE_LEN 256
+#endif
+
+#include "libdeku_private.h"
+
+#define DEKU_ERROR_MESSAGE_LEN 256
+
+__thread bool DekuDebugLog = false;
+
+/*
+ * Set while a library call or a batch job runs in the current thread. Errors
+ * abort only this call instead of the whole process.
+ */
+static __thread jmp_buf *JobErrorJmp = NULL;
+static __thread int JobErrorCode = 0;
+static __thread char JobErrorMessage[DEKU_ERROR_MESSAGE_LEN];
+
+void dekuFail(int code, const char *file, int line, const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(JobErrorMessage, sizeof(JobErrorMessage), fmt, args);
+	va_end(args);
+	fprintf(stderr, "ERROR (%s:%d): %s\n", file, line, JobErrorMessage);
+	if (JobErrorJmp != NULL)
+	{
+		JobErrorCode = code;
+		longjmp(*JobErrorJmp, 1);
+	}
+	exit(code);
+}
+
+int dekuErrorCode(void)
+{
+	return JobErrorCode;
+}
+
+#define invalidSym(sym) (sym.st_name == 0 && sym.st_info == 0 && sym.st_shndx == 0)
+
+typedef struct
+{
+	uint8_t *data;
+	size_t size;
+} SymbolData;
+
+/*
+ * Modified and new symbols in the order of the symbol table. Names point to
+ * the string table of the new file.
+ */
+typedef struct
+{
+	DekuDiffKind kind;
+	DekuChangeCause cause;
+	const char *name;
+	size_t symIndex;
+} DiffEntry;
+
+typedef struct
+{
+	DiffEntry *entries;
+	size_t count;
+	size_t capacity;
+} DiffResult;
+
+/*
+ * Memory that lives as long as the processed file. Allocations are never
+ * freed one by one, arenaFree() releases all of them.
+ */
+typedef struct ArenaChunk
+{
+	struct ArenaChunk *next;
+	size_t size;
+	size_t used;
+	uint8_t data[];
+} ArenaChunk;
+
+typedef struct
+{
+	ArenaChunk *chunks;
+} Arena;
+
+/*
+ * Symbols of the processed file kept as separate arrays indexed by the symbol
+ * index, so a scan over one field touches only that field. All arrays are
+ * allocated from "arena" and released by freeSymbols().
+ */
+typedef struct
+{
+	size_t count;
+	size_t *secIndex;
+	size_t *stValue;
+	size_t *stSize;
+	unsigned char *stInfo;
+	bool *isFun;
+	bool *isVar;
+	const char **name;
+	size_t *copiedIndex;
+	// callees of function "i" are callees[calleesStart[i]] .. callees[calleesStart[i + 1] - 1]
+	size_t *calleesStart;
+	size_t *callees;
+	// the same for callers of function "i"
+	size_t *callersStart;
+	size_t *callers;
+	Arena arena;
+} SymbolTable;
+
+// the state below is kept per thread, so batch jobs can run in parallel
+static __thread SymbolTable Symbols;
+static __thread Elf_Scn **CopiedScnMap = NULL;
+// offset of the input section in the output one, not 0 only for the merged text
+static __thread size_t *CopiedScnOffset = NULL;
+static __thread size_t SectionsCount = 0;
+
+// part of the input section copied to "newStart" in the packed output section
+typedef struct
+{
+	size_t start;
+	size_t end;
+	size_t newStart;
+} PackedChunk;
+
+/*
+ * Output section with only the referenced strings and constants of the input
+ * mergeable section or with the records of the table section that describe
+ * the copied functions. Indexed by the input section index like CopiedScnMap.
+ * The merged text is kept by its first input section.
+ */
+typedef struct
+{
+	Elf_Scn *scn;
+	size_t symIndex;
+	uint8_t *buf;
+	size_t size;
+	PackedChunk *chunks;
+	size_t count;
+	size_t capacity;
+} PackedSection;
+
+static __thread PackedSection *PackedSections = NULL;
+
+typedef struct
+{
+	Elf *elf;
+	GElf_Sym sym;
+	GElf_Shdr shdr;
+	SymbolData *symData;
+} DisasmData;
+
+/*
+ * Relocations that apply to one section, sorted by r_offset, so relocations
+ * that belongs to a symbol can be found with a binary search. If the RELA
+ * section is already sorted "rela" points directly to its data.
+ */
+typedef struct
+{
+	size_t relScnIndex;
+	size_t count;
+	const Elf64_Rela *rela;
+	bool copied;
+} SectionRelocs;
+
+/*
+ * Address range of a symbol. Ranges are grouped by section and sorted by the
+ * start address, "maxEnd" is the highest end address among this range and all
+ * ranges before it in the same section.
+ */
+typedef struct
+{
+	size_t start;
+	size_t end;
+	size_t maxEnd;
+	size_t symIndex;
+} SymbolRange;
+
+/*
+ * Name lookup tables built once per opened ELF file. Buckets and chains keep
+ * indexes of sections and symbols (0 ends the chain, because both the section
+ * and the symbol at index 0 are always unnamed). Chains are kept in ascending
+ * index order, so lookups return the same entry as a linear scan would.
+ */
+typedef struct ElfIndex
+{
+	Elf *elf;
+	size_t secCount;
+	const char **secNames;
+	size_t secMask;
+	size_t *secBuckets;
+	size_t *secNext;
+	Elf_Scn *symtab;
+	const Elf64_Sym *syms;
+	size_t symtabLink;
+	size_t symCount;
+	const char **symNames;
+	unsigned char *symInfo;
+	size_t symMask;
+	// symbols chained by name only
+	size_t *nameBuckets;
+	size_t *nameNext;
+	// symbols chained by name and STT type
+	size_t *typeBuckets;
+	size_t *typeNext;
+	// relocations for every section, indexed by section index
+	SectionRelocs *relocs;
+	// symbols ranges, ranges for section "i" start at ranges[rangesStart[i]]
+	SymbolRange *ranges;
+	size_t *rangesStart;
+	// first and second named symbol in every section
+	size_t *firstNamedSym;
+	size_t *secondNamedSym;
+	// ordinals of the numbered local symbols, built by getNumberedOrdinal()
+	size_t *symOrdinals;
+	// file descriptor for files opened by openElf()
+	int fd;
+	struct ElfIndex *next;
+} ElfIndex;
+
+static __thread ElfIndex *ElfIndexes = NULL;
+
+/*
+ * String tables of the output file. Before the file is written
+ * mergeStringTable() packs the strings that are suffixes of other strings.
+ */
+static __thread StringTable OutSectionNames;
+static __thread StringTable OutSymbolNames;
+
+/*
+ * Symbols of the output file. Index returned by copySymbol() is provisional
+ * (position in "syms") until writeOutputSymtab() moves local symbols before
+ * the global ones and remaps relocations.
+ */
+typedef struct
+{
+	Elf_Scn *scn;
+	GElf_Sym *syms;
+	size_t count;
+	size_t capacity;
+} OutputSymtab;
+
+static __thread OutputSymtab OutSymbols;
+static __thread Elf *OutElf = NULL;
+static __thread int OutFd = -1;
+
+#define HASH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define HASH_PRIME64_3 0x165667B19E3779F9ULL
+#define HASH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define HASH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const uint8_t *p)
+{
+	uint64_t val;
+	memcpy(&val, p, sizeof(val));
+	return val;
+}
+
+static inline uint32_t read32(const uint8_t *p)
+{
+	uint32_t val;
+	memcpy(&val, p, sizeof(val));
+	return val;
+}
+
+static inline uint64_t hashRound(uint64_t acc, uint64_t input)
+{
+	acc += input * HASH_PRIME64_2;
+	acc = rotl64(acc, 31);
+	return acc * HASH_PRIME64_1;
+}
+
+static inline uint64_t hashMergeRound(uint64_t acc, uint64_t val)
+{
+	acc ^= hashRound(0, val);
+	return acc * HASH_PRIME64_1 + HASH_PRIME64_4;
+}
+
+/*
+ * 64-bit non-cryptographic hash (the XXH64 algorithm). To hash several buffers
+ * in order pass the result of the previous call as the "seed".
+ */
+static uint64_t hash64(const uint8_t *data, size_t len, uint64_t seed)
+{
+	const uint8_t *end = data + len;
+	uint64_t hash;
+
+	if (len >= 32)
+	{
+		const uint8_t *limit = end - 32;
+		uint64_t v1 = seed + HASH_PRIME64_1 + HASH_PRIME64_2;
+		uint64_t v2 = seed + HASH_PRIME64_2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - HASH_PRIME64_1;
+		do
+		{
+			v1 = hashRound(v1, read64(data));
+			v2 = hashRound(v2, read64(data + 8));
+			v3 = hashRound(v3, read64(data + 16));
+			v4 = hashRound(v4, read64(data + 24));
+			data += 32;
+		} while (data <= limit);
+
+		hash = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+		hash = hashMergeRound(hash, v1);
+		hash = hashMergeRound(hash, v2);
+		hash = hashMergeRound(hash, v3);
+		hash = hashMergeRound(hash, v4);
+	}
+	else
+	{
+		hash = seed + HASH_PRIME64_5;
+	}
+
+	hash += len;
+	for (; data + 8 <= end; data += 8)
+	{
+		hash ^= hashRound(0, read64(data));
+		hash = rotl64(hash, 27) * HASH_PRIME64_1 + HASH_PRIME64_4;
+	}
+	if (data + 4 <= end)
+	{
+		hash ^= (uint64_t)read32(data) * HASH_PRIME64_1;
+		hash = rotl64(hash, 23) * HASH_PRIME64_2 + HASH_PRIME64_3;
+		data += 4;
+	}
+	for (; data < end; data++)
+	{
+		hash ^= *data * HASH_PRIME64_5;
+		hash = rotl64(hash, 11) * HASH_PRIME64_1;
+	}
+
+	hash ^= hash >> 33;
+	hash *= HASH_PRIME64_2;
+	hash ^= hash >> 29;
+	hash *= HASH_PRIME64_3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+#define ARENA_CHUNK_SIZE (256 * 1024)
+
+// returns zeroed memory aligned to 16 bytes
+static void *arenaAlloc(Arena *arena, size_t size)
+{
+	size = (size + 15) & ~(size_t)15;
+	ArenaChunk *chunk = arena->chunks;
+	if (chunk == NULL || chunk->size - chunk->used < size)
+	{
+		size_t chunkSize = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+		chunk = malloc(sizeof(ArenaChunk) + chunkSize);
+		CHECK_ALLOC(chunk);
+		chunk->size = chunkSize;
+		chunk->used = 0;
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+	}
+	void *result = chunk->data + chunk->used;
+	chunk->used += size;
+	memset(result, 0, size);
+	return result;
+}
+
+static void arenaFree(Arena *arena)
+{
+	ArenaChunk *chunk = arena->chunks;
+	while (chunk != NULL)
+	{
+		ArenaChunk *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+	arena->chunks = NULL;
+}
+
+static GElf_Shdr getSectionHeader(Elf *elf, Elf64_Section index)
+{
+	GElf_Shdr shdr = {0};
+	size_t shstrndx;
+	elf_getshdrstrndx(elf, &shstrndx);
+	Elf_Scn *scn = elf_getscn(elf, index);
+	if (scn)
+		gelf_getshdr(scn, &shdr);
+	return shdr;
+}
+
+uint32_t dekuHashName(const char *name)
+{
+	return (uint32_t)hash64((const uint8_t *)name, strlen(name), 0);
+}
+
+static uint32_t hashNameWithType(const char *name, int type)
+{
+	return dekuHashName(name) ^ ((uint32_t)type * 0x9E3779B1u);
+}
+
+static size_t bucketsMask(size_t cnt)
+{
+	size_t size = 16;
+	while (size < cnt * 2)
+		size <<= 1;
+	return size - 1;
+}
+
+static void insertString(StringTable *table, size_t entry)
+{
+	size_t bucket = dekuHashName(table->buf + table->offsets[entry]) & table->mask;
+	while (table->buckets[bucket] != 0)
+		bucket = (bucket + 1) & table->mask;
+	table->buckets[bucket] = entry + 1;
+}
+
+// index of the string in "offsets" or -1 if the string is not in the table
+static ssize_t findString(const StringTable *table, const char *text)
+{
+	size_t bucket = dekuHashName(text) & table->mask;
+	while (table->buckets[bucket] != 0)
+	{
+		size_t entry = table->buckets[bucket] - 1;
+		if (strcmp(table->buf + table->offsets[entry], text) == 0)
+			return entry;
+		bucket = (bucket + 1) & table->mask;
+	}
+	return -1;
+}
+
+// add the string at "offset" in "buf" to the hash table
+static void indexString(StringTable *table, size_t offset)
+{
+	if (table->count % 256 == 0)
+	{
+		table->offsets = realloc(table->offsets, (table->count + 256) * sizeof(size_t));
+		CHECK_ALLOC(table->offsets);
+	}
+	table->offsets[table->count] = offset;
+	insertString(table, table->count++);
+	if (table->count * 2 > table->mask)
+	{
+		table->mask = bucketsMask(table->count);
+		free(table->buckets);
+		table->buckets = calloc(table->mask + 1, sizeof(size_t));
+		CHECK_ALLOC(table->buckets);
+		for (size_t i = 0; i < table->count; i++)
+			insertString(table, i);
+	}
+}
+
+void dekuInitStringTable(StringTable *table, Elf_Scn *scn)
+{
+	memset(table, 0, sizeof(*table));
+	table->scn = scn;
+	table->data = elf_newdata(scn);
+	table->capacity = 4096;
+	table->buf = calloc(1, table->capacity);
+	table->size = 1;
+	table->mask = bucketsMask(0);
+	table->buckets = calloc(table->mask + 1, sizeof(size_t));
+	CHECK_ALLOC(table->data);
+	CHECK_ALLOC(table->buf);
+	CHECK_ALLOC(table->buckets);
+	table->data->d_buf = table->buf;
+	table->data->d_size = table->size;
+}
+
+/*
+ * New strings are appended after the existing ones, so the offsets already
+ * used in the file stay valid.
+ */
+void dekuLoadStringTable(StringTable *table, Elf_Scn *scn)
+{
+	memset(table, 0, sizeof(*table));
+	table->scn = scn;
+	table->data = elf_getdata(scn, NULL);
+	if (table->data == NULL)
+		LOG_ERR("Failed to get string table data");
+	table->size = table->data->d_size;
+	table->capacity = table->size * 2 + 4096;
+	table->buf = calloc(1, table->capacity);
+	table->mask = bucketsMask(0);
+	table->buckets = calloc(table->mask + 1, sizeof(size_t));
+	CHECK_ALLOC(table->buf);
+	CHECK_ALLOC(table->buckets);
+	if (table->data->d_buf)
+		memcpy(table->buf, table->data->d_buf, table->size);
+	if (table->size == 0)
+		table->size = 1;
+
+	for (size_t offset = 1; offset < table->size; offset += strlen(table->buf + offset) + 1)
+	{
+		if (table->buf[offset] != '\0' && findString(table, table->buf + offset) < 0)
+			indexString(table, offset);
+	}
+}
+
+/*
+ * Add string to the table if it is not already there. Returns offset of the
+ * string in the section. The offset is valid until mergeStringTable() is called.
+ */
+size_t dekuAddString(StringTable *table, const char *text)
+{
+	if (*text == '\0')
+		return 0;
+
+	ssize_t entry = findString(table, text);
+	if (entry >= 0)
+		return table->offsets[entry];
+
+	size_t len = strlen(text) + 1;
+	if (table->size + len > table->capacity)
+	{
+		while (table->size + len > table->capacity)
+			table->capacity *= 2;
+		table->buf = realloc(table->buf, table->capacity);
+		CHECK_ALLOC(table->buf);
+	}
+
+	size_t offset = table->size;
+	memcpy(table->buf + offset, text, len);
+	table->size += len;
+	indexString(table, offset);
+
+	GElf_Shdr shdr;
+	table->data->d_buf = table->buf;
+	table->data->d_size = table->size;
+	gelf_getshdr(table->scn, &shdr);
+	shdr.sh_size = table->size;
+	gelf_update_shdr(table->scn, &shdr);
+	return offset;
+}
+
+typedef struct
+{
+	const char *str;
+	size_t len;
+	size_t entry;
+} StringEntry;
+
+// compare strings from the last character, so suffixes are next to each other
+static int compareReversed(const void *a, const void *b)
+{
+	const StringEntry *left = (const StringEntry *)a;
+	const StringEntry *right = (const StringEntry *)b;
+	size_t i = left->len;
+	size_t j = right->len;
+	while (i > 0 && j > 0)
+	{
+		unsigned char l = left->str[--i];
+		unsigned char r = right->str[--j];
+		if (l != r)
+			return l < r ? -1 : 1;
+	}
+	return (i > 0) - (j > 0);
+}
+
+/*
+ * Build final content of the string table where strings that are suffixes of
+ * other strings share its bytes. Use getMergedOffset() to translate offsets
+ * returned by dekuAddString().
+ */
+static void mergeStringTable(StringTable *table)
+{
+	StringEntry *entries = calloc(table->count + 1, sizeof(StringEntry));
+	table->newOffsets = calloc(table->count + 1, sizeof(size_t));
+	table->mergedBuf = calloc(1, table->size);
+	CHECK_ALLOC(entries);
+	CHECK_ALLOC(table->newOffsets);
+	CHECK_ALLOC(table->mergedBuf);
+	for (size_t i = 0; i < table->count; i++)
+	{
+		entries[i].str = table->buf + table->offsets[i];
+		entries[i].len = strlen(entries[i].str);
+		entries[i].entry = i;
+	}
+	qsort(entries, table->count, sizeof(StringEntry), compareReversed);
+
+	size_t size = 1;
+	const StringEntry *prev = NULL;
+	size_t prevOffset = 0;
+	for (size_t i = table->count; i-- > 0;)
+	{
+		const StringEntry *e = &entries[i];
+		if (prev != NULL && prev->len >= e->len &&
+			memcmp(prev->str + prev->len - e->len, e->str, e->len) == 0)
+		{
+			table->newOffsets[e->entry] = prevOffset + prev->len - e->len;
+			continue;
+		}
+		memcpy(table->mergedBuf + size, e->str, e->len + 1);
+		table->newOffsets[e->entry] = size;
+		prev = e;
+		prevOffset = size;
+		size += e->len + 1;
+	}
+	free(entries);
+
+	GElf_Shdr shdr;
+	table->mergedSize = size;
+	table->data->d_buf = table->mergedBuf;
+	table->data->d_size = size;
+	gelf_getshdr(table->scn, &shdr);
+	shdr.sh_size = size;
+	gelf_update_shdr(table->scn, &shdr);
+}
+
+static size_t getMergedOffset(const StringTable *table, size_t offset)
+{
+	if (offset == 0 || offset >= table->size)
+		return 0;
+	ssize_t entry = findString(table, table->buf + offset);
+	if (entry < 0)
+		LOG_ERR("Can't find string at offset %ld in the string table", offset);
+	return table->newOffsets[entry];
+}
+
+void dekuFreeStringTable(StringTable *table)
+{
+	free(table->buf);
+	free(table->offsets);
+	free(table->buckets);
+	free(table->newOffsets);
+	free(table->mergedBuf);
+	memset(table, 0, sizeof(*table));
+}
+
+static ElfIndex *getElfIndex(Elf *elf)
+{
+	for (ElfIndex *index = ElfIndexes; index != NULL; index = index->next)
+	{
+		if (index->elf == elf)
+			return index;
+	}
+	return NULL;
+}
+
+static ElfIndex *getRequiredElfIndex(Elf *elf)
+{
+	ElfIndex *index = getElfIndex(elf);
+	if (index == NULL)
+		LOG_ERR("Symbols lookup in ELF file that is not indexed");
+	return index;
+}
+
+static int compareRelaOffset(const void *a, const void *b)
+{
+	const GElf_Rela *left = (const GElf_Rela *)a;
+	const GElf_Rela *right = (const GElf_Rela *)b;
+	if (left->r_offset < right->r_offset)
+		return -1;
+	return left->r_offset > right->r_offset;
+}
+
+static void buildRelocsIndex(ElfIndex *index)
+{
+	Elf_Scn *scn = NULL;
+	GElf_Shdr shdr;
+	index->relocs = calloc(index->secCount + 1, sizeof(SectionRelocs));
+	CHECK_ALLOC(index->relocs);
+	while ((scn = elf_nextscn(index->elf, scn)) != NULL)
+	{
+		gelf_getshdr(scn, &shdr);
+		if (shdr.sh_type != SHT_RELA || shdr.sh_info >= index->secCount ||
+			shdr.sh_entsize == 0)
+			continue;
+		SectionRelocs *relocs = &index->relocs[shdr.sh_info];
+		if (relocs->relScnIndex != 0)
+			continue;
+
+		Elf_Data *data = elf_getdata(scn, NULL);
+		const Elf64_Rela *rela = (const Elf64_Rela *)data->d_buf;
+		size_t cnt = data->d_size / sizeof(Elf64_Rela);
+		bool sorted = true;
+		relocs->relScnIndex = elf_ndxscn(scn);
+		relocs->count = cnt;
+		relocs->rela = rela;
+		for (size_t i = 1; i < cnt && sorted; i++)
+		{
+			if (rela[i].r_offset < rela[i - 1].r_offset)
+				sorted = false;
+		}
+		// relocations emitted by assemblers are usually sorted already
+		if (!sorted)
+		{
+			Elf64_Rela *copy = malloc(cnt * sizeof(Elf64_Rela));
+			CHECK_ALLOC(copy);
+			memcpy(copy, rela, cnt * sizeof(Elf64_Rela));
+			qsort(copy, cnt, sizeof(Elf64_Rela), compareRelaOffset);
+			relocs->rela = copy;
+			relocs->copied = true;
+		}
+	}
+}
+
+static int compareSymbolRange(const void *a, const void *b)
+{
+	const SymbolRange *left = (const SymbolRange *)a;
+	const SymbolRange *right = (const SymbolRange *)b;
+	if (left->start != right->start)
+		return left->start < right->start ? -1 : 1;
+	if (left->symIndex != right->symIndex)
+		return left->symIndex < right->symIndex ? -1 : 1;
+	return 0;
+}
+
+static void buildRangesIndex(ElfIndex *index)
+{
+	size_t secCount = index->secCount;
+	index->rangesStart = calloc(secCount + 1, sizeof(size_t));
+	index->firstNamedSym = calloc(secCount + 1, sizeof(size_t));
+	index->secondNamedSym = calloc(secCount + 1, sizeof(size_t));
+	CHECK_ALLOC(index->rangesStart);
+	CHECK_ALLOC(index->firstNamedSym);
+	CHECK_ALLOC(index->secondNamedSym);
+
+	// count symbols in every section and find first named symbols
+	for (size_t i = 1; i < index->symCount; i++)
+	{
+		const Elf64_Sym sym = index->syms[i];
+		if (sym.st_shndx == SHN_UNDEF || sym.st_shndx >= secCount)
+			continue;
+		index->rangesStart[sym.st_shndx]++;
+		if (sym.st_name == 0)
+			continue;
+		if (index->firstNamedSym[sym.st_shndx] == 0)
+			index->firstNamedSym[sym.st_shndx] = i;
+		else if (index->secondNamedSym[sym.st_shndx] == 0)
+			index->secondNamedSym[sym.st_shndx] = i;
+	}
+	size_t total = 0;
+	for (size_t i = 0; i <= secCount; i++)
+	{
+		size_t cnt = index->rangesStart[i];
+		index->rangesStart[i] = total;
+		total += cnt;
+	}
+
+	size_t *fill = calloc(secCount + 1, sizeof(size_t));
+	index->ranges = calloc(total + 1, sizeof(SymbolRange));
+	CHECK_ALLOC(fill);
+	CHECK_ALLOC(index->ranges);
+	for (size_t i = 1; i < index->symCount; i++)
+	{
+		const Elf64_Sym sym = index->syms[i];
+		if (sym.st_shndx == SHN_UNDEF || sym.st_shndx >= secCount)
+			continue;
+		SymbolRange *range = &index->ranges[index->rangesStart[sym.st_shndx] + fill[sym.st_shndx]++];
+		range->start = sym.st_value;
+		range->end = sym.st_value + sym.st_size;
+		range->symIndex = i;
+	}
+	free(fill);
+
+	for (size_t sec = 0; sec < secCount; sec++)
+	{
+		SymbolRange *ranges = &index->ranges[index->rangesStart[sec]];
+		size_t cnt = index->rangesStart[sec + 1] - index->rangesStart[sec];
+		qsort(ranges, cnt, sizeof(SymbolRange), compareSymbolRange);
+		size_t maxEnd = 0;
+		for (size_t i = 0; i < cnt; i++)
+		{
+			if (ranges[i].end > maxEnd)
+				maxEnd = ranges[i].end;
+			ranges[i].maxEnd = maxEnd;
+		}
+	}
+}
+
+static void buildElfIndex(Elf *elf)
+{
+	GElf_Shdr shdr;
+	size_t shstrndx;
+	// symbols and relocations are accessed directly as Elf64 structures
+	if (gelf_getclass(elf) != ELFCLASS64)
+		LOG_ERR("Only 64-bit ELF files are supported");
+
+	ElfIndex *index = calloc(1, sizeof(ElfIndex));
+	CHECK_ALLOC(index);
+	index->elf = elf;
+	index->fd = -1;
+	elf_getshdrstrndx(elf, &shstrndx);
+	elf_getshdrnum(elf, &index->secCount);
+
+	index->secMask = bucketsMask(index->secCount);
+	index->secNames = calloc(index->secCount + 1, sizeof(char *));
+	index->secBuckets = calloc(index->secMask + 1, sizeof(size_t));
+	index->secNext = calloc(index->secCount + 1, sizeof(size_t));
+	CHECK_ALLOC(index->secNames);
+	CHECK_ALLOC(index->secBuckets);
+	CHECK_ALLOC(index->secNext);
+	for (size_t i = index->secCount; i-- > 1;)
+	{
+		Elf_Scn *scn = elf_getscn(elf, i);
+		if (scn == NULL || gelf_getshdr(scn, &shdr) == NULL)
+			continue;
+		const char *name = elf_strptr(elf, shstrndx, shdr.sh_name);
+		if (name == NULL)
+			continue;
+		size_t bucket = dekuHashName(name) & index->secMask;
+		index->secNames[i] = name;
+		index->secNext[i] = index->secBuckets[bucket];
+		index->secBuckets[bucket] = i;
+		if (index->symtab == NULL && shdr.sh_type == SHT_SYMTAB)
+			index->symtab = scn;
+	}
+
+	if (index->symtab != NULL)
+	{
+		Elf_Data *data = elf_getdata(index->symtab, NULL);
+		gelf_getshdr(index->symtab, &shdr);
+		index->syms = (const Elf64_Sym *)data->d_buf;
+		index->symtabLink = shdr.sh_link;
+		index->symCount = data->d_size / sizeof(Elf64_Sym);
+	}
+	index->symMask = bucketsMask(index->symCount);
+	index->symNames = calloc(index->symCount + 1, sizeof(char *));
+	index->symInfo = calloc(index->symCount + 1, sizeof(unsigned char));
+	index->nameBuckets = calloc(index->symMask + 1, sizeof(size_t));
+	index->nameNext = calloc(index->symCount + 1, sizeof(size_t));
+	index->typeBuckets = calloc(index->symMask + 1, sizeof(size_t));
+	index->typeNext = calloc(index->symCount + 1, sizeof(size_t));
+	CHECK_ALLOC(index->symNames);
+	CHECK_ALLOC(index->symInfo);
+	CHECK_ALLOC(index->nameBuckets);
+	CHECK_ALLOC(index->nameNext);
+	CHECK_ALLOC(index->typeBuckets);
+	CHECK_ALLOC(index->typeNext);
+	for (size_t i = index->symCount; i-- > 1;)
+	{
+		const Elf64_Sym sym = index->syms[i];
+		const char *name = elf_strptr(elf, index->symtabLink, sym.st_name);
+		if (name == NULL)
+			name = "";
+		index->symNames[i] = name;
+		index->symInfo[i] = sym.st_info;
+		if (sym.st_name == 0 || *name == '\0')
+			continue;
+		size_t bucket = dekuHashName(name) & index->symMask;
+		index->nameNext[i] = index->nameBuckets[bucket];
+		index->nameBuckets[bucket] = i;
+		bucket = hashNameWithType(name, ELF64_ST_TYPE(sym.st_info)) & index->symMask;
+		index->typeNext[i] = index->typeBuckets[bucket];
+		index->typeBuckets[bucket] = i;
+	}
+	if (index->symCount > 0)
+		index->symNames[0] = "";
+
+	buildRelocsIndex(index);
+	buildRangesIndex(index);
+
+	index->next = ElfIndexes;
+	ElfIndexes = index;
+}
+
+static void freeElfIndex(Elf *elf)
+{
+	ElfIndex **prev = &ElfIndexes;
+	while (*prev != NULL && (*prev)->elf != elf)
+		prev = &(*prev)->next;
+	if (*prev == NULL)
+		return;
+
+	ElfIndex *index = *prev;
+	*prev = index->next;
+	free(index->secNames);
+	free(index->secBuckets);
+	free(index->secNext);
+	free(index->symNames);
+	free(index->symInfo);
+	free(index->nameBuckets);
+	free(index->nameNext);
+	free(index->typeBuckets);
+	free(index->typeNext);
+	for (size_t i = 0; i < index->secCount; i++)
+	{
+		if (index->relocs[i].copied)
+			free((Elf64_Rela *)index->relocs[i].rela);
+	}
+	free(index->relocs);
+	free(index->ranges);
+	free(index->rangesStart);
+	free(index->firstNamedSym);
+	free(index->secondNamedSym);
+	free(index->symOrdinals);
+	free(index);
+}
+
+/*
+ * Find next symbol with the given name after symbol at index "prev" (use 0 to
+ * find the first one). Use negative "type" to match symbol of any type.
+ * Returns 0 if there is no more symbols with the name.
+ */
+static size_t nextSymbolWithName(const ElfIndex *index, const char *name, int type, size_t prev)
+{
+	const size_t *next = type < 0 ? index->nameNext : index->typeNext;
+	size_t i;
+	if (prev != 0)
+		i = next[prev];
+	else if (type < 0)
+		i = index->nameBuckets[dekuHashName(name) & index->symMask];
+	else
+		i = index->typeBuckets[hashNameWithType(name, type) & index->symMask];
+
+	for (; i != 0; i = next[i])
+	{
+		if ((type < 0 || ELF64_ST_TYPE(index->symInfo[i]) == type) &&
+			strcmp(index->symNames[i], name) == 0)
+			return i;
+	}
+	return 0;
+}
+
+/*
+ * Find symbol whose [st_value, st_value + st_size) range in section "secIndex"
+ * contains "offset". If more symbols contain the offset then the symbol with
+ * the lowest index is returned. Symbol "skip" is ignored. Returns 0 if not found.
+ */
+static size_t findSymbolCovering(const ElfIndex *index, size_t secIndex, size_t offset, size_t skip)
+{
+	if (secIndex == SHN_UNDEF || secIndex >= index->secCount)
+		return 0;
+
+	const SymbolRange *ranges = &index->ranges[index->rangesStart[secIndex]];
+	size_t low = 0;
+	size_t high = index->rangesStart[secIndex + 1] - index->rangesStart[secIndex];
+	// find the first range that starts after the offset
+	while (low < high)
+	{
+		size_t mid = low + (high - low) / 2;
+		if (ranges[mid].start <= offset)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	size_t result = 0;
+	for (size_t i = low; i-- > 0 && ranges[i].maxEnd > offset;)
+	{
+		if (ranges[i].end > offset && ranges[i].symIndex != skip &&
+			(result == 0 || ranges[i].symIndex < result))
+			result = ranges[i].symIndex;
+	}
+	return result;
+}
+
+#ifdef SUPPORT_DISASSEMBLE
+/*
+ * Find the first named symbol in section "secIndex" with st_value equal to
+ * "offset". Returns 0 if not found.
+ */
+static size_t findSymbolAtOffset(const ElfIndex *index, size_t secIndex, size_t offset)
+{
+	if (secIndex == SHN_UNDEF || secIndex >= index->secCount)
+		return 0;
+
+	const SymbolRange *ranges = &index->ranges[index->rangesStart[secIndex]];
+	size_t cnt = index->rangesStart[secIndex + 1] - index->rangesStart[secIndex];
+	size_t low = 0;
+	size_t high = cnt;
+	while (low < high)
+	{
+		size_t mid = low + (high - low) / 2;
+		if (ranges[mid].start < offset)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	for (size_t i = low; i < cnt && ranges[i].start == offset; i++)
+	{
+		if (index->symNames[ranges[i].symIndex][0] != '\0')
+			return ranges[i].symIndex;
+	}
+	return 0;
+}
+#endif
+
+static Elf_Scn *getSectionByName(Elf *elf, const char *secName)
+{
+	ElfIndex *index = getElfIndex(elf);
+	if (index != NULL)
+	{
+		size_t i = index->secBuckets[dekuHashName(secName) & index->secMask];
+		for (; i != 0; i = index->secNext[i])
+		{
+			if (strcmp(index->secNames[i], secName) == 0)
+				return elf_getscn(elf, i);
+		}
+		return NULL;
+	}
+
+	// output files are not indexed because they change while symbols are copied
+	Elf_Scn *scn = NULL;
+	GElf_Shdr shdr;
+	size_t shstrndx;
+	elf_getshdrstrndx(elf, &shstrndx);
+	while ((scn = elf_nextscn(elf, scn)) != NULL)
+	{
+		gelf_getshdr(scn, &shdr);
+		char *name = elf_strptr(elf, shstrndx, shdr.sh_name);
+		if (name != NULL && strcmp(name, secName) == 0)
+			return scn;
+	}
+	return NULL;
+}
+
+static Elf_Scn *getRelForSectionIndex(Elf *elf, Elf64_Section index)
+{
+	ElfIndex *elfIndex = getRequiredElfIndex(elf);
+	if (index >= elfIndex->secCount || elfIndex->relocs[index].relScnIndex == 0)
+		return NULL;
+	return elf_getscn(elf, elfIndex->relocs[index].relScnIndex);
+}
+
+/*
+ * Get relocations for section "index" with offset in range [start, end).
+ * Returned relocations are sorted by offset.
+ */
+static const GElf_Rela *getRelocsInRange(Elf *elf, Elf64_Section index, size_t start,
+										 size_t end, size_t *count)
+{
+	ElfIndex *elfIndex = getRequiredElfIndex(elf);
+	*count = 0;
+	if (index >= elfIndex->secCount || elfIndex->relocs[index].relScnIndex == 0)
+		return NULL;
+
+	const SectionRelocs *relocs = &elfIndex->relocs[index];
+	size_t low = 0;
+	size_t high = relocs->count;
+	while (low < high)
+	{
+		size_t mid = low + (high - low) / 2;
+		if (relocs->rela[mid].r_offset < start)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	size_t last = low;
+	while (last < relocs->count && relocs->rela[last].r_offset < end)
+		last++;
+	*count = last - low;
+	return &relocs->rela[low];
+}
+
+static char *getSectionName(Elf *elf, Elf64_Section index)
+{
+	size_t shstrndx;
+	elf_getshdrstrndx(elf, &shstrndx);
+	GElf_Shdr shdr = getSectionHeader(elf, index);
+	return elf_strptr(elf, shstrndx, shdr.sh_name);
+}
+
+static void readSymbols(Elf *elf)
+{
+	ElfIndex *index = getRequiredElfIndex(elf);
+	if (index->symtab == NULL)
+		LOG_ERR("Failed to find .symtab section");
+	size_t cnt = index->symCount;
+	Arena *arena = &Symbols.arena;
+	Symbols.count = cnt;
+	Symbols.secIndex = arenaAlloc(arena, cnt * sizeof(size_t));
+	Symbols.stValue = arenaAlloc(arena, cnt * sizeof(size_t));
+	Symbols.stSize = arenaAlloc(arena, cnt * sizeof(size_t));
+	Symbols.stInfo = arenaAlloc(arena, cnt * sizeof(unsigned char));
+	Symbols.isFun = arenaAlloc(arena, cnt * sizeof(bool));
+	Symbols.isVar = arenaAlloc(arena, cnt * sizeof(bool));
+	Symbols.name = arenaAlloc(arena, cnt * sizeof(char *));
+	Symbols.copiedIndex = arenaAlloc(arena, cnt * sizeof(size_t));
+	for (size_t i = 0; i < cnt; i++)
+	{
+		const Elf64_Sym sym = index->syms[i];
+		const char *name = index->symNames[i];
+		Symbols.name[i] = name;
+		Symbols.secIndex[i] = sym.st_shndx;
+		// is function
+		if ((sym.st_info == ELF64_ST_INFO(STB_GLOBAL, STT_FUNC) ||
+			 (sym.st_info == ELF64_ST_INFO(STB_LOCAL, STT_FUNC))) &&
+			name[0] != '\0')
+		{
+			Symbols.isFun[i] = true;
+		}
+		// is variable
+		if (sym.st_info == ELF64_ST_INFO(STB_GLOBAL, STT_OBJECT) ||
+			(sym.st_info == ELF64_ST_INFO(STB_LOCAL, STT_OBJECT)))
+		{
+			const char *scnName = getSectionName(elf, sym.st_shndx);
+			if (strstr(scnName, ".data.") == scnName ||
+				strstr(scnName, ".bss.") == scnName)
+				Symbols.isVar[i] = true;
+			if (strstr(scnName, ".rodata.") == scnName ||
+				strstr(scnName, ".rodata.str") != scnName)
+				Symbols.isVar[i] = true;
+		}
+		Symbols.stInfo[i] = sym.st_info;
+		Symbols.stSize[i] = sym.st_size;
+		Symbols.stValue[i] = sym.st_value;
+	}
+}
+
+static void freeSymbols(void)
+{
+	arenaFree(&Symbols.arena);
+	memset(&Symbols, 0, sizeof(Symbols));
+}
+
+static GElf_Sym getSymbolByName(Elf *elf, char *name, size_t *symIndex)
+{
+	ElfIndex *index = getRequiredElfIndex(elf);
+	GElf_Sym sym = {0};
+	*symIndex = nextSymbolWithName(index, name, -1, 0);
+	if (*symIndex != 0)
+		sym = index->syms[*symIndex];
+	return sym;
+}
+
+static bool getSymbolByNameAndType(Elf *elf, const char *symName, const int type, GElf_Sym *sym)
+{
+	ElfIndex *index = getRequiredElfIndex(elf);
+	if (index->symtab == NULL)
+		LOG_ERR("Failed to find .symtab section");
+	size_t i = 0;
+	while ((i = nextSymbolWithName(index, symName, type, i)) != 0)
+	{
+		if (index->symInfo[i] == ELF64_ST_INFO(STB_LOCAL, type) ||
+			index->symInfo[i] == ELF64_ST_INFO(STB_GLOBAL, type))
+		{
+			*sym = index->syms[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+static GElf_Sym getSymbolByIndex(Elf *elf, size_t index)
+{
+	ElfIndex *elfIndex = getElfIndex(elf);
+	GElf_Sym sym = {0};
+	if (elfIndex != NULL)
+	{
+		if (index < elfIndex->symCount)
+			sym = elfIndex->syms[index];
+		return sym;
+	}
+
+	Elf_Scn *scn = getSectionByName(elf, ".symtab");
+	GElf_Shdr shdr;
+	Elf_Data *data = elf_getdata(scn, NULL);
+	gelf_getshdr(scn, &shdr);
+	size_t cnt = shdr.sh_size / shdr.sh_entsize;
+	if (index < cnt)
+		gelf_getsym(data, index, &sym);
+	return sym;
+}
+
+static uint16_t getSymbolIndexByName(Elf *elf, const char *symName)
+{
+	ElfIndex *index = getRequiredElfIndex(elf);
+	if (index->symtab == NULL)
+		LOG_ERR("Failed to find .symtab section");
+	return nextSymbolWithName(index, symName, -1, 0);
+}
+
+// returns index of the symbol the relocation refers to
+static size_t getSymbolForRelocation(Elf *elf, const GElf_Rela rela)
+{
+	size_t symIndex = ELF64_R_SYM(rela.r_info);
+	if (Symbols.secIndex[symIndex] == 0)
+		return symIndex;
+	if (Symbols.stSize[symIndex] > 0)
+		return symIndex;
+	if (ELF64_ST_TYPE(Symbols.stInfo[symIndex]) == STT_FUNC ||
+		ELF64_ST_TYPE(Symbols.stInfo[symIndex]) == STT_OBJECT)
+		return symIndex;
+
+	size_t secIndex = Symbols.secIndex[symIndex];
+	Elf64_Sxword addend = rela.r_addend;
+	switch (ELF64_R_TYPE(rela.r_info))
+	{
+	case R_386_PC32:
+	case R_X86_64_PLT32:
+		addend += 4;
+		break;
+	}
+
+	size_t coveringIndex = findSymbolCovering(getRequiredElfIndex(elf), secIndex,
+											  (size_t)addend, symIndex);
+	if (coveringIndex != 0)
+		return coveringIndex;
+
+	// example: referer to symbol (st_value == st_size == 0) that points to .rodata.str1.1
+	return symIndex;
+}
+
+static GElf_Sym getLinkedSym(Elf *elf, GElf_Sym *sym)
+{
+	ElfIndex *index = getRequiredElfIndex(elf);
+	GElf_Sym tsym = {0};
+	if (sym->st_shndx == SHN_UNDEF || sym->st_shndx >= index->secCount)
+		return tsym;
+
+	size_t i = index->firstNamedSym[sym->st_shndx];
+	if (i != 0)
+	{
+		tsym = index->syms[i];
+		if (memcmp(&tsym, sym, sizeof(*sym)) != 0)
+			return tsym;
+	}
+	memset(&tsym, 0, sizeof(tsym));
+	i = index->secondNamedSym[sym->st_shndx];
+	if (i != 0)
+		tsym = index->syms[i];
+	return tsym;
+}
+
+#ifdef SUPPORT_DISASSEMBLE
+
+static SymbolData getSymbolData(Elf *elf, const char *name, char type, bool modReloc)
+{
+	SymbolData result = {0};
+	ElfIndex *index = getRequiredElfIndex(elf);
+	if (index->symtab == NULL)
+		LOG_ERR("Failed to find .symtab section");
+	GElf_Sym sym;
+	size_t secCount = index->secCount;
+	size_t symIndex = 0;
+	while ((symIndex = nextSymbolWithName(index, name, type, symIndex)) != 0)
+	{
+		sym = index->syms[symIndex];
+		if (sym.st_size > 0 && sym.st_shndx < secCount)
+		{
+			Elf_Scn *scn = elf_getscn(elf, sym.st_shndx);
+			Elf_Data *data = elf_getdata(scn, NULL);
+			result.data = &((uint8_t *)data->d_buf)[sym.st_value];
+			result.size = sym.st_size;
+			if (modReloc)
+			{
+				if (getRelForSectionIndex(elf, sym.st_shndx) == NULL)
+					continue;
+				size_t cnt;
+				const GElf_Rela *rela = getRelocsInRange(elf, sym.st_shndx, sym.st_value,
+														 sym.st_value + sym.st_size, &cnt);
+				for (size_t i = 0; i < cnt; i++)
+				{
+					void *addr = &((uint8_t *)data->d_buf)[rela[i].r_offset];
+					if (ELF64_R_TYPE(rela[i].r_info) == R_X86_64_PC32)
+						*(uint32_t *)addr += -4;
+					else
+						*(uint32_t *)addr += rela[i].r_addend;
+				}
+			}
+			break;
+		}
+	}
+	return result;
+}
+
+static GElf_Sym getSymbolForReloc(Elf *elf, Elf64_Section sec, size_t offset)
+{
+	GElf_Sym invalidSym = {};
+	size_t cnt;
+	const GElf_Rela *rela = getRelocsInRange(elf, sec, offset, offset + 1, &cnt);
+	if (cnt > 0)
+		return getSymbolByIndex(elf, ELF64_R_SYM(rela->r_info));
+	return invalidSym;
+}
+
+static GElf_Sym getSymbolByOffset(Elf *elf, Elf64_Section shndx, size_t offset)
+{
+	ElfIndex *index = getRequiredElfIndex(elf);
+	GElf_Sym sym = {};
+	size_t i = findSymbolAtOffset(index, shndx, offset);
+	if (i != 0)
+		sym = index->syms[i];
+	return sym;
+}
+
+static int disasmPrintf(void *buf, const char *format, ...)
+{
+	char localBuf[MAX_DISASS_LINE_LEN];
+	va_list args;
+	va_start (args, format);
+	int len = vsnprintf(localBuf, sizeof(localBuf), format, args);
+	va_end (args);
+
+	char **buffer = (char **)buf;
+	buffer[0] = realloc(buffer[0], strlen(buffer[0]) + len + 1);
+	strcat(buffer[0], localBuf);
+	return len;
+}
+
+static void printFunAtAddr(bfd_vma vma, struct disassemble_info *inf)
+{
+	DisasmData *data = (DisasmData *)inf->application_data;
+	int32_t x = *(uint32_t *)(data->symData->data + vma);
+	vma += data->sym.st_value;
+	GElf_Sym sym = getSymbolByOffset(data->elf, data->sym.st_shndx, vma);
+	if(invalidSym(sym))
+		sym = getSymbolForReloc(data->elf, data->sym.st_shndx, vma);
+
+	if(invalidSym(sym))
+	{
+		sym = getSymbolForReloc(data->elf, data->sym.st_shndx, vma);
+		const char *name = elf_strptr(data->elf, data->shdr.sh_link, data->sym.st_name);
+		(*inf->fprintf_func)(inf->stream, "<%s+0x%lX>", name, vma - data->sym.st_value);
+	}
+	else
+	{
+		const char *name = elf_strptr(data->elf, data->shdr.sh_link, sym.st_name);
+		(*inf->fprintf_func)(inf->stream, "%s", name);
+	}
+}
+
+static char *disassembleBytes(uint8_t *inputBuf, size_t inputBufSize, DisasmData *data)
+{
+	char *buf[] = { calloc(0, 1) };
+
+	disassemble_info disasmInfo = {};
+	init_disassemble_info(&disasmInfo, buf, disasmPrintf);
+	disasmInfo.arch = bfd_arch_i386;
+	disasmInfo.mach = bfd_mach_x86_64;
+	disasmInfo.read_memory_func = buffer_read_memory;
+	disasmInfo.buffer = inputBuf;
+	disasmInfo.buffer_vma = 0;
+	disasmInfo.buffer_length = inputBufSize;
+	disasmInfo.application_data = (void *)data;
+	disassemble_init_for_target(&disasmInfo);
+
+	disasmInfo.print_address_func = printFunAtAddr;
+
+	disassembler_ftype disasm = disassembler(bfd_arch_i386, false, bfd_mach_x86_64, NULL);
+
+	size_t pc = 0;
+	while (pc < inputBufSize)
+	{
+		pc += disasm(pc, &disasmInfo);
+		disasmInfo.fprintf_func(disasmInfo.stream, "\n");
+	}
+
+	return buf[0];
+}
+#endif
+
+typedef struct
+{
+	const char *name;
+	int64_t offset;
+	bool hasOffset;
+	// symbol with the name, 0 for the sections and strings
+	size_t symIndex;
+} RelocTarget;
+
+static bool isStringName(const char *name)
+{
+	return strstr(name, ".str.") || strstr(name, ".str1.") || strstr(name, ".rodata.str") == name;
+}
+
+/*
+ * Describe the relocation target in a way that does not depend on the symbols
+ * layout in the file. Targets in the string sections are described by the
+ * string itself. Section relative targets are described by the symbol that
+ * covers the target and the offset from that symbol.
+ */
+static RelocTarget getRelocTarget(Elf *elf, const GElf_Rela *rela)
+{
+	ElfIndex *index = getRequiredElfIndex(elf);
+	RelocTarget target = {0};
+	size_t symIndex = ELF64_R_SYM(rela->r_info);
+	GElf_Sym rsym = getSymbolByIndex(elf, symIndex);
+	if(invalidSym(rsym))
+		LOG_ERR("Can't find symbol at index: %ld", symIndex);
+
+	int secIndex = rsym.st_shndx;
+	if(rsym.st_name == 0)
+	{
+		if (rsym.st_info == STT_SECTION)
+		{
+			target.name = getSectionName(elf, secIndex);
+			if (target.name != NULL && !isStringName(target.name))
+			{
+				Elf64_Sxword addend = rela->r_addend;
+				if (ELF64_R_TYPE(rela->r_info) == R_X86_64_PC32 ||
+					ELF64_R_TYPE(rela->r_info) == R_X86_64_PLT32)
+					addend += 4;
+				size_t covering = findSymbolCovering(index, secIndex, (size_t)addend, symIndex);
+				if (covering != 0 && index->symNames[covering][0] != '\0')
+				{
+					GElf_Sym coveringSym = getSymbolByIndex(elf, covering);
+					target.name = index->symNames[covering];
+					target.offset = rela->r_addend - (Elf64_Sxword)coveringSym.st_value;
+					target.hasOffset = true;
+					target.symIndex = covering;
+					return target;
+				}
+			}
+		}
+		else
+		{
+			rsym = getLinkedSym(elf, &rsym);
+			if(invalidSym(rsym))
+				LOG_ERR("Can't find symbol at index: %ld", symIndex);
+			target.name = elf_strptr(elf, index->symtabLink, rsym.st_name);
+		}
+	}
+	else
+	{
+		target.name = index->symNames[symIndex];
+		target.offset = rela->r_addend;
+		target.hasOffset = true;
+		target.symIndex = symIndex;
+	}
+
+	if (target.name == NULL)
+		return target;
+
+	if (isStringName(target.name))
+	{
+		Elf_Scn *scn = elf_getscn(elf, secIndex);
+		Elf_Data *data = elf_getdata(scn, NULL);
+		GElf_Shdr shdr;
+		gelf_getshdr(scn, &shdr);
+		if ((Elf64_Sxword)shdr.sh_size > rela->r_addend)
+		{
+			target.name = (char *)data->d_buf + rela->r_addend;
+			target.hasOffset = false;
+		}
+	}
+	if (strstr(target.name, ".text.unlikely.") == target.name)
+		target.name += strlen(".text.unlikely.");
+	else if (strstr(target.name, ".text.") == target.name)
+		target.name += strlen(".text.");
+	return target;
+}
+
+static bool equalRelocTargets(const RelocTarget *left, const RelocTarget *right)
+{
+	if (left->name == NULL || right->name == NULL)
+		return left->name == right->name;
+	if (left->hasOffset != right->hasOffset)
+		return false;
+	if (left->hasOffset && left->offset != right->offset)
+		return false;
+	return strcmp(left->name, right->name) == 0;
+}
+
+// number of bytes in the code that are patched by the relocation
+static size_t relocSlotSize(const GElf_Rela *rela)
+{
+	switch (ELF64_R_TYPE(rela->r_info))
+	{
+	case R_X86_64_NONE:
+		return 0;
+	case R_X86_64_8:
+	case R_X86_64_PC8:
+		return 1;
+	case R_X86_64_16:
+	case R_X86_64_PC16:
+		return 2;
+	case R_X86_64_64:
+	case R_X86_64_PC64:
+	case R_X86_64_GOTOFF64:
+	case R_X86_64_GOTPC64:
+	case R_X86_64_GOT64:
+	case R_X86_64_GOTPCREL64:
+	case R_X86_64_PLTOFF64:
+		return 8;
+	}
+	return 4;
+}
+
+// number of equal bytes at the beginning of both buffers
+static size_t equalPrefix(const uint8_t *left, const uint8_t *right, size_t len)
+{
+	if (memcmp(left, right, len) == 0)
+		return len;
+	size_t i = 0;
+	while (left[i] == right[i])
+		i++;
+	return i;
+}
+
+/*
+ * Compare two functions byte by byte. The bytes patched by relocations are
+ * skipped and the relocation targets are compared instead. Returns true if the
+ * functions are equal, otherwise sets "diffOffset" to the offset of the first
+ * difference.
+ */
+static bool equalFunctions(Elf *elf, const GElf_Sym *sym, Elf *secondElf,
+						   const GElf_Sym *secondSym, size_t *diffOffset)
+{
+	Elf_Data *data = elf_getdata(elf_getscn(elf, sym->st_shndx), NULL);
+	Elf_Data *secondData = elf_getdata(elf_getscn(secondElf, secondSym->st_shndx), NULL);
+	if (data == NULL || secondData == NULL || data->d_buf == NULL || secondData->d_buf == NULL)
+		LOG_ERR("Can't get data of the function");
+	const uint8_t *code = (uint8_t *)data->d_buf + sym->st_value;
+	const uint8_t *secondCode = (uint8_t *)secondData->d_buf + secondSym->st_value;
+	size_t size = sym->st_size < secondSym->st_size ? sym->st_size : secondSym->st_size;
+
+	size_t cnt, secondCnt;
+	const GElf_Rela *relocs = getRelocsInRange(elf, sym->st_shndx, sym->st_value,
+											   sym->st_value + sym->st_size, &cnt);
+	const GElf_Rela *secondRelocs = getRelocsInRange(secondElf, secondSym->st_shndx,
+													 secondSym->st_value,
+													 secondSym->st_value + secondSym->st_size,
+													 &secondCnt);
+	size_t pos = 0;
+	size_t i = 0;
+	for (; i < cnt && i < secondCnt; i++)
+	{
+		size_t offset = relocs[i].r_offset - sym->st_value;
+		size_t secondOffset = secondRelocs[i].r_offset - secondSym->st_value;
+		size_t relOffset = offset < secondOffset ? offset : secondOffset;
+		if (relOffset >= size)
+			break;
+
+		if (relOffset > pos)
+		{
+			size_t equal = equalPrefix(code + pos, secondCode + pos, relOffset - pos);
+			if (equal < relOffset - pos)
+			{
+				*diffOffset = pos + equal;
+				return false;
+			}
+		}
+
+		RelocTarget target = getRelocTarget(elf, &relocs[i]);
+		RelocTarget secondTarget = getRelocTarget(secondElf, &secondRelocs[i]);
+		if (offset != secondOffset ||
+			ELF64_R_TYPE(relocs[i].r_info) != ELF64_R_TYPE(secondRelocs[i].r_info) ||
+			!equalRelocTargets(&target, &secondTarget))
+		{
+			*diffOffset = relOffset;
+			return false;
+		}
+
+		size_t slotEnd = relOffset + relocSlotSize(&relocs[i]);
+		if (slotEnd > pos)
+			pos = slotEnd < size ? slotEnd : size;
+	}
+
+	if (size > pos)
+	{
+		size_t equal = equalPrefix(code + pos, secondCode + pos, size - pos);
+		if (equal < size - pos)
+		{
+			*diffOffset = pos + equal;
+			return false;
+		}
+	}
+
+	// one of the functions has more relocations
+	if (i < cnt || i < secondCnt)
+	{
+		size_t offset = i < cnt ? relocs[i].r_offset - sym->st_value : SIZE_MAX;
+		size_t secondOffset = i < secondCnt ? secondRelocs[i].r_offset - secondSym->st_value : SIZE_MAX;
+		*diffOffset = offset < secondOffset ? offset : secondOffset;
+		return false;
+	}
+
+	if (sym->st_size != secondSym->st_size)
+	{
+		*diffOffset = size;
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Fingerprint of the function split by the cause of the change. Together the
+ * hashes cover everything compared by equalFunctions().
+ */
+typedef struct
+{
+	// code with bytes patched by the relocations cleared, offsets and types of the relocations
+	uint64_t code;
+	// targets of the calls and of the other references to the functions
+	uint64_t call;
+	// targets of the data references, numbering of the local symbols is ignored
+	uint64_t data;
+	// targets of the data references with the exact names
+	uint64_t metadata;
+} FunctionFingerprint;
+
+/*
+ * Fingerprints of the functions and the variables of the origin file used to
+ * compare the new file without opening the origin one. Layout of the cache
+ * file:
+ * FingerprintsHeader header
+ * uint32_t buckets[bucketsCount] - entry index + 1, 0 for the empty bucket
+ * FingerprintEntry entries[entriesCount]
+ * char strings[stringsSize] - starts with the empty string
+ */
+#define FINGERPRINTS_MAGIC "DEKUFPR3"
+
+// sections of the function that make it the init or exit function
+#define FINGERPRINT_INIT_TEXT 1
+#define FINGERPRINT_EXIT_TEXT 2
+// function without the code in the file, it never equals any function
+#define FINGERPRINT_NO_CODE 4
+
+typedef struct
+{
+	char magic[8];
+	// hashes of the origin file content and of the kernel version
+	uint64_t fileHash;
+	uint64_t kernelHash;
+	uint32_t bucketsCount;
+	uint32_t entriesCount;
+	uint32_t stringsSize;
+	uint32_t reserved;
+} FingerprintsHeader;
+
+typedef struct
+{
+	FunctionFingerprint fingerprint;
+	uint32_t name;
+	// hashNameWithType() of the name and type
+	uint32_t nameHash;
+	uint8_t type;
+	uint8_t flags;
+	uint8_t reserved[6];
+} FingerprintEntry;
+
+typedef struct
+{
+	void *data;
+	size_t size;
+	const FingerprintsHeader *header;
+	const uint32_t *buckets;
+	const FingerprintEntry *entries;
+	const char *strings;
+} Fingerprints;
+
+// the relocation is the call or another reference to the function
+static bool isFunctionReloc(Elf *elf, const GElf_Rela *rela)
+{
+	ElfIndex *index = getRequiredElfIndex(elf);
+	if (ELF64_R_TYPE(rela->r_info) == R_X86_64_PLT32)
+		return true;
+	size_t symIndex = ELF64_R_SYM(rela->r_info);
+	if (symIndex >= index->symCount)
+		return false;
+	const Elf64_Sym *sym = &index->syms[symIndex];
+	if (ELF64_ST_TYPE(sym->st_info) == STT_FUNC)
+		return true;
+	return ELF64_ST_TYPE(sym->st_info) == STT_SECTION && sym->st_shndx != SHN_UNDEF &&
+		   (getSectionHeader(elf, sym->st_shndx).sh_flags & SHF_EXECINSTR);
+}
+
+/*
+ * Length of the name without the numbers added to the names of the local
+ * symbols, e.g. "__func__.12" or "__UNIQUE_ID_ddebug123.4". The numbers shift
+ * when a symbol with the same name is added earlier in the file.
+ */
+static size_t unnumberedNameLength(const char *name)
+{
+	size_t len = strlen(name);
+	while (true)
+	{
+		size_t end = len;
+		while (end > 0 && isdigit((unsigned char)name[end - 1]))
+			end--;
+		if (end == len || end < 2 || name[end - 1] != '.')
+			break;
+		len = end - 1;
+	}
+	if (strncmp(name, "__UNIQUE_ID_", strlen("__UNIQUE_ID_")) == 0)
+	{
+		while (len > strlen("__UNIQUE_ID_") && isdigit((unsigned char)name[len - 1]))
+			len--;
+	}
+	return len;
+}
+
+typedef struct
+{
+	const char *name;
+	size_t unnumberedLen;
+	size_t symIndex;
+} NumberedSymbol;
+
+// compare the numbers of the names, so "x.2" goes before "x.10"
+static int compareNameNumbers(const char *left, const char *right)
+{
+	while (*left != '\0' && *right != '\0')
+	{
+		if (isdigit((unsigned char)*left) && isdigit((unsigned char)*right))
+		{
+			char *leftEnd;
+			char *rightEnd;
+			unsigned long long leftNum = strtoull(left, &leftEnd, 10);
+			unsigned long long rightNum = strtoull(right, &rightEnd, 10);
+			if (leftNum != rightNum)
+				return leftNum < rightNum ? -1 : 1;
+			left = leftEnd;
+			right = rightEnd;
+		}
+		else if (*left != *right)
+		{
+			break;
+		}
+		else
+		{
+			left++;
+			right++;
+		}
+	}
+	return (unsigned char)*left - (unsigned char)*right;
+}
+
+static int compareNumberedSymbol(const void *a, const void *b)
+{
+	const NumberedSymbol *left = (const NumberedSymbol *)a;
+	const NumberedSymbol *right = (const NumberedSymbol *)b;
+	size_t len = left->unnumberedLen < right->unnumberedLen ? left->unnumberedLen
+															: right->unnumberedLen;
+	int cmp = memcmp(left->name, right->name, len);
+	if (cmp == 0 && left->unnumberedLen != right->unnumberedLen)
+		cmp = left->unnumberedLen < right->unnumberedLen ? -1 : 1;
+	return cmp != 0 ? cmp : compareNameNumbers(left->name + len, right->name + len);
+}
+
+/*
+ * Position of the numbered local symbol among the local symbols with the same
+ * unnumbered name, ordered by their numbers. It doesn't change when the
+ * symbols with other names are added.
+ */
+static size_t getNumberedOrdinal(ElfIndex *index, size_t symIndex)
+{
+	if (index->symOrdinals == NULL)
+	{
+		NumberedSymbol *syms = malloc(index->symCount * sizeof(NumberedSymbol));
+		index->symOrdinals = calloc(index->symCount, sizeof(size_t));
+		CHECK_ALLOC(syms);
+		CHECK_ALLOC(index->symOrdinals);
+		size_t count = 0;
+		for (size_t i = 1; i < index->symCount; i++)
+		{
+			size_t len = unnumberedNameLength(index->symNames[i]);
+			if (ELF64_ST_BIND(index->symInfo[i]) == STB_LOCAL && index->symNames[i][len] != '\0')
+			{
+				NumberedSymbol sym = { .name = index->symNames[i], .unnumberedLen = len,
+									   .symIndex = i };
+				syms[count++] = sym;
+			}
+		}
+		qsort(syms, count, sizeof(NumberedSymbol), compareNumberedSymbol);
+		for (size_t i = 1; i < count; i++)
+		{
+			if (syms[i].unnumberedLen == syms[i - 1].unnumberedLen &&
+				memcmp(syms[i].name, syms[i - 1].name, syms[i].unnumberedLen) == 0)
+				index->symOrdinals[syms[i].symIndex] = index->symOrdinals[syms[i - 1].symIndex] + 1;
+		}
+		free(syms);
+	}
+	return index->symOrdinals[symIndex];
+}
+
+/*
+ * Hash identity of the numbered target, so only the references renamed one to
+ * one are equal. Constant data without relocations is identified by its
+ * content, e.g. "__func__.12", and other symbols by getNumberedOrdinal().
+ */
+static uint64_t hashNumberedTarget(Elf *elf, const RelocTarget *target, uint64_t seed)
+{
+	ElfIndex *index = getRequiredElfIndex(elf);
+	if (target->symIndex == 0)
+		return hash64((const uint8_t *)target->name, strlen(target->name), seed);
+
+	const Elf64_Sym *sym = &index->syms[target->symIndex];
+	if (sym->st_shndx != SHN_UNDEF && sym->st_shndx < SHN_LORESERVE)
+	{
+		GElf_Shdr shdr = getSectionHeader(elf, sym->st_shndx);
+		Elf_Data *data = elf_getdata(elf_getscn(elf, sym->st_shndx), NULL);
+		size_t cnt;
+		getRelocsInRange(elf, sym->st_shndx, sym->st_value, sym->st_value + sym->st_size, &cnt);
+		if (!(shdr.sh_flags & SHF_WRITE) && shdr.sh_type == SHT_PROGBITS && cnt == 0 &&
+			data != NULL && data->d_buf != NULL && sym->st_value + sym->st_size <= data->d_size)
+			return hash64((const uint8_t *)data->d_buf + sym->st_value, sym->st_size, seed);
+	}
+	uint64_t ordinal = getNumberedOrdinal(index, target->symIndex);
+	return hash64((const uint8_t *)&ordinal, sizeof(ordinal), seed);
+}
+
+static uint64_t hashRelocTarget(const RelocTarget *target, size_t nameLen, uint64_t seed)
+{
+	uint64_t fields[2] = {
+		(target->name != NULL) | target->hasOffset << 1,
+		target->hasOffset ? (uint64_t)target->offset : 0,
+	};
+	uint64_t hash = hash64((const uint8_t *)fields, sizeof(fields), seed);
+	if (target->name != NULL)
+		hash = hash64((const uint8_t *)target->name, nameLen, hash);
+	return hash;
+}
+
+static FunctionFingerprint fingerprintFunction(Elf *elf, const GElf_Sym *sym)
+{
+	Elf_Data *data = elf_getdata(elf_getscn(elf, sym->st_shndx), NULL);
+	if (data == NULL || data->d_buf == NULL || sym->st_value + sym->st_size > data->d_size)
+		LOG_ERR("Can't get data of the function");
+	size_t size = sym->st_size;
+	uint8_t *code = malloc(size + 1);
+	CHECK_ALLOC(code);
+	memcpy(code, (uint8_t *)data->d_buf + sym->st_value, size);
+
+	size_t cnt;
+	const GElf_Rela *relocs = getRelocsInRange(elf, sym->st_shndx, sym->st_value,
+											   sym->st_value + size, &cnt);
+	for (size_t i = 0; i < cnt; i++)
+	{
+		size_t offset = relocs[i].r_offset - sym->st_value;
+		size_t slotEnd = offset + relocSlotSize(&relocs[i]);
+		memset(code + offset, 0, (slotEnd < size ? slotEnd : size) - offset);
+	}
+
+	FunctionFingerprint fingerprint = { .code = hash64(code, size, size) };
+	for (size_t i = 0; i < cnt; i++)
+	{
+		uint64_t fields[2] = { relocs[i].r_offset - sym->st_value, ELF64_R_TYPE(relocs[i].r_info) };
+		fingerprint.code = hash64((const uint8_t *)fields, sizeof(fields), fingerprint.code);
+		RelocTarget target = getRelocTarget(elf, &relocs[i]);
+		size_t nameLen = target.name != NULL ? strlen(target.name) : 0;
+		// every hash includes the relocation index, so moved references are not equal
+		uint64_t seed = i;
+		if (isFunctionReloc(elf, &relocs[i]))
+		{
+			fingerprint.call = hashRelocTarget(&target, nameLen, fingerprint.call ^ seed);
+		}
+		else
+		{
+			size_t unnumberedLen = target.name != NULL ? unnumberedNameLength(target.name) : 0;
+			fingerprint.data = hashRelocTarget(&target, unnumberedLen, fingerprint.data ^ seed);
+			if (unnumberedLen != nameLen)
+				fingerprint.data = hashNumberedTarget(elf, &target, fingerprint.data);
+			fingerprint.metadata = hashRelocTarget(&target, nameLen, fingerprint.metadata ^ seed);
+		}
+	}
+	free(code);
+	return fingerprint;
+}
+
+/*
+ * Cause of the difference between fingerprints of the function, the change
+ * of the code goes before the changed calls and these before the changed data
+ * references. Returns false if the fingerprints are equal.
+ */
+static bool compareFingerprints(const FunctionFingerprint *left, const FunctionFingerprint *right,
+								DekuChangeCause *cause)
+{
+	if (left->code != right->code)
+		*cause = DEKU_CHANGE_CODE;
+	else if (left->call != right->call)
+		*cause = DEKU_CHANGE_CALL;
+	else if (left->data != right->data)
+		*cause = DEKU_CHANGE_DATA;
+	else if (left->metadata != right->metadata)
+		*cause = DEKU_CHANGE_METADATA;
+	else
+		return false;
+	return true;
+}
+
+static const FingerprintEntry *findFingerprint(const Fingerprints *fingerprints,
+											   const char *name, int type)
+{
+	const FingerprintsHeader *header = fingerprints->header;
+	uint32_t hash = hashNameWithType(name, type);
+	size_t mask = header->bucketsCount - 1;
+	for (size_t slot = hash & mask, i = 0; fingerprints->buckets[slot] != 0 && i <= mask;
+		 slot = (slot + 1) & mask, i++)
+	{
+		if (fingerprints->buckets[slot] > header->entriesCount)
+			break;
+		const FingerprintEntry *entry = &fingerprints->entries[fingerprints->buckets[slot] - 1];
+		if (entry->nameHash == hash && entry->type == type &&
+			entry->name < header->stringsSize &&
+			strcmp(fingerprints->strings + entry->name, name) == 0)
+			return entry;
+	}
+	return NULL;
+}
+
+static void setFingerprintsView(Fingerprints *fingerprints)
+{
+	fingerprints->header = fingerprints->data;
+	fingerprints->buckets = (const uint32_t *)(fingerprints->header + 1);
+	fingerprints->entries = (const FingerprintEntry *)(fingerprints->buckets +
+													   fingerprints->header->bucketsCount);
+	fingerprints->strings = (const char *)(fingerprints->entries +
+										   fingerprints->header->entriesCount);
+}
+
+// symbols are looked up like by getSymbolByNameAndType(), so only the first one counts
+static Fingerprints computeFingerprints(Elf *elf, uint64_t fileHash, uint64_t kernelHash)
+{
+	ElfIndex *index = getRequiredElfIndex(elf);
+	if (index->symtab == NULL)
+		LOG_ERR("Failed to find .symtab section");
+
+	size_t mask = bucketsMask(index->symCount);
+	uint32_t *buckets = calloc(mask + 1, sizeof(uint32_t));
+	FingerprintEntry *entries = calloc(index->symCount + 1, sizeof(FingerprintEntry));
+	CHECK_ALLOC(buckets);
+	CHECK_ALLOC(entries);
+	char *strings = NULL;
+	size_t stringsSize = 0;
+	FILE *stringsFile = open_memstream(&strings, &stringsSize);
+	CHECK_ALLOC(stringsFile);
+	fputc('\0', stringsFile);
+	size_t count = 0;
+	for (size_t i = 1; i < index->symCount; i++)
+	{
+		int type = ELF64_ST_TYPE(index->symInfo[i]);
+		if ((type != STT_FUNC && type != STT_OBJECT) || index->symNames[i][0] == '\0')
+			continue;
+		size_t first = 0;
+		while ((first = nextSymbolWithName(index, index->symNames[i], type, first)) != 0 &&
+			   index->symInfo[first] != ELF64_ST_INFO(STB_LOCAL, type) &&
+			   index->symInfo[first] != ELF64_ST_INFO(STB_GLOBAL, type))
+			;
+		if (first != i)
+			continue;
+
+		FingerprintEntry *entry = &entries[count];
+		entry->name = ftell(stringsFile);
+		fputs(index->symNames[i], stringsFile);
+		fputc('\0', stringsFile);
+		entry->nameHash = hashNameWithType(index->symNames[i], type);
+		entry->type = type;
+		const Elf64_Sym *sym = &index->syms[i];
+		if (type == STT_FUNC && (sym->st_shndx == SHN_UNDEF || sym->st_shndx >= index->secCount))
+		{
+			entry->flags = FINGERPRINT_NO_CODE;
+		}
+		else if (type == STT_FUNC)
+		{
+			const char *secName = getSectionName(elf, sym->st_shndx);
+			if (strcmp(secName, ".init.text") == 0)
+				entry->flags = FINGERPRINT_INIT_TEXT;
+			else if (strcmp(secName, ".exit.text") == 0)
+				entry->flags = FINGERPRINT_EXIT_TEXT;
+			entry->fingerprint = fingerprintFunction(elf, sym);
+		}
+		size_t slot = entry->nameHash & mask;
+		while (buckets[slot] != 0)
+			slot = (slot + 1) & mask;
+		buckets[slot] = ++count;
+	}
+	fclose(stringsFile);
+
+	FingerprintsHeader header = {
+		.fileHash = fileHash,
+		.kernelHash = kernelHash,
+		.bucketsCount = mask + 1,
+		.entriesCount = count,
+		.stringsSize = stringsSize,
+	};
+	memcpy(header.magic, FINGERPRINTS_MAGIC, sizeof(header.magic));
+	Fingerprints fingerprints = { .size = sizeof(header) + (mask + 1) * sizeof(uint32_t) +
+										  count * sizeof(FingerprintEntry) + stringsSize };
+	fingerprints.data = malloc(fingerprints.size);
+	CHECK_ALLOC(fingerprints.data);
+	uint8_t *out = fingerprints.data;
+	memcpy(out, &header, sizeof(header));
+	out += sizeof(header);
+	memcpy(out, buckets, (mask + 1) * sizeof(uint32_t));
+	out += (mask + 1) * sizeof(uint32_t);
+	memcpy(out, entries, count * sizeof(FingerprintEntry));
+	out += count * sizeof(FingerprintEntry);
+	memcpy(out, strings, stringsSize);
+	setFingerprintsView(&fingerprints);
+
+	free(strings);
+	free(entries);
+	free(buckets);
+	return fingerprints;
+}
+
+// returns false if the file does not exist, is invalid or was made for other keys
+static bool loadFingerprints(const char *path, uint64_t fileHash, uint64_t kernelHash,
+							 Fingerprints *fingerprints)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return false;
+	struct stat st;
+	void *data = NULL;
+	if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(FingerprintsHeader))
+	{
+		data = malloc(st.st_size);
+		CHECK_ALLOC(data);
+		if (read(fd, data, st.st_size) != st.st_size)
+		{
+			free(data);
+			data = NULL;
+		}
+	}
+	close(fd);
+	if (data == NULL)
+		return false;
+
+	const FingerprintsHeader *header = data;
+	uint64_t size = sizeof(FingerprintsHeader) + (uint64_t)header->bucketsCount * sizeof(uint32_t) +
+					(uint64_t)header->entriesCount * sizeof(FingerprintEntry) + header->stringsSize;
+	if (memcmp(header->magic, FINGERPRINTS_MAGIC, sizeof(header->magic)) != 0 ||
+		header->fileHash != fileHash || header->kernelHash != kernelHash ||
+		size != (uint64_t)st.st_size || header->bucketsCount == 0 || header->stringsSize == 0 ||
+		(header->bucketsCount & (header->bucketsCount - 1)) != 0 ||
+		((const char *)data)[st.st_size - 1] != '\0')
+	{
+		free(data);
+		return false;
+	}
+
+	fingerprints->data = data;
+	fingerprints->size = st.st_size;
+	setFingerprintsView(fingerprints);
+	return true;
+}
+
+// the cache is only an optimization, so failures are not errors
+static void saveFingerprints(const char *path, const Fingerprints *fingerprints)
+{
+	// every writer uses its own temporary file, so the readers never see a partial file
+	size_t len = strlen(path) + sizeof(".XXXXXX");
+	char *tmpFile = malloc(len);
+	CHECK_ALLOC(tmpFile);
+	snprintf(tmpFile, len, "%s.XXXXXX", path);
+	int fd = mkstemp(tmpFile);
+	if (fd == -1)
+	{
+		LOG_DEBUG("Cannot create '%s': %s", tmpFile, strerror(errno));
+		free(tmpFile);
+		return;
+	}
+	ssize_t written = write(fd, fingerprints->data, fingerprints->size);
+	if (close(fd) != 0 || written != (ssize_t)fingerprints->size || rename(tmpFile, path) != 0)
+	{
+		LOG_DEBUG("Failed to save fingerprints '%s'", path);
+		unlink(tmpFile);
+	}
+	free(tmpFile);
+}
+
+static void addDiffEntry(DiffResult *result, DekuDiffKind kind, DekuChangeCause cause,
+						 const char *name, size_t symIndex)
+{
+	if (result->count == result->capacity)
+	{
+		result->capacity = result->capacity ? result->capacity * 2 : 16;
+		result->entries = realloc(result->entries, result->capacity * sizeof(DiffEntry));
+		CHECK_ALLOC(result->entries);
+	}
+	DiffEntry entry = { .kind = kind, .cause = cause, .name = name, .symIndex = symIndex };
+	result->entries[result->count++] = entry;
+}
+
+/*
+ * "elf" is the new file, "secondElf" is the origin one. When "fingerprints" of
+ * the origin file are given, they are used instead of "secondElf".
+ */
+static void findModifiedSymbols(Elf *elf, Elf *secondElf, const Fingerprints *fingerprints,
+								DiffResult *result)
+{
+	Elf_Scn *scn = getSectionByName(elf, ".symtab");
+	if (scn == NULL)
+		LOG_ERR("Failed to find .symtab section");
+	GElf_Shdr shdr;
+	GElf_Sym sym;
+	size_t secCount;
+	elf_getshdrnum(elf, &secCount);
+	Elf_Data *data = elf_getdata(scn, NULL);
+	gelf_getshdr(scn, &shdr);
+	size_t cnt = shdr.sh_size / shdr.sh_entsize;
+	for (size_t i = 0; i < cnt; i++)
+	{
+		gelf_getsym(data, i, &sym);
+		if (sym.st_size == 0 || sym.st_shndx == 0 || sym.st_shndx >= secCount || sym.st_name == 0)
+			continue;
+		const char *name = elf_strptr(elf, shdr.sh_link, sym.st_name);
+		if (ELF64_ST_TYPE(sym.st_info) == STT_FUNC && fingerprints != NULL)
+		{
+			const FingerprintEntry *entry = findFingerprint(fingerprints, name, STT_FUNC);
+			DekuChangeCause cause = DEKU_CHANGE_CODE;
+			if (entry == NULL)
+			{
+				addDiffEntry(result, DEKU_NEW_FUNCTION, DEKU_CHANGE_CODE, name, i);
+				continue;
+			}
+			FunctionFingerprint fingerprint = fingerprintFunction(elf, &sym);
+			if ((entry->flags & FINGERPRINT_NO_CODE) ||
+				compareFingerprints(&fingerprint, &entry->fingerprint, &cause))
+			{
+				LOG_DEBUG("Function '%s' differs from the origin fingerprint", name);
+				addDiffEntry(result, DEKU_MODIFIED_FUNCTION, cause, name, i);
+			}
+		}
+		else if (ELF64_ST_TYPE(sym.st_info) == STT_FUNC)
+		{
+			GElf_Sym secondSym;
+			if (!getSymbolByNameAndType(secondElf, name, STT_FUNC, &secondSym))
+			{
+				addDiffEntry(result, DEKU_NEW_FUNCTION, DEKU_CHANGE_CODE, name, i);
+			}
+			else
+			{
+				size_t diffOffset;
+				if (!equalFunctions(elf, &sym, secondElf, &secondSym, &diffOffset))
+				{
+					LOG_DEBUG("Function '%s' differs at offset 0x%lx", name, diffOffset);
+					// fingerprints are made only for the modified functions to find the cause
+					FunctionFingerprint fingerprint = fingerprintFunction(elf, &sym);
+					FunctionFingerprint secondFingerprint = fingerprintFunction(secondElf, &secondSym);
+					DekuChangeCause cause = DEKU_CHANGE_CODE;
+					compareFingerprints(&fingerprint, &secondFingerprint, &cause);
+					addDiffEntry(result, DEKU_MODIFIED_FUNCTION, cause, name, i);
+				}
+			}
+		}
+		else if (ELF64_ST_TYPE(sym.st_info) == STT_OBJECT)
+		{
+			GElf_Sym secondSym;
+			bool inOrigin = fingerprints != NULL ?
+							findFingerprint(fingerprints, name, STT_OBJECT) != NULL :
+							getSymbolByNameAndType(secondElf, name, STT_OBJECT, &secondSym);
+			if (!inOrigin)
+			{
+				char *bssName = malloc(strlen(name) + 6);
+				CHECK_ALLOC(bssName);
+				char *dataName = malloc(strlen(name) + 7);
+				CHECK_ALLOC(dataName);
+				char *rodataName = malloc(strlen(name) + 9);
+				CHECK_ALLOC(rodataName);
+				snprintf(bssName, strlen(name) + 6, ".bss.%s", name);
+				snprintf(dataName, strlen(name) + 7, ".data.%s", name);
+				snprintf(rodataName, strlen(name) + 9, ".rodata.%s", name);
+
+				const char *scnName = getSectionName(elf, sym.st_shndx);
+				if (strcmp(scnName, bssName) == 0 ||
+					strcmp(scnName, dataName) == 0 ||
+					strcmp(scnName, rodataName) == 0 ||
+					strcmp(scnName, ".bss") == 0 ||
+					strcmp(scnName, ".data") == 0 ||
+					strcmp(scnName, ".rodata") == 0)
+					addDiffEntry(result, DEKU_NEW_VARIABLE, DEKU_CHANGE_DATA, name, i);
+
+				free(rodataName);
+				free(dataName);
+				free(bssName);
+			}
+		}
+	}
+}
+
+static Elf *createNewElf(const char *outFile)
+{
+	OutFd = open(outFile, O_RDWR|O_TRUNC|O_CREAT, 0666);
+	if (OutFd == -1)
+		LOG_ERR("Failed to create file: %s", outFile);
+
+	Elf *elf = elf_begin(OutFd, ELF_C_WRITE, 0);
+	OutElf = elf;
+
+	Elf64_Ehdr *m_ehdr = elf64_newehdr(elf);
+
+	m_ehdr->e_ident[EI_MAG0] = ELFMAG0;
+	m_ehdr->e_ident[EI_MAG1] = ELFMAG1;
+	m_ehdr->e_ident[EI_MAG2] = ELFMAG2;
+	m_ehdr->e_ident[EI_MAG3] = ELFMAG3;
+	m_ehdr->e_ident[EI_CLASS] = ELFCLASS64;
+	m_ehdr->e_ident[EI_DATA] = ELFDATA2LSB;
+	m_ehdr->e_ident[EI_VERSION] = EV_CURRENT;
+	m_ehdr->e_machine = EM_X86_64;
+	m_ehdr->e_type = ET_REL;
+	m_ehdr->e_version = EV_CURRENT;
+	m_ehdr->e_shstrndx = 1;
+
+	GElf_Shdr shdr;
+	Elf_Scn *shstrtabScn = elf_newscn(elf);
+	Elf_Scn *strtabScn = elf_newscn(elf);
+	dekuInitStringTable(&OutSectionNames, shstrtabScn);
+	dekuInitStringTable(&OutSymbolNames, strtabScn);
+
+	gelf_getshdr(shstrtabScn, &shdr);
+	shdr.sh_type = SHT_STRTAB;
+	shdr.sh_name = dekuAddString(&OutSectionNames, ".shstrtab");
+	gelf_update_shdr(shstrtabScn, &shdr);
+
+	gelf_getshdr(strtabScn, &shdr);
+	shdr.sh_size = 1;
+	shdr.sh_type = SHT_STRTAB;
+	shdr.sh_name = dekuAddString(&OutSectionNames, ".strtab");
+	gelf_update_shdr(strtabScn, &shdr);
+
+	Elf_Scn *symtabScn = elf_newscn(elf);
+	Elf_Data *newData = elf_newdata(symtabScn);
+	gelf_getshdr(symtabScn, &shdr);
+	newData->d_type = ELF_T_SYM;
+
+	OutSymbols.scn = symtabScn;
+	OutSymbols.capacity = 256;
+	OutSymbols.syms = calloc(OutSymbols.capacity, sizeof(GElf_Sym));
+	CHECK_ALLOC(OutSymbols.syms);
+	OutSymbols.count = 1;
+
+	shdr.sh_link = elf_ndxscn(strtabScn);
+	shdr.sh_type = SHT_SYMTAB;
+	shdr.sh_name = dekuAddString(&OutSectionNames, ".symtab");
+	shdr.sh_entsize = sizeof(GElf_Sym);
+	gelf_update_shdr(symtabScn, &shdr);
+
+	return elf;
+}
+
+static void checkStaticKeys(Elf *elf, bool *symToCopy)
+{
+	Elf_Scn *scn = getSectionByName(elf, "__jump_table");
+	if (scn == NULL)
+		return;
+	Elf_Scn *relScn = getRelForSectionIndex(elf, elf_ndxscn(scn));
+	if (relScn == NULL)
+		LOG_ERR("Can't find relocation section for __jump_table");
+
+	GElf_Rela rela;
+	GElf_Shdr shdr;
+	Elf_Data *data = elf_getdata(relScn, NULL);
+	gelf_getshdr(relScn, &shdr);
+	size_t cnt = shdr.sh_size / shdr.sh_entsize;
+	for (size_t i = 0; i < cnt; i+=3)
+	{
+		gelf_getrela(data, i, &rela);
+		size_t symIndex = getSymbolForRelocation(elf, rela);
+		if (symToCopy[symIndex])
+		{
+			gelf_getrela(data, i + 2, &rela);
+			const char *keyName = Symbols.name[ELF64_R_SYM(rela.r_info)];
+			LOG_INFO("The '%s' function uses static key `%s` that is not yet "
+					 "supported by DEKU.", Symbols.name[symIndex], keyName);
+		}
+	}
+}
+
+static Elf_Scn *copySection(Elf *elf, Elf *outElf, Elf64_Section index, bool copyData)
+{
+	if (CopiedScnMap[index] != NULL)
+		return CopiedScnMap[index];
+
+	if (index >= SectionsCount)
+		LOG_ERR("Try to copy section that is out range (%d/%ld)", index, SectionsCount);
+
+	size_t shstrndx;
+	GElf_Shdr newShdr;
+	GElf_Shdr oldShdr;
+	elf_getshdrstrndx(elf, &shstrndx);
+	Elf_Scn *oldScn = elf_getscn(elf, index);
+	Elf_Data *oldData = elf_getdata(oldScn, NULL);
+	Elf_Scn *newScn = elf_newscn(outElf);
+	Elf_Data *newData = elf_newdata(newScn);
+	gelf_getshdr(oldScn, &oldShdr);
+	gelf_getshdr(newScn, &newShdr);
+	newShdr.sh_type = oldShdr.sh_type;
+	newShdr.sh_flags = oldShdr.sh_flags;
+	newShdr.sh_entsize = oldShdr.sh_entsize;
+	newShdr.sh_name = dekuAddString(&OutSectionNames, elf_strptr(elf, shstrndx, oldShdr.sh_name));
+	newData->d_type = oldData->d_type;
+	if (copyData)
+	{
+		newShdr.sh_size = oldShdr.sh_size;
+		newData->d_size = oldData->d_size;
+		// the input stays open until the output is written, so its data is
+		// referenced instead of copied (SHT_NOBITS sections have no data)
+		newData->d_buf = oldData->d_buf;
+	}
+	gelf_update_shdr(newScn, &newShdr);
+
+	CopiedScnMap[index] = newScn;
+	return newScn;
+}
+
+static Elf64_Word copyStrtabItem(Elf *elf, size_t offset)
+{
+	size_t strtabIdx = elf_ndxscn(getSectionByName(elf, ".strtab"));
+	char *text = elf_strptr(elf, strtabIdx, offset);
+	return dekuAddString(&OutSymbolNames, text);
+}
+
+static size_t addOutputSymbol(const GElf_Sym *sym)
+{
+	if (OutSymbols.count == OutSymbols.capacity)
+	{
+		OutSymbols.capacity *= 2;
+		OutSymbols.syms = realloc(OutSymbols.syms, OutSymbols.capacity * sizeof(GElf_Sym));
+		CHECK_ALLOC(OutSymbols.syms);
+	}
+	size_t newIndex = OutSymbols.count++;
+	OutSymbols.syms[newIndex] = *sym;
+	return newIndex;
+}
+
+static size_t copySymbol(Elf *elf, Elf *outElf, size_t index, bool copySec)
+{
+	GElf_Sym oldSym;
+	GElf_Sym newSym;
+
+	if (Symbols.copiedIndex[index])
+		return Symbols.copiedIndex[index];
+
+	oldSym = getSymbolByIndex(elf, index);
+	newSym = oldSym;
+
+	char symType = ELF64_ST_TYPE(oldSym.st_info);
+	if (oldSym.st_shndx > 0 && oldSym.st_shndx < SectionsCount &&
+		copySec)
+	{
+		Elf_Scn *scn = copySection(elf, outElf, oldSym.st_shndx, true);
+		newSym.st_shndx = elf_ndxscn(scn);
+		if (symType != STT_SECTION)
+			newSym.st_value += CopiedScnOffset[oldSym.st_shndx];
+
+		if (oldSym.st_name != 0)
+		{
+			newSym.st_info = ELF64_ST_INFO(STB_GLOBAL, symType);
+			// TODO: Avoid modify symbol name for functions
+			if (symType == STT_FUNC)
+			{
+				char *symName = strdup(Symbols.name[index]);
+				CHECK_ALLOC(symName);
+				char *n;
+				while ((n = strchr(symName, '.')) != NULL)
+					*n = '_';
+				newSym.st_name = dekuAddString(&OutSymbolNames, symName);
+
+				free(symName);
+			}
+			else
+			{
+				newSym.st_name = dekuAddString(&OutSymbolNames, Symbols.name[index]);
+			}
+		}
+	}
+	else // mark symbol as "external"
+	{
+		if (symType == STT_OBJECT && oldSym.st_name != 0)
+		{
+			if (strstr(getSectionName(elf, oldSym.st_shndx), ".read_mostly"))
+			{
+				dekuFail(DEKU_ERROR_UNSUPPORTED_READ_MOSTLY, __FILE__, __LINE__,
+						 "Changes to the source code affects the %s variable "
+						 "marked with the __read_mostly macro. This is not yet "
+						 "supported by DEKU.", Symbols.name[index]);
+			}
+		}
+		if (oldSym.st_shndx > 0 && oldSym.st_shndx < SectionsCount)
+			newSym.st_shndx = 0;
+		newSym.st_size = 0;
+		newSym.st_info = ELF64_ST_INFO(STB_GLOBAL, symType);
+		if (oldSym.st_name != 0)
+			newSym.st_name = copyStrtabItem(elf, oldSym.st_name);
+	}
+
+	size_t newIndex = addOutputSymbol(&newSym);
+	Symbols.copiedIndex[index] = newIndex;
+	return newIndex;
+}
+
+// mergeable strings and constants are copied by packPlace() instead of the whole section
+static bool isPackableSection(const GElf_Shdr *shdr)
+{
+	if (shdr->sh_type != SHT_PROGBITS || !(shdr->sh_flags & SHF_MERGE))
+		return false;
+	// only the strings of 1-byte characters are split
+	return shdr->sh_flags & SHF_STRINGS ? shdr->sh_entsize <= 1 : shdr->sh_entsize > 0;
+}
+
+/*
+ * Bytes of the input section needed by the reference to "first" .. "last",
+ * extended to the whole strings or the whole constants.
+ */
+static void getPackedRange(const uint8_t *buf, const GElf_Shdr *shdr, Elf64_Sxword first,
+						   Elf64_Sxword last, size_t *start, size_t *end)
+{
+	Elf64_Sxword size = shdr->sh_size;
+	if (size == 0)
+	{
+		*start = *end = 0;
+		return;
+	}
+	first = first < 0 ? 0 : first >= size ? size - 1 : first;
+	last = last < first ? first : last >= size ? size - 1 : last;
+	if (shdr->sh_flags & SHF_STRINGS)
+	{
+		*start = first;
+		while (*start > 0 && buf[*start - 1] != '\0')
+			(*start)--;
+		*end = last;
+		while (*end < (size_t)size && buf[*end] != '\0')
+			(*end)++;
+		*end = *end < (size_t)size ? *end + 1 : (size_t)size;
+	}
+	else
+	{
+		*start = first / shdr->sh_entsize * shdr->sh_entsize;
+		*end = (last / shdr->sh_entsize + 1) * shdr->sh_entsize;
+		if (*end > (size_t)size)
+			*end = size;
+	}
+}
+
+/*
+ * Copy the part of the mergeable section referenced by the relocation to the
+ * packed output section and point the relocation to it. The PC-relative
+ * relocations in the code point up to 8 bytes before the target, depending
+ * on the immediate that follows the displacement in the instruction, so all
+ * these bytes are kept together.
+ */
+static size_t packPlace(Elf *elf, Elf *outElf, Elf64_Section index, bool fromCode, GElf_Rela *rela)
+{
+	PackedSection *packed = &PackedSections[index];
+	Elf_Scn *scn = elf_getscn(elf, index);
+	Elf_Data *data = elf_getdata(scn, NULL);
+	GElf_Shdr shdr;
+	gelf_getshdr(scn, &shdr);
+	if (data == NULL || data->d_buf == NULL || data->d_size < shdr.sh_size)
+		LOG_ERR("Can't get data of the %s section", getSectionName(elf, index));
+
+	if (packed->scn == NULL)
+	{
+		packed->scn = copySection(elf, outElf, index, false);
+		GElf_Shdr newShdr;
+		gelf_getshdr(packed->scn, &newShdr);
+		// entries are no longer at the offsets that the linker could merge
+		newShdr.sh_flags &= ~(SHF_MERGE | SHF_STRINGS);
+		newShdr.sh_entsize = 0;
+		newShdr.sh_addralign = shdr.sh_addralign;
+		gelf_update_shdr(packed->scn, &newShdr);
+		elf_getdata(packed->scn, NULL)->d_align = data->d_align;
+
+		GElf_Sym sym = {0};
+		sym.st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
+		sym.st_shndx = elf_ndxscn(packed->scn);
+		packed->symIndex = addOutputSymbol(&sym);
+	}
+
+	size_t symIndex = ELF64_R_SYM(rela->r_info);
+	Elf64_Sxword value = Symbols.stValue[symIndex] + rela->r_addend;
+	Elf64_Sxword first = value;
+	Elf64_Sxword last = value;
+	switch (ELF64_R_TYPE(rela->r_info))
+	{
+	case R_X86_64_PC32:
+	case R_X86_64_PLT32:
+	case R_X86_64_PC64:
+		if (fromCode)
+		{
+			first = value + 4;
+			last = value + 8;
+		}
+		break;
+	}
+	size_t start, end;
+	getPackedRange(data->d_buf, &shdr, first, last, &start, &end);
+
+	PackedChunk *chunk = NULL;
+	for (size_t i = 0; i < packed->count; i++)
+	{
+		if (packed->chunks[i].start <= start && packed->chunks[i].end >= end)
+		{
+			chunk = &packed->chunks[i];
+			break;
+		}
+	}
+	if (chunk == NULL)
+	{
+		if (packed->count == packed->capacity)
+		{
+			packed->capacity = packed->capacity ? packed->capacity * 2 : 16;
+			packed->chunks = realloc(packed->chunks, packed->capacity * sizeof(PackedChunk));
+			CHECK_ALLOC(packed->chunks);
+		}
+		// keep the alignment of the entries from the input section
+		size_t align = shdr.sh_addralign > 1 ? shdr.sh_addralign : 1;
+		size_t newStart = packed->size + (start % align + align - packed->size % align) % align;
+		packed->buf = realloc(packed->buf, newStart + (end - start) + 1);
+		CHECK_ALLOC(packed->buf);
+		memset(packed->buf + packed->size, 0, newStart - packed->size);
+		memcpy(packed->buf + newStart, (uint8_t *)data->d_buf + start, end - start);
+		packed->size = newStart + (end - start);
+
+		chunk = &packed->chunks[packed->count++];
+		chunk->start = start;
+		chunk->end = end;
+		chunk->newStart = newStart;
+
+		Elf_Data *newData = elf_getdata(packed->scn, NULL);
+		newData->d_buf = packed->buf;
+		newData->d_size = packed->size;
+		GElf_Shdr newShdr;
+		gelf_getshdr(packed->scn, &newShdr);
+		newShdr.sh_size = packed->size;
+		gelf_update_shdr(packed->scn, &newShdr);
+	}
+
+	rela->r_addend = value - (Elf64_Sxword)chunk->start + (Elf64_Sxword)chunk->newStart;
+	return packed->symIndex;
+}
+
+static void freePackedSections(void)
+{
+	for (size_t i = 0; PackedSections != NULL && i < SectionsCount; i++)
+	{
+		free(PackedSections[i].buf);
+		free(PackedSections[i].chunks);
+	}
+	free(PackedSections);
+	PackedSections = NULL;
+}
+
+/*
+ * Copy relocations of the "start" .. "end" range and move them by "shift" and
+ * by the offset of the relocated section in the output. Targets of the
+ * relocations from the function are resolved to the symbols, so the called
+ * functions and the used variables are kept as externals.
+ */
+static void copyRelocsInRange(Elf *elf, Elf *outElf, Elf64_Section index, size_t relTo,
+							  size_t start, size_t end, Elf64_Sxword shift, bool fromFunction)
+{
+	Elf_Scn *outScn = copySection(elf, outElf, index, false);
+	GElf_Shdr shdr;
+	gelf_getshdr(outScn, &shdr);
+	shdr.sh_link = elf_ndxscn(OutSymbols.scn);
+	shdr.sh_info = relTo;
+	gelf_update_shdr(outScn, &shdr);
+
+	size_t j = shdr.sh_size / shdr.sh_entsize;
+	Elf_Scn *scn = elf_getscn(elf, index);
+	Elf_Data *outData = elf_getdata(outScn, NULL);
+	gelf_getshdr(scn, &shdr);
+	bool fromCode = getSectionHeader(elf, shdr.sh_info).sh_flags & SHF_EXECINSTR;
+	shift += CopiedScnOffset[shdr.sh_info];
+	size_t cnt;
+	const GElf_Rela *relocs = getRelocsInRange(elf, shdr.sh_info, start, end, &cnt);
+	outData->d_size += cnt * shdr.sh_entsize;
+	outData->d_buf = realloc(outData->d_buf, outData->d_size);
+	CHECK_ALLOC(outData->d_buf);
+	for (size_t i = 0; i < cnt; i++)
+	{
+		GElf_Rela rela = relocs[i];
+		size_t newSymIndex;
+		size_t symIndex = ELF64_R_SYM(rela.r_info);
+		GElf_Shdr shdr = getSectionHeader(elf, Symbols.secIndex[symIndex]);
+		const char *secName = getSectionName(elf, Symbols.secIndex[symIndex]);
+		if (isPackableSection(&shdr))
+		{
+			newSymIndex = packPlace(elf, outElf, Symbols.secIndex[symIndex], fromCode, &rela);
+		}
+		else if (shdr.sh_flags & SHF_STRINGS ||
+			strstr(secName, ".rodata.__func__") == secName)
+		{
+			newSymIndex = copySymbol(elf, outElf, symIndex, true);
+		}
+		else
+		{
+			size_t target = fromFunction ? getSymbolForRelocation(elf, rela) : symIndex;
+			bool isFuncOrVar = Symbols.isFun[target] || Symbols.isVar[target];
+			bool copySec = fromFunction ? !isFuncOrVar : true;
+			newSymIndex = copySymbol(elf, outElf, target, copySec);
+			if (copySec && ELF64_ST_TYPE(Symbols.stInfo[target]) == STT_SECTION)
+				rela.r_addend += CopiedScnOffset[Symbols.secIndex[target]];
+		}
+		rela.r_offset += shift;
+		rela.r_info = ELF64_R_INFO(newSymIndex, ELF64_R_TYPE(rela.r_info));
+		gelf_update_rela(outData, j, &rela);
+		j++;
+	}
+	gelf_getshdr(outScn, &shdr);
+	shdr.sh_size = j * shdr.sh_entsize;
+	outData->d_size = shdr.sh_size;
+	if (!gelf_update_shdr(outScn, &shdr))
+		LOG_ERR("gelf_update_shdr failed");
+}
+
+static void copyRelSection(Elf *elf, Elf *outElf, Elf64_Section index, size_t relTo, GElf_Sym *fromSym)
+{
+	if (fromSym != NULL)
+		copyRelocsInRange(elf, outElf, index, relTo, fromSym->st_value,
+						  fromSym->st_value + fromSym->st_size, 0, true);
+	else
+		copyRelocsInRange(elf, outElf, index, relTo, 0, SIZE_MAX, 0, false);
+}
+
+static void copySectionWithRel(Elf *elf, Elf *outElf, Elf64_Section index, GElf_Sym *fromSym)
+{
+	Elf_Scn *newScn = copySection(elf, outElf, index, true);
+	Elf_Scn *relScn = getRelForSectionIndex(elf, index);
+	if (relScn)
+		copyRelSection(elf, outElf, elf_ndxscn(relScn), elf_ndxscn(newScn), fromSym);
+}
+
+// record of the table with relocations at "relocOffsets", the first one points to the code
+typedef struct
+{
+	size_t size;
+	size_t relocOffsets[2];
+	size_t relocCount;
+} TableLayout;
+
+/*
+ * Tables with a record for every place in the code. Layouts of the records
+ * depend on the kernel version and the config, the first one that matches
+ * all relocations of the section is used.
+ */
+typedef struct
+{
+	const char *name;
+	TableLayout layouts[3];
+} TableSection;
+
+static const TableSection TableSections[] =
+{
+	{ ".altinstructions", { { 14, { 0, 4 }, 2 }, { 13, { 0, 4 }, 2 }, { 12, { 0, 4 }, 2 } } },
+	{ "__bug_table", { { 12, { 0, 4 }, 2 }, { 8, { 0 }, 1 } } },
+};
+
+static const TableSection *getTableSection(const char *name)
+{
+	for (size_t i = 0; i < sizeof(TableSections) / sizeof(*TableSections); i++)
+	{
+		if (strcmp(TableSections[i].name, name) == 0)
+			return &TableSections[i];
+	}
+	LOG_ERR("Unknown table section: %s", name);
+}
+
+static const TableLayout *findTableLayout(const TableSection *table, const GElf_Shdr *shdr,
+										  const GElf_Rela *relocs, size_t cnt)
+{
+	for (size_t i = 0; i < sizeof(table->layouts) / sizeof(*table->layouts); i++)
+	{
+		const TableLayout *layout = &table->layouts[i];
+		if (layout->size == 0 || shdr->sh_size % layout->size != 0 ||
+			cnt != shdr->sh_size / layout->size * layout->relocCount)
+			continue;
+		size_t j = 0;
+		for (; j < cnt; j++)
+		{
+			size_t offset = j / layout->relocCount * layout->size +
+							layout->relocOffsets[j % layout->relocCount];
+			if (relocs[j].r_offset != offset)
+				break;
+		}
+		if (j == cnt)
+			return layout;
+	}
+	return NULL;
+}
+
+// the relocation points into one of the "copied" functions
+static bool isCopiedCode(const GElf_Rela *rela, const size_t *copied, size_t copiedCount)
+{
+	size_t symIndex = ELF64_R_SYM(rela->r_info);
+	Elf64_Sxword value = Symbols.stValue[symIndex] + rela->r_addend;
+	for (size_t i = 0; i < copiedCount; i++)
+	{
+		size_t fun = copied[i];
+		if (Symbols.secIndex[fun] == Symbols.secIndex[symIndex] &&
+			value >= (Elf64_Sxword)Symbols.stValue[fun] &&
+			value < (Elf64_Sxword)(Symbols.stValue[fun] + Symbols.stSize[fun]))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Copy records of the table that describe the copied functions, the records
+ * of the other functions would pull their relocation targets into the module.
+ * The section is copied whole if its layout is unknown.
+ */
+static void copyTableSection(Elf *elf, Elf *outElf, Elf64_Section index, const TableSection *table,
+							 const size_t *copied, size_t copiedCount)
+{
+	Elf_Scn *scn = elf_getscn(elf, index);
+	Elf_Scn *relScn = getRelForSectionIndex(elf, index);
+	Elf_Data *data = elf_getdata(scn, NULL);
+	GElf_Shdr shdr;
+	gelf_getshdr(scn, &shdr);
+	size_t cnt;
+	const GElf_Rela *relocs = getRelocsInRange(elf, index, 0, SIZE_MAX, &cnt);
+	const TableLayout *layout = findTableLayout(table, &shdr, relocs, cnt);
+	if (relScn == NULL || layout == NULL || data == NULL || data->d_buf == NULL)
+	{
+		LOG_DEBUG("Copy %s section", table->name);
+		copySectionWithRel(elf, outElf, index, NULL);
+		return;
+	}
+
+	PackedSection *packed = &PackedSections[index];
+	size_t records = shdr.sh_size / layout->size;
+	for (size_t i = 0; i < records; i++)
+	{
+		if (!isCopiedCode(&relocs[i * layout->relocCount], copied, copiedCount))
+			continue;
+		if (packed->scn == NULL)
+			packed->scn = copySection(elf, outElf, index, false);
+		size_t start = i * layout->size;
+		packed->buf = realloc(packed->buf, packed->size + layout->size);
+		CHECK_ALLOC(packed->buf);
+		memcpy(packed->buf + packed->size, (uint8_t *)data->d_buf + start, layout->size);
+		copyRelocsInRange(elf, outElf, elf_ndxscn(relScn), elf_ndxscn(packed->scn), start,
+						  start + layout->size, (Elf64_Sxword)packed->size - (Elf64_Sxword)start,
+						  false);
+		packed->size += layout->size;
+	}
+	LOG_DEBUG("Copy %zu of %zu records of %s section", packed->size / layout->size, records,
+			  table->name);
+	if (packed->scn == NULL)
+		return;
+
+	Elf_Data *newData = elf_getdata(packed->scn, NULL);
+	newData->d_buf = packed->buf;
+	newData->d_size = packed->size;
+	gelf_getshdr(packed->scn, &shdr);
+	shdr.sh_size = packed->size;
+	gelf_update_shdr(packed->scn, &shdr);
+}
+
+typedef struct
+{
+	size_t start;
+	bool copied;
+} Replacement;
+
+static int compareReplacement(const void *a, const void *b)
+{
+	const Replacement *left = a;
+	const Replacement *right = b;
+	if (left->start != right->start)
+		return left->start < right->start ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Copy relocations of the replacements used by the copied .altinstructions
+ * records. The replacement lasts until the start of the next one.
+ */
+static void copyReplacementRelocs(Elf *elf, Elf *outElf, Elf64_Section index,
+								  const size_t *copied, size_t copiedCount)
+{
+	Elf_Scn *altScn = getSectionByName(elf, ".altinstructions");
+	GElf_Shdr shdr;
+	size_t cnt = 0;
+	const GElf_Rela *relocs = NULL;
+	const TableLayout *layout = NULL;
+	if (altScn != NULL)
+	{
+		gelf_getshdr(altScn, &shdr);
+		relocs = getRelocsInRange(elf, elf_ndxscn(altScn), 0, SIZE_MAX, &cnt);
+		layout = findTableLayout(getTableSection(".altinstructions"), &shdr, relocs, cnt);
+	}
+	if (layout == NULL || layout->relocCount < 2)
+	{
+		copySectionWithRel(elf, outElf, index, NULL);
+		return;
+	}
+
+	size_t records = cnt / layout->relocCount;
+	Replacement *replacements = calloc(records, sizeof(Replacement));
+	CHECK_ALLOC(replacements);
+	size_t count = 0;
+	for (size_t i = 0; i < records; i++)
+	{
+		const GElf_Rela *rela = &relocs[i * layout->relocCount + 1];
+		size_t symIndex = ELF64_R_SYM(rela->r_info);
+		if (Symbols.secIndex[symIndex] != index)
+			continue;
+		replacements[count].start = Symbols.stValue[symIndex] + rela->r_addend;
+		replacements[count].copied = isCopiedCode(&relocs[i * layout->relocCount], copied,
+												  copiedCount);
+		count++;
+	}
+	qsort(replacements, count, sizeof(Replacement), compareReplacement);
+
+	Elf_Scn *newScn = copySection(elf, outElf, index, true);
+	Elf_Scn *relScn = getRelForSectionIndex(elf, index);
+	gelf_getshdr(elf_getscn(elf, index), &shdr);
+	for (size_t i = 0; relScn != NULL && i < count; i++)
+	{
+		// records with the same replacement
+		bool isCopied = replacements[i].copied;
+		while (i + 1 < count && replacements[i + 1].start == replacements[i].start)
+			isCopied |= replacements[++i].copied;
+		size_t end = i + 1 < count ? replacements[i + 1].start : shdr.sh_size;
+		if (isCopied)
+			copyRelocsInRange(elf, outElf, elf_ndxscn(relScn), elf_ndxscn(newScn),
+							  replacements[i].start, end, 0, false);
+	}
+	free(replacements);
+}
+
+/*
+ * Write the output symbol table with all local symbols before the global ones
+ * and update relocations to the final symbol indexes.
+ */
+static void writeOutputSymtab(Elf *outElf)
+{
+	size_t cnt = OutSymbols.count;
+	size_t *newIndex = calloc(cnt, sizeof(size_t));
+	CHECK_ALLOC(newIndex);
+	size_t firstGlobalIndex = 1;
+	for (size_t i = 1; i < cnt; i++)
+	{
+		if (ELF64_ST_BIND(OutSymbols.syms[i].st_info) == STB_LOCAL)
+			newIndex[i] = firstGlobalIndex++;
+	}
+	size_t next = firstGlobalIndex;
+	for (size_t i = 1; i < cnt; i++)
+	{
+		if (ELF64_ST_BIND(OutSymbols.syms[i].st_info) != STB_LOCAL)
+			newIndex[i] = next++;
+	}
+
+	Elf_Data *data = elf_getdata(OutSymbols.scn, NULL);
+	GElf_Sym *syms = calloc(cnt, sizeof(GElf_Sym));
+	CHECK_ALLOC(syms);
+	for (size_t i = 1; i < cnt; i++)
+		syms[newIndex[i]] = OutSymbols.syms[i];
+	free(OutSymbols.syms);
+	OutSymbols.syms = syms;
+	data->d_buf = syms;
+	data->d_size = cnt * sizeof(GElf_Sym);
+
+	GElf_Shdr shdr;
+	gelf_getshdr(OutSymbols.scn, &shdr);
+	shdr.sh_size = data->d_size;
+	shdr.sh_info = firstGlobalIndex;
+	gelf_update_shdr(OutSymbols.scn, &shdr);
+
+	Elf_Scn *scn = NULL;
+	while ((scn = elf_nextscn(outElf, scn)) != NULL)
+	{
+		gelf_getshdr(scn, &shdr);
+		if (shdr.sh_type != SHT_RELA)
+			continue;
+
+		GElf_Rela rela;
+		Elf_Data *relData = elf_getdata(scn, NULL);
+		size_t relCnt = shdr.sh_size / shdr.sh_entsize;
+		for (size_t i = 0; i < relCnt; i++)
+		{
+			gelf_getrela(relData, i, &rela);
+			rela.r_info = ELF64_R_INFO(newIndex[ELF64_R_SYM(rela.r_info)],
+									   ELF64_R_TYPE(rela.r_info));
+			gelf_update_rela(relData, i, &rela);
+		}
+	}
+	free(newIndex);
+}
+
+/*
+ * Pack the string tables of the output file and update names of the sections
+ * and symbols to the final offsets.
+ */
+static void writeOutputNames(Elf *outElf)
+{
+	Elf_Scn *scn = NULL;
+	Elf_Scn *symtabScn = NULL;
+	GElf_Shdr shdr;
+	mergeStringTable(&OutSectionNames);
+	mergeStringTable(&OutSymbolNames);
+	while ((scn = elf_nextscn(outElf, scn)) != NULL)
+	{
+		gelf_getshdr(scn, &shdr);
+		shdr.sh_name = getMergedOffset(&OutSectionNames, shdr.sh_name);
+		gelf_update_shdr(scn, &shdr);
+		if (shdr.sh_type == SHT_SYMTAB)
+			symtabScn = scn;
+	}
+	if (symtabScn == NULL)
+		LOG_ERR("Failed to find .symtab section");
+
+	GElf_Sym sym;
+	Elf_Data *data = elf_getdata(symtabScn, NULL);
+	gelf_getshdr(symtabScn, &shdr);
+	size_t cnt = shdr.sh_size / shdr.sh_entsize;
+	for (size_t i = 0; i < cnt; i++)
+	{
+		gelf_getsym(data, i, &sym);
+		sym.st_name = getMergedOffset(&OutSymbolNames, sym.st_name);
+		gelf_update_sym(data, i, &sym);
+	}
+}
+
+static void closeOutputElf(void)
+{
+	Elf_Scn *scn = NULL;
+	GElf_Shdr shdr;
+	if (OutElf != NULL)
+	{
+		// relocations are the only output data allocated here, see copyRelSection()
+		while ((scn = elf_nextscn(OutElf, scn)) != NULL)
+		{
+			gelf_getshdr(scn, &shdr);
+			if (shdr.sh_type == SHT_RELA)
+				free(elf_getdata(scn, NULL)->d_buf);
+		}
+		elf_end(OutElf);
+		OutElf = NULL;
+	}
+	if (OutFd != -1)
+		close(OutFd);
+	OutFd = -1;
+	dekuFreeStringTable(&OutSectionNames);
+	dekuFreeStringTable(&OutSymbolNames);
+	free(OutSymbols.syms);
+	memset(&OutSymbols, 0, sizeof(OutSymbols));
+}
+
+// appends indexes of functions called by function "symIndex" to "result"
+static size_t symbolCallees(Elf *elf, size_t symIndex, size_t *result, size_t *seen)
+{
+	size_t cnt;
+	size_t calleesCnt = 0;
+	size_t secIndex = Symbols.secIndex[symIndex];
+	size_t start = Symbols.stValue[symIndex];
+	size_t end = start + Symbols.stSize[symIndex];
+	// function without size (e.g. from assembly) takes the whole section
+	if (Symbols.stSize[symIndex] == 0)
+	{
+		start = 0;
+		end = SIZE_MAX;
+	}
+	const GElf_Rela *relocs = getRelocsInRange(elf, secIndex, start, end, &cnt);
+	for (size_t i = 0; i < cnt; i++)
+	{
+		GElf_Rela rela = relocs[i];
+		if (ELF64_R_SYM(rela.r_info) >= Symbols.count)
+			LOG_ERR("Invalid symbol index: %ld in relocations for section %ld",
+					ELF64_R_SYM(rela.r_info), secIndex);
+		size_t callee = getSymbolForRelocation(elf, rela);
+		// "seen" keeps the last function that added the callee + 1
+		if (Symbols.isFun[callee] && seen[callee] != symIndex + 1)
+		{
+			seen[callee] = symIndex + 1;
+			result[calleesCnt++] = callee;
+		}
+	}
+	return calleesCnt;
+}
+
+/*
+ * Copied functions ordered by the calls between them. Every function goes
+ * after its first caller, so the patched code paths are close to each other.
+ */
+typedef struct
+{
+	// copied callees of the copied function "i" are callees[calleesStart[i]] .. callees[calleesEnd[i] - 1]
+	size_t *calleesStart;
+	size_t *calleesEnd;
+	size_t *callees;
+	bool *placed;
+	size_t *order;
+	size_t count;
+} FunctionOrder;
+
+static void placeFunction(FunctionOrder *functions, size_t fun)
+{
+	if (functions->placed[fun])
+		return;
+	functions->placed[fun] = true;
+	functions->order[functions->count++] = fun;
+	for (size_t i = functions->calleesStart[fun]; i < functions->calleesEnd[fun]; i++)
+		placeFunction(functions, functions->callees[i]);
+}
+
+// ".cold" part of the function jumps back to it, the jump is not a call
+static bool isColdPartOf(size_t cold, size_t fun)
+{
+	const char *name = Symbols.name[cold];
+	size_t len = strlen(Symbols.name[fun]);
+	return strncmp(name, Symbols.name[fun], len) == 0 && strcmp(name + len, ".cold") == 0;
+}
+
+// "order" gets "copiedCount" functions, the ones not called by the other copied functions go first
+static void orderByCalls(Elf *elf, const bool *symToCopy, const size_t *copied,
+						 size_t copiedCount, size_t *order)
+{
+	size_t cnt = Symbols.count;
+	FunctionOrder functions = { .order = order };
+	functions.calleesStart = calloc(cnt, sizeof(size_t));
+	functions.calleesEnd = calloc(cnt, sizeof(size_t));
+	functions.placed = calloc(cnt, sizeof(bool));
+	size_t *seen = calloc(cnt, sizeof(size_t));
+	size_t *callees = malloc(cnt * sizeof(size_t));
+	bool *isCalled = calloc(cnt, sizeof(bool));
+	CHECK_ALLOC(functions.calleesStart);
+	CHECK_ALLOC(functions.calleesEnd);
+	CHECK_ALLOC(functions.placed);
+	CHECK_ALLOC(seen);
+	CHECK_ALLOC(callees);
+	CHECK_ALLOC(isCalled);
+
+	size_t total = 0;
+	size_t capacity = copiedCount;
+	functions.callees = malloc((capacity + 1) * sizeof(size_t));
+	CHECK_ALLOC(functions.callees);
+	for (size_t i = 0; i < copiedCount; i++)
+	{
+		size_t fun = copied[i];
+		functions.calleesStart[fun] = total;
+		size_t calleesCnt = symbolCallees(elf, fun, callees, seen);
+		for (size_t j = 0; j < calleesCnt; j++)
+		{
+			if (!symToCopy[callees[j]] || callees[j] == fun || isColdPartOf(fun, callees[j]))
+				continue;
+			if (total == capacity)
+			{
+				capacity *= 2;
+				functions.callees = realloc(functions.callees, capacity * sizeof(size_t));
+				CHECK_ALLOC(functions.callees);
+			}
+			functions.callees[total++] = callees[j];
+			isCalled[callees[j]] = true;
+		}
+		functions.calleesEnd[fun] = total;
+	}
+
+	for (size_t i = 0; i < copiedCount; i++)
+	{
+		if (!isCalled[copied[i]])
+			placeFunction(&functions, copied[i]);
+	}
+	// functions called only in a cycle
+	for (size_t i = 0; i < copiedCount; i++)
+		placeFunction(&functions, copied[i]);
+
+	free(isCalled);
+	free(callees);
+	free(seen);
+	free(functions.callees);
+	free(functions.placed);
+	free(functions.calleesEnd);
+	free(functions.calleesStart);
+}
+
+// text sections that can be merged, ".text..*" are the special kernel sections
+static bool isMergeableText(Elf *elf, Elf64_Section index)
+{
+	GElf_Shdr shdr = getSectionHeader(elf, index);
+	const char *name = getSectionName(elf, index);
+	if (shdr.sh_type != SHT_PROGBITS || !(shdr.sh_flags & SHF_EXECINSTR))
+		return false;
+	return strcmp(name, ".text") == 0 ||
+		   (strncmp(name, ".text.", strlen(".text.")) == 0 && name[strlen(".text.")] != '.');
+}
+
+static bool isColdText(const char *name)
+{
+	return strncmp(name, ".text.unlikely", strlen(".text.unlikely")) == 0 ||
+		   strncmp(name, ".text.cold", strlen(".text.cold")) == 0;
+}
+
+static Elf_Scn *addMergedSection(Elf *elf, Elf *outElf, Elf64_Section index, const char *name)
+{
+	GElf_Shdr oldShdr = getSectionHeader(elf, index);
+	GElf_Shdr newShdr;
+	Elf_Scn *newScn = elf_newscn(outElf);
+	Elf_Data *newData = elf_newdata(newScn);
+	gelf_getshdr(newScn, &newShdr);
+	newShdr.sh_type = oldShdr.sh_type;
+	newShdr.sh_flags = oldShdr.sh_flags;
+	newShdr.sh_entsize = oldShdr.sh_entsize;
+	newShdr.sh_name = dekuAddString(&OutSectionNames, name);
+	newData->d_type = elf_getdata(elf_getscn(elf, index), NULL)->d_type;
+	gelf_update_shdr(newScn, &newShdr);
+	CopiedScnMap[index] = newScn;
+	return newScn;
+}
+
+/*
+ * Put the text of the copied functions in one ".text" section and the cold
+ * text in one ".text.unlikely" section, in the order of the calls. Separate
+ * sections of every function would be aligned and placed by the module loader
+ * independently.
+ */
+static void mergeTextSections(Elf *elf, Elf *outElf, const bool *symToCopy, const size_t *copied,
+							  size_t copiedCount)
+{
+	static const char *names[] = { ".text", ".text.unlikely" };
+	static const char *relNames[] = { ".rela.text", ".rela.text.unlikely" };
+	PackedSection *merged[2] = { NULL, NULL };
+	Elf_Scn *mergedRel[2] = { NULL, NULL };
+	size_t align[2] = { 1, 1 };
+
+	size_t *order = malloc((copiedCount + 1) * sizeof(size_t));
+	CHECK_ALLOC(order);
+	orderByCalls(elf, symToCopy, copied, copiedCount, order);
+	for (size_t i = 0; i < copiedCount; i++)
+	{
+		size_t index = Symbols.secIndex[order[i]];
+		if (index == 0 || index >= SectionsCount || CopiedScnMap[index] != NULL ||
+			!isMergeableText(elf, index))
+			continue;
+
+		Elf_Scn *scn = elf_getscn(elf, index);
+		Elf_Data *data = elf_getdata(scn, NULL);
+		GElf_Shdr shdr;
+		gelf_getshdr(scn, &shdr);
+		if (data == NULL || data->d_buf == NULL || data->d_size < shdr.sh_size)
+			LOG_ERR("Can't get data of the %s section", getSectionName(elf, index));
+		int cold = isColdText(getSectionName(elf, index));
+		if (merged[cold] == NULL)
+		{
+			merged[cold] = &PackedSections[index];
+			merged[cold]->scn = addMergedSection(elf, outElf, index, names[cold]);
+		}
+		PackedSection *out = merged[cold];
+		CopiedScnMap[index] = out->scn;
+
+		// gaps between the functions are filled with int3
+		size_t secAlign = shdr.sh_addralign > 1 ? shdr.sh_addralign : 1;
+		size_t offset = (out->size + secAlign - 1) / secAlign * secAlign;
+		out->buf = realloc(out->buf, offset + shdr.sh_size + 1);
+		CHECK_ALLOC(out->buf);
+		memset(out->buf + out->size, 0xcc, offset - out->size);
+		memcpy(out->buf + offset, data->d_buf, shdr.sh_size);
+		out->size = offset + shdr.sh_size;
+		CopiedScnOffset[index] = offset;
+		if (secAlign > align[cold])
+			align[cold] = secAlign;
+
+		Elf_Scn *relScn = getRelForSectionIndex(elf, index);
+		if (relScn == NULL)
+			continue;
+		if (mergedRel[cold] == NULL)
+			mergedRel[cold] = addMergedSection(elf, outElf, elf_ndxscn(relScn), relNames[cold]);
+		CopiedScnMap[elf_ndxscn(relScn)] = mergedRel[cold];
+	}
+	free(order);
+
+	for (int cold = 0; cold < 2; cold++)
+	{
+		if (merged[cold] == NULL)
+			continue;
+		Elf_Data *newData = elf_getdata(merged[cold]->scn, NULL);
+		newData->d_buf = merged[cold]->buf;
+		newData->d_size = merged[cold]->size;
+		newData->d_align = align[cold];
+		GElf_Shdr shdr;
+		gelf_getshdr(merged[cold]->scn, &shdr);
+		shdr.sh_size = merged[cold]->size;
+		shdr.sh_addralign = align[cold];
+		gelf_update_shdr(merged[cold]->scn, &shdr);
+	}
+}
+
+static void copySymbols(Elf *elf, Elf *outElf, char **symbols)
+{
+	Elf_Scn *scn;
+	GElf_Sym sym;
+	size_t symIndex;
+	char **syms = symbols;
+	while(*syms != NULL)
+	{
+		sym = getSymbolByName(elf, *syms, &symIndex);
+		if (sym.st_name == 0)
+			LOG_ERR("Can't find symbol: %s", *syms);
+		syms++;
+	}
+
+	bool *symToCopy = calloc(sizeof(bool), Symbols.count);
+	CHECK_ALLOC(symToCopy);
+	for (syms = symbols; *syms != NULL; syms++)
+	{
+		getSymbolByName(elf, *syms, &symIndex);
+		symToCopy[symIndex] = true;
+	}
+
+	size_t *copied = calloc(Symbols.count, sizeof(size_t));
+	CHECK_ALLOC(copied);
+	size_t copiedCount = 0;
+	for (size_t i = 0; i < Symbols.count; i++)
+	{
+		if (symToCopy[i])
+			copied[copiedCount++] = i;
+	}
+	mergeTextSections(elf, outElf, symToCopy, copied, copiedCount);
+
+	for (size_t i = 0; i < Symbols.count; i++)
+	{
+		if (!symToCopy[i])
+			continue;
+
+		sym = getSymbolByIndex(elf, i);
+		Elf_Scn *newScn = copySection(elf, outElf, sym.st_shndx, true);
+		size_t index = copySymbol(elf, outElf, i, true);
+		OutSymbols.syms[index].st_shndx = elf_ndxscn(newScn);
+	}
+
+	for (size_t i = 0; i < Symbols.count; i++)
+	{
+		if (!symToCopy[i])
+			continue;
+
+		sym = getSymbolByIndex(elf, i);
+		copySectionWithRel(elf, outElf, sym.st_shndx, &sym);
+	}
+
+	// BUG() needs the __bug_table
+	const char *tableSections[] = {".altinstructions", "__bug_table"};
+	for (size_t i = 0; i < sizeof(tableSections) / sizeof(*tableSections); i++)
+	{
+		scn = getSectionByName(elf, tableSections[i]);
+		if (scn)
+			copyTableSection(elf, outElf, elf_ndxscn(scn), getTableSection(tableSections[i]),
+							 copied, copiedCount);
+	}
+	// code referenced by the copied .altinstructions records and by the copied functions
+	scn = getSectionByName(elf, ".altinstr_replacement");
+	if (scn && CopiedScnMap[elf_ndxscn(scn)] != NULL)
+	{
+		LOG_DEBUG("Copy .altinstr_replacement section");
+		copyReplacementRelocs(elf, outElf, elf_ndxscn(scn), copied, copiedCount);
+	}
+	free(copied);
+	scn = getSectionByName(elf, ".altinstr_aux");
+	if (scn && CopiedScnMap[elf_ndxscn(scn)] != NULL)
+	{
+		LOG_DEBUG("Copy .altinstr_aux section");
+		copySectionWithRel(elf, outElf, elf_ndxscn(scn), NULL);
+	}
+	checkStaticKeys(elf, symToCopy);
+
+	// TODO: Fix file path in string sections
+
+	writeOutputSymtab(outElf);
+	writeOutputNames(outElf);
+
+	elf_update(outElf, ELF_C_WRITE);
+	closeOutputElf();
+
+	free(symToCopy);
+}
+
+static Elf *openElf(const char *filePath, int *fd)
+{
+	*fd = open(filePath, O_RDONLY);
+	if (*fd == -1)
+		LOG_ERR("Cannot open file '%s': %s", filePath, strerror(errno));
+
+	Elf *elf = elf_begin(*fd, ELF_C_READ_MMAP, NULL);
+	if (elf == NULL)
+	{
+		close(*fd);
+		LOG_ERR("Problems opening '%s' as ELF file: %s", filePath, elf_errmsg(-1));
+	}
+
+	size_t shstrndx;
+	if (elf_getshdrstrndx(elf, &shstrndx))
+	{
+		elf_end(elf);
+		close(*fd);
+		LOG_ERR("Cannot get section header string index in %s", filePath);
+	}
+
+	buildElfIndex(elf);
+	getElfIndex(elf)->fd = *fd;
+
+	if (getSectionByName(elf, ".strtab") == NULL)
+		LOG_ERR("Failed to find .strtab section");
+	if (getSectionByName(elf, ".symtab") == NULL)
+		LOG_ERR("Failed to find .symtab section");
+
+	return elf;
+}
+
+static void closeElf(Elf *elf, int fd)
+{
+	freeElfIndex(elf);
+	elf_end(elf);
+	if (fd != -1)
+		close(fd);
+}
+
+// release everything left after a job that failed in the middle
+static void releaseThreadState(void)
+{
+	closeOutputElf();
+	freePackedSections();
+	free(CopiedScnOffset);
+	CopiedScnOffset = NULL;
+	free(CopiedScnMap);
+	CopiedScnMap = NULL;
+	freeSymbols();
+	while (ElfIndexes != NULL)
+		closeElf(ElfIndexes->elf, ElfIndexes->fd);
+}
+
+static void readCallees(Elf *elf)
+{
+	size_t cnt = Symbols.count;
+	size_t *seen = calloc(cnt, sizeof(size_t));
+	size_t *callees = malloc(cnt * sizeof(size_t));
+	size_t capacity = cnt;
+	size_t total = 0;
+	size_t *edges = malloc(capacity * sizeof(size_t));
+	CHECK_ALLOC(seen);
+	CHECK_ALLOC(callees);
+	CHECK_ALLOC(edges);
+	Symbols.calleesStart = arenaAlloc(&Symbols.arena, (cnt + 1) * sizeof(size_t));
+	for (size_t i = 0; i < cnt; i++)
+	{
+		Symbols.calleesStart[i] = total;
+		if (!Symbols.isFun[i])
+			continue;
+		size_t calleesCnt = symbolCallees(elf, i, callees, seen);
+		if (total + calleesCnt > capacity)
+		{
+			while (total + calleesCnt > capacity)
+				capacity *= 2;
+			edges = realloc(edges, capacity * sizeof(size_t));
+			CHECK_ALLOC(edges);
+		}
+		memcpy(edges + total, callees, calleesCnt * sizeof(size_t));
+		total += calleesCnt;
+	}
+	Symbols.calleesStart[cnt] = total;
+	Symbols.callees = arenaAlloc(&Symbols.arena, (total + 1) * sizeof(size_t));
+	memcpy(Symbols.callees, edges, total * sizeof(size_t));
+	free(edges);
+	free(callees);
+	free(seen);
+
+	// reverse graph
+	Symbols.callersStart = arenaAlloc(&Symbols.arena, (cnt + 1) * sizeof(size_t));
+	Symbols.callers = arenaAlloc(&Symbols.arena, (total + 1) * sizeof(size_t));
+	for (size_t i = 0; i < total; i++)
+		Symbols.callersStart[Symbols.callees[i] + 1]++;
+	for (size_t i = 0; i < cnt; i++)
+		Symbols.callersStart[i + 1] += Symbols.callersStart[i];
+	size_t *fill = calloc(cnt, sizeof(size_t));
+	CHECK_ALLOC(fill);
+	for (size_t i = 0; i < cnt; i++)
+	{
+		for (size_t j = Symbols.calleesStart[i]; j < Symbols.calleesStart[i + 1]; j++)
+		{
+			size_t callee = Symbols.callees[j];
+			Symbols.callers[Symbols.callersStart[callee] + fill[callee]++] = i;
+		}
+	}
+	free(fill);
+}
+
+static size_t getFunctionIndex(Elf *elf, const char *name)
+{
+	ElfIndex *index = getRequiredElfIndex(elf);
+	size_t i = 0;
+	while ((i = nextSymbolWithName(index, name, STT_FUNC, i)) != 0)
+	{
+		if (Symbols.isFun[i])
+			return i;
+	}
+	LOG_ERR("Can't find function: %s", name);
+}
+
+typedef void (*ChainHandler)(const size_t *chain, size_t len, void *arg);
+
+/*
+ * Find callers of function "symIndex" up to the callers marked in "isRoot".
+ * Functions that are on a chain from "symIndex" to a root are marked in
+ * "onChain" and the roots are saved in "roots". Each function is visited once
+ * going up from "symIndex" and once going down from the roots. "reachedFrom"
+ * (optional) keeps the callee through which the caller was reached first.
+ * Returns number of found roots.
+ */
+static size_t findCallerChains(size_t symIndex, const bool *isRoot, bool *onChain,
+							   size_t *reachedFrom, size_t *roots)
+{
+	size_t *queue = malloc(Symbols.count * sizeof(size_t));
+	bool *reached = calloc(Symbols.count, sizeof(bool));
+	CHECK_ALLOC(queue);
+	CHECK_ALLOC(reached);
+
+	size_t rootCount = 0;
+	size_t head = 0, tail = 0;
+	queue[tail++] = symIndex;
+	reached[symIndex] = true;
+	while (head < tail)
+	{
+		size_t fun = queue[head++];
+		if (fun != symIndex && isRoot[fun])
+		{
+			roots[rootCount++] = fun;
+			continue;
+		}
+		for (size_t i = Symbols.callersStart[fun]; i < Symbols.callersStart[fun + 1]; i++)
+		{
+			size_t caller = Symbols.callers[i];
+			if (reached[caller])
+				continue;
+			reached[caller] = true;
+			if (reachedFrom != NULL)
+				reachedFrom[caller] = fun;
+			queue[tail++] = caller;
+		}
+	}
+
+	// reached function is on a chain if it's called by a root or by a function on a chain
+	head = tail = 0;
+	for (size_t i = 0; i < rootCount; i++)
+	{
+		onChain[roots[i]] = true;
+		queue[tail++] = roots[i];
+	}
+	while (head < tail)
+	{
+		size_t fun = queue[head++];
+		for (size_t i = Symbols.calleesStart[fun]; i < Symbols.calleesStart[fun + 1]; i++)
+		{
+			size_t callee = Symbols.callees[i];
+			if (!reached[callee] || onChain[callee])
+				continue;
+			if (callee != symIndex && isRoot[callee])
+				continue;
+			onChain[callee] = true;
+			// chains don't go through the function twice
+			if (callee != symIndex)
+				queue[tail++] = callee;
+		}
+	}
+	free(queue);
+	free(reached);
+	return rootCount;
+}
+
+/*
+ * Find every call chain that starts in function "symIndex". "visited" keeps
+ * the root index + 1 for functions already reached from the root, so it
+ * doesn't need a reset.
+ */
+static void walkCallees(size_t symIndex, size_t *callStack, size_t depth, size_t *chain,
+						size_t *visited, size_t root, ChainHandler handler, void *arg)
+{
+	// function that is on the stack is visited as well, so cycles stop here
+	if (visited[symIndex] == root + 1)
+		return;
+	visited[symIndex] = root + 1;
+
+	callStack[depth++] = symIndex;
+	size_t first = Symbols.calleesStart[symIndex];
+	size_t last = Symbols.calleesStart[symIndex + 1];
+	if (first == last)
+	{
+		// chain is passed from the last called function
+		for (size_t i = 0; i < depth; i++)
+			chain[i] = callStack[depth - i - 1];
+		handler(chain, depth, arg);
+		return;
+	}
+	for (size_t i = first; i < last; i++)
+		walkCallees(Symbols.callees[i], callStack, depth, chain, visited, root, handler, arg);
+}
+
+typedef struct
+{
+	DekuChainHandler handler;
+	void *arg;
+	const char **names;
+} ChainNames;
+
+// pass the chain to the handler from the library user
+static void forwardChain(const size_t *chain, size_t len, void *arg)
+{
+	ChainNames *names = (ChainNames *)arg;
+	for (size_t i = 0; i < len; i++)
+		names->names[i] = Symbols.name[chain[i]];
+	names->handler(names->names, len, names->arg);
+}
+
+typedef struct
+{
+	char *name;
+	char *value;
+	size_t count;
+} NameMapEntry;
+
+// open addressing map from a symbol name to a value and number of occurrences
+typedef struct
+{
+	NameMapEntry *entries;
+	size_t mask;
+	size_t count;
+} NameMap;
+
+static NameMapEntry *findNameMapSlot(const NameMap *map, const char *name)
+{
+	size_t slot = dekuHashName(name) & map->mask;
+	while (map->entries[slot].name != NULL && strcmp(map->entries[slot].name, name) != 0)
+		slot = (slot + 1) & map->mask;
+	return &map->entries[slot];
+}
+
+static const NameMapEntry *findNameMapEntry(const NameMap *map, const char *name)
+{
+	if (map->entries == NULL)
+		return NULL;
+	const NameMapEntry *entry = findNameMapSlot(map, name);
+	return entry->name != NULL ? entry : NULL;
+}
+
+// value of the first occurrence of the name is kept
+static void addNameMapEntry(NameMap *map, const char *name, const char *value)
+{
+	if (map->entries == NULL || (map->count + 1) * 2 > map->mask + 1)
+	{
+		NameMap grown = { .mask = bucketsMask(map->count + 1) };
+		grown.entries = calloc(grown.mask + 1, sizeof(NameMapEntry));
+		CHECK_ALLOC(grown.entries);
+		for (size_t i = 0; map->entries != NULL && i <= map->mask; i++)
+		{
+			if (map->entries[i].name != NULL)
+				*findNameMapSlot(&grown, map->entries[i].name) = map->entries[i];
+		}
+		grown.count = map->count;
+		free(map->entries);
+		*map = grown;
+	}
+
+	NameMapEntry *entry = findNameMapSlot(map, name);
+	if (entry->name == NULL)
+	{
+		entry->name = strdup(name);
+		CHECK_ALLOC(entry->name);
+		if (value != NULL)
+		{
+			entry->value = strdup(value);
+			CHECK_ALLOC(entry->value);
+		}
+		map->count++;
+	}
+	entry->count++;
+}
+
+static void freeNameMap(NameMap *map)
+{
+	for (size_t i = 0; map->entries != NULL && i <= map->mask; i++)
+	{
+		free(map->entries[i].name);
+		free(map->entries[i].value);
+	}
+	free(map->entries);
+	memset(map, 0, sizeof(*map));
+}
+
+/*
+ * Functions defined in the reference object file. When the context caches
+ * them, they are kept for every reference file until the context is closed or
+ * the kernel version is changed.
+ */
+typedef struct RefFunctions
+{
+	char *path;
+	struct timespec mtime;
+	off_t size;
+	NameMap names;
+	struct RefFunctions *next;
+} RefFunctions;
+
+/*
+ * Indexes of the kernel build. They are loaded on first use and dropped when
+ * content of the kernel version file changes.
+ */
+typedef struct
+{
+	char *versionFile;
+	char *systemMap;
+	char *symvers;
+	char *symbolsDir;
+	char *version;
+	bool loaded;
+	// System.map: symbol -> number of occurrences
+	NameMap kernelSymbols;
+	// Module.symvers: symbol -> module
+	NameMap exportedSymbols;
+	// symbols defined in the modules dumped to SYMBOLS_DIR: symbol -> module
+	NameMap moduleSymbols;
+} KernelIndex;
+
+// symbol index file mapped by the lookups, see dekuBuildSymbolIndex()
+typedef struct
+{
+	char *path;
+	void *data;
+	size_t size;
+	ino_t inode;
+	struct timespec mtime;
+} SymbolIndexMap;
+
+struct DekuContext
+{
+	bool debug;
+	int errorCode;
+	char errorMessage[DEKU_ERROR_MESSAGE_LEN];
+	bool cacheRefFunctions;
+	bool keepMetadataChanges;
+	// stale entries are kept until the cache is dropped since they may be used
+	RefFunctions *refFunctions;
+	pthread_mutex_t refFunctionsLock;
+	KernelIndex kernel;
+	SymbolIndexMap symbolIndex;
+	// directory with the fingerprints of the origin files, see getOriginFingerprints()
+	char *fingerprintsDir;
+};
+
+// context of the library call running in the current thread
+static __thread DekuContext *Context = NULL;
+
+static RefFunctions *readRefFunctions(const char *refFile, const struct stat *st)
+{
+	RefFunctions *ref = calloc(1, sizeof(RefFunctions));
+	CHECK_ALLOC(ref);
+	ref->path = strdup(refFile);
+	CHECK_ALLOC(ref->path);
+	ref->mtime = st->st_mtim;
+	ref->size = st->st_size;
+
+	int fd;
+	Elf *refElf = openElf(refFile, &fd);
+	ElfIndex *refIndex = getRequiredElfIndex(refElf);
+	for (size_t i = 1; i < refIndex->symCount; i++)
+	{
+		const Elf64_Sym *sym = &refIndex->syms[i];
+		if (ELF64_ST_TYPE(sym->st_info) == STT_FUNC && sym->st_shndx != SHN_UNDEF)
+			addNameMapEntry(&ref->names, refIndex->symNames[i], NULL);
+	}
+	closeElf(refElf, fd);
+	return ref;
+}
+
+static void freeRefFunctions(RefFunctions *ref)
+{
+	freeNameMap(&ref->names);
+	free(ref->path);
+	free(ref);
+}
+
+static void dropRefFunctionsCache(DekuContext *ctx)
+{
+	while (ctx->refFunctions != NULL)
+	{
+		RefFunctions *next = ctx->refFunctions->next;
+		freeRefFunctions(ctx->refFunctions);
+		ctx->refFunctions = next;
+	}
+}
+
+// returned functions must be released by putRefFunctions()
+static RefFunctions *getRefFunctions(const char *refFile)
+{
+	struct stat st;
+	if (stat(refFile, &st) != 0)
+		LOG_ERR("Cannot open reference file '%s': %s", refFile, strerror(errno));
+	if (!Context->cacheRefFunctions)
+		return readRefFunctions(refFile, &st);
+
+	pthread_mutex_lock(&Context->refFunctionsLock);
+	RefFunctions *ref = Context->refFunctions;
+	while (ref != NULL && (strcmp(ref->path, refFile) != 0 || ref->size != st.st_size ||
+		   ref->mtime.tv_sec != st.st_mtim.tv_sec || ref->mtime.tv_nsec != st.st_mtim.tv_nsec))
+		ref = ref->next;
+	pthread_mutex_unlock(&Context->refFunctionsLock);
+	if (ref != NULL)
+		return ref;
+
+	// the lock is not held while the file is read since reading may fail
+	ref = readRefFunctions(refFile, &st);
+	pthread_mutex_lock(&Context->refFunctionsLock);
+	ref->next = Context->refFunctions;
+	Context->refFunctions = ref;
+	pthread_mutex_unlock(&Context->refFunctionsLock);
+	return ref;
+}
+
+static void putRefFunctions(RefFunctions *ref)
+{
+	if (!Context->cacheRefFunctions)
+		freeRefFunctions(ref);
+}
+
+/*
+ * Mark functions where call chains found by findCallerChains() end. Without
+ * reference file these are functions that are not called by any function.
+ * Otherwise these are functions that exists in the reference file, i.e.
+ * functions that are not inlined there.
+ */
+static bool *findRootFunctions(const char *refFile)
+{
+	// read the reference file first, so nothing is leaked when it fails
+	RefFunctions *ref = refFile != NULL ? getRefFunctions(refFile) : NULL;
+	bool *isRoot = calloc(Symbols.count, sizeof(bool));
+	CHECK_ALLOC(isRoot);
+	if (ref == NULL)
+	{
+		for (size_t i = 0; i < Symbols.count; i++)
+			isRoot[i] = Symbols.isFun[i] && Symbols.callersStart[i] == Symbols.callersStart[i + 1];
+		return isRoot;
+	}
+
+	for (size_t i = 0; i < Symbols.count; i++)
+		isRoot[i] = Symbols.isFun[i] && findNameMapEntry(&ref->names, Symbols.name[i]) != NULL;
+	putRefFunctions(ref);
+	return isRoot;
+}
+
+/*
+ * Inlined copies of the functions are read from the DWARF with the libdw. The
+ * libdwfl opens the relocatable object on its own, because it applies the
+ * relocations of the debug sections that the libdw doesn't.
+ */
+typedef struct
+{
+	// inlined function and the out-of-line function with its copy
+	const char *function;
+	const char *container;
+} InlinedCopy;
+
+typedef struct
+{
+	InlinedCopy *copies;
+	size_t count;
+	size_t capacity;
+	// names of the inlined functions point to the debug info read by it
+	Dwfl *dwfl;
+} InlinedCopies;
+
+typedef struct
+{
+	Dwfl_Module *module;
+	Dwarf_Addr bias;
+	ElfIndex *index;
+	InlinedCopies *copies;
+	// reading stops on malformed data
+	bool failed;
+} DwarfWalk;
+
+static void addInlinedCopy(InlinedCopies *copies, const char *function, const char *container)
+{
+	if (copies->count == copies->capacity)
+	{
+		copies->capacity = copies->capacity ? copies->capacity * 2 : 64;
+		copies->copies = realloc(copies->copies, copies->capacity * sizeof(InlinedCopy));
+		CHECK_ALLOC(copies->copies);
+	}
+	InlinedCopy copy = { .function = function, .container = container };
+	copies->copies[copies->count++] = copy;
+}
+
+static void freeInlinedCopies(InlinedCopies *copies)
+{
+	free(copies->copies);
+	if (copies->dwfl != NULL)
+		dwfl_end(copies->dwfl);
+	memset(copies, 0, sizeof(*copies));
+}
+
+static int compareInlinedCopy(const void *a, const void *b)
+{
+	const InlinedCopy *left = (const InlinedCopy *)a;
+	const InlinedCopy *right = (const InlinedCopy *)b;
+	int cmp = strcmp(left->function, right->function);
+	return cmp != 0 ? cmp : strcmp(left->container, right->container);
+}
+
+// name of the function symbol at the address, NULL if there is none
+static const char *getFunctionAt(const ElfIndex *index, Elf64_Section section, uint64_t address)
+{
+	size_t sym = findSymbolCovering(index, section, address, 0);
+	if (sym == 0 || ELF64_ST_TYPE(index->symInfo[sym]) != STT_FUNC ||
+		index->symNames[sym][0] == '\0')
+		return NULL;
+	return index->symNames[sym];
+}
+
+// name of the subprogram, from its abstract origin or specification if needed
+static const char *getSubprogramName(Dwarf_Die *die)
+{
+	Dwarf_Attribute attr;
+	return dwarf_formstring(dwarf_attr_integrate(die, DW_AT_name, &attr));
+}
+
+static const char *getContainerName(DwarfWalk *walk, Dwarf_Die *die)
+{
+	// names of the clones like "foo.isra.0" are known only from the symbols
+	Dwarf_Addr address;
+	if (dwarf_lowpc(die, &address) == 0)
+	{
+		Dwarf_Addr bias;
+		address += walk->bias;
+		Elf_Scn *scn = dwfl_module_address_section(walk->module, &address, &bias);
+		const char *symbol = scn != NULL ? getFunctionAt(walk->index, elf_ndxscn(scn), address)
+										 : NULL;
+		if (symbol != NULL)
+			return symbol;
+	}
+	return getSubprogramName(die);
+}
+
+// add copies inlined in the entries below the out-of-line function
+static void addInlinedCopiesIn(DwarfWalk *walk, Dwarf_Die *parent, const char *container)
+{
+	Dwarf_Die die;
+	int res = dwarf_child(parent, &die);
+	while (res == 0)
+	{
+		Dwarf_Attribute attr;
+		Dwarf_Die origin;
+		if (dwarf_tag(&die) == DW_TAG_inlined_subroutine &&
+			dwarf_formref_die(dwarf_attr(&die, DW_AT_abstract_origin, &attr), &origin) != NULL)
+		{
+			const char *function = getSubprogramName(&origin);
+			if (function != NULL)
+				addInlinedCopy(walk->copies, function, container);
+		}
+		addInlinedCopiesIn(walk, &die, container);
+		res = dwarf_siblingof(&die, &die);
+	}
+	if (res < 0)
+		walk->failed = true;
+}
+
+/*
+ * The container of the copy is the outermost subprogram, so the copies inlined
+ * through several levels of inline functions belong to the out-of-line
+ * function.
+ */
+static void findInlinedCopies(DwarfWalk *walk, Dwarf_Die *parent)
+{
+	Dwarf_Die die;
+	int res = dwarf_child(parent, &die);
+	while (res == 0 && !walk->failed)
+	{
+		if (dwarf_tag(&die) == DW_TAG_subprogram)
+		{
+			const char *container = getContainerName(walk, &die);
+			if (container != NULL)
+				addInlinedCopiesIn(walk, &die, container);
+		}
+		else
+		{
+			findInlinedCopies(walk, &die);
+		}
+		res = dwarf_siblingof(&die, &die);
+	}
+	if (res < 0)
+		walk->failed = true;
+}
+
+/*
+ * Read inlined copies of the functions from the debug info of the file. Strings
+ * are valid until the file is closed and the copies are freed. Returns false if
+ * the file has no usable debug info.
+ */
+static bool readInlinedCopies(Elf *elf, const char *filePath, InlinedCopies *copies)
+{
+	static const Dwfl_Callbacks callbacks =
+	{
+		.find_debuginfo = dwfl_standard_find_debuginfo,
+		.section_address = dwfl_offline_section_address,
+	};
+	memset(copies, 0, sizeof(*copies));
+	copies->dwfl = dwfl_begin(&callbacks);
+	CHECK_ALLOC(copies->dwfl);
+	DwarfWalk walk = { .index = getRequiredElfIndex(elf), .copies = copies };
+	walk.module = dwfl_report_offline(copies->dwfl, filePath, filePath, -1);
+	dwfl_report_end(copies->dwfl, NULL, NULL);
+	Dwarf *dwarf = walk.module != NULL ? dwfl_module_getdwarf(walk.module, &walk.bias) : NULL;
+	if (dwarf == NULL)
+	{
+		LOG_DEBUG("Can't read DWARF from '%s': %s", filePath, dwfl_errmsg(-1));
+		freeInlinedCopies(copies);
+		return false;
+	}
+
+	Dwarf_Off offset = 0;
+	Dwarf_Off next;
+	size_t headerSize;
+	int res;
+	while (!walk.failed &&
+		   (res = dwarf_nextcu(dwarf, offset, &next, &headerSize, NULL, NULL, NULL)) == 0)
+	{
+		Dwarf_Die unit;
+		if (dwarf_offdie(dwarf, offset + headerSize, &unit) == NULL)
+			walk.failed = true;
+		// type units and skeleton units of the split DWARF have no code
+		else if (dwarf_tag(&unit) == DW_TAG_compile_unit ||
+				 dwarf_tag(&unit) == DW_TAG_partial_unit)
+			findInlinedCopies(&walk, &unit);
+		offset = next;
+	}
+	if (walk.failed || res < 0)
+	{
+		LOG_DEBUG("Can't read DWARF at offset 0x%llx: %s", (unsigned long long)offset,
+				  dwarf_errmsg(-1));
+		freeInlinedCopies(copies);
+		return false;
+	}
+	if (copies->count > 0)
+		qsort(copies->copies, copies->count, sizeof(InlinedCopy), compareInlinedCopy);
+	return true;
+}
+
+/*
+ * Call the handler for every out-of-line function with an inlined copy of the
+ * function. Clones like "foo.isra.0" are inlined copies of "foo".
+ */
+static void forEachInlinedCopy(const InlinedCopies *copies, const char *function,
+							   DekuSymbolHandler handler, void *arg)
+{
+	const char *suffix = strchr(function + 1, '.');
+	char *name = suffix != NULL ? strndup(function, suffix - function) : strdup(function);
+	CHECK_ALLOC(name);
+
+	size_t low = 0;
+	size_t high = copies->count;
+	while (low < high)
+	{
+		size_t mid = low + (high - low) / 2;
+		if (strcmp(copies->copies[mid].function, name) < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	const char *prev = NULL;
+	for (size_t i = low; i < copies->count && strcmp(copies->copies[i].function, name) == 0; i++)
+	{
+		// copies are sorted by the container too, so duplicates are adjacent
+		if (prev == NULL || strcmp(prev, copies->copies[i].container) != 0)
+			handler(copies->copies[i].container, arg);
+		prev = copies->copies[i].container;
+	}
+	free(name);
+}
+
+static void extractFromElf(Elf *elf, const char *outFile, char **symbols)
+{
+	elf_getshdrnum(elf, &SectionsCount);
+	CopiedScnMap = calloc(SectionsCount, sizeof(Elf_Scn *));
+	CHECK_ALLOC(CopiedScnMap);
+	CopiedScnOffset = calloc(SectionsCount, sizeof(size_t));
+	CHECK_ALLOC(CopiedScnOffset);
+	PackedSections = calloc(SectionsCount, sizeof(PackedSection));
+	CHECK_ALLOC(PackedSections);
+
+	Elf *outElf = createNewElf(outFile);
+	copySymbols(elf, outElf, symbols);
+
+	freePackedSections();
+	free(CopiedScnOffset);
+	CopiedScnOffset = NULL;
+	free(CopiedScnMap);
+	CopiedScnMap = NULL;
+}
+
+/*
+ * Job from the batch manifest. Every line of the manifest is:
+ * <ORIGIN_ELF>\t<NEW_ELF>\t<OUT_ELF>[\t<REF_ELF>]
+ * REF_ELF is the file built by the kernel and it's used to find functions
+ * inlined there.
+ */
+typedef struct
+{
+	char *originFile;
+	char *newFile;
+	char *outFile;
+	char *refFile;
+	// results of the job, see runBatchJob()
+	char *result;
+	size_t resultSize;
+} BatchJob;
+
+typedef struct
+{
+	DekuContext *ctx;
+	BatchJob *jobs;
+	size_t count;
+	size_t next;
+	pthread_mutex_t lock;
+} BatchQueue;
+
+typedef struct
+{
+	FILE *out;
+	size_t job;
+	bool *toExtract;
+	bool *toPatch;
+	// buffers for findCallerChains()
+	bool *onChain;
+	size_t *roots;
+} BatchChains;
+
+static void markRoot(BatchChains *chains, size_t root)
+{
+	chains->toExtract[root] = true;
+	if (!chains->toPatch[root])
+	{
+		chains->toPatch[root] = true;
+		fprintf(chains->out, "%zu\tlivepatch\t%s\n", chains->job, Symbols.name[root]);
+	}
+}
+
+// mark chains from function "fun" up to the callers marked in "isRoot"
+static void markCallers(BatchChains *chains, size_t fun, const bool *isRoot)
+{
+	memset(chains->onChain, 0, Symbols.count * sizeof(bool));
+	size_t rootCount = findCallerChains(fun, isRoot, chains->onChain, NULL, chains->roots);
+	for (size_t i = 0; i < Symbols.count; i++)
+	{
+		if (chains->onChain[i])
+			chains->toExtract[i] = true;
+	}
+	for (size_t i = 0; i < rootCount; i++)
+		markRoot(chains, chains->roots[i]);
+}
+
+typedef struct
+{
+	Elf *elf;
+	BatchChains *chains;
+	const bool *isRoot;
+	size_t function;
+	// containers found in the new file
+	bool *isContainer;
+	size_t marked;
+	// a container is not a root function of the new file
+	bool missing;
+} InlinedChains;
+
+// mark the out-of-line function with an inlined copy like a chain found by markCallers()
+static void markInlinedCopy(const char *container, void *arg)
+{
+	InlinedChains *inlined = (InlinedChains *)arg;
+	ElfIndex *index = getRequiredElfIndex(inlined->elf);
+	size_t i = 0;
+	while ((i = nextSymbolWithName(index, container, STT_FUNC, i)) != 0 && !Symbols.isFun[i])
+		;
+	if (i == 0 || !inlined->isRoot[i])
+	{
+		inlined->missing = true;
+		return;
+	}
+	inlined->chains->toExtract[inlined->function] = true;
+	markRoot(inlined->chains, i);
+	inlined->isContainer[i] = true;
+	inlined->marked++;
+}
+
+static bool isInSection(Elf *elf, const char *name, const char *secName)
+{
+	GElf_Sym sym;
+	if (!getSymbolByNameAndType(elf, name, STT_FUNC, &sym))
+		return false;
+	return strcmp(getSectionName(elf, sym.st_shndx), secName) == 0;
+}
+
+// "section" is FINGERPRINT_INIT_TEXT or FINGERPRINT_EXIT_TEXT
+static bool isOriginInSection(Elf *originElf, const Fingerprints *fingerprints, const char *name,
+							  int section)
+{
+	if (fingerprints == NULL)
+		return isInSection(originElf, name,
+						   section == FINGERPRINT_INIT_TEXT ? ".init.text" : ".exit.text");
+	const FingerprintEntry *entry = findFingerprint(fingerprints, name, STT_FUNC);
+	return entry != NULL && (entry->flags & section) != 0;
+}
+
+/*
+ * Fingerprints of the origin file read from the cache dir of the context. The
+ * cache file is named after the hash of the file content and the hash of the
+ * kernel version, on a miss the fingerprints are computed and saved.
+ * Returns false if the cache or the kernel version is not set.
+ */
+static bool getOriginFingerprints(const char *originFile, Fingerprints *fingerprints)
+{
+	const char *dir = Context->fingerprintsDir;
+	if (dir == NULL)
+		return false;
+	// fingerprints of the files built for other kernel must not be mixed up
+	const char *version = Context->kernel.version;
+	if (version == NULL)
+	{
+		LOG_DEBUG("Skip the fingerprints cache, the kernel version is not set");
+		return false;
+	}
+
+	int fd = open(originFile, O_RDONLY);
+	if (fd == -1)
+		LOG_ERR("Cannot open file '%s': %s", originFile, strerror(errno));
+	struct stat st;
+	void *content = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+		content = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (content == MAP_FAILED)
+		LOG_ERR("Cannot read file '%s'", originFile);
+	uint64_t fileHash = hash64(content, st.st_size, 0);
+	munmap(content, st.st_size);
+	uint64_t kernelHash = hash64((const uint8_t *)version, strlen(version), 0);
+
+	char path[PATH_MAX];
+	if (snprintf(path, sizeof(path), "%s/%016llx-%016llx.fp", dir, (unsigned long long)fileHash,
+				 (unsigned long long)kernelHash) >= (int)sizeof(path))
+		LOG_ERR("Path of the fingerprints cache is too long: %s", dir);
+	if (loadFingerprints(path, fileHash, kernelHash, fingerprints))
+	{
+		LOG_DEBUG("Use fingerprints of '%s' from '%s'", originFile, path);
+		return true;
+	}
+
+	Elf *elf = openElf(originFile, &fd);
+	*fingerprints = computeFingerprints(elf, fileHash, kernelHash);
+	closeElf(elf, fd);
+	if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+		LOG_DEBUG("Cannot create '%s': %s", dir, strerror(errno));
+	else
+		saveFingerprints(path, fingerprints);
+	return true;
+}
+
+// function is traceable if it starts with the call to __fentry__
+static bool isTraceable(Elf *elf, const char *name)
+{
+	GElf_Sym sym;
+	if (!getSymbolByNameAndType(elf, name, STT_FUNC, &sym))
+		return true;
+
+	const ElfIndex *index = getRequiredElfIndex(elf);
+	size_t count;
+	const GElf_Rela *relocs = getRelocsInRange(elf, sym.st_shndx, sym.st_value + 1,
+											   sym.st_value + 2, &count);
+	for (size_t i = 0; i < count; i++)
+	{
+		size_t symIndex = ELF64_R_SYM(relocs[i].r_info);
+		if (symIndex < index->symCount && strcmp(index->symNames[symIndex], "__fentry__") == 0)
+			return true;
+	}
+	return false;
+}
+
+// check whether ".cold" part of function is called only by the origin function
+static bool isColdCalledByOrigin(size_t fun)
+{
+	const char *name = Symbols.name[fun];
+	size_t originLen = strrchr(name, '.') - name;
+	for (size_t i = Symbols.callersStart[fun]; i < Symbols.callersStart[fun + 1]; i++)
+	{
+		const char *caller = Symbols.name[Symbols.callers[i]];
+		if (Symbols.callers[i] != fun &&
+			(strlen(caller) != originLen || strncmp(caller, name, originLen) != 0))
+			return false;
+	}
+	return true;
+}
+
+// allocations of runBatchJob() released also when the job fails
+typedef struct
+{
+	Fingerprints fingerprints;
+	DiffResult diff;
+	bool *toExtract;
+	bool *toPatch;
+	size_t *roots;
+	bool *onChain;
+	bool *isRoot;
+	InlinedCopies inlinedCopies;
+	bool *isContainer;
+	char **symbols;
+} BatchJobState;
+
+static void releaseBatchJobState(BatchJobState *state)
+{
+	free(state->fingerprints.data);
+	free(state->diff.entries);
+	free(state->toExtract);
+	free(state->toPatch);
+	free(state->roots);
+	free(state->onChain);
+	free(state->isRoot);
+	freeInlinedCopies(&state->inlinedCopies);
+	free(state->isContainer);
+	free(state->symbols);
+	memset(state, 0, sizeof(*state));
+}
+
+/*
+ * Find changes between the origin and new file, filter them and extract the
+ * changed symbols. Results are written as lines "<JOB>\t<KIND>\t<VALUE>":
+ * modified/new_function/new_variable - result of the diff
+ * init_function/exit_function - modified function that is skipped
+ * cold_split - ".cold" part of function that is called by other function
+ * inlined - modified function that is inlined in the reference file
+ * notrace - modified function that can't be traced in the reference file
+ * duplicate - modified function that has many instances in the kernel image
+ * livepatch - function to replace with the livepatch
+ * extract - symbol extracted to the output file
+ * status - "patch" if output file was created, "unchanged" if no valid
+ * changes were found or "error <CODE>"
+ */
+static void runBatchJob(BatchJob *job, size_t jobIndex)
+{
+	FILE *out = open_memstream(&job->result, &job->resultSize);
+	// the job without the result is reported as failed by dekuBatch()
+	if (out == NULL)
+	{
+		job->result = NULL;
+		return;
+	}
+	BatchJobState state = {0};
+	jmp_buf errorJmp;
+	if (setjmp(errorJmp) != 0)
+	{
+		JobErrorJmp = NULL;
+		releaseBatchJobState(&state);
+		releaseThreadState();
+		fprintf(out, "%zu\tstatus\terror %d\n", jobIndex, JobErrorCode);
+		fclose(out);
+		return;
+	}
+	JobErrorJmp = &errorJmp;
+
+	int originFd, newFd, refFd = -1;
+	bool useFingerprints = getOriginFingerprints(job->originFile, &state.fingerprints);
+	const Fingerprints *originFingerprints = useFingerprints ? &state.fingerprints : NULL;
+	Elf *originElf = useFingerprints ? NULL : openElf(job->originFile, &originFd);
+	Elf *newElf = openElf(job->newFile, &newFd);
+	Elf *refElf = job->refFile != NULL ? openElf(job->refFile, &refFd) : NULL;
+	const NameMap *kernelSymbols = Context->kernel.loaded ? &Context->kernel.kernelSymbols : NULL;
+	DiffResult *diff = &state.diff;
+	findModifiedSymbols(newElf, originElf, originFingerprints, diff);
+	readSymbols(newElf);
+	readCallees(newElf);
+
+	bool *toExtract = state.toExtract = calloc(Symbols.count, sizeof(bool));
+	bool *toPatch = state.toPatch = calloc(Symbols.count, sizeof(bool));
+	state.roots = malloc((Symbols.count + 1) * sizeof(size_t));
+	state.onChain = calloc(Symbols.count, sizeof(bool));
+	CHECK_ALLOC(toExtract);
+	CHECK_ALLOC(toPatch);
+	CHECK_ALLOC(state.roots);
+	CHECK_ALLOC(state.onChain);
+	bool *isRoot = state.isRoot = job->refFile != NULL ? findRootFunctions(job->refFile) : NULL;
+	BatchChains chains = { .out = out, .job = jobIndex, .toExtract = toExtract, .toPatch = toPatch,
+						   .onChain = state.onChain, .roots = state.roots };
+	// inlined copies in the reference file, read on the first inlined function
+	int hasInlinedCopies = -1;
+	bool changed = false;
+	for (size_t i = 0; i < diff->count; i++)
+	{
+		const DiffEntry *entry = &diff->entries[i];
+		size_t sym = entry->symIndex;
+		if (entry->kind == DEKU_NEW_FUNCTION || entry->kind == DEKU_NEW_VARIABLE)
+		{
+			fprintf(out, "%zu\t%s\t%s\n", jobIndex,
+					entry->kind == DEKU_NEW_FUNCTION ? "new_function" : "new_variable",
+					entry->name);
+			toExtract[sym] = true;
+			changed = true;
+			continue;
+		}
+		if (entry->cause == DEKU_CHANGE_METADATA && !Context->keepMetadataChanges)
+		{
+			fprintf(out, "%zu\tmetadata_only\t%s\n", jobIndex, entry->name);
+			continue;
+		}
+
+		if (isOriginInSection(originElf, originFingerprints, entry->name, FINGERPRINT_INIT_TEXT))
+		{
+			fprintf(out, "%zu\tinit_function\t%s\n", jobIndex, entry->name);
+			continue;
+		}
+		if (isOriginInSection(originElf, originFingerprints, entry->name, FINGERPRINT_EXIT_TEXT))
+		{
+			fprintf(out, "%zu\texit_function\t%s\n", jobIndex, entry->name);
+			continue;
+		}
+		size_t nameLen = strlen(entry->name);
+		bool isCold = nameLen > 5 && strcmp(entry->name + nameLen - 5, ".cold") == 0;
+		if (isCold && !isColdCalledByOrigin(sym))
+		{
+			fprintf(out, "%zu\tcold_split\t%s\n", jobIndex, entry->name);
+			continue;
+		}
+
+		static const char *causes[] =
+		{
+			[DEKU_CHANGE_CODE] = "code",
+			[DEKU_CHANGE_CALL] = "call",
+			[DEKU_CHANGE_DATA] = "data",
+			[DEKU_CHANGE_METADATA] = "metadata",
+		};
+		fprintf(out, "%zu\tmodified\t%s\n", jobIndex, entry->name);
+		fprintf(out, "%zu\tcause\t%s %s\n", jobIndex, entry->name, causes[entry->cause]);
+		changed = true;
+		if (refElf != NULL && !isCold && !isTraceable(refElf, entry->name))
+			fprintf(out, "%zu\tnotrace\t%s\n", jobIndex, entry->name);
+		const NameMapEntry *kernelSym = kernelSymbols != NULL ?
+										findNameMapEntry(kernelSymbols, entry->name) : NULL;
+		if (kernelSym != NULL && kernelSym->count > 1)
+			fprintf(out, "%zu\tduplicate\t%s\n", jobIndex, entry->name);
+		if (isRoot != NULL && !isRoot[sym])
+		{
+			fprintf(out, "%zu\tinlined\t%s\n", jobIndex, entry->name);
+			if (hasInlinedCopies == -1)
+				hasInlinedCopies = readInlinedCopies(refElf, job->refFile, &state.inlinedCopies);
+			InlinedChains inlined = { .elf = newElf, .chains = &chains, .isRoot = isRoot,
+									  .function = sym };
+			inlined.isContainer = state.isContainer = calloc(Symbols.count, sizeof(bool));
+			CHECK_ALLOC(inlined.isContainer);
+			if (hasInlinedCopies)
+				forEachInlinedCopy(&state.inlinedCopies, entry->name, markInlinedCopy, &inlined);
+			// without the debug info or when the copies are not in the new file
+			// the callers are found from the calls
+			if (inlined.marked == 0 || inlined.missing)
+				markCallers(&chains, sym, isRoot);
+			else
+				// functions called on the way from the containers are extracted as well
+				markCallers(&chains, sym, inlined.isContainer);
+			free(state.isContainer);
+			state.isContainer = NULL;
+		}
+		else
+		{
+			toExtract[sym] = true;
+			if (!toPatch[sym])
+				fprintf(out, "%zu\tlivepatch\t%s\n", jobIndex, entry->name);
+			toPatch[sym] = true;
+		}
+	}
+
+	size_t extractCnt = 0;
+	char **symbols = state.symbols = calloc(Symbols.count + 1, sizeof(char *));
+	CHECK_ALLOC(symbols);
+	for (size_t i = 0; i < Symbols.count; i++)
+	{
+		if (toExtract[i])
+			symbols[extractCnt++] = (char *)Symbols.name[i];
+	}
+	if (changed && extractCnt > 0)
+	{
+		extractFromElf(newElf, job->outFile, symbols);
+		for (size_t i = 0; i < extractCnt; i++)
+			fprintf(out, "%zu\textract\t%s\n", jobIndex, symbols[i]);
+		fprintf(out, "%zu\tstatus\tpatch\n", jobIndex);
+	}
+	else
+	{
+		fprintf(out, "%zu\tstatus\tunchanged\n", jobIndex);
+	}
+
+	JobErrorJmp = NULL;
+	releaseBatchJobState(&state);
+	freeSymbols();
+	if (refElf != NULL)
+		closeElf(refElf, refFd);
+	closeElf(newElf, newFd);
+	if (originElf != NULL)
+		closeElf(originElf, originFd);
+	fclose(out);
+}
+
+static void *batchWorker(void *arg)
+{
+	BatchQueue *queue = (BatchQueue *)arg;
+	Context = queue->ctx;
+	DekuDebugLog = queue->ctx->debug;
+	while (true)
+	{
+		pthread_mutex_lock(&queue->lock);
+		size_t job = queue->next++;
+		pthread_mutex_unlock(&queue->lock);
+		if (job >= queue->count)
+			break;
+		runBatchJob(&queue->jobs[job], job);
+	}
+	return NULL;
+}
+
+static BatchJob *readBatchManifest(const char *manifest, size_t *count)
+{
+	FILE *file = fopen(manifest, "r");
+	if (file == NULL)
+		LOG_ERR("Cannot open manifest '%s': %s", manifest, strerror(errno));
+
+	BatchJob *jobs = NULL;
+	size_t capacity = 0;
+	char *line = NULL;
+	size_t lineSize = 0;
+	ssize_t len;
+	*count = 0;
+	while ((len = getline(&line, &lineSize, file)) != -1)
+	{
+		if (len > 0 && line[len - 1] == '\n')
+			line[len - 1] = '\0';
+		if (line[0] == '\0' || line[0] == '#')
+			continue;
+		if (*count == capacity)
+		{
+			capacity = capacity ? capacity * 2 : 16;
+			jobs = realloc(jobs, capacity * sizeof(BatchJob));
+			CHECK_ALLOC(jobs);
+		}
+		BatchJob *job = &jobs[*count];
+		memset(job, 0, sizeof(*job));
+		char *fields[4] = {0};
+		char *savePtr = NULL;
+		char *field = strtok_r(line, "\t", &savePtr);
+		for (size_t i = 0; i < 4 && field != NULL; i++)
+		{
+			fields[i] = strdup(field);
+			CHECK_ALLOC(fields[i]);
+			field = strtok_r(NULL, "\t", &savePtr);
+		}
+		if (fields[2] == NULL)
+			LOG_ERR("Invalid line %zu in manifest '%s'", *count + 1, manifest);
+		job->originFile = fields[0];
+		job->newFile = fields[1];
+		job->outFile = fields[2];
+		job->refFile = fields[3];
+		(*count)++;
+	}
+	free(line);
+	fclose(file);
+	return jobs;
+}
+
+static char *readWholeFile(const char *path)
+{
+	FILE *file = fopen(path, "r");
+	if (file == NULL)
+		return NULL;
+
+	char *content = NULL;
+	size_t size = 0;
+	if (getdelim(&content, &size, '\0', file) == -1)
+	{
+		free(content);
+		content = strdup("");
+		CHECK_ALLOC(content);
+	}
+	fclose(file);
+	return content;
+}
+
+static FILE *openIndexFile(const char *path)
+{
+	FILE *file = fopen(path, "r");
+	if (file == NULL)
+		LOG_ERR("Cannot open '%s': %s", path, strerror(errno));
+	return file;
+}
+
+// every line of the System.map is: <ADDRESS> <TYPE> <SYMBOL>
+static void loadSystemMap(NameMap *map, const char *path)
+{
+	FILE *file = openIndexFile(path);
+	char *line = NULL;
+	size_t lineSize = 0;
+	while (getline(&line, &lineSize, file) != -1)
+	{
+		char *savePtr = NULL;
+		strtok_r(line, " \n", &savePtr);
+		strtok_r(NULL, " \n", &savePtr);
+		char *name = strtok_r(NULL, " \n", &savePtr);
+		if (name != NULL)
+			addNameMapEntry(map, name, NULL);
+	}
+	free(line);
+	fclose(file);
+}
+
+// every line of the Module.symvers is: <CRC>\t<SYMBOL>\t<MODULE>\t<EXPORT_TYPE>...
+static void loadSymvers(NameMap *map, const char *path)
+{
+	FILE *file = openIndexFile(path);
+	char *line = NULL;
+	size_t lineSize = 0;
+	while (getline(&line, &lineSize, file) != -1)
+	{
+		char *savePtr = NULL;
+		strtok_r(line, "\t\n", &savePtr);
+		char *name = strtok_r(NULL, "\t\n", &savePtr);
+		char *module = strtok_r(NULL, "\t\n", &savePtr);
+		if (name != NULL && module != NULL)
+			addNameMapEntry(map, name, module);
+	}
+	free(line);
+	fclose(file);
+}
+
+// files in the SYMBOLS_DIR are "nm -f posix" output cut to: <SYMBOL> <TYPE>
+static void loadSymbolsDir(NameMap *map, const char *path)
+{
+	DIR *dir = opendir(path);
+	if (dir == NULL)
+		return;
+
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL)
+	{
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+			continue;
+
+		size_t len = strlen(path) + strlen(entry->d_name) + 2;
+		char *filePath = malloc(len);
+		CHECK_ALLOC(filePath);
+		snprintf(filePath, len, "%s/%s", path, entry->d_name);
+		struct stat st;
+		if (stat(filePath, &st) != 0)
+		{
+			free(filePath);
+			continue;
+		}
+		if (S_ISDIR(st.st_mode))
+		{
+			loadSymbolsDir(map, filePath);
+		}
+		else if (S_ISREG(st.st_mode))
+		{
+			FILE *file = openIndexFile(filePath);
+			char *line = NULL;
+			size_t lineSize = 0;
+			while (getline(&line, &lineSize, file) != -1)
+			{
+				char *savePtr = NULL;
+				char *name = strtok_r(line, " \n", &savePtr);
+				char *type = strtok_r(NULL, " \n", &savePtr);
+				if (name != NULL && type != NULL && strcmp(type, "U") != 0)
+					addNameMapEntry(map, name, entry->d_name);
+			}
+			free(line);
+			fclose(file);
+		}
+		free(filePath);
+	}
+	closedir(dir);
+}
+
+/*
+ * Index of the symbols defined in vmlinux and in the modules, built once on
+ * sync and mapped by the lookups. Layout of the file:
+ * SymbolIndexHeader
+ * SymbolIndexObject objects[objectsCount]
+ * uint32_t buckets[bucketsCount] - index of the entry + 1, 0 for an empty bucket
+ * SymbolIndexEntry entries[entriesCount]
+ * SymbolIndexPosition positions[positionsCount]
+ * uint32_t exportBuckets[exportBucketsCount] - like buckets for the exports
+ * SymbolIndexExport exports[exportsCount]
+ * char strings[stringsSize] - starts with the empty string
+ */
+#define SYMBOL_INDEX_MAGIC "DEKUSYM3"
+
+typedef struct
+{
+	char magic[8];
+	uint32_t objectsCount;
+	uint32_t bucketsCount;
+	uint32_t entriesCount;
+	uint32_t positionsCount;
+	// 0 when the Module.symvers was not indexed
+	uint32_t exportBucketsCount;
+	uint32_t exportsCount;
+	uint32_t stringsSize;
+} SymbolIndexHeader;
+
+typedef struct
+{
+	// offsets in the strings: path relative to the modules dir and module name
+	uint32_t path;
+	uint32_t name;
+} SymbolIndexObject;
+
+typedef struct
+{
+	uint32_t name;
+	uint32_t hash;
+	// first object defining the symbol, vmlinux goes before the modules
+	uint32_t object;
+	// number of definitions in the object and in all indexed objects
+	uint32_t count;
+	uint32_t total;
+	// first of "count" positions, set for the symbols defined in vmlinux
+	uint32_t positions;
+	char type;
+	uint8_t reserved[3];
+} SymbolIndexEntry;
+
+/*
+ * Definition of the symbol in vmlinux. Positions of the symbol are sorted by
+ * the address like in the kallsyms, so the sympos is the index + 1.
+ */
+typedef struct
+{
+	// offset of the preceding STT_FILE name in the strings and its index
+	uint32_t file;
+	uint32_t group;
+} SymbolIndexPosition;
+
+// symbol from the Module.symvers
+typedef struct
+{
+	uint32_t name;
+	uint32_t hash;
+	// offset of the exporting module name in the strings
+	uint32_t module;
+} SymbolIndexExport;
+
+// sections of the mapped index
+typedef struct
+{
+	const SymbolIndexHeader *header;
+	const SymbolIndexObject *objects;
+	const uint32_t *buckets;
+	const SymbolIndexEntry *entries;
+	const SymbolIndexPosition *positions;
+	const uint32_t *exportBuckets;
+	const SymbolIndexExport *exports;
+	const char *strings;
+} SymbolIndexView;
+
+// symbols read by the index worker from a single object
+typedef struct
+{
+	char *path;
+	const char *relPath;
+	// directory not read yet by findModules()
+	bool isDir;
+	Arena arena;
+	const char **names;
+	char *types;
+	size_t count;
+	// for vmlinux only: addresses and indexes of STT_FILE groups of the symbols
+	bool isVmlinux;
+	GElf_Addr *addresses;
+	uint32_t *groups;
+	const char **files;
+	size_t filesCount;
+	bool failed;
+	char error[DEKU_ERROR_MESSAGE_LEN];
+} IndexedObject;
+
+typedef struct
+{
+	DekuContext *ctx;
+	IndexedObject *objects;
+	size_t count;
+	size_t capacity;
+	size_t next;
+	pthread_mutex_t lock;
+} IndexQueue;
+
+// symbol type as printed by the nm
+static char nmSymbolType(const GElf_Sym *sym, const char *sectionTypes, size_t sectionsCount)
+{
+	char type = '?';
+	if (sym->st_shndx == SHN_COMMON)
+		return 'C';
+	if (sym->st_shndx == SHN_ABS)
+		type = 'a';
+	else if (sym->st_shndx < sectionsCount)
+		type = sectionTypes[sym->st_shndx];
+
+	if (ELF64_ST_BIND(sym->st_info) == STB_WEAK)
+		return ELF64_ST_TYPE(sym->st_info) == STT_OBJECT ? 'V' : 'W';
+	if (ELF64_ST_BIND(sym->st_info) != STB_LOCAL)
+		type = toupper(type);
+	return type;
+}
+
+static void readIndexedObject(IndexedObject *object, Elf *elf)
+{
+	size_t sectionsCount;
+	if (elf_kind(elf) != ELF_K_ELF)
+		LOG_ERR("'%s' is not an ELF file", object->path);
+	if (elf_getshdrnum(elf, &sectionsCount) != 0)
+		LOG_ERR("Cannot get number of sections in '%s'", object->path);
+
+	char *sectionTypes = arenaAlloc(&object->arena, sectionsCount);
+	Elf_Scn *symtab = NULL;
+	Elf_Scn *scn = NULL;
+	while ((scn = elf_nextscn(elf, scn)) != NULL)
+	{
+		GElf_Shdr shdr;
+		gelf_getshdr(scn, &shdr);
+		char type = 'n';
+		if (shdr.sh_flags & SHF_EXECINSTR)
+			type = 't';
+		else if (shdr.sh_type == SHT_NOBITS)
+			type = 'b';
+		else if (shdr.sh_flags & SHF_WRITE)
+			type = 'd';
+		else if (shdr.sh_flags & SHF_ALLOC)
+			type = 'r';
+		sectionTypes[elf_ndxscn(scn)] = type;
+		if (shdr.sh_type == SHT_SYMTAB)
+			symtab = scn;
+	}
+	if (symtab == NULL)
+		LOG_ERR("Failed to find .symtab section in '%s'", object->path);
+
+	GElf_Shdr shdr;
+	gelf_getshdr(symtab, &shdr);
+	Elf_Data *data = elf_getdata(symtab, NULL);
+	size_t symCount = shdr.sh_entsize ? shdr.sh_size / shdr.sh_entsize : 0;
+	object->names = arenaAlloc(&object->arena, symCount * sizeof(char *));
+	object->types = arenaAlloc(&object->arena, symCount);
+	if (object->isVmlinux)
+	{
+		object->addresses = arenaAlloc(&object->arena, symCount * sizeof(GElf_Addr));
+		object->groups = arenaAlloc(&object->arena, symCount * sizeof(uint32_t));
+		object->files = arenaAlloc(&object->arena, symCount * sizeof(char *));
+	}
+	// local symbols follow the STT_FILE symbol of their source file
+	uint32_t group = UINT32_MAX;
+	for (size_t i = 1; i < symCount; i++)
+	{
+		GElf_Sym sym;
+		if (gelf_getsym(data, i, &sym) == NULL)
+			continue;
+		int type = ELF64_ST_TYPE(sym.st_info);
+		const char *name = elf_strptr(elf, shdr.sh_link, sym.st_name);
+		if (name == NULL || type == STT_SECTION ||
+			(type != STT_FILE && (sym.st_shndx == SHN_UNDEF || name[0] == '\0')))
+			continue;
+
+		if (type == STT_FILE && !object->isVmlinux)
+			continue;
+
+		size_t len = strlen(name) + 1;
+		char *copy = arenaAlloc(&object->arena, len);
+		memcpy(copy, name, len);
+		if (type == STT_FILE)
+		{
+			group = object->filesCount;
+			object->files[object->filesCount++] = copy;
+			continue;
+		}
+		if (object->isVmlinux)
+		{
+			object->addresses[object->count] = sym.st_value;
+			object->groups[object->count] = ELF64_ST_BIND(sym.st_info) == STB_LOCAL ? group : UINT32_MAX;
+		}
+		object->names[object->count] = copy;
+		object->types[object->count++] = nmSymbolType(&sym, sectionTypes, sectionsCount);
+	}
+}
+
+// number of the worker threads for the jobs, one per CPU if "workers" is not set
+static long countWorkers(long workers, size_t jobs)
+{
+	if (workers <= 0)
+		workers = sysconf(_SC_NPROCESSORS_ONLN);
+	return (size_t)workers > jobs ? (long)jobs : workers;
+}
+
+static void *indexWorker(void *arg)
+{
+	IndexQueue *queue = (IndexQueue *)arg;
+	Context = queue->ctx;
+	DekuDebugLog = queue->ctx->debug;
+	while (true)
+	{
+		pthread_mutex_lock(&queue->lock);
+		size_t job = queue->next++;
+		pthread_mutex_unlock(&queue->lock);
+		if (job >= queue->count)
+			break;
+
+		IndexedObject *object = &queue->objects[job];
+		int fd = open(object->path, O_RDONLY);
+		// closed after the jump, so it must not be kept in a register
+		Elf *volatile elf = fd != -1 ? elf_begin(fd, ELF_C_READ_MMAP, NULL) : NULL;
+		jmp_buf errorJmp;
+		if (setjmp(errorJmp) != 0)
+		{
+			object->failed = true;
+			snprintf(object->error, sizeof(object->error), "%s", JobErrorMessage);
+		}
+		else
+		{
+			JobErrorJmp = &errorJmp;
+			if (fd == -1)
+				LOG_ERR("Cannot open file '%s': %s", object->path, strerror(errno));
+			if (elf == NULL)
+				LOG_ERR("Problems opening '%s' as ELF file: %s", object->path, elf_errmsg(-1));
+			readIndexedObject(object, elf);
+		}
+		JobErrorJmp = NULL;
+		if (elf != NULL)
+			elf_end(elf);
+		if (fd != -1)
+			close(fd);
+	}
+	return NULL;
+}
+
+static int comparePaths(const void *a, const void *b)
+{
+	return strcmp(((const IndexedObject *)a)->path, ((const IndexedObject *)b)->path);
+}
+
+// takes ownership of the "path", it's freed with the queue
+static bool addIndexedObject(IndexQueue *queue, char *path, bool isDir)
+{
+	if (queue->count == queue->capacity)
+	{
+		size_t capacity = queue->capacity ? queue->capacity * 2 : 256;
+		IndexedObject *objects = realloc(queue->objects, capacity * sizeof(IndexedObject));
+		if (objects == NULL)
+			return false;
+		queue->objects = objects;
+		queue->capacity = capacity;
+	}
+	memset(&queue->objects[queue->count], 0, sizeof(IndexedObject));
+	queue->objects[queue->count].path = path;
+	queue->objects[queue->count++].isDir = isDir;
+	return true;
+}
+
+static void freeIndexQueue(IndexQueue *queue)
+{
+	if (queue == NULL)
+		return;
+	for (size_t i = 0; i < queue->count; i++)
+	{
+		arenaFree(&queue->objects[i].arena);
+		free(queue->objects[i].path);
+	}
+	free(queue->objects);
+	free(queue);
+}
+
+/*
+ * Append all "*.ko" files from the "path", symbolic links are not followed.
+ * Subdirectories are queued like the objects and read one by one, so no
+ * directory is left open when an error stops the search. Unreadable
+ * subdirectories are skipped.
+ */
+static void findModules(const char *path, IndexQueue *queue)
+{
+	size_t first = queue->count;
+	char *root = strdup(path);
+	if (root == NULL || !addIndexedObject(queue, root, true))
+	{
+		free(root);
+		LOG_ERR("Failed to alloc memory in %s (%s:%d)", __func__, __FILE__, __LINE__);
+	}
+	for (size_t i = first; i < queue->count; i++)
+	{
+		if (!queue->objects[i].isDir)
+			continue;
+		// the queue can be reallocated, but the path stays in place
+		const char *dirPath = queue->objects[i].path;
+		DIR *dir = opendir(dirPath);
+		if (dir == NULL && i == first)
+			LOG_ERR("Cannot open directory '%s': %s", dirPath, strerror(errno));
+		if (dir == NULL)
+		{
+			LOG_DEBUG("Skip directory '%s': %s", dirPath, strerror(errno));
+			continue;
+		}
+
+		struct dirent *entry;
+		while ((entry = readdir(dir)) != NULL)
+		{
+			if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+				continue;
+
+			size_t len = strlen(dirPath) + strlen(entry->d_name) + 2;
+			char *filePath = malloc(len);
+			if (filePath == NULL)
+			{
+				closedir(dir);
+				LOG_ERR("Failed to alloc memory in %s (%s:%d)", __func__, __FILE__, __LINE__);
+			}
+			snprintf(filePath, len, "%s/%s", dirPath, entry->d_name);
+			struct stat st;
+			size_t nameLen = strlen(entry->d_name);
+			bool isDir = false;
+			if (lstat(filePath, &st) == 0)
+				isDir = S_ISDIR(st.st_mode);
+			else
+				st.st_mode = 0;
+			bool isModule = S_ISREG(st.st_mode) && nameLen > 3 &&
+							strcmp(entry->d_name + nameLen - 3, ".ko") == 0;
+			if (!isDir && !isModule)
+			{
+				free(filePath);
+				continue;
+			}
+			if (!addIndexedObject(queue, filePath, isDir))
+			{
+				free(filePath);
+				closedir(dir);
+				LOG_ERR("Failed to alloc memory in %s (%s:%d)", __func__, __FILE__, __LINE__);
+			}
+		}
+		closedir(dir);
+	}
+
+	// leave the modules only
+	size_t count = first;
+	for (size_t i = first; i < queue->count; i++)
+	{
+		if (queue->objects[i].isDir)
+			free(queue->objects[i].path);
+		else
+			queue->objects[count++] = queue->objects[i];
+	}
+	queue->count = count;
+}
+
+typedef struct
+{
+	SymbolIndexEntry *entries;
+	size_t count;
+	uint32_t *buckets;
+	size_t mask;
+	char *strings;
+	size_t stringsSize;
+	size_t stringsCapacity;
+} SymbolIndexBuilder;
+
+static uint32_t addIndexString(SymbolIndexBuilder *builder, const char *text, size_t len)
+{
+	if (builder->stringsSize + len + 1 > builder->stringsCapacity)
+	{
+		while (builder->stringsSize + len + 1 > builder->stringsCapacity)
+			builder->stringsCapacity = builder->stringsCapacity ? builder->stringsCapacity * 2 : 1 << 20;
+		builder->strings = realloc(builder->strings, builder->stringsCapacity);
+		CHECK_ALLOC(builder->strings);
+	}
+	if (builder->stringsSize + len + 1 > UINT32_MAX)
+		LOG_ERR("Symbol index is too big");
+	uint32_t offset = builder->stringsSize;
+	memcpy(builder->strings + offset, text, len);
+	builder->strings[offset + len] = '\0';
+	builder->stringsSize += len + 1;
+	return offset;
+}
+
+static uint32_t *findIndexBucket(uint32_t *buckets, size_t mask, const SymbolIndexEntry *entries,
+								 const char *strings, const char *name, uint32_t hash)
+{
+	size_t slot = hash & mask;
+	while (buckets[slot] != 0)
+	{
+		const SymbolIndexEntry *entry = &entries[buckets[slot] - 1];
+		if (entry->hash == hash && strcmp(strings + entry->name, name) == 0)
+			break;
+		slot = (slot + 1) & mask;
+	}
+	return &buckets[slot];
+}
+
+static void addIndexedSymbol(SymbolIndexBuilder *builder, const char *name, char type,
+							 uint32_t object)
+{
+	uint32_t hash = dekuHashName(name);
+	uint32_t *bucket = findIndexBucket(builder->buckets, builder->mask, builder->entries,
+									   builder->strings, name, hash);
+	if (*bucket != 0)
+	{
+		SymbolIndexEntry *entry = &builder->entries[*bucket - 1];
+		if (entry->object == object)
+			entry->count++;
+		entry->total++;
+		return;
+	}
+
+	SymbolIndexEntry *entry = &builder->entries[builder->count++];
+	entry->name = addIndexString(builder, name, strlen(name));
+	entry->hash = hash;
+	entry->object = object;
+	entry->count = 1;
+	entry->total = 1;
+	entry->type = type;
+	*bucket = builder->count;
+}
+
+typedef struct
+{
+	GElf_Addr address;
+	size_t symbol;
+} SymbolAddress;
+
+static int compareSymbolAddress(const void *a, const void *b)
+{
+	const SymbolAddress *left = a;
+	const SymbolAddress *right = b;
+	if (left->address != right->address)
+		return left->address < right->address ? -1 : 1;
+	return left->symbol < right->symbol ? -1 : left->symbol > right->symbol;
+}
+
+// positions of the symbols defined in vmlinux, sorted like in the kallsyms
+static SymbolIndexPosition *buildSymbolPositions(SymbolIndexBuilder *builder,
+												 const IndexedObject *vmlinux, size_t *count)
+{
+	*count = 0;
+	for (size_t i = 0; i < builder->count; i++)
+	{
+		SymbolIndexEntry *entry = &builder->entries[i];
+		if (entry->object == 0)
+		{
+			entry->positions = *count;
+			*count += entry->count;
+		}
+	}
+
+	uint32_t *files = malloc((vmlinux->filesCount + 1) * sizeof(uint32_t));
+	uint32_t *filled = calloc(builder->count + 1, sizeof(uint32_t));
+	SymbolAddress *addresses = malloc((*count + 1) * sizeof(SymbolAddress));
+	SymbolIndexPosition *positions = calloc(*count + 1, sizeof(SymbolIndexPosition));
+	CHECK_ALLOC(files);
+	CHECK_ALLOC(filled);
+	CHECK_ALLOC(addresses);
+	CHECK_ALLOC(positions);
+	for (size_t i = 0; i < vmlinux->filesCount; i++)
+		files[i] = addIndexString(builder, vmlinux->files[i], strlen(vmlinux->files[i]));
+
+	for (size_t i = 0; i < vmlinux->count; i++)
+	{
+		const char *name = vmlinux->names[i];
+		uint32_t bucket = *findIndexBucket(builder->buckets, builder->mask, builder->entries,
+										   builder->strings, name, dekuHashName(name));
+		const SymbolIndexEntry *entry = &builder->entries[bucket - 1];
+		SymbolAddress *address = &addresses[entry->positions + filled[bucket - 1]++];
+		address->address = vmlinux->addresses[i];
+		address->symbol = i;
+	}
+
+	for (size_t i = 0; i < builder->count; i++)
+	{
+		const SymbolIndexEntry *entry = &builder->entries[i];
+		if (entry->object != 0)
+			continue;
+		qsort(&addresses[entry->positions], entry->count, sizeof(SymbolAddress),
+			  compareSymbolAddress);
+		for (size_t j = entry->positions; j < entry->positions + entry->count; j++)
+		{
+			uint32_t group = vmlinux->groups[addresses[j].symbol];
+			positions[j].group = group;
+			positions[j].file = group != UINT32_MAX ? files[group] : 0;
+		}
+	}
+
+	free(addresses);
+	free(filled);
+	free(files);
+	return positions;
+}
+
+static uint32_t *findExportBucket(uint32_t *buckets, size_t mask, const SymbolIndexExport *exports,
+								  const char *strings, const char *name, uint32_t hash)
+{
+	size_t slot = hash & mask;
+	while (buckets[slot] != 0)
+	{
+		const SymbolIndexExport *export = &exports[buckets[slot] - 1];
+		if (export->hash == hash && strcmp(strings + export->name, name) == 0)
+			break;
+		slot = (slot + 1) & mask;
+	}
+	return &buckets[slot];
+}
+
+static SymbolIndexExport *buildSymbolExports(SymbolIndexBuilder *builder, const NameMap *symvers,
+											 uint32_t **buckets, size_t *bucketsCount)
+{
+	SymbolIndexExport *exports = calloc(symvers->count + 1, sizeof(SymbolIndexExport));
+	*bucketsCount = bucketsMask(symvers->count) + 1;
+	*buckets = calloc(*bucketsCount, sizeof(uint32_t));
+	CHECK_ALLOC(exports);
+	CHECK_ALLOC(*buckets);
+	size_t count = 0;
+	for (size_t i = 0; symvers->entries != NULL && i <= symvers->mask; i++)
+	{
+		const NameMapEntry *entry = &symvers->entries[i];
+		if (entry->name == NULL)
+			continue;
+		SymbolIndexExport *export = &exports[count];
+		export->name = addIndexString(builder, entry->name, strlen(entry->name));
+		export->hash = dekuHashName(entry->name);
+		export->module = addIndexString(builder, entry->value, strlen(entry->value));
+		*findExportBucket(*buckets, *bucketsCount - 1, exports, builder->strings,
+						  entry->name, export->hash) = ++count;
+	}
+	return exports;
+}
+
+static void writeSymbolIndex(const char *indexFile, IndexedObject *objects, size_t objectsCount,
+							 const NameMap *symvers)
+{
+	size_t symbolsCount = 0;
+	for (size_t i = 0; i < objectsCount; i++)
+		symbolsCount += objects[i].count;
+
+	SymbolIndexBuilder builder = { .mask = bucketsMask(symbolsCount) };
+	builder.entries = calloc(symbolsCount + 1, sizeof(SymbolIndexEntry));
+	builder.buckets = calloc(builder.mask + 1, sizeof(uint32_t));
+	SymbolIndexObject *indexObjects = calloc(objectsCount, sizeof(SymbolIndexObject));
+	CHECK_ALLOC(builder.entries);
+	CHECK_ALLOC(builder.buckets);
+	CHECK_ALLOC(indexObjects);
+	addIndexString(&builder, "", 0);
+	for (size_t i = 0; i < objectsCount; i++)
+	{
+		const char *relPath = objects[i].relPath;
+		const char *name = strrchr(relPath, '/');
+		name = name != NULL ? name + 1 : relPath;
+		size_t nameLen = strlen(name);
+		if (nameLen > 3 && strcmp(name + nameLen - 3, ".ko") == 0)
+			nameLen -= 3;
+		indexObjects[i].path = addIndexString(&builder, relPath, strlen(relPath));
+		indexObjects[i].name = addIndexString(&builder, name, nameLen);
+		for (size_t j = 0; j < objects[i].count; j++)
+			addIndexedSymbol(&builder, objects[i].names[j], objects[i].types[j], i);
+	}
+
+	// the buckets are sized for all symbols, shrink them to the unique ones
+	free(builder.buckets);
+	builder.mask = bucketsMask(builder.count);
+	builder.buckets = calloc(builder.mask + 1, sizeof(uint32_t));
+	CHECK_ALLOC(builder.buckets);
+	for (size_t i = 0; i < builder.count; i++)
+	{
+		const SymbolIndexEntry *entry = &builder.entries[i];
+		*findIndexBucket(builder.buckets, builder.mask, builder.entries, builder.strings,
+						 builder.strings + entry->name, entry->hash) = i + 1;
+	}
+
+	size_t positionsCount = 0;
+	SymbolIndexPosition *positions = NULL;
+	if (objectsCount > 0 && objects[0].isVmlinux)
+		positions = buildSymbolPositions(&builder, &objects[0], &positionsCount);
+	size_t exportBucketsCount = 0;
+	uint32_t *exportBuckets = NULL;
+	SymbolIndexExport *exports = NULL;
+	if (symvers != NULL)
+		exports = buildSymbolExports(&builder, symvers, &exportBuckets, &exportBucketsCount);
+
+	SymbolIndexHeader header = {
+		.objectsCount = objectsCount,
+		.bucketsCount = builder.mask + 1,
+		.entriesCount = builder.count,
+		.positionsCount = positionsCount,
+		.exportBucketsCount = exportBucketsCount,
+		.exportsCount = symvers != NULL ? symvers->count : 0,
+		.stringsSize = builder.stringsSize,
+	};
+	memcpy(header.magic, SYMBOL_INDEX_MAGIC, sizeof(header.magic));
+
+	// write to the temporary file so the readers never see a partial index
+	size_t len = strlen(indexFile) + sizeof(".tmp");
+	char *tmpFile = malloc(len);
+	CHECK_ALLOC(tmpFile);
+	snprintf(tmpFile, len, "%s.tmp", indexFile);
+	FILE *file = fopen(tmpFile, "w");
+	if (file == NULL)
+		LOG_ERR("Cannot create '%s': %s", tmpFile, strerror(errno));
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(indexObjects, sizeof(SymbolIndexObject), objectsCount, file);
+	fwrite(builder.buckets, sizeof(uint32_t), builder.mask + 1, file);
+	fwrite(builder.entries, sizeof(SymbolIndexEntry), builder.count, file);
+	fwrite(positions, sizeof(SymbolIndexPosition), positionsCount, file);
+	fwrite(exportBuckets, sizeof(uint32_t), exportBucketsCount, file);
+	fwrite(exports, sizeof(SymbolIndexExport), header.exportsCount, file);
+	fwrite(builder.strings, 1, builder.stringsSize, file);
+	bool failed = ferror(file);
+	if (fclose(file) != 0 || failed || rename(tmpFile, indexFile) != 0)
+	{
+		unlink(tmpFile);
+		LOG_ERR("Failed to write symbol index '%s'", indexFile);
+	}
+	LOG_DEBUG("Symbol index: %zu objects, %zu symbols", objectsCount, builder.count);
+
+	free(tmpFile);
+	free(exports);
+	free(exportBuckets);
+	free(positions);
+	free(indexObjects);
+	free(builder.strings);
+	free(builder.buckets);
+	free(builder.entries);
+}
+
+static void unmapSymbolIndex(SymbolIndexMap *map)
+{
+	if (map->data != NULL)
+		munmap(map->data, map->size);
+	free(map->path);
+	memset(map, 0, sizeof(*map));
+}
+
+// maps the index again when the file was rebuilt since the last lookup
+static SymbolIndexView mapSymbolIndex(SymbolIndexMap *map)
+{
+	if (map->path == NULL)
+		LOG_ERR("Symbol index is not set");
+
+	struct stat st;
+	if (stat(map->path, &st) != 0)
+		LOG_ERR("Cannot find symbol index '%s': %s", map->path, strerror(errno));
+	if (map->data == NULL || map->size != (size_t)st.st_size || map->inode != st.st_ino ||
+		map->mtime.tv_sec != st.st_mtim.tv_sec || map->mtime.tv_nsec != st.st_mtim.tv_nsec)
+	{
+		if (map->data != NULL)
+			munmap(map->data, map->size);
+		map->data = NULL;
+		int fd = open(map->path, O_RDONLY);
+		if (fd == -1)
+			LOG_ERR("Cannot open symbol index '%s': %s", map->path, strerror(errno));
+		void *data = st.st_size > 0 ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)
+									: MAP_FAILED;
+		close(fd);
+		if (data == MAP_FAILED)
+			LOG_ERR("Cannot map symbol index '%s'", map->path);
+		map->data = data;
+		map->size = st.st_size;
+		map->inode = st.st_ino;
+		map->mtime = st.st_mtim;
+
+		const SymbolIndexHeader *header = map->data;
+		uint64_t size = sizeof(SymbolIndexHeader);
+		if (map->size >= size)
+		{
+			size += (uint64_t)header->objectsCount * sizeof(SymbolIndexObject) +
+					(uint64_t)header->bucketsCount * sizeof(uint32_t) +
+					(uint64_t)header->entriesCount * sizeof(SymbolIndexEntry) +
+					(uint64_t)header->positionsCount * sizeof(SymbolIndexPosition) +
+					(uint64_t)header->exportBucketsCount * sizeof(uint32_t) +
+					(uint64_t)header->exportsCount * sizeof(SymbolIndexExport) +
+					header->stringsSize;
+		}
+		if (map->size < sizeof(SymbolIndexHeader) ||
+			memcmp(header->magic, SYMBOL_INDEX_MAGIC, sizeof(header->magic)) != 0 ||
+			size != map->size || header->bucketsCount == 0 || header->stringsSize == 0 ||
+			((const char *)map->data)[map->size - 1] != '\0' ||
+			(header->bucketsCount & (header->bucketsCount - 1)) != 0 ||
+			(header->exportBucketsCount & (header->exportBucketsCount - 1)) != 0)
+		{
+			munmap(map->data, map->size);
+			map->data = NULL;
+			LOG_ERR("Invalid symbol index '%s'", map->path);
+		}
+	}
+
+	SymbolIndexView view = { .header = map->data };
+	view.objects = (const SymbolIndexObject *)(view.header + 1);
+	view.buckets = (const uint32_t *)(view.objects + view.header->objectsCount);
+	view.entries = (const SymbolIndexEntry *)(view.buckets + view.header->bucketsCount);
+	view.positions = (const SymbolIndexPosition *)(view.entries + view.header->entriesCount);
+	view.exportBuckets = (const uint32_t *)(view.positions + view.header->positionsCount);
+	view.exports = (const SymbolIndexExport *)(view.exportBuckets + view.header->exportBucketsCount);
+	view.strings = (const char *)(view.exports + view.header->exportsCount);
+	return view;
+}
+
+static const SymbolIndexEntry *findIndexedSymbol(const SymbolIndexView *view, const char *symbol)
+{
+	const SymbolIndexHeader *header = view->header;
+	uint32_t hash = dekuHashName(symbol);
+	size_t mask = header->bucketsCount - 1;
+	for (size_t slot = hash & mask, i = 0; view->buckets[slot] != 0 && i <= mask;
+		 slot = (slot + 1) & mask, i++)
+	{
+		if (view->buckets[slot] > header->entriesCount)
+			break;
+		const SymbolIndexEntry *entry = &view->entries[view->buckets[slot] - 1];
+		if (entry->hash != hash || entry->name >= header->stringsSize ||
+			strcmp(view->strings + entry->name, symbol) != 0)
+			continue;
+		if (entry->object >= header->objectsCount ||
+			view->objects[entry->object].path >= header->stringsSize ||
+			view->objects[entry->object].name >= header->stringsSize)
+			break;
+		return entry;
+	}
+	return NULL;
+}
+
+static bool isIndexedInVmlinux(const SymbolIndexView *view, const SymbolIndexEntry *entry)
+{
+	return strcmp(view->strings + view->objects[entry->object].path, "vmlinux") == 0;
+}
+
+static const SymbolIndexExport *findIndexedExport(const SymbolIndexView *view, const char *symbol)
+{
+	const SymbolIndexHeader *header = view->header;
+	uint32_t hash = dekuHashName(symbol);
+	size_t mask = header->exportBucketsCount - 1;
+	for (size_t slot = hash & mask, i = 0; header->exportBucketsCount > 0 &&
+		 view->exportBuckets[slot] != 0 && i <= mask; slot = (slot + 1) & mask, i++)
+	{
+		if (view->exportBuckets[slot] > header->exportsCount)
+			break;
+		const SymbolIndexExport *export = &view->exports[view->exportBuckets[slot] - 1];
+		if (export->hash != hash || export->name >= header->stringsSize ||
+			strcmp(view->strings + export->name, symbol) != 0)
+			continue;
+		if (export->module >= header->stringsSize)
+			break;
+		return export;
+	}
+	return NULL;
+}
+
+// positions are set only when the symbol is defined in vmlinux
+static const SymbolIndexPosition *getIndexedPositions(const SymbolIndexView *view,
+													  const SymbolIndexEntry *entry)
+{
+	if (entry->object != 0 || !isIndexedInVmlinux(view, entry) ||
+		(uint64_t)entry->positions + entry->count > view->header->positionsCount)
+		return NULL;
+	return &view->positions[entry->positions];
+}
+
+/*
+ * Find the definition of the symbol that comes from the object file "objFile".
+ * Definitions are matched by the name of the source file (STT_FILE). When many
+ * source files have the same name, the one with the most of the other local
+ * symbols of the object file is chosen.
+ */
+static size_t findSymbolPosition(const SymbolIndexView *view, const SymbolIndexEntry *entry,
+								 const char *symbol, const char *objFile)
+{
+	const SymbolIndexPosition *positions = getIndexedPositions(view, entry);
+	if (positions == NULL)
+		LOG_ERR("Invalid positions of the symbol '%s' in the symbol index", symbol);
+
+	int fd;
+	Elf *elf = openElf(objFile, &fd);
+	Elf_Scn *scn = getSectionByName(elf, ".symtab");
+	GElf_Shdr shdr;
+	gelf_getshdr(scn, &shdr);
+	Elf_Data *data = elf_getdata(scn, NULL);
+	size_t symCount = shdr.sh_entsize ? shdr.sh_size / shdr.sh_entsize : 0;
+	const char *fileName = NULL;
+	char file[PATH_MAX] = "";
+	bool isLocal = true;
+	for (size_t i = 1; i < symCount; i++)
+	{
+		GElf_Sym sym;
+		if (gelf_getsym(data, i, &sym) == NULL)
+			continue;
+		const char *name = elf_strptr(elf, shdr.sh_link, sym.st_name);
+		if (ELF64_ST_TYPE(sym.st_info) == STT_FILE && fileName == NULL)
+			fileName = name;
+		else if (sym.st_shndx != SHN_UNDEF && name != NULL && strcmp(name, symbol) == 0)
+			isLocal = ELF64_ST_BIND(sym.st_info) == STB_LOCAL;
+	}
+	if (fileName == NULL)
+	{
+		closeElf(elf, fd);
+		LOG_ERR("Can't find source file name in '%s'", objFile);
+	}
+	snprintf(file, sizeof(file), "%s", fileName);
+
+	// nothing below fails until the buffers are freed
+	size_t *scores = calloc(entry->count, sizeof(size_t));
+	// symbols of the groups that are not in the object file make the match worse
+	size_t *groupSizes = calloc(entry->count, sizeof(size_t));
+	if (scores == NULL || groupSizes == NULL)
+	{
+		free(scores);
+		free(groupSizes);
+		closeElf(elf, fd);
+		LOG_ERR("Failed to alloc memory in %s (%s:%d)", __func__, __FILE__, __LINE__);
+	}
+	size_t candidates = 0;
+	size_t result = 0;
+	for (size_t i = 0; i < entry->count; i++)
+	{
+		const SymbolIndexPosition *pos = &positions[i];
+		bool fromFile = isLocal ? pos->group != UINT32_MAX && pos->file < view->header->stringsSize &&
+								  strcmp(view->strings + pos->file, fileName) == 0
+								: pos->group == UINT32_MAX;
+		if (fromFile)
+		{
+			candidates++;
+			scores[i] = 1;
+			result = i + 1;
+		}
+	}
+
+	if (candidates > 1)
+	{
+		// count the other local symbols of the object file in every candidate group
+		for (size_t i = 1; i < symCount; i++)
+		{
+			GElf_Sym sym;
+			if (gelf_getsym(data, i, &sym) == NULL || ELF64_ST_BIND(sym.st_info) != STB_LOCAL ||
+				sym.st_shndx == SHN_UNDEF || ELF64_ST_TYPE(sym.st_info) == STT_FILE ||
+				ELF64_ST_TYPE(sym.st_info) == STT_SECTION)
+				continue;
+			const char *name = elf_strptr(elf, shdr.sh_link, sym.st_name);
+			if (name == NULL || name[0] == '\0' || strcmp(name, symbol) == 0)
+				continue;
+			const SymbolIndexEntry *other = findIndexedSymbol(view, name);
+			const SymbolIndexPosition *otherPositions = other != NULL ?
+														getIndexedPositions(view, other) : NULL;
+			for (size_t j = 0; otherPositions != NULL && j < other->count; j++)
+			{
+				for (size_t k = 0; k < entry->count; k++)
+				{
+					if (scores[k] > 0 && otherPositions[j].group == positions[k].group)
+						scores[k]++;
+				}
+			}
+		}
+
+		for (size_t i = 0; i < view->header->positionsCount; i++)
+		{
+			for (size_t k = 0; k < entry->count; k++)
+			{
+				if (scores[k] > 0 && view->positions[i].group == positions[k].group)
+					groupSizes[k]++;
+			}
+		}
+
+		size_t best = 0;
+		candidates = 0;
+		for (size_t i = 0; i < entry->count; i++)
+		{
+			if (scores[i] == 0)
+				continue;
+			if (best == 0 || scores[i] > scores[best - 1] ||
+				(scores[i] == scores[best - 1] && groupSizes[i] < groupSizes[best - 1]))
+			{
+				best = i + 1;
+				candidates = 1;
+			}
+			else if (scores[i] == scores[best - 1] && groupSizes[i] == groupSizes[best - 1])
+			{
+				candidates++;
+			}
+		}
+		result = best;
+	}
+	free(groupSizes);
+	free(scores);
+	closeElf(elf, fd);
+
+	if (candidates == 0)
+		dekuFail(DEKU_ERROR_CANT_FIND_SYM_INDEX, __FILE__, __LINE__,
+				 "Can't find symbol '%s' from '%s' in vmlinux", symbol, file);
+	if (candidates > 1)
+		dekuFail(DEKU_ERROR_CANT_FIND_SYM_INDEX, __FILE__, __LINE__,
+				 "Can't choose between %zu definitions of the symbol '%s' from '%s'",
+				 candidates, symbol, file);
+	return result;
+}
+
+static void dropKernelIndex(DekuContext *ctx)
+{
+	KernelIndex *kernel = &ctx->kernel;
+	freeNameMap(&kernel->kernelSymbols);
+	freeNameMap(&kernel->exportedSymbols);
+	freeNameMap(&kernel->moduleSymbols);
+	dropRefFunctionsCache(ctx);
+	kernel->loaded = false;
+}
+
+static void refreshKernelIndex(DekuContext *ctx)
+{
+	KernelIndex *kernel = &ctx->kernel;
+	if (kernel->versionFile == NULL)
+		return;
+
+	char *version = readWholeFile(kernel->versionFile);
+	if (version == NULL || kernel->version == NULL || strcmp(version, kernel->version) != 0)
+		dropKernelIndex(ctx);
+	free(kernel->version);
+	kernel->version = version;
+}
+
+static bool hasKernelFiles(const KernelIndex *kernel)
+{
+	return kernel->versionFile != NULL || kernel->systemMap != NULL ||
+		   kernel->symvers != NULL || kernel->symbolsDir != NULL;
+}
+
+static void loadKernelIndex(DekuContext *ctx)
+{
+	KernelIndex *kernel = &ctx->kernel;
+	if (!hasKernelFiles(kernel))
+		LOG_ERR("Kernel files are not set");
+	refreshKernelIndex(ctx);
+	if (kernel->loaded)
+		return;
+
+	if (kernel->systemMap != NULL)
+		loadSystemMap(&kernel->kernelSymbols, kernel->systemMap);
+	if (kernel->symvers != NULL)
+		loadSymvers(&kernel->exportedSymbols, kernel->symvers);
+	if (kernel->symbolsDir != NULL)
+		loadSymbolsDir(&kernel->moduleSymbols, kernel->symbolsDir);
+	kernel->loaded = true;
+}
+
+static char *absolutePath(const char *path)
+{
+	if (path == NULL)
+		return NULL;
+
+	char *result = realpath(path, NULL);
+	if (result == NULL)
+		LOG_ERR("Cannot find '%s': %s", path, strerror(errno));
+	return result;
+}
+
+void dekuEnter(DekuContext *ctx, DekuScope *scope)
+{
+	scope->prevErrorJmp = JobErrorJmp;
+	scope->prevContext = Context;
+	scope->prevDebugLog = DekuDebugLog;
+	scope->allocCount = 0;
+	JobErrorJmp = &scope->errorJmp;
+	Context = ctx;
+	DekuDebugLog = ctx->debug;
+	ctx->errorCode = DEKU_OK;
+	ctx->errorMessage[0] = '\0';
+}
+
+void dekuFreeOnError(DekuScope *scope, void *ptr)
+{
+	if (scope->allocCount == DEKU_SCOPE_ALLOCS)
+		LOG_ERR("Too many allocations in the scope");
+	scope->allocs[scope->allocCount++] = ptr;
+}
+
+void dekuReleaseScope(DekuScope *scope)
+{
+	for (size_t i = 0; i < scope->allocCount; i++)
+	{
+		void **ptr = (void **)scope->allocs[i];
+		free(*ptr);
+		*ptr = NULL;
+	}
+	scope->allocCount = 0;
+}
+
+int dekuLeave(DekuContext *ctx, DekuScope *scope, int code)
+{
+	JobErrorJmp = scope->prevErrorJmp;
+	Context = scope->prevContext;
+	DekuDebugLog = scope->prevDebugLog;
+	ctx->errorCode = code;
+	if (code != DEKU_OK)
+		snprintf(ctx->errorMessage, sizeof(ctx->errorMessage), "%s", JobErrorMessage);
+	return code;
+}
+
+/*
+ * Errors reported by LOG_ERR after this point release the thread state and the
+ * memory registered with dekuFreeOnError(), and return the error code from the
+ * calling function.
+ */
+#define ENTER_CONTEXT(ctx, scope)										\
+	do																	\
+	{																	\
+		if (setjmp((scope).errorJmp) != 0)								\
+		{																\
+			dekuReleaseScope(&(scope));									\
+			releaseThreadState();										\
+			return dekuLeave(ctx, &(scope), JobErrorCode);				\
+		}																\
+		dekuEnter(ctx, &(scope));										\
+	} while (0)
+
+// failure that is expected by the caller, nothing is printed
+static int quietError(DekuContext *ctx, DekuScope *scope, int code, const char *symbol)
+{
+	snprintf(JobErrorMessage, sizeof(JobErrorMessage), "Can't find symbol: %s", symbol);
+	return dekuLeave(ctx, scope, code);
+}
+
+DekuContext *dekuOpen(void)
+{
+	if (elf_version(EV_CURRENT) == EV_NONE)
+		return NULL;
+	DekuContext *ctx = calloc(1, sizeof(DekuContext));
+	if (ctx == NULL)
+		return NULL;
+	pthread_mutex_init(&ctx->refFunctionsLock, NULL);
+	return ctx;
+}
+
+void dekuClose(DekuContext *ctx)
+{
+	if (ctx == NULL)
+		return;
+
+	KernelIndex *kernel = &ctx->kernel;
+	dropKernelIndex(ctx);
+	free(kernel->version);
+	free(kernel->versionFile);
+	free(kernel->systemMap);
+	free(kernel->symvers);
+	free(kernel->symbolsDir);
+	unmapSymbolIndex(&ctx->symbolIndex);
+	free(ctx->fingerprintsDir);
+	pthread_mutex_destroy(&ctx->refFunctionsLock);
+	free(ctx);
+}
+
+const char *dekuErrorMessage(const DekuContext *ctx)
+{
+	return ctx->errorMessage;
+}
+
+void dekuSetDebug(DekuContext *ctx, bool debug)
+{
+	ctx->debug = debug;
+}
+
+void dekuSetKeepMetadataChanges(DekuContext *ctx, bool keep)
+{
+	ctx->keepMetadataChanges = keep;
+}
+
+void dekuSetCache(DekuContext *ctx, bool cache)
+{
+	ctx->cacheRefFunctions = cache;
+	if (!cache)
+		dropRefFunctionsCache(ctx);
+}
+
+int dekuSetKernelFiles(DekuContext *ctx, const char *versionFile, const char *systemMap,
+					   const char *symvers, const char *symbolsDir)
+{
+	DekuScope scope;
+	ENTER_CONTEXT(ctx, scope);
+	KernelIndex *kernel = &ctx->kernel;
+	KernelIndex files =
+	{
+		.versionFile = absolutePath(versionFile),
+		.systemMap = absolutePath(systemMap),
+		.symvers = absolutePath(symvers),
+		.symbolsDir = absolutePath(symbolsDir),
+	};
+	dropKernelIndex(ctx);
+	free(kernel->version);
+	free(kernel->versionFile);
+	free(kernel->systemMap);
+	free(kernel->symvers);
+	free(kernel->symbolsDir);
+	*kernel = files;
+	return dekuLeave(ctx, &scope, DEKU_OK);
+}
+
+int dekuLoadKernelIndex(DekuContext *ctx)
+{
+	DekuScope scope;
+	ENTER_CONTEXT(ctx, scope);
+	loadKernelIndex(ctx);
+	return dekuLeave(ctx, &scope, DEKU_OK);
+}
+
+int dekuSymbolOwner(DekuContext *ctx, const char *symbol, const char **owner)
+{
+	DekuScope scope;
+	ENTER_CONTEXT(ctx, scope);
+	if (ctx->symbolIndex.path != NULL)
+	{
+		SymbolIndexView view = mapSymbolIndex(&ctx->symbolIndex);
+		const SymbolIndexEntry *entry = findIndexedSymbol(&view, symbol);
+		if (entry != NULL)
+		{
+			*owner = view.strings + view.objects[entry->object].name;
+			return dekuLeave(ctx, &scope, DEKU_OK);
+		}
+		if (!hasKernelFiles(&ctx->kernel))
+			return quietError(ctx, &scope, DEKU_ERROR_CANT_FIND_SYMBOL, symbol);
+	}
+	loadKernelIndex(ctx);
+
+	KernelIndex *kernel = &ctx->kernel;
+	if (findNameMapEntry(&kernel->kernelSymbols, symbol) != NULL)
+	{
+		*owner = "vmlinux";
+		return dekuLeave(ctx, &scope, DEKU_OK);
+	}
+
+	const NameMapEntry *entry = findNameMapEntry(&kernel->moduleSymbols, symbol);
+	if (entry == NULL && kernel->symbolsDir != NULL)
+	{
+		// symbols for the modules might be generated since the last load
+		freeNameMap(&kernel->moduleSymbols);
+		loadSymbolsDir(&kernel->moduleSymbols, kernel->symbolsDir);
+		entry = findNameMapEntry(&kernel->moduleSymbols, symbol);
+	}
+	if (entry == NULL)
+		return quietError(ctx, &scope, DEKU_ERROR_CANT_FIND_SYMBOL, symbol);
+
+	*owner = entry->value;
+	return dekuLeave(ctx, &scope, DEKU_OK);
+}
+
+int dekuSymbolPosition(DekuContext *ctx, const char *symbol, const char *objFile,
+					   size_t *position)
+{
+	DekuScope scope;
+	ENTER_CONTEXT(ctx, scope);
+	if (ctx->symbolIndex.path != NULL)
+	{
+		SymbolIndexView view = mapSymbolIndex(&ctx->symbolIndex);
+		const SymbolIndexEntry *entry = findIndexedSymbol(&view, symbol);
+		if (entry != NULL && isIndexedInVmlinux(&view, entry))
+		{
+			if (entry->count == 1)
+				*position = 0;
+			else if (objFile != NULL)
+				*position = findSymbolPosition(&view, entry, symbol, objFile);
+			else
+				return quietError(ctx, &scope, DEKU_ERROR_CANT_FIND_SYM_INDEX, symbol);
+			return dekuLeave(ctx, &scope, DEKU_OK);
+		}
+		if (!hasKernelFiles(&ctx->kernel))
+			return quietError(ctx, &scope, DEKU_ERROR_CANT_FIND_SYMBOL, symbol);
+	}
+
+	// only the unique symbols can be resolved from the System.map
+	loadKernelIndex(ctx);
+
+	const NameMapEntry *entry = findNameMapEntry(&ctx->kernel.kernelSymbols, symbol);
+	if (entry == NULL || entry->count != 1)
+		return quietError(ctx, &scope, DEKU_ERROR_CANT_FIND_SYM_INDEX, symbol);
+
+	*position = 0;
+	return dekuLeave(ctx, &scope, DEKU_OK);
+}
+
+int dekuExportingModule(DekuContext *ctx, const char *symbol, const char **module)
+{
+	DekuScope scope;
+	ENTER_CONTEXT(ctx, scope);
+	if (ctx->symbolIndex.path != NULL)
+	{
+		SymbolIndexView view = mapSymbolIndex(&ctx->symbolIndex);
+		if (view.header->exportBucketsCount > 0)
+		{
+			const SymbolIndexExport *export = findIndexedExport(&view, symbol);
+			if (export == NULL)
+				return quietError(ctx, &scope, DEKU_ERROR_CANT_FIND_SYMBOL, symbol);
+			*module = view.strings + export->module;
+			return dekuLeave(ctx, &scope, DEKU_OK);
+		}
+	}
+	loadKernelIndex(ctx);
+
+	const NameMapEntry *entry = findNameMapEntry(&ctx->kernel.exportedSymbols, symbol);
+	if (entry == NULL)
+		return quietError(ctx, &scope, DEKU_ERROR_CANT_FIND_SYMBOL, symbol);
+
+	*module = entry->value;
+	return dekuLeave(ctx, &scope, DEKU_OK);
+}
+
+int dekuUnexportedSymbols(DekuContext *ctx, const char *moduleFile, DekuSymbolHandler handler,
+						  void *arg)
+{
+	DekuScope scope;
+	ENTER_CONTEXT(ctx, scope);
+	SymbolIndexView view = {0};
+	if (ctx->symbolIndex.path != NULL)
+		view = mapSymbolIndex(&ctx->symbolIndex);
+	bool useIndex = view.header != NULL && view.header->exportBucketsCount > 0;
+	if (!useIndex)
+	{
+		if (ctx->kernel.symvers == NULL)
+			LOG_ERR("Module.symvers is not indexed");
+		loadKernelIndex(ctx);
+	}
+
+	int fd;
+	Elf *elf = openElf(moduleFile, &fd);
+	Elf_Scn *scn = getSectionByName(elf, ".symtab");
+	GElf_Shdr shdr;
+	gelf_getshdr(scn, &shdr);
+	Elf_Data *data = elf_getdata(scn, NULL);
+	size_t symCount = shdr.sh_entsize ? shdr.sh_size / shdr.sh_entsize : 0;
+	for (size_t i = 1; i < symCount; i++)
+	{
+		GElf_Sym sym;
+		if (gelf_getsym(data, i, &sym) == NULL || sym.st_shndx != SHN_UNDEF)
+			continue;
+		const char *name = elf_strptr(elf, shdr.sh_link, sym.st_name);
+		if (name == NULL || name[0] == '\0')
+			continue;
+		bool exported = useIndex ? findIndexedExport(&view, name) != NULL
+								 : findNameMapEntry(&ctx->kernel.exportedSymbols, name) != NULL;
+		if (!exported)
+			handler(name, arg);
+	}
+	closeElf(elf, fd);
+	return dekuLeave(ctx, &scope, DEKU_OK);
+}
+
+int dekuSetSymbolIndex(DekuContext *ctx, const char *indexFile)
+{
+	DekuScope scope;
+	ENTER_CONTEXT(ctx, scope);
+	unmapSymbolIndex(&ctx->symbolIndex);
+	if (indexFile != NULL)
+	{
+		ctx->symbolIndex.path = strdup(indexFile);
+		CHECK_ALLOC(ctx->symbolIndex.path);
+	}
+	return dekuLeave(ctx, &scope, DEKU_OK);
+}
+
+int dekuSetFingerprintCache(DekuContext *ctx, const char *dir)
+{
+	DekuScope scope;
+	ENTER_CONTEXT(ctx, scope);
+	free(ctx->fingerprintsDir);
+	ctx->fingerprintsDir = NULL;
+	if (dir != NULL)
+	{
+		ctx->fingerprintsDir = strdup(dir);
+		CHECK_ALLOC(ctx->fingerprintsDir);
+	}
+	return dekuLeave(ctx, &scope, DEKU_OK);
+}
+
+int dekuBuildSymbolIndex(DekuContext *ctx, const char *vmlinux, const char *modulesDir,
+						 const char *symvers, long workers, const char *indexFile)
+{
+	DekuScope scope;
+	// the queue is not changed after setjmp(), only the objects in it
+	IndexQueue *const queue = calloc(1, sizeof(IndexQueue));
+	if (setjmp(scope.errorJmp) != 0)
+	{
+		freeIndexQueue(queue);
+		dekuReleaseScope(&scope);
+		releaseThreadState();
+		return dekuLeave(ctx, &scope, JobErrorCode);
+	}
+	dekuEnter(ctx, &scope);
+	CHECK_ALLOC(queue);
+	queue->ctx = ctx;
+
+	char *dir = NULL;
+	dekuFreeOnError(&scope, &dir);
+	if (modulesDir != NULL)
+	{
+		dir = strdup(modulesDir);
+		CHECK_ALLOC(dir);
+		for (size_t len = strlen(dir); len > 1 && dir[len - 1] == '/'; len--)
+			dir[len - 1] = '\0';
+		findModules(dir, queue);
+		qsort(queue->objects, queue->count, sizeof(IndexedObject), comparePaths);
+		for (size_t i = 0; i < queue->count; i++)
+			queue->objects[i].relPath = queue->objects[i].path + strlen(dir) + 1;
+	}
+	if (vmlinux != NULL)
+	{
+		char *path = strdup(vmlinux);
+		if (path == NULL || !addIndexedObject(queue, path, false))
+		{
+			free(path);
+			LOG_ERR("Failed to alloc memory in %s (%s:%d)", __func__, __FILE__, __LINE__);
+		}
+		IndexedObject object = queue->objects[queue->count - 1];
+		memmove(queue->objects + 1, queue->objects, (queue->count - 1) * sizeof(IndexedObject));
+		object.relPath = "vmlinux";
+		object.isVmlinux = true;
+		queue->objects[0] = object;
+	}
+
+	pthread_mutex_init(&queue->lock, NULL);
+	long threadsCount = countWorkers(workers, queue->count);
+	pthread_t *threads = calloc(threadsCount + 1, sizeof(pthread_t));
+	CHECK_ALLOC(threads);
+	// the workers use the queue from the stack, so don't leave before they end
+	long started = 0;
+	while (started < threadsCount &&
+		   pthread_create(&threads[started], NULL, indexWorker, queue) == 0)
+		started++;
+	if (started < threadsCount)
+		LOG_DEBUG("Created only %ld of %ld worker threads", started, threadsCount);
+	for (long i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&queue->lock);
+	free(threads);
+
+	const char *error = started == 0 && threadsCount > 0 ? "Failed to create worker thread"
+														 : NULL;
+	for (size_t i = 0; i < queue->count && error == NULL; i++)
+	{
+		if (queue->objects[i].failed)
+			error = queue->objects[i].error;
+	}
+	NameMap exports = {0};
+	if (error == NULL && symvers != NULL)
+		loadSymvers(&exports, symvers);
+	if (error == NULL)
+		writeSymbolIndex(indexFile, queue->objects, queue->count,
+						 symvers != NULL ? &exports : NULL);
+	freeNameMap(&exports);
+
+	// the queue and "dir" are released on the error path
+	if (error != NULL)
+		LOG_ERR("Failed to build symbol index: %s", error);
+	freeIndexQueue(queue);
+	free(dir);
+	return dekuLeave(ctx, &scope, DEKU_OK);
+}
+
+int dekuLookupSymbol(DekuContext *ctx, const char *symbol, DekuSymbolInfo *info)
+{
+	DekuScope scope;
+	ENTER_CONTEXT(ctx, scope);
+	SymbolIndexView view = mapSymbolIndex(&ctx->symbolIndex);
+	const SymbolIndexEntry *entry = findIndexedSymbol(&view, symbol);
+	if (entry == NULL)
+		return quietError(ctx, &scope, DEKU_ERROR_CANT_FIND_SYMBOL, symbol);
+
+	const SymbolIndexObject *object = &view.objects[entry->object];
+	info->object = view.strings + object->name;
+	info->path = view.strings + object->path;
+	info->type = entry->type;
+	info->count = entry->count;
+	info->total = entry->total;
+	return dekuLeave(ctx, &scope, DEKU_OK);
+}
+
+int dekuDiff(DekuContext *ctx, const char *originFile, const char *newFile, DekuDiff *diff)
+{
+	DekuScope scope;
+	memset(diff, 0, sizeof(*diff));
+	if (setjmp(scope.errorJmp) != 0)
+	{
+		dekuFreeDiff(diff);
+		dekuReleaseScope(&scope);
+		releaseThreadState();
+		return dekuLeave(ctx, &scope, JobErrorCode);
+	}
+	dekuEnter(ctx, &scope);
+
+	// the kernel version is a part of the fingerprints cache key
+	if (ctx->fingerprintsDir != NULL)
+		refreshKernelIndex(ctx);
+	int originFd;
+	int newFd;
+	Fingerprints fingerprints = {0};
+	DiffResult result = {0};
+	dekuFreeOnError(&scope, &fingerprints.data);
+	dekuFreeOnError(&scope, &result.entries);
+	bool useFingerprints = getOriginFingerprints(originFile, &fingerprints);
+	Elf *originElf = useFingerprints ? NULL : openElf(originFile, &originFd);
+	Elf *newElf = openElf(newFile, &newFd);
+	findModifiedSymbols(newElf, originElf, useFingerprints ? &fingerprints : NULL, &result);
+	diff->entries = calloc(result.count + 1, sizeof(DekuDiffEntry));
+	CHECK_ALLOC(diff->entries);
+	for (size_t i = 0; i < result.count; i++)
+	{
+		if (result.entries[i].cause == DEKU_CHANGE_METADATA && !ctx->keepMetadataChanges)
+		{
+			LOG_DEBUG("Function '%s' differs only in the metadata", result.entries[i].name);
+			continue;
+		}
+		DekuDiffEntry *entry = &diff->entries[diff->count];
+		entry->kind = result.entries[i].kind;
+		entry->cause = result.entries[i].cause;
+		entry->name = strdup(result.entries[i].name);
+		CHECK_ALLOC(entry->name);
+		diff->count++;
+	}
+	free(result.entries);
+	free(fingerprints.data);
+	if (originElf != NULL)
+		closeElf(originElf, originFd);
+	closeElf(newElf, newFd);
+	return dekuLeave(ctx, &scope, DEKU_OK);
+}
+
+void dekuFreeDiff(DekuDiff *diff)
+{
+	for (size_t i = 0; i < diff->count; i++)
+		free(diff->entries[i].name);
+	free(diff->entries);
+	memset(diff, 0, sizeof(*diff));
+}
+
+int dekuExtract(DekuContext *ctx, const char *file, const char *outFile,
+				const char *const *symbols)
+{
+	DekuScope scope;
+	ENTER_CONTEXT(ctx, scope);
+	if (symbols == NULL || *symbols == NULL)
+		LOG_ERR("No symbols to extract");
+
+	int fd;
+	Elf *elf = openElf(file, &fd);
+	readSymbols(elf);
+	extractFromElf(elf, outFile, (char **)symbols);
+	freeSymbols();
+	closeElf(elf, fd);
+	return dekuLeave(ctx, &scope, DEKU_OK);
+}
+
+int dekuCallees(DekuContext *ctx, const char *file, DekuChainHandler handler, void *arg)
+{
+	DekuScope scope;
+	ENTER_CONTEXT(ctx, scope);
+
+	int fd;
+	Elf *elf = openElf(file, &fd);
+	readSymbols(elf);
+	readCallees(elf);
+	size_t *callStack = calloc(Symbols.count + 1, sizeof(size_t));
+	size_t *chain = calloc(Symbols.count + 1, sizeof(size_t));
+	size_t *visited = calloc(Symbols.count, sizeof(size_t));
+	ChainNames names = { .handler = handler, .arg = arg };
+	names.names = calloc(Symbols.count + 1, sizeof(char *));
+	CHECK_ALLOC(callStack);
+	CHECK_ALLOC(chain);
+	CHECK_ALLOC(visited);
+	CHECK_ALLOC(names.names);
+	for (size_t i = 0; i < Symbols.count; i++)
+	{
+		if (Symbols.isFun[i])
+			walkCallees(i, callStack, 0, chain, visited, i, forwardChain, &names);
+	}
+	free(callStack);
+	free(chain);
+	free(visited);
+	free(names.names);
+	freeSymbols();
+	closeElf(elf, fd);
+	return dekuLeave(ctx, &scope, DEKU_OK);
+}
+
+int dekuCallers(DekuContext *ctx, const char *file, const char *function,
+				const char *refFile, DekuChainHandler handler, void *arg)
+{
+	DekuScope scope;
+	ENTER_CONTEXT(ctx, scope);
+	refreshKernelIndex(ctx);
+
+	int fd;
+	Elf *elf = openElf(file, &fd);
+	readSymbols(elf);
+	readCallees(elf);
+	size_t fun = getFunctionIndex(elf, function);
+	size_t *chain = malloc((Symbols.count + 1) * sizeof(size_t));
+	size_t *roots = malloc((Symbols.count + 1) * sizeof(size_t));
+	size_t *reachedFrom = malloc((Symbols.count + 1) * sizeof(size_t));
+	bool *onChain = calloc(Symbols.count, sizeof(bool));
+	bool *isRoot = NULL;
+	ChainNames names = { .handler = handler, .arg = arg };
+	names.names = calloc(Symbols.count + 1, sizeof(char *));
+	dekuFreeOnError(&scope, &chain);
+	dekuFreeOnError(&scope, &roots);
+	dekuFreeOnError(&scope, &reachedFrom);
+	dekuFreeOnError(&scope, &onChain);
+	dekuFreeOnError(&scope, &isRoot);
+	dekuFreeOnError(&scope, &names.names);
+	CHECK_ALLOC(chain);
+	CHECK_ALLOC(roots);
+	CHECK_ALLOC(reachedFrom);
+	CHECK_ALLOC(onChain);
+	CHECK_ALLOC(names.names);
+	isRoot = findRootFunctions(refFile);
+	size_t rootCount = findCallerChains(fun, isRoot, onChain, reachedFrom, roots);
+	for (size_t i = 0; i < rootCount; i++)
+	{
+		// the shortest chain to the root, from the called function
+		size_t len = 0;
+		for (size_t caller = roots[i]; caller != fun; caller = reachedFrom[caller])
+			len++;
+		chain[0] = fun;
+		for (size_t caller = roots[i], j = len; caller != fun; caller = reachedFrom[caller], j--)
+			chain[j] = caller;
+		forwardChain(chain, len + 1, &names);
+	}
+	free(chain);
+	free(roots);
+	free(reachedFrom);
+	free(onChain);
+	free(isRoot);
+	free(names.names);
+	freeSymbols();
+	closeElf(elf, fd);
+	return dekuLeave(ctx, &scope, DEKU_OK);
+}
+
+int dekuInlinedCallers(DekuContext *ctx, const char *file, const char *function,
+					   DekuSymbolHandler handler, void *arg)
+{
+	DekuScope scope;
+	ENTER_CONTEXT(ctx, scope);
+
+	int fd;
+	Elf *elf = openElf(file, &fd);
+	InlinedCopies copies;
+	if (!readInlinedCopies(elf, file, &copies))
+		LOG_ERR("Can't read the debug info from '%s'", file);
+	forEachInlinedCopy(&copies, function, handler, arg);
+	freeInlinedCopies(&copies);
+	closeElf(elf, fd);
+	return dekuLeave(ctx, &scope, DEKU_OK);
+}
+
+int dekuDirectCallers(DekuContext *ctx, const char *file, const char *function,
+					  DekuChainHandler handler, void *arg)
+{
+	DekuScope scope;
+	ENTER_CONTEXT(ctx, scope);
+
+	int fd;
+	Elf *elf = openElf(file, &fd);
+	readSymbols(elf);
+	readCallees(elf);
+	size_t fun = getFunctionIndex(elf, function);
+	for (size_t i = Symbols.callersStart[fun]; i < Symbols.callersStart[fun + 1]; i++)
+	{
+		size_t caller = Symbols.callers[i];
+		if (caller == fun)
+			continue;
+		const char *chain[] = { Symbols.name[fun], Symbols.name[caller] };
+		handler(chain, 2, arg);
+	}
+	freeSymbols();
+	closeElf(elf, fd);
+	return dekuLeave(ctx, &scope, DEKU_OK);
+}
+
+int dekuBatch(DekuContext *ctx, const char *manifest, long workers, FILE *out)
+{
+	DekuScope scope;
+	ENTER_CONTEXT(ctx, scope);
+	// workers only read the kernel indexes so load them before
+	if (hasKernelFiles(&ctx->kernel))
+		loadKernelIndex(ctx);
+
+	BatchQueue queue = { .ctx = ctx };
+	queue.jobs = readBatchManifest(manifest, &queue.count);
+	pthread_mutex_init(&queue.lock, NULL);
+	long threadsCount = countWorkers(workers, queue.count);
+	pthread_t *threads = calloc(threadsCount + 1, sizeof(pthread_t));
+	CHECK_ALLOC(threads);
+	// the workers use the queue from the stack, so don't leave before they end
+	long started = 0;
+	while (started < threadsCount &&
+		   pthread_create(&threads[started], NULL, batchWorker, &queue) == 0)
+		started++;
+	if (started < threadsCount)
+		LOG_DEBUG("Created only %ld of %ld worker threads", started, threadsCount);
+	for (long i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	for (size_t i = 0; i < queue.count; i++)
+	{
+		BatchJob *job = &queue.jobs[i];
+		if (job->result != NULL)
+			fwrite(job->result, 1, job->resultSize, out);
+		else if (started > 0)
+			fprintf(out, "%zu\tstatus\terror %d\n", i, DEKU_ERROR);
+		free(job->result);
+		free(job->originFile);
+		free(job->newFile);
+		free(job->outFile);
+		free(job->refFile);
+	}
+	pthread_mutex_destroy(&queue.lock);
+	free(threads);
+	free(queue.jobs);
+	if (started == 0 && threadsCount > 0)
+		LOG_ERR("Failed to create worker thread");
+	return dekuLeave(ctx, &scope, DEKU_OK);
+}
+
+int dekuChangeCallSymbol(DekuContext *ctx, const char *file, const char *fromSymbol,
+						 const char *toSymbol)
+{
+	DekuScope scope;
+	ENTER_CONTEXT(ctx, scope);
+
+	int fd = open(file, O_RDWR);
+	if (fd == -1)
+		LOG_ERR("Cannot open input file '%s': %s", file, strerror(errno));
+
+	Elf *elf = elf_begin(fd, ELF_C_RDWR, NULL);
+	if (elf == NULL)
+	{
+		close(fd);
+		LOG_ERR("Problems opening '%s' as ELF file: %s", file, elf_errmsg(-1));
+	}
+
+	buildElfIndex(elf);
+	getRequiredElfIndex(elf)->fd = fd;
+
+	Elf_Scn *scn = NULL;
+	GElf_Shdr shdr;
+	GElf_Rela rela;
+	Elf_Data *data;
+	size_t replaced = 0;
+
+	uint16_t oldSymIndex = getSymbolIndexByName(elf, fromSymbol);
+	uint16_t newSymIndex = getSymbolIndexByName(elf, toSymbol);
+	if (oldSymIndex == 0)
+		LOG_ERR("Can't find symbol '%s'", fromSymbol);
+	if (newSymIndex == 0)
+		LOG_ERR("Can't find symbol '%s'", toSymbol);
+
+	while ((scn = elf_nextscn(elf, scn)) != NULL)
+	{
+		gelf_getshdr(scn, &shdr);
+		if (shdr.sh_type != SHT_RELA)
+			continue;
+		data = elf_getdata(scn, NULL);
+		Elf64_Xword cnt = shdr.sh_size / shdr.sh_entsize;
+		for (Elf64_Xword i = 0; i < cnt; i++)
+		{
+			gelf_getrela(data, i, &rela);
+			if (ELF64_R_SYM(rela.r_info) == oldSymIndex)
+			{
+				rela.r_info = ELF64_R_INFO(newSymIndex, ELF64_R_TYPE(rela.r_info));
+				gelf_update_rela(data, i, &rela);
+				replaced++;
+			}
+		}
+	}
+
+	if (replaced == 0)
+		LOG_ERR("No relocation has been replaced");
+	if (elf_update(elf, ELF_C_WRITE) == -1)
+		LOG_ERR("elf_update failed: %s", elf_errmsg(-1));
+
+	closeElf(elf, fd);
+	return dekuLeave(ctx, &scope, DEKU_OK);
+}
+
+#ifdef SUPPORT_DISASSEMBLE
+int dekuDisassemble(DekuContext *ctx, const char *file, const char *symbol, char **text)
+{
+	DekuScope scope;
+	ENTER_CONTEXT(ctx, scope);
+
+	int fd;
+	Elf *elf = openElf(file, &fd);
+	GElf_Sym sym;
+	if (!getSymbolByNameAndType(elf, symbol, STT_FUNC, &sym))
+		LOG_ERR("Can't find symbol %s", symbol);
+
+	GElf_Shdr shdr;
+	gelf_getshdr(getSectionByName(elf, ".symtab"), &shdr);
+	SymbolData symData = getSymbolData(elf, symbol, STT_FUNC, true);
+	DisasmData data = { .elf = elf, .sym = sym, .shdr = shdr, .symData = &symData };
+
+	*text = disassembleBytes(data.symData->data, data.symData->size, &data);
+	closeElf(elf, fd);
+	return dekuLeave(ctx, &scope, DEKU_OK);
+}
+#endif
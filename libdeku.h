@@ -0,0 +1,194 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/*
+ * Copyright (C) Semihalf, 2022
+ * Author: Marek Maślanka <mm@semihalf.com>
+ *
+ * ELF analysis used by DEKU to find changes in the object files and to
+ * generate the livepatch modules.
+ */
+
+#ifndef LIBDEKU_H
+#define LIBDEKU_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define DEKU_OK 0
+#define DEKU_ERROR 1
+#define DEKU_ERROR_CANT_FIND_SYM_INDEX 19
+#define DEKU_ERROR_CANT_FIND_SYMBOL 20
+#define DEKU_ERROR_CHANGE_CALL_TO_ORIGIN 29
+#define DEKU_ERROR_UNSUPPORTED_READ_MOSTLY 30
+
+/*
+ * Every call returns DEKU_OK or the error code and the error message is kept
+ * in the context. Contexts are independent of each other and can be used
+ * by many threads in parallel, but a single context must not be used by two
+ * threads at the same time.
+ */
+typedef struct DekuContext DekuContext;
+
+typedef enum
+{
+	DEKU_MODIFIED_FUNCTION,
+	DEKU_NEW_FUNCTION,
+	DEKU_NEW_VARIABLE,
+} DekuDiffKind;
+
+/*
+ * Cause of the change in the function. Metadata changes are the references to
+ * the local symbols whose numbering changed, like "__func__.3" becoming
+ * "__func__.4", when the code, the calls and the other references are equal.
+ */
+typedef enum
+{
+	DEKU_CHANGE_CODE,
+	DEKU_CHANGE_CALL,
+	DEKU_CHANGE_DATA,
+	DEKU_CHANGE_METADATA,
+} DekuChangeCause;
+
+typedef struct
+{
+	DekuDiffKind kind;
+	DekuChangeCause cause;
+	char *name;
+} DekuDiffEntry;
+
+typedef struct
+{
+	DekuDiffEntry *entries;
+	size_t count;
+} DekuDiff;
+
+// chain of the functions starting from the called function
+typedef void (*DekuChainHandler)(const char *const *chain, size_t len, void *arg);
+
+DekuContext *dekuOpen(void);
+void dekuClose(DekuContext *ctx);
+const char *dekuErrorMessage(const DekuContext *ctx);
+void dekuSetDebug(DekuContext *ctx, bool debug);
+// keep data read from the reference files between calls
+void dekuSetCache(DekuContext *ctx, bool cache);
+// report functions with the metadata changes only, they are skipped by default
+void dekuSetKeepMetadataChanges(DekuContext *ctx, bool keep);
+
+/*
+ * Files describing the kernel build, any of them can be NULL. Indexes built
+ * from them are dropped when content of the kernel version file changes.
+ */
+int dekuSetKernelFiles(DekuContext *ctx, const char *versionFile, const char *systemMap,
+					   const char *symvers, const char *symbolsDir);
+int dekuLoadKernelIndex(DekuContext *ctx);
+// "owner" and "module" are valid until the next call on the context
+int dekuSymbolOwner(DekuContext *ctx, const char *symbol, const char **owner);
+/*
+ * Position of the symbol among the symbols with the same name in vmlinux as
+ * used by the livepatch "sympos", 0 for the unique symbol. "objFile" is the
+ * object file that defines the symbol and can be NULL. Non-unique symbols are
+ * resolved only from the symbol index.
+ */
+int dekuSymbolPosition(DekuContext *ctx, const char *symbol, const char *objFile,
+					   size_t *position);
+int dekuExportingModule(DekuContext *ctx, const char *symbol, const char **module);
+
+typedef struct
+{
+	// module name or "vmlinux" and path of the object relative to the modules dir
+	const char *object;
+	const char *path;
+	// type as printed by the nm
+	char type;
+	// definitions in the object and in vmlinux with all modules
+	size_t count;
+	size_t total;
+} DekuSymbolInfo;
+
+/*
+ * Index of the symbols defined in "vmlinux" and in all "*.ko" files found in
+ * "modulesDir" and of the symbols exported in "symvers", any of them can be
+ * NULL. The symbol owner is the first object defining it, vmlinux goes before
+ * the modules. workers <= 0 uses one worker per CPU.
+ */
+int dekuBuildSymbolIndex(DekuContext *ctx, const char *vmlinux, const char *modulesDir,
+						 const char *symvers, long workers, const char *indexFile);
+// index used by the lookups and checked first by dekuSymbolOwner(), NULL unsets it
+int dekuSetSymbolIndex(DekuContext *ctx, const char *indexFile);
+// strings in "info" are valid until the next call on the context
+int dekuLookupSymbol(DekuContext *ctx, const char *symbol, DekuSymbolInfo *info);
+
+typedef void (*DekuSymbolHandler)(const char *symbol, void *arg);
+
+/*
+ * Undefined symbols of the module that are not exported. They are checked in
+ * the symbol index or in the Module.symvers from the kernel files.
+ */
+int dekuUnexportedSymbols(DekuContext *ctx, const char *moduleFile, DekuSymbolHandler handler,
+						  void *arg);
+
+/*
+ * Directory where dekuDiff() and dekuBatch() keep the fingerprints of the
+ * functions from the origin files. The origin file is then compared by its
+ * fingerprints, which are computed only once for its content and the kernel
+ * version. NULL unsets it.
+ */
+int dekuSetFingerprintCache(DekuContext *ctx, const char *dir);
+int dekuDiff(DekuContext *ctx, const char *originFile, const char *newFile, DekuDiff *diff);
+void dekuFreeDiff(DekuDiff *diff);
+// "symbols" is NULL terminated
+int dekuExtract(DekuContext *ctx, const char *file, const char *outFile,
+				const char *const *symbols);
+int dekuCallees(DekuContext *ctx, const char *file, DekuChainHandler handler, void *arg);
+/*
+ * Chains end on functions not called by any function or defined in "refFile".
+ * The handler gets the shortest chain to each of these functions.
+ */
+int dekuCallers(DekuContext *ctx, const char *file, const char *function,
+				const char *refFile, DekuChainHandler handler, void *arg);
+/*
+ * Out-of-line functions that contain an inlined copy of "function", read from
+ * the debug info of the file. Copies inlined through other inline functions
+ * are found too.
+ */
+int dekuInlinedCallers(DekuContext *ctx, const char *file, const char *function,
+					   DekuSymbolHandler handler, void *arg);
+int dekuDirectCallers(DekuContext *ctx, const char *file, const char *function,
+					  DekuChainHandler handler, void *arg);
+/*
+ * Run diff and extract for every "<ORIGIN> <NEW> <OUT> [<REF>]" line of the
+ * manifest. Modified functions are checked against the kernel indexes when
+ * the kernel files are set. workers <= 0 uses one worker per CPU.
+ */
+int dekuBatch(DekuContext *ctx, const char *manifest, long workers, FILE *out);
+int dekuChangeCallSymbol(DekuContext *ctx, const char *file, const char *fromSymbol,
+						 const char *toSymbol);
+// "relocations" is NULL terminated list of "<OBJ>.<SYMBOL>,<SYMPOS>"
+int dekuMakeLivepatch(DekuContext *ctx, const char *moduleFile, const char *objName,
+					  const char *const *relocations);
+
+// relocations of "from" are changed to "to" and "from" is removed from the module
+typedef struct
+{
+	const char *from;
+	const char *to;
+} DekuCallRestore;
+
+typedef struct
+{
+	const DekuCallRestore *calls;
+	size_t callsCount;
+	// klp relocations, same as in dekuMakeLivepatch(), can be NULL
+	const char *objName;
+	const char *const *relocations;
+	// content of the ".note.deku" section, not added if NULL
+	const char *note;
+} DekuFinalizeParams;
+
+// apply all changes to the built livepatch module and write it once
+int dekuFinalizeModule(DekuContext *ctx, const char *moduleFile, const DekuFinalizeParams *params);
+#ifdef SUPPORT_DISASSEMBLE
+int dekuDisassemble(DekuContext *ctx, const char *file, const char *symbol, char **text);
+#endif
+
+#endif /* LIBDEKU_H */
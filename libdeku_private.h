@@ -0,0 +1,110 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/*
+ * Copyright (C) Semihalf, 2022
+ * Author: Marek Maślanka <mm@semihalf.com>
+ *
+ * Helpers shared by the libdeku sources
+ */
+
+#ifndef LIBDEKU_PRIVATE_H
+#define LIBDEKU_PRIVATE_H
+
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <gelf.h>
+
+#include "libdeku.h"
+
+extern __thread bool DekuDebugLog;
+
+/*
+ * State saved when the library call enters the context. Errors reported
+ * during the call jump back to "errorJmp".
+ */
+#define DEKU_SCOPE_ALLOCS 8
+
+typedef struct
+{
+	jmp_buf errorJmp;
+	jmp_buf *prevErrorJmp;
+	DekuContext *prevContext;
+	bool prevDebugLog;
+	// addresses of the pointers to memory that is freed when the call fails
+	void *allocs[DEKU_SCOPE_ALLOCS];
+	size_t allocCount;
+} DekuScope;
+
+void dekuEnter(DekuContext *ctx, DekuScope *scope);
+/*
+ * Free "*ptr" if the call fails. "ptr" is the address of the pointer, so
+ * the pointer can be set or reallocated later. It must be valid until the
+ * call ends.
+ */
+void dekuFreeOnError(DekuScope *scope, void *ptr);
+// free the memory registered with dekuFreeOnError()
+void dekuReleaseScope(DekuScope *scope);
+// returns "code"
+int dekuLeave(DekuContext *ctx, DekuScope *scope, int code);
+// error code of the failed call, valid after the jump to "errorJmp"
+int dekuErrorCode(void);
+__attribute__((noreturn, format(printf, 4, 5)))
+void dekuFail(int code, const char *file, int line, const char *fmt, ...);
+
+#define LOG_ERR(fmt, ...) dekuFail(DEKU_ERROR, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
+/*
+ * Messages go to the stderr, because the stdout of the tools carries results,
+ * e.g. the records of the "--batch".
+ */
+#define LOG_INFO(fmt, ...)												\
+	do																	\
+	{																	\
+		fprintf(stderr, fmt "\n", ##__VA_ARGS__);						\
+	} while (0)
+#define LOG_DEBUG(fmt, ...)												\
+	do																	\
+	{																	\
+		if (DekuDebugLog)												\
+			fprintf(stderr, fmt "\n", ##__VA_ARGS__);					\
+	} while (0)
+
+/*
+ * String table of an ELF section. Strings are deduplicated and stored in one
+ * growing buffer that is used as the section data, so the offsets returned by
+ * dekuAddString() can be used right away.
+ */
+typedef struct
+{
+	Elf_Scn *scn;
+	Elf_Data *data;
+	char *buf;
+	size_t size;
+	size_t capacity;
+	// offsets of the strings in "buf" in the order of adding
+	size_t *offsets;
+	size_t count;
+	// open addressing hash table, keeps index in "offsets" + 1
+	size_t *buckets;
+	size_t mask;
+	// filled by mergeStringTable()
+	size_t *newOffsets;
+	char *mergedBuf;
+	size_t mergedSize;
+} StringTable;
+
+uint32_t dekuHashName(const char *name);
+// start the table of a new section
+void dekuInitStringTable(StringTable *table, Elf_Scn *scn);
+// start the table with the strings that are already in the section
+void dekuLoadStringTable(StringTable *table, Elf_Scn *scn);
+// returns offset of the string in the section
+size_t dekuAddString(StringTable *table, const char *text);
+void dekuFreeStringTable(StringTable *table);
+
+#define CHECK_ALLOC(m)	\
+	if (m == NULL)		\
+	LOG_ERR("Failed to alloc memory in %s (%s:%d)", __func__, __FILE__, __LINE__)
+
+#endif /* LIBDEKU_PRIVATE_H */
@@ -0,0 +1,620 @@
+/* SPDX-License-Identifier: GPL-2.0 OR Apache-2.0 */
+/*
+ * Copyright (C) Semihalf, 2022
+ * Author: Marek Maślanka <mm@semihalf.com>
+ *
+ * Convert kernel module to livepatch module
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <gelf.h>
+
+#include "libdeku_private.h"
+
+/*
+* Make livepatch procedure:
+* * Add private symbols to the table (symbols not accessible from outside module/file)
+* * Find the relocation sections that contain the symbols above and remove them
+* * Add the symbol names from the first step to .strtab
+* * Update the symbols name and flag in .symtab as the kernel livepatch requirements
+* * Add the names for the new relocation sections to .shstrtab
+* * Add new relocation sections with a relocations entry
+*
+* The conversion is done together with the rest of the module finalization
+* (restoring calls to the origin functions and adding the note) to write the
+* module only once.
+*/
+
+/* In kernel, this size is defined in linux/module.h;
+ * here we use Elf_Addr instead of long for covering cross-compile
+ */
+#define MODULE_NAME_LEN (64 - sizeof(GElf_Addr))
+
+#define KSYM_NAME_LEN 128
+
+typedef struct
+{
+	size_t symOff;
+	char *sym;
+	char *fName;
+} Symbol;
+
+typedef struct
+{
+	GElf_Shdr shdr;
+	GElf_Rela *rela;
+	size_t relaCnt;
+	char *secName;
+	// data of the new relocation section
+	void *buf;
+} RelaSym;
+
+// state of the module conversion, released by releaseLivepatch()
+typedef struct
+{
+	int fd;
+	Elf *elf;
+	Symbol *symToRelocate;
+	size_t symToRelocateCnt;
+	size_t symToRelocateCapacity;
+	// index in "symToRelocate" + 1 for every symbol of the module, 0 if not relocated
+	size_t *relocateOf;
+	size_t symCount;
+	RelaSym **relocs;
+	size_t relaSectionCount;
+	char **symbolNames;
+	StringTable strtab;
+	StringTable shstrtab;
+	size_t *restoreBuf;
+	char *note;
+} Livepatch;
+
+static void addSymbolToRelocate(Livepatch *lp, const char *sym)
+{
+	size_t cnt, symPos;
+	char objName[MODULE_NAME_LEN];
+	char fName[KSYM_NAME_LEN];
+
+	/* Format: sym_objname.sym_name,sympos */
+	cnt = sscanf(sym, "%55[^.].%127[^,],%lu", objName, fName, &symPos);
+	if (cnt != 3)
+		LOG_ERR("symbol '%s' has an incorrectly formatted name", sym);
+	char *klpSym = (char *)malloc(strlen(sym) + 16);
+	CHECK_ALLOC(klpSym);
+	sprintf(klpSym, ".klp.sym.%s", sym);
+	Symbol s =
+	{
+		.sym = klpSym, .fName = strdup(fName)
+	};
+	if (lp->symToRelocateCnt == lp->symToRelocateCapacity)
+	{
+		size_t capacity = lp->symToRelocateCapacity ? lp->symToRelocateCapacity * 2 : 64;
+		Symbol *syms = realloc(lp->symToRelocate, capacity * sizeof(*lp->symToRelocate));
+		if (syms != NULL)
+		{
+			lp->symToRelocate = syms;
+			lp->symToRelocateCapacity = capacity;
+		}
+	}
+	if (lp->symToRelocateCnt == lp->symToRelocateCapacity || s.fName == NULL)
+	{
+		free(klpSym);
+		free(s.fName);
+		LOG_ERR("Failed to alloc memory in %s (%s:%d)", __func__, __FILE__, __LINE__);
+	}
+	lp->symToRelocate[lp->symToRelocateCnt++] = s;
+}
+
+/*
+ * Match symbols of the module with the symbols to relocate by the name. If
+ * the name is given more than once then the last entry is used.
+ */
+static void findSymbolsToRelocate(Livepatch *lp)
+{
+	size_t symCnt = 0;
+	while (lp->symbolNames[symCnt] != NULL)
+		symCnt++;
+	lp->symCount = symCnt;
+	lp->relocateOf = calloc(symCnt + 1, sizeof(size_t));
+	CHECK_ALLOC(lp->relocateOf);
+
+	size_t mask = 63;
+	while (mask < lp->symToRelocateCnt * 2)
+		mask = mask * 2 + 1;
+	size_t *buckets = calloc(mask + 1, sizeof(size_t));
+	CHECK_ALLOC(buckets);
+	for (size_t i = 0; i < lp->symToRelocateCnt; i++)
+	{
+		const char *name = lp->symToRelocate[i].fName;
+		size_t bucket = dekuHashName(name) & mask;
+		while (buckets[bucket] != 0 &&
+			   strcmp(lp->symToRelocate[buckets[bucket] - 1].fName, name) != 0)
+			bucket = (bucket + 1) & mask;
+		buckets[bucket] = i + 1;
+	}
+
+	for (size_t i = 0; i < symCnt; i++)
+	{
+		const char *name = lp->symbolNames[i];
+		if (name == NULL || name[0] == '\0')
+			continue;
+		size_t bucket = dekuHashName(name) & mask;
+		while (buckets[bucket] != 0)
+		{
+			size_t entry = buckets[bucket] - 1;
+			if (strcmp(lp->symToRelocate[entry].fName, name) == 0)
+			{
+				lp->relocateOf[i] = entry + 1;
+				break;
+			}
+			bucket = (bucket + 1) & mask;
+		}
+	}
+	free(buckets);
+}
+
+static bool isRelocated(const Livepatch *lp, size_t symIndex)
+{
+	return symIndex < lp->symCount && lp->relocateOf[symIndex] != 0;
+}
+
+static Elf_Scn *getSectionByName(Elf *elf, const char *secName)
+{
+	Elf_Scn *scn = NULL;
+	GElf_Shdr shdr;
+	size_t shstrndx;
+	elf_getshdrstrndx(elf, &shstrndx);
+	while ((scn = elf_nextscn(elf, scn)) != NULL)
+	{
+		gelf_getshdr(scn, &shdr);
+		char *name = elf_strptr(elf, shstrndx, shdr.sh_name);
+		if (strcmp(name, secName) == 0)
+			return scn;
+	}
+	return NULL;
+}
+
+static char **getSymbolNames(Elf *elf)
+{
+	char **result;
+	Elf_Scn *scn = getSectionByName(elf, ".symtab");
+	if (scn == NULL)
+		LOG_ERR("Failed to find .symtab section");
+	GElf_Shdr shdr;
+	Elf_Data *data = elf_getdata(scn, NULL);
+	gelf_getshdr(scn, &shdr);
+	const Elf64_Sym *syms = (const Elf64_Sym *)data->d_buf;
+	size_t cnt = data->d_size / sizeof(Elf64_Sym);
+	result = (char **)calloc(cnt + 1, sizeof(char *));
+	CHECK_ALLOC(result);
+	for (size_t i = 0; i < cnt; i++)
+		result[i] = elf_strptr(elf, shdr.sh_link, syms[i].st_name);
+	return result;
+}
+
+static void addRelocateSymToStrtab(Livepatch *lp)
+{
+	Elf_Scn *scn = getSectionByName(lp->elf, ".strtab");
+	if (scn == NULL)
+		LOG_ERR("Failed to find .strtab section");
+	dekuLoadStringTable(&lp->strtab, scn);
+	for(size_t i = 0; i < lp->symToRelocateCnt; i++)
+		lp->symToRelocate[i].symOff = dekuAddString(&lp->strtab, lp->symToRelocate[i].sym);
+}
+
+static void addSectionStr(Livepatch *lp, const char *objName)
+{
+	Elf *elf = lp->elf;
+	RelaSym **relocs = lp->relocs;
+	size_t shstrndx;
+	elf_getshdrstrndx(elf, &shstrndx);
+	const char *lastName = "";
+	for (size_t i = 0; i < lp->relaSectionCount; i++)
+	{
+		char *name = elf_strptr(elf, shstrndx, relocs[i]->shdr.sh_name);
+		if (strcmp(name, lastName) == 0)
+			continue;
+		lastName = name;
+		char *relaSecName = (char *)malloc(16 + strlen(objName) + strlen(name));
+		CHECK_ALLOC(relaSecName);
+		sprintf(relaSecName, ".klp.rela.%s%s", objName, name + 5);
+		relocs[i]->shdr.sh_name = dekuAddString(&lp->shstrtab, relaSecName);
+		relocs[i]->secName = relaSecName;
+		LOG_DEBUG("Add section '%s' to string table", relaSecName);
+	}
+}
+
+static int convSymToLpRelSym(Livepatch *lp)
+{
+	Elf *elf = lp->elf;
+	Elf_Scn *scn = getSectionByName(elf, ".symtab");
+	if (scn == NULL)
+		LOG_ERR("Failed to find .symtab section");
+	Elf_Data *data = elf_getdata(scn, NULL);
+	Elf64_Sym *syms = (Elf64_Sym *)data->d_buf;
+	size_t cnt = data->d_size / sizeof(Elf64_Sym);
+	for (size_t i = 0; i < cnt; i++)
+	{
+		if (!isRelocated(lp, i))
+			continue;
+		Symbol *symbol = &lp->symToRelocate[lp->relocateOf[i] - 1];
+		syms[i].st_name = symbol->symOff;
+		syms[i].st_shndx = 0xFF20;
+		LOG_DEBUG("Convert to livepatch symbol '%s'", lp->symbolNames[i]);
+	}
+	elf_flagdata(data, ELF_C_SET, ELF_F_DIRTY);
+	return 0;
+}
+
+static void removeRelaSymbols(Livepatch *lp)
+{
+	Elf *elf = lp->elf;
+	char **names = lp->symbolNames;
+	Elf_Scn *scn = NULL;
+	GElf_Shdr shdr;
+	size_t shstrndx;
+	Elf_Data *data;
+
+	elf_getshdrstrndx(elf, &shstrndx);
+	while ((scn = elf_nextscn(elf, scn)) != NULL)
+	{
+		gelf_getshdr(scn, &shdr);
+		if (shdr.sh_type != SHT_RELA)
+			continue;
+		char *secName = elf_strptr(elf, shstrndx, shdr.sh_name);
+		if (strcmp(".rela.debug_info", secName) == 0 ||
+			strcmp(".rela__jump_table", secName) == 0)
+			continue;
+		data = elf_getdata(scn, NULL);
+		Elf64_Rela *relocs = (Elf64_Rela *)data->d_buf;
+		size_t cnt = data->d_size / sizeof(Elf64_Rela);
+		size_t moved = 0;
+		for (size_t i = 0; i < cnt; i++)
+		{
+			if (isRelocated(lp, ELF64_R_SYM(relocs[i].r_info)))
+				moved++;
+		}
+		if (moved == 0)
+			continue;
+
+		RelaSym *relaSym = (RelaSym *)calloc(1, sizeof(RelaSym));
+		CHECK_ALLOC(relaSym);
+		RelaSym **sections = (RelaSym **)realloc(lp->relocs, sizeof(*lp->relocs) * (lp->relaSectionCount + 1));
+		if (sections == NULL)
+		{
+			free(relaSym);
+			LOG_ERR("Failed to alloc memory in %s (%s:%d)", __func__, __FILE__, __LINE__);
+		}
+		lp->relocs = sections;
+		lp->relocs[lp->relaSectionCount++] = relaSym;
+		relaSym->shdr = shdr;
+		relaSym->rela = (GElf_Rela *)malloc(sizeof(GElf_Rela) * moved);
+		CHECK_ALLOC(relaSym->rela);
+
+		// move relocations of the relocated symbols to the new section in one pass
+		size_t j = 0;
+		for (size_t i = 0; i < cnt; i++)
+		{
+			Elf64_Rela rela = relocs[i];
+			size_t idx = ELF64_R_SYM(rela.r_info);
+			if (isRelocated(lp, idx))
+			{
+				relaSym->rela[relaSym->relaCnt++] = rela;
+				LOG_DEBUG("Remove relocation '%s' from '%s'", names[idx], secName);
+			}
+			else
+			{
+				relocs[j++] = rela;
+			}
+		}
+		shdr.sh_size = j * shdr.sh_entsize;
+		data->d_size = shdr.sh_size;
+		elf_flagdata(data, ELF_C_SET, ELF_F_DIRTY);
+		gelf_update_shdr(scn, &shdr);
+	}
+}
+
+static void addRelaSection(Livepatch *lp)
+{
+	Elf *elf = lp->elf;
+	char **names = lp->symbolNames;
+	Elf_Scn *newscn;
+	Elf_Data *newData;
+	GElf_Shdr shdr;
+	for (size_t i = 0; i < lp->relaSectionCount; i++)
+	{
+		newscn = elf_newscn(elf);
+		if (!newscn)
+			LOG_ERR("elf_newscn failed");
+
+		newData = elf_newdata(newscn);
+		if (!newData)
+			LOG_ERR("elf_newdata failed");
+
+		gelf_getshdr(newscn, &shdr);
+		RelaSym *relaSym = lp->relocs[i];
+		memcpy(&shdr, &relaSym->shdr, sizeof(GElf_Shdr));
+		shdr.sh_flags = SHF_ALLOC | 0x0000000000100000;
+
+		newData->d_size = relaSym->relaCnt * shdr.sh_entsize;
+		newData->d_type = ELF_T_RELA;
+		relaSym->buf = malloc(newData->d_size);
+		CHECK_ALLOC(relaSym->buf);
+		newData->d_buf = relaSym->buf;
+
+		for (size_t j = 0; j < relaSym->relaCnt; j++)
+		{
+			GElf_Rela rela = relaSym->rela[j];
+			int idx = ELF64_R_SYM(rela.r_info);
+			int r = gelf_update_rela(newData, j, &rela);
+			if (r)
+				LOG_DEBUG("Add relocation '%s' to '%s'", names[idx], relaSym->secName);
+			else
+				LOG_ERR("Fail to add relocation '%s' to '%s'", names[idx], relaSym->secName);
+		}
+
+		if (!gelf_update_shdr(newscn, &shdr))
+			LOG_ERR("gelf_update_shdr failed");
+	}
+}
+
+/*
+ * Change relocations of the "from" symbols to the "to" symbols and remove the
+ * "from" symbols from the symbol table
+ */
+static void restoreCalls(Livepatch *lp, const DekuCallRestore *calls, size_t count)
+{
+	Elf *elf = lp->elf;
+	GElf_Shdr shdr;
+	Elf_Scn *symScn = getSectionByName(elf, ".symtab");
+	if (symScn == NULL)
+		LOG_ERR("Failed to find .symtab section");
+	Elf_Data *symData = elf_getdata(symScn, NULL);
+	Elf64_Sym *syms = (Elf64_Sym *)symData->d_buf;
+	size_t symCnt = symData->d_size / sizeof(Elf64_Sym);
+
+	lp->restoreBuf = calloc(symCnt * 2 + count * 2, sizeof(size_t));
+	CHECK_ALLOC(lp->restoreBuf);
+	// index of the call restored by the symbol + 1
+	size_t *callOf = lp->restoreBuf;
+	size_t *newIndex = callOf + symCnt;
+	size_t *toIndex = newIndex + symCnt;
+	size_t *replaced = toIndex + count;
+
+	for (size_t j = 0; j < count; j++)
+	{
+		size_t from = 0;
+		for (size_t i = 1; i < symCnt && (from == 0 || toIndex[j] == 0); i++)
+		{
+			if (from == 0 && strcmp(lp->symbolNames[i], calls[j].from) == 0)
+				from = i;
+			else if (toIndex[j] == 0 && strcmp(lp->symbolNames[i], calls[j].to) == 0)
+				toIndex[j] = i;
+		}
+		if (from == 0)
+			dekuFail(DEKU_ERROR_CHANGE_CALL_TO_ORIGIN, __FILE__, __LINE__,
+					 "Can't find symbol '%s'", calls[j].from);
+		if (toIndex[j] == 0)
+			dekuFail(DEKU_ERROR_CHANGE_CALL_TO_ORIGIN, __FILE__, __LINE__,
+					 "Can't find symbol '%s'", calls[j].to);
+		callOf[from] = j + 1;
+	}
+
+	size_t removed = 0;
+	for (size_t i = 0; i < symCnt; i++)
+	{
+		newIndex[i] = i - removed;
+		if (callOf[i] != 0)
+			removed++;
+	}
+
+	Elf_Scn *scn = NULL;
+	Elf_Scn *shndxScn = NULL;
+	while ((scn = elf_nextscn(elf, scn)) != NULL)
+	{
+		gelf_getshdr(scn, &shdr);
+		if (shdr.sh_type == SHT_SYMTAB_SHNDX)
+			shndxScn = scn;
+		if (shdr.sh_type == SHT_GROUP && shdr.sh_info < symCnt)
+		{
+			// signature symbol of the group
+			shdr.sh_info = newIndex[shdr.sh_info];
+			gelf_update_shdr(scn, &shdr);
+		}
+		if (shdr.sh_type != SHT_RELA)
+			continue;
+		Elf_Data *data = elf_getdata(scn, NULL);
+		Elf64_Rela *relocs = (Elf64_Rela *)data->d_buf;
+		size_t cnt = data->d_size / sizeof(Elf64_Rela);
+		for (size_t i = 0; i < cnt; i++)
+		{
+			size_t sym = ELF64_R_SYM(relocs[i].r_info);
+			if (sym >= symCnt)
+				continue;
+			if (callOf[sym] != 0)
+			{
+				replaced[callOf[sym] - 1]++;
+				sym = toIndex[callOf[sym] - 1];
+			}
+			relocs[i].r_info = ELF64_R_INFO(newIndex[sym], ELF64_R_TYPE(relocs[i].r_info));
+		}
+		elf_flagdata(data, ELF_C_SET, ELF_F_DIRTY);
+	}
+
+	for (size_t j = 0; j < count; j++)
+	{
+		if (replaced[j] == 0)
+			dekuFail(DEKU_ERROR_CHANGE_CALL_TO_ORIGIN, __FILE__, __LINE__,
+					 "No relocation has been replaced for '%s'", calls[j].from);
+		LOG_DEBUG("Restore calls from '%s' to '%s'", calls[j].from, calls[j].to);
+	}
+
+	Elf32_Word *shndx = shndxScn ? (Elf32_Word *)elf_getdata(shndxScn, NULL)->d_buf : NULL;
+	gelf_getshdr(symScn, &shdr);
+	size_t locals = shdr.sh_info;
+	size_t j = 0;
+	for (size_t i = 0; i < symCnt; i++)
+	{
+		if (callOf[i] != 0)
+		{
+			if (i < shdr.sh_info)
+				locals--;
+			continue;
+		}
+		syms[j] = syms[i];
+		lp->symbolNames[j] = lp->symbolNames[i];
+		if (shndx != NULL)
+			shndx[j] = shndx[i];
+		j++;
+	}
+	lp->symbolNames[j] = NULL;
+	shdr.sh_info = locals;
+	shdr.sh_size = j * sizeof(Elf64_Sym);
+	symData->d_size = shdr.sh_size;
+	elf_flagdata(symData, ELF_C_SET, ELF_F_DIRTY);
+	gelf_update_shdr(symScn, &shdr);
+	if (shndxScn != NULL)
+	{
+		Elf_Data *data = elf_getdata(shndxScn, NULL);
+		gelf_getshdr(shndxScn, &shdr);
+		shdr.sh_size = j * sizeof(Elf32_Word);
+		data->d_size = shdr.sh_size;
+		elf_flagdata(data, ELF_C_SET, ELF_F_DIRTY);
+		gelf_update_shdr(shndxScn, &shdr);
+	}
+}
+
+static void addNote(Livepatch *lp, const char *note)
+{
+	Elf_Scn *scn = elf_newscn(lp->elf);
+	if (scn == NULL)
+		LOG_ERR("elf_newscn failed");
+	Elf_Data *data = elf_newdata(scn);
+	if (data == NULL)
+		LOG_ERR("elf_newdata failed");
+
+	lp->note = strdup(note);
+	CHECK_ALLOC(lp->note);
+	data->d_buf = lp->note;
+	data->d_size = strlen(note);
+	data->d_type = ELF_T_BYTE;
+	data->d_align = 1;
+
+	GElf_Shdr shdr;
+	gelf_getshdr(scn, &shdr);
+	shdr.sh_name = dekuAddString(&lp->shstrtab, ".note.deku");
+	shdr.sh_type = SHT_NOTE;
+	shdr.sh_flags = SHF_ALLOC;
+	shdr.sh_addralign = 1;
+	shdr.sh_size = data->d_size;
+	if (!gelf_update_shdr(scn, &shdr))
+		LOG_ERR("gelf_update_shdr failed");
+	LOG_DEBUG("Add .note.deku section");
+}
+
+static void releaseLivepatch(Livepatch *lp)
+{
+	if (lp->elf != NULL)
+		elf_end(lp->elf);
+	if (lp->fd != -1)
+		close(lp->fd);
+	for (size_t i = 0; i < lp->relaSectionCount; i++)
+	{
+		free(lp->relocs[i]->rela);
+		free(lp->relocs[i]->secName);
+		free(lp->relocs[i]->buf);
+		free(lp->relocs[i]);
+	}
+	for (size_t i = 0; i < lp->symToRelocateCnt; i++)
+	{
+		free(lp->symToRelocate[i].sym);
+		free(lp->symToRelocate[i].fName);
+	}
+	free(lp->relocs);
+	free(lp->symToRelocate);
+	free(lp->symbolNames);
+	dekuFreeStringTable(&lp->strtab);
+	dekuFreeStringTable(&lp->shstrtab);
+	free(lp->restoreBuf);
+	free(lp->relocateOf);
+	free(lp->note);
+	memset(lp, 0, sizeof(*lp));
+	lp->fd = -1;
+}
+
+int dekuFinalizeModule(DekuContext *ctx, const char *moduleFile, const DekuFinalizeParams *params)
+{
+	Livepatch lp = { .fd = -1 };
+	DekuScope scope;
+	if (setjmp(scope.errorJmp) != 0)
+	{
+		releaseLivepatch(&lp);
+		return dekuLeave(ctx, &scope, dekuErrorCode());
+	}
+	dekuEnter(ctx, &scope);
+
+	const char *const *relocations = params->relocations;
+	for (; relocations != NULL && *relocations != NULL; relocations++)
+		addSymbolToRelocate(&lp, *relocations);
+	if (lp.symToRelocateCnt > 0 && params->objName == NULL)
+		LOG_ERR("Object name is required to convert relocations");
+
+	lp.fd = open(moduleFile, O_RDWR);
+	if (lp.fd == -1)
+		LOG_ERR("cannot open input file '%s': %s", moduleFile, strerror(errno));
+
+	lp.elf = elf_begin(lp.fd, ELF_C_RDWR, NULL);
+	if (lp.elf == NULL)
+		LOG_ERR("problems opening '%s' as ELF file: %s", moduleFile, elf_errmsg(-1));
+
+	size_t shstrndx;
+	if (elf_getshdrstrndx(lp.elf, &shstrndx))
+		LOG_ERR("cannot get section header string index");
+
+	// symbols and relocations are accessed directly as Elf64 structures
+	if (gelf_getclass(lp.elf) != ELFCLASS64)
+		LOG_ERR("Only 64-bit ELF files are supported");
+
+	Elf_Scn *scn = getSectionByName(lp.elf, ".shstrtab");
+	if (scn == NULL)
+		LOG_ERR("Failed to find .shstrtab section");
+	dekuLoadStringTable(&lp.shstrtab, scn);
+
+	lp.symbolNames = getSymbolNames(lp.elf);
+	if (params->callsCount > 0)
+		restoreCalls(&lp, params->calls, params->callsCount);
+	if (lp.symToRelocateCnt > 0)
+	{
+		findSymbolsToRelocate(&lp);
+		removeRelaSymbols(&lp);
+		addRelocateSymToStrtab(&lp);
+		convSymToLpRelSym(&lp);
+		addSectionStr(&lp, params->objName);
+		addRelaSection(&lp);
+	}
+	if (params->note != NULL)
+		addNote(&lp, params->note);
+
+	if (elf_update(lp.elf, ELF_C_WRITE) == -1)
+		LOG_ERR("elf_update failed: %s", elf_errmsg(-1));
+
+	releaseLivepatch(&lp);
+	return dekuLeave(ctx, &scope, DEKU_OK);
+}
+
+int dekuMakeLivepatch(DekuContext *ctx, const char *moduleFile, const char *objName,
+					  const char *const *relocations)
+{
+	DekuFinalizeParams params =
+	{
+		.objName = objName,
+		.relocations = relocations,
+	};
+	return dekuFinalizeModule(ctx, moduleFile, &params);
+}
@@ -3,358 +3,160 @@
  * Copyright (C) Semihalf, 2022
  * Author: Marek Maślanka <mm@semihalf.com>
  *
- * Convert kernel module to livepatch module
+ * Finalize the livepatch module: restore calls to the origin functions, convert
+ * relocations to the klp relocations and add the note
  */
 
 #include <errno.h>
 #include <error.h>
-#include <fcntl.h>
-#include <stdlib.h>
-#include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
 
-#include <gelf.h>
-
-/*
-* Make livepatch procedure:
-* * Add private symbols to the table (symbols not accessible from outside module/file)
-* * Find the relocation sections that contain the symbols above and remove them
-* * Add the symbol names from the first step to .strtab
-* * Update the symbols name and flag in .symtab as the kernel livepatch requirements
-* * Add the names for the new relocation sections to .shstrtab
-* * Add new relocation sections with a relocations entry
-*/
-
-/* In kernel, this size is defined in linux/module.h;
- * here we use Elf_Addr instead of long for covering cross-compile
- */
-#define MODULE_NAME_LEN (64 - sizeof(GElf_Addr))
-
-#define KSYM_NAME_LEN 128
-
-static int ShowDebugLog = 1;
-#define LOG_ERR(fmt, ...) do { fprintf(stderr, "ERROR: " fmt "\n", ##__VA_ARGS__); exit(1); } while(0)
-#define LOG_DEBUG(fmt, ...) do { if (ShowDebugLog) printf(fmt "\n", ##__VA_ARGS__); } while(0)
-
-#define CHECK_ALLOC(m) if (m == NULL) LOG_ERR("Failed to alloc memory in %s (%s:%d)", __func__, __FILE__, __LINE__)
-
-typedef struct
-{
-	size_t symOff;
-	char *sym;
-	char *fName;
-} Symbol;
-
-typedef struct
-{
-	GElf_Shdr shdr;
-	GElf_Rela *rela;
-	size_t relaCnt;
-	char *secName;
-} RelaSym;
-
-size_t relaSectionCount = 0;
-
-Symbol *symToRelocate = NULL;
-size_t symToRelocateCnt = 0;
-char **funToReplace = NULL;
-
-static int appendString(GElf_Shdr *shdr, Elf_Data *data, const char *text)
-{
-	size_t oldSize = data->d_size;
-	size_t newSize = data->d_size + strlen(text) + 1;
-	char *buf = (char *)malloc(newSize);
-	CHECK_ALLOC(buf);
-
-	memcpy(buf, data->d_buf, data->d_size);
-	strcpy(&buf[data->d_size], text);
-	data->d_buf = buf;
-	data->d_size = newSize;
-	shdr->sh_size = newSize;
-	return oldSize;
-}
-
-static void addSymbolToRelocate(const char *sym)
-{
-	size_t cnt, symPos;
-	char objName[MODULE_NAME_LEN];
-	char *fName = (char *)malloc(KSYM_NAME_LEN);
-	char *klpSym = (char *)malloc(strlen(sym) + 16);
-	CHECK_ALLOC(fName);
-	CHECK_ALLOC(klpSym);
-
-	sprintf(klpSym, ".klp.sym.%s", sym);
-	/* Format: sym_objname.sym_name,sympos */
-	cnt = sscanf(sym, "%55[^.].%127[^,],%lu", objName, fName, &symPos);
-	if (cnt != 3)
-		LOG_ERR("symbol '%s' has an incorrectly formatted name", sym);
-	Symbol s =
-	{
-		.sym = klpSym, .fName = fName
-	};
-	symToRelocate = realloc(symToRelocate, (symToRelocateCnt + 1) * sizeof(*symToRelocate));
-	CHECK_ALLOC(symToRelocate);
-	symToRelocate[symToRelocateCnt++] = s;
-}
-
-static Elf_Scn *getSectionByName(Elf *elf, const char *secName)
-{
-	Elf_Scn *scn = NULL;
-	GElf_Shdr shdr;
-	size_t shstrndx;
-	elf_getshdrstrndx(elf, &shstrndx);
-	while ((scn = elf_nextscn(elf, scn)) != NULL)
-	{
-		gelf_getshdr(scn, &shdr);
-		char *name = elf_strptr(elf, shstrndx, shdr.sh_name);
-		if (strcmp(name, secName) == 0)
-			return scn;
-	}
-	return NULL;
-}
-
-static char **getSymbolNames(Elf *elf)
-{
-	char **result;
-	Elf_Scn *scn = getSectionByName(elf, ".symtab");
-	if (scn == NULL)
-		LOG_ERR("Failed to find .symtab section");
-	GElf_Shdr shdr;
-	Elf_Data *data = elf_getdata(scn, NULL);
-	gelf_getshdr(scn, &shdr);
-	size_t cnt = shdr.sh_size / shdr.sh_entsize;
-	result = (char **)calloc(cnt + 1, sizeof(char *));
-	CHECK_ALLOC(result);
-	for (size_t i = 0; i < cnt; i++)
-	{
-		GElf_Sym sym;
-		gelf_getsym(data, i, &sym);
-		result[i] = elf_strptr(elf, shdr.sh_link, sym.st_name);
-	}
-	return result;
-}
+#include "libdeku.h"
 
-static void addRelocateSymToStrtab(Elf *elf)
+static void help(const char *execName)
 {
-	GElf_Shdr shdr;
-	Elf_Scn *scn = getSectionByName(elf, ".strtab");
-	if (scn == NULL)
-		LOG_ERR("Failed to find .strtab section");
-	gelf_getshdr(scn, &shdr);
-	Elf_Data *data = elf_getdata(scn, NULL);
-	for(size_t i = 0; i < symToRelocateCnt; i++)
-	{
-		symToRelocate[i].symOff = appendString(&shdr, data, symToRelocate[i].sym);
-		if (symToRelocate[i].symOff == (size_t)-1)
-			LOG_ERR("Failed to add sybmol name '%s' to string table", symToRelocate[i].sym);
-	}
+	error(EXIT_FAILURE, 0, "Usage: %s [-s <OBJ.PATCH_FUNCTION> -r <OBJ.RELOCATION_FUNCTION,IDX>] "
+		  "[-R <RELOCATIONS_FILE>] [-c <FROM_SYMBOL>:<TO_SYMBOL>] [-n <NOTE_FILE>] [-V] <MODULE.ko>", execName);
 }
 
-static void addSectionStr(Elf *elf, RelaSym **relocs, const char *objName)
+typedef struct
 {
-	GElf_Shdr shdr;
-	size_t shstrndx;
-	elf_getshdrstrndx(elf, &shstrndx);
-	Elf_Scn *scn = getSectionByName(elf, ".shstrtab");
-	if (scn == NULL)
-		LOG_ERR("Failed to find .shstrtab section");
-	gelf_getshdr(scn, &shdr);
-	Elf_Data *data = elf_getdata(scn, NULL);
-	const char *lastName = "";
-	for (size_t i = 0; i < relaSectionCount; i++)
-	{
-		char *name = elf_strptr(elf, shstrndx, relocs[i]->shdr.sh_name);
-		if (strcmp(name, lastName) == 0)
-			continue;
-		lastName = name;
-		char *relaSecName = (char *)malloc(16 + strlen(objName) + strlen(name));
-		CHECK_ALLOC(relaSecName);
-		sprintf(relaSecName, ".klp.rela.%s%s", objName, name + 5);
-		int off = appendString(&shdr, data, relaSecName);
-		if (off == -1)
-			LOG_ERR("Failed to add section '%s' to string table", relaSecName);
-		relocs[i]->shdr.sh_name = off;
-		relocs[i]->secName = relaSecName;
-		LOG_DEBUG("Add section '%s' to string table", relaSecName);
-	}
-}
-
-static int convSymToLpRelSym(Elf *elf)
+	const char **list;
+	size_t count;
+	size_t capacity;
+	// lines read from the relocations files
+	char **lines;
+	size_t linesCount;
+	size_t linesCapacity;
+} Relocations;
+
+static void addRelocation(Relocations *relocs, const char *rel)
 {
-	GElf_Shdr shdr;
-	Elf_Scn *scn = getSectionByName(elf, ".symtab");
-	if (scn == NULL)
-		LOG_ERR("Failed to find .symtab section");
-	Elf_Data *data = elf_getdata(scn, NULL);
-	gelf_getshdr(scn, &shdr);
-	size_t cnt = shdr.sh_size / shdr.sh_entsize;
-	for (size_t i = 0; i < cnt; i++)
+	// keep place for the NULL terminator
+	if (relocs->count + 1 >= relocs->capacity)
 	{
-		GElf_Sym sym;
-		gelf_getsym(data, i, &sym);
-		char *name = elf_strptr(elf, shdr.sh_link, sym.st_name);
-		for(size_t j = 0; j < symToRelocateCnt; j++)
-		{
-			if (strcmp(name, symToRelocate[j].fName) == 0)
-			{
-				sym.st_name = symToRelocate[j].symOff;
-				sym.st_shndx = 0xFF20;
-				LOG_DEBUG("Convert to livepatch symbol '%s'", name);
-			}
-		}
-		gelf_update_sym(data, i, &sym);
+		relocs->capacity = relocs->capacity ? relocs->capacity * 2 : 64;
+		relocs->list = realloc(relocs->list, relocs->capacity * sizeof(char *));
+		if (relocs->list == NULL)
+			error(EXIT_FAILURE, ENOMEM, "Failed to alloc memory");
 	}
-	return 0;
+	relocs->list[relocs->count++] = rel;
+	relocs->list[relocs->count] = NULL;
 }
 
-static RelaSym **removeRelaSymbols(Elf *elf, char **names)
+// every line of the file is "<OBJ>.<SYMBOL>,<SYMPOS>", "-" reads the standard input
+static void readRelocations(Relocations *relocs, const char *path)
 {
-	RelaSym **result = NULL;
-	Elf_Scn *scn = NULL;
-	GElf_Shdr shdr;
-	size_t shstrndx;
-	GElf_Rela rela;
-	Elf_Data *data;
-
-	elf_getshdrstrndx(elf, &shstrndx);
-	while ((scn = elf_nextscn(elf, scn)) != NULL)
+	FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+	if (file == NULL)
+		error(EXIT_FAILURE, errno, "Cannot open relocations file '%s'", path);
+	char *line = NULL;
+	size_t lineSize = 0;
+	ssize_t len;
+	while ((len = getline(&line, &lineSize, file)) != -1)
 	{
-		gelf_getshdr(scn, &shdr);
-		if (shdr.sh_type != SHT_RELA)
+		while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == ' '))
+			line[--len] = '\0';
+		if (len == 0)
 			continue;
-		char *secName = elf_strptr(elf, shstrndx, shdr.sh_name);
-		if (strcmp(".rela.debug_info", secName) == 0 ||
-			strcmp(".rela__jump_table", secName) == 0)
-			continue;
-		RelaSym *relaSym = NULL;
-		data = elf_getdata(scn, NULL);
-		size_t j = 0;
-		size_t cnt = shdr.sh_size / shdr.sh_entsize;
-		for (size_t i = 0; i < cnt; i++)
-		{
-			gelf_getrela(data, i, &rela);
-			int idx = ELF64_R_SYM(rela.r_info);
-			size_t k;
-			for (k = 0; k < symToRelocateCnt; k++)
-			{
-				if (strcmp(names[idx], symToRelocate[k].fName) == 0)
-				{
-					if (relaSym == NULL)
-					{
-						relaSym = (RelaSym *)calloc(1, sizeof(RelaSym));
-						CHECK_ALLOC(relaSym);
-						relaSym->rela = (GElf_Rela *)malloc(sizeof(GElf_Rela) * cnt);
-						CHECK_ALLOC(relaSym->rela);
-					}
-					relaSym->shdr = shdr;
-					relaSym->rela[relaSym->relaCnt++] = rela;
-
-					LOG_DEBUG("Remove relocation '%s' from '%s'", symToRelocate[k].fName, secName);
-					break;
-				}
-			}
-			if (k == symToRelocateCnt)
-			{
-				gelf_update_rela(data, j, &rela);
-				j++;
-			}
-		}
-		if (relaSym != NULL)
-		{
-			result = (RelaSym **)realloc(result, sizeof(*result) * (relaSectionCount + 1));
-			CHECK_ALLOC(result);
-			result[relaSectionCount++] = relaSym;
-			shdr.sh_size = j * shdr.sh_entsize;
-			data->d_size = shdr.sh_size;
-			gelf_update_shdr(scn, &shdr);
-		}
-	}
-	return result;
-}
-
-static void addRelaSection(Elf *elf, RelaSym **relocs, char **names)
-{
-	Elf_Scn *newscn;
-	Elf_Data *newData;
-	GElf_Shdr shdr;
-	for (size_t i = 0; i < relaSectionCount; i++)
-	{
-		newscn = elf_newscn(elf);
-		if (!newscn)
-			LOG_ERR("elf_newscn failed");
-
-		newData = elf_newdata(newscn);
-		if (!newData)
-			LOG_ERR("elf_newdata failed");
-
-		gelf_getshdr(newscn, &shdr);
-		RelaSym *relaSym = relocs[i];
-		memcpy(&shdr, &relaSym->shdr, sizeof(GElf_Shdr));
-		shdr.sh_flags = SHF_ALLOC | 0x0000000000100000;
-
-		newData->d_size = relaSym->relaCnt * shdr.sh_entsize;
-		newData->d_type = ELF_T_RELA;
-		newData->d_buf = malloc(newData->d_size);
-		CHECK_ALLOC(newData->d_buf);
-
-		for (size_t j = 0; j < relaSym->relaCnt; j++)
+		if (relocs->linesCount == relocs->linesCapacity)
 		{
-			GElf_Rela rela = relaSym->rela[j];
-			int idx = ELF64_R_SYM(rela.r_info);
-			int r = gelf_update_rela(newData, j, &rela);
-			if (r)
-				LOG_DEBUG("Add relocation '%s' to '%s'", names[idx], relaSym->secName);
-			else
-				LOG_ERR("Fail to add relocation '%s' to '%s'", names[idx], relaSym->secName);
+			relocs->linesCapacity = relocs->linesCapacity ? relocs->linesCapacity * 2 : 64;
+			relocs->lines = realloc(relocs->lines, relocs->linesCapacity * sizeof(char *));
+			if (relocs->lines == NULL)
+				error(EXIT_FAILURE, ENOMEM, "Failed to alloc memory");
 		}
-
-		if (!gelf_update_shdr(newscn, &shdr))
-			LOG_ERR("gelf_update_shdr failed");
+		relocs->lines[relocs->linesCount] = strdup(line);
+		if (relocs->lines[relocs->linesCount] == NULL)
+			error(EXIT_FAILURE, ENOMEM, "Failed to alloc memory");
+		addRelocation(relocs, relocs->lines[relocs->linesCount++]);
 	}
+	free(line);
+	if (file != stdin)
+		fclose(file);
 }
 
-static void help(const char *execName)
+static char *readNote(const char *path)
 {
-	error(EXIT_FAILURE, 0, "Usage: %s -s <OBJ.PATCH_FUNCTION> -r <OBJ.RELOCATION_FUNCTION,IDX> [-V] <MODULE.ko>", execName);
+	FILE *file = fopen(path, "r");
+	if (file == NULL)
+		error(EXIT_FAILURE, errno, "Cannot open note file '%s'", path);
+	char *note = NULL;
+	size_t size = 0;
+	FILE *out = open_memstream(&note, &size);
+	if (out == NULL)
+		error(EXIT_FAILURE, ENOMEM, "Failed to alloc memory");
+	char buf[4096];
+	size_t len;
+	while ((len = fread(buf, 1, sizeof(buf), file)) > 0)
+		fwrite(buf, 1, len, out);
+	fclose(out);
+	fclose(file);
+	return note;
 }
 
 int main(int argc, char *argv[])
 {
 	char *file = NULL;
+	DekuFinalizeParams params = {0};
 	char *objName = NULL;
-	int opt, funCnt = 0;
-
-	funToReplace = calloc(argc, sizeof(char *));
-	CHECK_ALLOC(funToReplace);
-	symToRelocate = malloc(sizeof(*symToRelocate));
-	CHECK_ALLOC(symToRelocate);
-	while ((opt = getopt(argc, argv, "s:r:Vh")) != -1)
+	char *note = NULL;
+	Relocations relocs = {0};
+	int opt;
+
+	DekuContext *ctx = dekuOpen();
+	if (ctx == NULL)
+		error(EXIT_FAILURE, 0, "Failed to initialize libdeku");
+	dekuSetDebug(ctx, true);
+
+	DekuCallRestore *calls = calloc(argc, sizeof(DekuCallRestore));
+	if (calls == NULL)
+		error(EXIT_FAILURE, ENOMEM, "Failed to alloc memory");
+	while ((opt = getopt(argc, argv, "s:r:R:c:n:Vh")) != -1)
 	{
 		switch (opt)
 		{
 		case 's':
 		{
-			char *fun = strchr(optarg, '.') + 1;
-			int offset = fun - optarg - 1;
-			objName = strdup(optarg);
-			objName[offset] = '\0';
-			funToReplace[funCnt++] = fun;
+			char *fun = strchr(optarg, '.');
+			if (fun == NULL)
+				help(argv[0]);
+			free(objName);
+			objName = strndup(optarg, fun - optarg);
 			break;
 		}
 		case 'r':
-			addSymbolToRelocate(optarg);
+			addRelocation(&relocs, optarg);
+			break;
+		case 'R':
+			readRelocations(&relocs, optarg);
+			break;
+		case 'c':
+		{
+			char *to = strchr(optarg, ':');
+			if (to == NULL)
+				help(argv[0]);
+			*to = '\0';
+			calls[params.callsCount].from = optarg;
+			calls[params.callsCount++].to = to + 1;
+			break;
+		}
+		case 'n':
+			free(note);
+			note = readNote(optarg);
 			break;
 		case 'V':
-			ShowDebugLog = 0;
+			dekuSetDebug(ctx, false);
 			break;
 		case '?':
 		case 'h':
 			help(argv[0]);
 			break;
 		case ':':
-			LOG_ERR("Missing arg for %c", optopt);
+			error(EXIT_FAILURE, EINVAL, "Missing arg for %c", optopt);
 			break;
 		}
 	}
@@ -362,48 +164,26 @@ int main(int argc, char *argv[])
 	if (optind < argc)
 	{
 		file = argv[optind++];
-		while (optind < argc)
-			LOG_ERR("Unknown parameter: %s", argv[optind++]);
+		if (optind < argc)
+			error(EXIT_FAILURE, EINVAL, "Unknown parameter: %s", argv[optind]);
 	}
 
-	if (file == NULL || objName == NULL)
+	if (file == NULL || (relocs.count > 0 && objName == NULL))
 		help(argv[0]);
 
-	elf_version(EV_CURRENT);
-
-	int fd = open(file, O_RDWR);
-	if (fd == -1)
-		error(EXIT_FAILURE, errno, "cannot open input file '%s'", file);
-
-	Elf *elf = elf_begin(fd, ELF_C_RDWR, NULL);
-	if (elf == NULL)
-		error(EXIT_FAILURE, 0, "problems opening '%s' as ELF file: %s",
-			  file, elf_errmsg(-1));
-
-	size_t shstrndx;
-	if (elf_getshdrstrndx(elf, &shstrndx))
-		error(EXIT_FAILURE, errno, "cannot get section header string index");
-
-	char **symbolNames = getSymbolNames(elf);
-	RelaSym **relocs = removeRelaSymbols(elf, symbolNames);
-	addRelocateSymToStrtab(elf);
-	convSymToLpRelSym(elf);
-	addSectionStr(elf, relocs, objName);
-	addRelaSection(elf, relocs, symbolNames);
-
-	if (elf_update(elf, ELF_C_WRITE) == -1)
-		error(EXIT_FAILURE, 0, "elf_update failed: %s", elf_errmsg(-1));
-
-	close(fd);
-	for (size_t i = 0; i < relaSectionCount; i++)
-	{
-		free(relocs[i]->secName);
-	}
-	free(relocs);
+	params.calls = calls;
+	params.objName = objName;
+	params.relocations = relocs.list;
+	params.note = note;
+	int status = dekuFinalizeModule(ctx, file, &params);
+
+	free(note);
+	free(calls);
+	for (size_t i = 0; i < relocs.linesCount; i++)
+		free(relocs.lines[i]);
+	free(relocs.lines);
+	free(relocs.list);
 	free(objName);
-	free(symbolNames);
-	free(symToRelocate);
-	free(funToReplace);
-
-	return 0;
+	dekuClose(ctx);
+	return status;
 }
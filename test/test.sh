@@ -147,6 +147,16 @@ checkIfDmesgNOTContains()
 	return $res
 }
 
+checkSymbolOwner()
+{
+	local sym=$1
+	local owner=$2
+	local out=`./elfutils --lookupSymbol -i "$SYMBOL_INDEX_FILE" "$sym"`
+	[[ ${out%% *} != "$owner" ]] && { >&2 echo -e "${RED}Symbol '$sym' is not found in '$owner' (${out%% *})${NC}"; return 1; }
+	echo "Found '$sym' in '$owner'... OK"
+	return 0
+}
+
 checkIfFileExists()
 {
 	local file=$1
@@ -155,6 +165,15 @@ checkIfFileExists()
 	return 0
 }
 
+checkIfFileContains()
+{
+	local file=$1
+	local line=$2
+	! grep -qxF "$line" "$file" && { >&2 echo -e "${RED}File '$file' does not contain line '$line'${NC}"; cat "$file"; return 1; }
+	echo "Found '$line' in '$file'... OK"
+	return 0
+}
+
 buildKernel()
 {
 	rm -f "$BUILD_DIR/vmlinux"
@@ -360,6 +379,500 @@ evdev_event'
 	return 0
 }
 
+# check if inlined copies are found in the DWARF 4 and DWARF 5 debug info
+dwarfTest()
+{
+	rm -rf "$WORKDIR"
+	mkdir -p "$WORKDIR"
+	cat > "$WORKDIR/inline.c" <<'EOF'
+static int counter;
+
+static inline __attribute__((always_inline)) int leaf(int x)
+{
+	counter += x;
+	return x * 3;
+}
+
+static inline __attribute__((always_inline)) int middle(int x)
+{
+	return leaf(x) + 1;
+}
+
+int outer(int x)
+{
+	return middle(x) + leaf(x + 2);
+}
+
+static __attribute__((noinline)) int helper(int x, int y)
+{
+	return middle(x) ^ y;
+}
+
+int viaHelper(int x)
+{
+	return helper(x, 7) + helper(x + 1, 7);
+}
+EOF
+	# the clone "helper.constprop.0" is found by the address of its code
+	local expected='helper.constprop.0
+outer'
+	for version in 4 5; do
+		local obj="$WORKDIR/inline_dwarf$version.o"
+		gcc -O2 -g -gdwarf-$version -c "$WORKDIR/inline.c" -o "$obj" || return 1
+		./elfutils --callchain -f "$obj" --inlined-callers-of leaf > "$WORKDIR/callers" || return 2
+		compareFileContents "$WORKDIR/callers" "$expected" || return 3
+		gcc -O2 -g -gdwarf-$version -gz -c "$WORKDIR/inline.c" -o "$obj" || return 1
+		./elfutils --callchain -f "$obj" --inlined-callers-of middle > "$WORKDIR/callers" || return 4
+		compareFileContents "$WORKDIR/callers" "$expected" || return 5
+	done
+	echo -e "${GREEN}------------------------- DWARF TEST DONE -------------------------${NC}"
+	return 0
+}
+
+# check if the callers of the function inlined in the kernel build are patched
+inlinedCallersTest()
+{
+	rm -rf "$WORKDIR"
+	mkdir -p "$WORKDIR"
+	cat > "$WORKDIR/origin.c" <<'EOF'
+static int counter;
+
+static int leaf(int x)
+{
+	counter += x;
+	return x * 3;
+}
+
+static int middle(int x)
+{
+	return leaf(x) + 1;
+}
+
+int outer(int x)
+{
+	return middle(x) + leaf(x + 2);
+}
+
+static __attribute__((noinline)) int helper(int x, int y)
+{
+	return middle(x) ^ y;
+}
+
+int viaHelper(int x)
+{
+	return helper(x, 7) + helper(x + 1, 7);
+}
+
+int unrelated(int x)
+{
+	return x - 1;
+}
+EOF
+	sed 's/x \* 3/x * 5/' "$WORKDIR/origin.c" > "$WORKDIR/new.c"
+	# objects are built by DEKU without inlining, the kernel inlines "leaf" and "middle"
+	for file in origin new; do
+		gcc -O2 -fno-inline -ffunction-sections -fdata-sections -c "$WORKDIR/$file.c" -o "$WORKDIR/$file.o" || return 1
+	done
+	gcc -O2 -g -c "$WORKDIR/origin.c" -o "$WORKDIR/ref_dwarf.o" || return 1
+	gcc -O2 -c "$WORKDIR/origin.c" -o "$WORKDIR/ref.o" || return 1
+	# without the debug info the callers are found from the calls
+	local ref
+	for ref in ref_dwarf ref; do
+		printf "%s\t%s\t%s\t%s\n" "$WORKDIR/origin.o" "$WORKDIR/new.o" "$WORKDIR/$ref.out.o" \
+			"$WORKDIR/$ref.o" > "$WORKDIR/manifest"
+		./elfutils --batch "$WORKDIR/manifest" > "$WORKDIR/batch" || return 2
+		checkIfFileContains "$WORKDIR/batch" $'0\tinlined\tleaf' || return 3
+		checkIfFileContains "$WORKDIR/batch" $'0\tlivepatch\touter' || return 3
+		checkIfFileContains "$WORKDIR/batch" $'0\tlivepatch\thelper.constprop.0' || return 3
+		checkIfFileContains "$WORKDIR/batch" $'0\tstatus\tpatch' || return 3
+		grep -q "livepatch.leaf\|viaHelper\|unrelated" "$WORKDIR/batch" && return 4
+		nm "$WORKDIR/$ref.out.o" | grep " T " | cut -d ' ' -f 3 | sort > "$WORKDIR/symbols"
+		compareFileContents "$WORKDIR/symbols" $'helper_constprop_0\nleaf\nmiddle\nouter' || return 5
+	done
+	echo -e "${GREEN}------------------------- INLINED CALLERS TEST DONE -------------------------${NC}"
+	return 0
+}
+
+# check if renumbered local symbols are skipped only when they refer to the same object
+metadataTest()
+{
+	rm -rf "$WORKDIR"
+	mkdir -p "$WORKDIR"
+	cat > "$WORKDIR/origin.c" <<'EOF'
+extern void use(const char *name, int *counter);
+
+void first(void)
+{
+	static int calls;
+	use(__func__, &calls);
+}
+
+void second(void)
+{
+	static int calls;
+	use(__func__, &calls);
+}
+EOF
+	# GCC numbers the local symbols from the end of the file, so the function
+	# added at the end renumbers "calls" and "__func__" of the other ones
+	cp "$WORKDIR/origin.c" "$WORKDIR/renumbered.c"
+	cat >> "$WORKDIR/renumbered.c" <<'EOF'
+
+void added(void)
+{
+	static int seen;
+	use(__func__, &seen);
+}
+EOF
+	# swapped functions refer to the "calls" of the other function in the origin file
+	{ sed -n '1,2p;9,13p' "$WORKDIR/origin.c"; echo; sed -n '3,7p' "$WORKDIR/origin.c"; } > "$WORKDIR/swapped.c"
+	for file in origin renumbered swapped; do
+		gcc -O2 -c "$WORKDIR/$file.c" -o "$WORKDIR/$file.o" || return 1
+	done
+	printf "%s\t%s\t%s\n" "$WORKDIR/origin.o" "$WORKDIR/renumbered.o" "$WORKDIR/out0.o" \
+		"$WORKDIR/origin.o" "$WORKDIR/swapped.o" "$WORKDIR/out1.o" > "$WORKDIR/manifest"
+	./elfutils --batch "$WORKDIR/manifest" > "$WORKDIR/batch" || return 2
+	checkIfFileContains "$WORKDIR/batch" $'0\tmetadata_only\tfirst' || return 3
+	checkIfFileContains "$WORKDIR/batch" $'0\tmetadata_only\tsecond' || return 3
+	checkIfFileContains "$WORKDIR/batch" $'1\tcause\tfirst data' || return 4
+	checkIfFileContains "$WORKDIR/batch" $'1\tcause\tsecond data' || return 4
+	echo -e "${GREEN}------------------------- METADATA TEST DONE -------------------------${NC}"
+	return 0
+}
+
+# check the records of the batch jobs run on a few workers
+batchTest()
+{
+	rm -rf "$WORKDIR"
+	mkdir -p "$WORKDIR"
+	cat > "$WORKDIR/origin.c" <<'EOF'
+int value = 1;
+
+int traced(int x)
+{
+	return x + value;
+}
+
+__attribute__((no_instrument_function)) int untraced(int x)
+{
+	return x * value;
+}
+EOF
+	sed 's/x + value/x - value/;s/x \* value/x * value * 2/' "$WORKDIR/origin.c" > "$WORKDIR/modified.c"
+	cp "$WORKDIR/origin.c" "$WORKDIR/added.c"
+	cat >> "$WORKDIR/added.c" <<'EOF'
+
+int added;
+
+int addedFunction(void)
+{
+	return added;
+}
+EOF
+	for file in origin modified added; do
+		gcc -O2 -c "$WORKDIR/$file.c" -o "$WORKDIR/$file.o" || return 1
+	done
+	# the reference file is built like the kernel, with the ftrace calls
+	gcc -O2 -fno-pic -fcf-protection=none -pg -mfentry -c "$WORKDIR/origin.c" -o "$WORKDIR/ref.o" || return 1
+	printf "ffffffff81000000 t traced\nffffffff81000100 t traced\nffffffff81000200 T untraced\n" > "$WORKDIR/System.map"
+	local job
+	for job in modified added origin missing; do
+		printf "%s\t%s\t%s\t%s\n" "$WORKDIR/origin.o" "$WORKDIR/$job.o" "$WORKDIR/$job.out.o" "$WORKDIR/ref.o"
+	done > "$WORKDIR/manifest"
+	./elfutils --batch "$WORKDIR/manifest" -j 2 -m "$WORKDIR/System.map" > "$WORKDIR/batch" || return 2
+	local expected='0	modified	traced
+0	cause	traced code
+0	duplicate	traced
+0	livepatch	traced
+0	modified	untraced
+0	cause	untraced code
+0	notrace	untraced
+0	livepatch	untraced
+0	extract	traced
+0	extract	untraced
+0	status	patch
+1	new_function	addedFunction
+1	new_variable	added
+1	extract	addedFunction
+1	extract	added
+1	status	patch
+2	status	unchanged
+3	status	error 1'
+	compareFileContents "$WORKDIR/batch" "$expected" || return 3
+	nm "$WORKDIR/added.out.o" | cut -d ' ' -f 2,3 > "$WORKDIR/symbols"
+	checkIfFileContains "$WORKDIR/symbols" "T addedFunction" || return 4
+	checkIfFileContains "$WORKDIR/symbols" "B added" || return 4
+	# nothing is extracted from the unchanged file
+	[[ ! -f "$WORKDIR/origin.out.o" ]] || return 5
+	echo -e "${GREEN}------------------------- BATCH TEST DONE -------------------------${NC}"
+	return 0
+}
+
+# check the kallsyms position of the local symbols duplicated in the vmlinux
+symposTest()
+{
+	rm -rf "$WORKDIR"
+	mkdir -p "$WORKDIR"
+	local file
+	for file in first second; do
+		cat > "$WORKDIR/$file.c" <<EOF
+static int __attribute__((noinline)) duplicated(int x)
+{
+	return x + sizeof("$file");
+}
+
+int ${file}Entry(int x)
+{
+	return duplicated(x) * 2;
+}
+EOF
+		gcc -O2 -c "$WORKDIR/$file.c" -o "$WORKDIR/$file.o" || return 1
+	done
+	ld -r "$WORKDIR/first.o" "$WORKDIR/second.o" -o "$WORKDIR/vmlinux" || return 1
+	./elfutils --symbolIndex -k "$WORKDIR/vmlinux" -o "$WORKDIR/symbols.idx" || return 2
+	./elfutils --symbolPosition -i "$WORKDIR/symbols.idx" -f "$WORKDIR/first.o" duplicated > "$WORKDIR/sympos" || return 3
+	compareFileContents "$WORKDIR/sympos" "1" || return 3
+	./elfutils --symbolPosition -i "$WORKDIR/symbols.idx" -f "$WORKDIR/second.o" duplicated > "$WORKDIR/sympos" || return 4
+	compareFileContents "$WORKDIR/sympos" "2" || return 4
+	./elfutils --symbolPosition -i "$WORKDIR/symbols.idx" -f "$WORKDIR/first.o" firstEntry > "$WORKDIR/sympos" || return 5
+	compareFileContents "$WORKDIR/sympos" "0" || return 5
+	# the duplicated symbol can't be resolved without the object file
+	./elfutils --symbolPosition -i "$WORKDIR/symbols.idx" duplicated
+	[[ $? == $ERROR_CANT_FIND_SYM_INDEX ]] || return 6
+	echo -e "${GREEN}------------------------- SYMPOS TEST DONE -------------------------${NC}"
+	return 0
+}
+
+# check if the cached fingerprints are used only for the same origin file and kernel
+fingerprintsTest()
+{
+	rm -rf "$WORKDIR"
+	mkdir -p "$WORKDIR"
+	cat > "$WORKDIR/origin.c" <<'EOF'
+int value = 1;
+
+int first(int x)
+{
+	return x + value;
+}
+
+int second(int x)
+{
+	return x * value;
+}
+EOF
+	sed 's/x + value/x - value/' "$WORKDIR/origin.c" > "$WORKDIR/new.c"
+	for file in origin new; do
+		gcc -O2 -c "$WORKDIR/$file.c" -o "$WORKDIR/$file.o" || return 1
+	done
+	echo "1" > "$WORKDIR/version"
+	printf "%s\t%s\t%s\n" "$WORKDIR/origin.o" "$WORKDIR/new.o" "$WORKDIR/out.o" > "$WORKDIR/manifest"
+	local cache="$WORKDIR/fingerprints"
+	local batch=(--batch "$WORKDIR/manifest" -c "$cache" -k "$WORKDIR/version" -V)
+	local expected='0	modified	first
+0	cause	first code
+0	livepatch	first
+0	extract	first
+0	status	patch'
+	./elfutils "${batch[@]}" > "$WORKDIR/batch" 2> "$WORKDIR/log" || return 2
+	compareFileContents "$WORKDIR/batch" "$expected" || return 2
+	grep -q "Use fingerprints" "$WORKDIR/log" && return 2
+	[[ `ls "$cache" | wc -l` == 1 ]] || return 2
+
+	./elfutils "${batch[@]}" > "$WORKDIR/batch" 2> "$WORKDIR/log" || return 3
+	compareFileContents "$WORKDIR/batch" "$expected" || return 3
+	grep -q "Use fingerprints" "$WORKDIR/log" || return 3
+
+	# broken cache file is computed again
+	local file=`ls "$cache"`
+	head -c 20 "$cache/$file" > "$WORKDIR/broken"
+	cp "$WORKDIR/broken" "$cache/$file"
+	./elfutils "${batch[@]}" > "$WORKDIR/batch" 2> "$WORKDIR/log" || return 4
+	compareFileContents "$WORKDIR/batch" "$expected" || return 4
+	grep -q "Use fingerprints" "$WORKDIR/log" && return 4
+	[[ `stat -c %s "$cache/$file"` -gt 20 ]] || return 4
+
+	echo "2" > "$WORKDIR/version"
+	./elfutils "${batch[@]}" > "$WORKDIR/batch" 2> "$WORKDIR/log" || return 5
+	compareFileContents "$WORKDIR/batch" "$expected" || return 5
+	grep -q "Use fingerprints" "$WORKDIR/log" && return 5
+	[[ `ls "$cache" | wc -l` == 2 ]] || return 5
+
+	cp "$WORKDIR/new.o" "$WORKDIR/origin.o"
+	./elfutils "${batch[@]}" > "$WORKDIR/batch" 2> "$WORKDIR/log" || return 6
+	compareFileContents "$WORKDIR/batch" $'0\tstatus\tunchanged' || return 6
+	grep -q "Use fingerprints" "$WORKDIR/log" && return 6
+	[[ `ls "$cache" | wc -l` == 3 ]] || return 6
+	echo -e "${GREEN}------------------------- FINGERPRINTS TEST DONE -------------------------${NC}"
+	return 0
+}
+
+# check if only the referenced strings and constants are copied to the extracted file
+stringsTest()
+{
+	rm -rf "$WORKDIR"
+	mkdir -p "$WORKDIR"
+	cat > "$WORKDIR/strings.c" <<'EOF'
+#include <stdio.h>
+
+void unused(void)
+{
+	puts("unused");
+	printf("%f\n", 7.75);
+}
+
+const char *name(int x)
+{
+	return x ? "picked name" : "other name";
+}
+
+double scale(double x)
+{
+	return x * 3.25;
+}
+EOF
+	cat > "$WORKDIR/main.c" <<'EOF'
+#include <stdio.h>
+
+const char *name(int x);
+double scale(double x);
+
+int main(void)
+{
+	printf("%s, %s, %.2f\n", name(1), name(0), scale(2));
+	return 0;
+}
+EOF
+	gcc -O2 -fno-pic -ffunction-sections -c "$WORKDIR/strings.c" -o "$WORKDIR/strings.o" || return 1
+	./elfutils --extract -f "$WORKDIR/strings.o" -o "$WORKDIR/out.o" -s name -s scale || return 2
+	objcopy -O binary -j .rodata.str1.1 "$WORKDIR/out.o" "$WORKDIR/str" || return 3
+	tr '\0' '\n' < "$WORKDIR/str" > "$WORKDIR/strings"
+	compareFileContents "$WORKDIR/strings" $'picked name\nother name' || return 3
+	objcopy -O binary -j .rodata.cst8 "$WORKDIR/out.o" "$WORKDIR/cst" || return 4
+	[[ `stat -c %s "$WORKDIR/cst"` == 8 ]] || return 4
+	# the relocations point to the moved strings and constants
+	gcc -no-pie "$WORKDIR/main.c" "$WORKDIR/out.o" -o "$WORKDIR/main" 2> "$WORKDIR/link.log" || return 5
+	"$WORKDIR/main" > "$WORKDIR/output" || return 5
+	compareFileContents "$WORKDIR/output" "picked name, other name, 6.50" || return 5
+	echo -e "${GREEN}------------------------- STRINGS TEST DONE -------------------------${NC}"
+	return 0
+}
+
+# check if only the records of the extracted functions are copied from the tables
+tablesTest()
+{
+	rm -rf "$WORKDIR"
+	mkdir -p "$WORKDIR"
+	cat > "$WORKDIR/tables.c" <<'EOF'
+#define TABLE_RECORDS(line)									\
+	asm volatile("1:	nop\n"									\
+				 ".pushsection __bug_table, \"aw\"\n"			\
+				 "	.long 1b - .\n"								\
+				 "	.long %c0 - .\n"							\
+				 "	.word %c1, 0\n"								\
+				 ".popsection\n"								\
+				 ".pushsection .altinstructions, \"a\"\n"		\
+				 "	.long 1b - .\n"								\
+				 "	.long 2f - .\n"								\
+				 "	.word 0\n"									\
+				 "	.byte 1, 1\n"								\
+				 ".popsection\n"								\
+				 ".pushsection .altinstr_replacement, \"ax\"\n"	\
+				 "2:	nop\n"									\
+				 ".popsection\n" :: "i" (__FILE__), "i" (line))
+
+int kept(int x)
+{
+	TABLE_RECORDS(10);
+	return x + 1;
+}
+
+int dropped(int x)
+{
+	TABLE_RECORDS(20);
+	return x - 1;
+}
+EOF
+	gcc -O2 -fno-pic -ffunction-sections -c "$WORKDIR/tables.c" -o "$WORKDIR/tables.o" || return 1
+	./elfutils --extract -f "$WORKDIR/tables.o" -o "$WORKDIR/out.o" -s kept || return 2
+	objcopy -O binary -j __bug_table "$WORKDIR/out.o" "$WORKDIR/bug" || return 3
+	[[ `stat -c %s "$WORKDIR/bug"` == 12 ]] || return 3
+	# line of the BUG() in the copied record
+	[[ `od -An -t u2 -j 8 -N 2 "$WORKDIR/bug"` == *" 10" ]] || return 3
+	objcopy -O binary -j .altinstructions "$WORKDIR/out.o" "$WORKDIR/alt" || return 4
+	[[ `stat -c %s "$WORKDIR/alt"` == 12 ]] || return 4
+	# the code and the replacement or the file name of every copied record
+	readelf -rW "$WORKDIR/out.o" | sed -n '/rela.altinstructions\|rela__bug_table/,/^$/p' > "$WORKDIR/relocs"
+	[[ `grep -c R_X86_64 "$WORKDIR/relocs"` == 4 ]] || return 5
+	grep -q "dropped" "$WORKDIR/relocs" && return 5
+	echo -e "${GREEN}------------------------- TABLES TEST DONE -------------------------${NC}"
+	return 0
+}
+
+# check if the extracted functions are merged into one text section ordered by the calls
+textTest()
+{
+	rm -rf "$WORKDIR"
+	mkdir -p "$WORKDIR"
+	cat > "$WORKDIR/text.c" <<'EOF'
+#include <stdio.h>
+
+static __attribute__((noinline)) int leafB(int x)
+{
+	return x * 7;
+}
+
+static __attribute__((noinline)) int leafA(int x)
+{
+	return x + 3;
+}
+
+__attribute__((noinline, cold)) void report(int x)
+{
+	printf("report %d\n", x);
+}
+
+int rootB(int x)
+{
+	return leafB(x) - 1;
+}
+
+int rootA(int x)
+{
+	if (x < 0)
+		report(x);
+	return leafA(x) * 2;
+}
+EOF
+	cat > "$WORKDIR/main.c" <<'EOF'
+#include <stdio.h>
+
+int rootA(int x);
+int rootB(int x);
+
+int main(void)
+{
+	printf("%d %d\n", rootA(4), rootB(5));
+	rootA(-1);
+	return 0;
+}
+EOF
+	gcc -O2 -fno-pic -ffunction-sections -c "$WORKDIR/text.c" -o "$WORKDIR/text.o" || return 1
+	./elfutils --extract -f "$WORKDIR/text.o" -o "$WORKDIR/out.o" -s rootA -s rootB -s report \
+		-s leafA -s leafB -s rootA.cold || return 2
+	readelf -SW "$WORKDIR/out.o" | grep -o ' \.text[^ ]*' | sort > "$WORKDIR/sections"
+	compareFileContents "$WORKDIR/sections" $' .text\n .text.unlikely' || return 3
+	# functions of the ".text" go before the ones of the ".text.unlikely"
+	readelf -sW "$WORKDIR/out.o" | awk '$4 == "FUNC" { print $7, $2, $8 }' | sort | \
+		cut -d ' ' -f 3 > "$WORKDIR/functions"
+	compareFileContents "$WORKDIR/functions" $'rootB\nleafB\nrootA\nleafA\nrootA_cold\nreport' || return 4
+	gcc -no-pie "$WORKDIR/main.c" "$WORKDIR/out.o" -o "$WORKDIR/main" 2> "$WORKDIR/link.log" || return 5
+	"$WORKDIR/main" > "$WORKDIR/output" || return 5
+	compareFileContents "$WORKDIR/output" $'14 34\nreport -1' || return 5
+	echo -e "${GREEN}------------------------- TEXT TEST DONE -------------------------${NC}"
+	return 0
+}
+
 # test build-in module
 moduleTest()
 {
@@ -393,8 +906,12 @@ symbolsTest()
 	appendToFunction "$SOURCE_DIR/drivers/thermal/intel/x86_pkg_temp_thermal.c" pkg_thermal_cpu_offline "pr_info(\"x86_pkg_temp_thermal\");"
 	./deku -w "$WORKDIR" build || return 1
 	checkIfFileExists "$SYMBOLS_DIR/drivers/thermal/intel/x86_pkg_temp_thermal" || return 2
+	checkIfFileExists "$SYMBOL_INDEX_FILE" || return 2
+	checkSymbolOwner pkg_thermal_cpu_offline x86_pkg_temp_thermal || return 2
 	./deku -w "$WORKDIR" sync
 	checkIfFileExists "$SYMBOLS_DIR/drivers/thermal/intel/x86_pkg_temp_thermal" || return 3
+	checkIfFileExists "$SYMBOL_INDEX_FILE" || return 3
+	checkSymbolOwner pkg_thermal_cpu_offline x86_pkg_temp_thermal || return 3
 	echo -e "${GREEN}------------------------- SYMBOLS TEST DONE -------------------------${NC}"
 	return 0
 }
@@ -541,6 +1058,15 @@ buildTest()
 
 # test/test.sh integration
 # test/test.sh inline
+# test/test.sh dwarf
+# test/test.sh inlined
+# test/test.sh metadata
+# test/test.sh batch
+# test/test.sh sympos
+# test/test.sh fingerprints
+# test/test.sh strings
+# test/test.sh tables
+# test/test.sh text
 # test/test.sh symbols
 main()
 {
@@ -561,6 +1087,51 @@ main()
 		res=$?
 		[[ $res == 0 ]] && { testname="Inline 2"; inline2Test; res=$?; }
 	fi
+	if [[ $res == 0 ]] && [[ "$1" == "dwarf" || "$1" == "all" ]]; then
+		testname="DWARF"
+		dwarfTest
+		res=$?
+	fi
+	if [[ $res == 0 ]] && [[ "$1" == "inlined" || "$1" == "all" ]]; then
+		testname="Inlined callers"
+		inlinedCallersTest
+		res=$?
+	fi
+	if [[ $res == 0 ]] && [[ "$1" == "metadata" || "$1" == "all" ]]; then
+		testname="Metadata"
+		metadataTest
+		res=$?
+	fi
+	if [[ $res == 0 ]] && [[ "$1" == "batch" || "$1" == "all" ]]; then
+		testname="Batch"
+		batchTest
+		res=$?
+	fi
+	if [[ $res == 0 ]] && [[ "$1" == "sympos" || "$1" == "all" ]]; then
+		testname="Sympos"
+		symposTest
+		res=$?
+	fi
+	if [[ $res == 0 ]] && [[ "$1" == "fingerprints" || "$1" == "all" ]]; then
+		testname="Fingerprints"
+		fingerprintsTest
+		res=$?
+	fi
+	if [[ $res == 0 ]] && [[ "$1" == "strings" || "$1" == "all" ]]; then
+		testname="Strings"
+		stringsTest
+		res=$?
+	fi
+	if [[ $res == 0 ]] && [[ "$1" == "tables" || "$1" == "all" ]]; then
+		testname="Tables"
+		tablesTest
+		res=$?
+	fi
+	if [[ $res == 0 ]] && [[ "$1" == "text" || "$1" == "all" ]]; then
+		testname="Text"
+		textTest
+		res=$?
+	fi
 	if [[ $res == 0 ]] && [[ "$1" == "symbols" || "$1" == "all" ]]; then
 		testname="Symbols"
 		[ ! -d "$SOURCE_DIR" ] && prepareKernelSources